@@ -0,0 +1,36 @@
+# Run with cmake -P. Writes OUTPUT, a C++ file with the SPIR-V of every shader listed in MANIFEST as a byte array and
+# the vulkan_embeddedShaders table src/vulkan/vulkan_shaders.h declares. Each line of the manifest is
+# <name>|<GLSL source>|<SPIR-V binary>.
+
+file(STRINGS "${MANIFEST}" SHADER_ENTRIES)
+
+set(SHADER_ARRAYS "")
+set(SHADER_TABLE "")
+set(SHADER_COUNT 0)
+
+foreach(SHADER_ENTRY ${SHADER_ENTRIES})
+    string(REPLACE "|" ";" SHADER_FIELDS "${SHADER_ENTRY}")
+    list(GET SHADER_FIELDS 0 SHADER_NAME)
+    list(GET SHADER_FIELDS 1 SHADER_SOURCE)
+    list(GET SHADER_FIELDS 2 SHADER_BINARY)
+
+    file(READ "${SHADER_BINARY}" SHADER_HEX HEX)
+    string(LENGTH "${SHADER_HEX}" SHADER_HEX_LENGTH)
+    math(EXPR SHADER_SIZE "${SHADER_HEX_LENGTH} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," SHADER_BYTES "${SHADER_HEX}")
+
+    string(APPEND SHADER_ARRAYS "alignas(4) static const unsigned char shader_${SHADER_COUNT}[] = { ${SHADER_BYTES} };\n")
+    string(APPEND SHADER_TABLE "    { \"${SHADER_NAME}\", \"${SHADER_SOURCE}\", shader_${SHADER_COUNT}, ${SHADER_SIZE} },\n")
+    math(EXPR SHADER_COUNT "${SHADER_COUNT} + 1")
+endforeach()
+
+file(WRITE "${OUTPUT}"
+    "// Generated by cmake/embed_shaders.cmake, do not edit\n\n"
+    "#include \"${HEADER}\"\n\n"
+    "${SHADER_ARRAYS}\n"
+    "// Terminated by an empty entry, so the table is never empty\n"
+    "const vulkan_embedded_shader vulkan_embeddedShaders[] = {\n"
+    "${SHADER_TABLE}"
+    "    { nullptr, nullptr, nullptr, 0 }\n"
+    "};\n\n"
+    "const size_t vulkan_embeddedShaderCount = ${SHADER_COUNT};\n")
@@ -0,0 +1,79 @@
+#!/bin/bash
+# Renders a few frames with --headless and compares the read back PPMs against reference images.
+#
+#   headless_check.sh <executable> <reference dir> [--update]
+#
+# Runs in workdir like the program itself. Uses lavapipe when it is installed so the images don't depend on the GPU,
+# set VK_ICD_FILENAMES to test another driver. References are only comparable on the driver they were written with,
+# --update replaces them with the frames of this run.
+
+set -u
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <executable> <reference dir> [--update]"
+    exit 2
+fi
+
+executable=$(realpath "$1")
+references=$(realpath -m "$2")
+update=${3:-}
+
+frames=30
+interval=10
+width=1280
+height=720
+
+cd "$(dirname "$0")/workdir" || exit 2
+
+if [ -z "${VK_ICD_FILENAMES:-}" ]; then
+    for icd in /usr/share/vulkan/icd.d/lvp_icd.*.json /usr/local/share/vulkan/icd.d/lvp_icd.*.json; do
+        if [ -f "$icd" ]; then
+            export VK_ICD_FILENAMES=$icd
+            break
+        fi
+    done
+fi
+echo "Driver: ${VK_ICD_FILENAMES:-system default}"
+
+rm -f frame_*.ppm
+if ! "$executable" --headless --frames $frames --readback $interval; then
+    echo "FAILED: the headless run exited with an error"
+    exit 1
+fi
+
+# Frame 0 is read back too, the last one is the highest multiple of the interval below the frame count
+headerSize=$((${#width} + ${#height} + 9))
+expectedSize=$((headerSize + width * height * 3))
+failed=0
+for ((frame = 0; frame < frames; frame += interval)); do
+    image=frame_$frame.ppm
+
+    if [ ! -f "$image" ]; then
+        echo "FAILED: $image was not written"
+        failed=1
+        continue
+    fi
+
+    header=$(head -c $headerSize "$image" | tr '\n' ' ')
+    if [ "$header" != "P6 $width $height 255 " ] || [ "$(stat -c %s "$image")" -ne $expectedSize ]; then
+        echo "FAILED: $image is not a ${width}x${height} binary PPM"
+        failed=1
+        continue
+    fi
+
+    if [ "$update" = "--update" ]; then
+        mkdir -p "$references"
+        cp "$image" "$references/$image"
+        echo "updated: $image"
+    elif [ ! -f "$references/$image" ]; then
+        echo "FAILED: no reference for $image, run with --update to create them"
+        failed=1
+    elif ! cmp -s "$image" "$references/$image"; then
+        echo "FAILED: $image differs from the reference"
+        failed=1
+    else
+        echo "passed: $image"
+    fi
+done
+
+exit $failed
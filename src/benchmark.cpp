@@ -0,0 +1,267 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "benchmark.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+bool load_benchmark_path(const std::string& file, benchmark_path* outPath) {
+    std::ifstream stream(file);
+    if (!stream.is_open()) {
+        std::cout << "Could not open benchmark path " << file << std::endl;
+        return false;
+    }
+
+    outPath->map.clear();
+    outPath->timestep = BENCHMARK_DEFAULT_TIMESTEP;
+    outPath->keyframes.clear();
+
+    std::string line;
+    uint32_t lineNumber = 0;
+    while (std::getline(stream, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream words(line);
+        std::string type;
+        if (!(words >> type)) {
+            continue;
+        }
+
+        bool valid = false;
+        if (type == "map") {
+            valid = (bool)(words >> outPath->map);
+        } else if (type == "timestep") {
+            valid = (bool)(words >> outPath->timestep) && outPath->timestep > 0.0f;
+        } else if (type == "key") {
+            benchmark_keyframe key;
+            valid = (bool)(words >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.rotation.x >> key.rotation.y >> key.rotation.z);
+            valid = valid && (outPath->keyframes.empty() || key.time >= outPath->keyframes.back().time);
+            if (valid) {
+                outPath->keyframes.push_back(key);
+            }
+        }
+
+        if (!valid) {
+            std::cout << "Could not parse line " << lineNumber << " of benchmark path " << file << std::endl;
+            return false;
+        }
+    }
+
+    if (outPath->keyframes.empty()) {
+        std::cout << "Benchmark path " << file << " has no keyframes" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool save_benchmark_path(const std::string& file, const benchmark_path* path) {
+    std::ofstream stream(file, std::ios::trunc);
+    if (!stream) {
+        std::cout << "Could not write benchmark path " << file << std::endl;
+        return false;
+    }
+
+    stream << std::setprecision(9);
+    stream << "map " << path->map << "\n";
+    stream << "timestep " << path->timestep << "\n";
+    for (const benchmark_keyframe& key : path->keyframes) {
+        stream << "key " << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z << " "
+               << key.rotation.x << " " << key.rotation.y << " " << key.rotation.z << "\n";
+    }
+
+    std::cout << "Wrote " << path->keyframes.size() << " keyframes to " << file << std::endl;
+    return true;
+}
+
+void benchmark_path_camera(const benchmark_path* path, float time, camera* c) {
+    const std::vector<benchmark_keyframe>& keys = path->keyframes;
+
+    size_t next = 0;
+    while (next < keys.size() && keys[next].time < time) {
+        next++;
+    }
+
+    const benchmark_keyframe& a = keys[next == 0 ? 0 : next - 1];
+    const benchmark_keyframe& b = keys[std::min(next, keys.size() - 1)];
+    float t = b.time > a.time ? std::min(std::max((time - a.time) / (b.time - a.time), 0.0f), 1.0f) : 0.0f;
+
+    c->position = glm::mix(a.position, b.position, t);
+    c->rotationQuat = glm::slerp(glm::quat(a.rotation), glm::quat(b.rotation), t);
+    c->rotation = glm::eulerAngles(c->rotationQuat);
+}
+
+void init_benchmark_run(benchmark_run* run, const benchmark_path* path) {
+    run->path = *path;
+    run->frameIndex = 0;
+    run->firstMeasuredFrame = 0;
+    run->nextGpuFrame = 0;
+    run->frames.clear();
+    run->gpuMilliseconds.clear();
+}
+
+bool benchmark_next_frame(benchmark_run* run, vulkan_renderer* renderer, camera* c) {
+    float time = 0.0f;
+    if (run->frameIndex >= BENCHMARK_WARMUP_FRAMES) {
+        time = (run->frameIndex - BENCHMARK_WARMUP_FRAMES) * run->path.timestep;
+        if (time > run->path.keyframes.back().time) {
+            return false;
+        }
+    }
+
+    if (run->frameIndex == BENCHMARK_WARMUP_FRAMES) {
+        run->firstMeasuredFrame = renderer->frameNumber;
+        run->nextGpuFrame = renderer->frameNumber;
+        renderer->gpuProfiler->paused = false;
+    }
+
+    benchmark_path_camera(&run->path, time, c);
+    run->frameIndex++;
+    return true;
+}
+
+void benchmark_end_frame(benchmark_run* run, vulkan_renderer* renderer, const bsp_rendering_data* renderingData) {
+    if (run->frameIndex <= BENCHMARK_WARMUP_FRAMES) {
+        return;
+    }
+
+    benchmark_frame frame;
+    frame.frameMilliseconds = renderer->metrics.frameMilliseconds;
+    frame.cpuMilliseconds = renderer->metrics.cpuMilliseconds;
+    frame.drawCalls = renderingData->drawCalls;
+    frame.visibleFaces = renderingData->gpuVisibleFaces;
+    memcpy(frame.culledFaces, renderingData->gpuCulledFaces, sizeof(frame.culledFaces));
+    run->frames.push_back(frame);
+
+    // GPU times arrive a few frames late, the last frames of the run are never resolved
+    for (const vulkan_gpu_frame& gpuFrame : renderer->gpuProfiler->history) {
+        if (gpuFrame.frameNumber >= run->nextGpuFrame) {
+            run->gpuMilliseconds.push_back((float)gpuFrame.durationMilliseconds);
+            run->nextGpuFrame = gpuFrame.frameNumber + 1;
+        }
+    }
+}
+
+// Nearest rank on sorted values
+static float percentile(const std::vector<float>& sorted, float p) {
+    if (sorted.empty()) {
+        return 0.0f;
+    }
+
+    size_t rank = (size_t)std::ceil(p / 100.0f * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+static void write_distribution(std::ofstream& file, const char* name, std::vector<float> values) {
+    std::sort(values.begin(), values.end());
+
+    double total = 0.0;
+    for (float value : values) {
+        total += value;
+    }
+
+    file << "  \"" << name << "\": {\"samples\": " << values.size()
+         << ", \"mean\": " << (values.empty() ? 0.0 : total / values.size())
+         << ", \"p50\": " << percentile(values, 50.0f)
+         << ", \"p95\": " << percentile(values, 95.0f)
+         << ", \"p99\": " << percentile(values, 99.0f)
+         << ", \"max\": " << (values.empty() ? 0.0f : values.back()) << "},\n";
+}
+
+bool benchmark_write_report(const benchmark_run* run, vulkan_renderer* renderer, const bsp_rendering_data* renderingData, const std::string& file) {
+    std::ofstream stream(file, std::ios::trunc);
+    if (!stream) {
+        std::cout << "Could not write benchmark report " << file << std::endl;
+        return false;
+    }
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(renderer->init_objects.physicalDevice, &deviceProperties);
+
+    std::vector<float> frameMilliseconds;
+    std::vector<float> cpuMilliseconds;
+    std::vector<float> drawCalls;
+    std::vector<float> visibleFaces;
+    double culledFaces[BSP_CULL_STAT_COUNT] = {};
+    for (const benchmark_frame& frame : run->frames) {
+        frameMilliseconds.push_back(frame.frameMilliseconds);
+        cpuMilliseconds.push_back(frame.cpuMilliseconds);
+        drawCalls.push_back((float)frame.drawCalls);
+        visibleFaces.push_back((float)frame.visibleFaces);
+        for (int i = 0; i < BSP_CULL_STAT_COUNT; i++) {
+            culledFaces[i] += frame.culledFaces[i];
+        }
+    }
+    double frameCount = std::max<size_t>(run->frames.size(), 1);
+
+    // Keys are in a fixed order so reports of two builds diff line by line
+    stream << std::fixed << std::setprecision(3);
+    stream << "{\n";
+    stream << "  \"map\": \"" << run->path.map << "\",\n";
+    stream << "  \"device\": \"" << deviceProperties.deviceName << "\",\n";
+    stream << "  \"width\": " << renderer->init_objects.swapchainExtent.width << ",\n";
+    stream << "  \"height\": " << renderer->init_objects.swapchainExtent.height << ",\n";
+    stream << "  \"headless\": " << (renderer->init_objects.headless ? "true" : "false") << ",\n";
+    stream << "  \"timestep\": " << std::setprecision(6) << run->path.timestep << std::setprecision(3) << ",\n";
+    stream << "  \"warmup_frames\": " << BENCHMARK_WARMUP_FRAMES << ",\n";
+    stream << "  \"frames\": " << run->frames.size() << ",\n";
+    stream << "  \"settings\": {\"gpu_driven\": " << (renderingData->gpuDriven && renderingData->gpuDrivenSupported ? "true" : "false")
+           << ", \"cull_flags\": " << renderingData->cullFlags
+           << ", \"parallel_recording\": " << (renderingData->parallelRecording ? "true" : "false")
+           << ", \"depth_prepass\": " << (renderingData->depthPrepass ? "true" : "false")
+           << ", \"frames_in_flight\": " << renderer->frames.size() << "},\n";
+    write_distribution(stream, "frame_ms", frameMilliseconds);
+    write_distribution(stream, "cpu_ms", cpuMilliseconds);
+    write_distribution(stream, "gpu_ms", run->gpuMilliseconds);
+    write_distribution(stream, "draw_calls", drawCalls);
+    write_distribution(stream, "visible_faces", visibleFaces);
+    stream << "  \"mean_culled_faces\": {\"pvs\": " << culledFaces[BSP_CULL_STAT_PVS] / frameCount
+           << ", \"frustum\": " << culledFaces[BSP_CULL_STAT_FRUSTUM] / frameCount
+           << ", \"backface\": " << culledFaces[BSP_CULL_STAT_BACKFACE] / frameCount
+           << ", \"occlusion\": " << culledFaces[BSP_CULL_STAT_OCCLUSION] / frameCount << "}\n";
+    stream << "}\n";
+
+    std::cout << "Wrote benchmark report of " << run->frames.size() << " frames to " << file << std::endl;
+    return true;
+}
+
+void init_benchmark_recorder(benchmark_recorder* recorder, const std::string& map) {
+    recorder->path.map = map;
+    recorder->path.timestep = BENCHMARK_DEFAULT_TIMESTEP;
+    recorder->path.keyframes.clear();
+    recorder->start = std::chrono::high_resolution_clock::now();
+}
+
+void benchmark_record_camera(benchmark_recorder* recorder, const camera* c) {
+    float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - recorder->start).count();
+    if (!recorder->path.keyframes.empty() && time - recorder->path.keyframes.back().time < BENCHMARK_RECORD_INTERVAL) {
+        return;
+    }
+
+    benchmark_keyframe key;
+    key.time = time;
+    key.position = c->position;
+    key.rotation = c->rotation;
+    recorder->path.keyframes.push_back(key);
+}
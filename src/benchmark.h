@@ -0,0 +1,94 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "camera.h"
+#include "vulkan/vulkan_renderer.h"
+#include "bsp/bsp_rendering.h"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+// Played back at this simulated step unless the path sets one, independent of how long frames really take
+#define BENCHMARK_DEFAULT_TIMESTEP (1.0f / 60.0f)
+// Frames rendered at the first keyframe before measuring, so pipelines and caches are warm
+#define BENCHMARK_WARMUP_FRAMES 30
+// Seconds between keyframes while recording
+#define BENCHMARK_RECORD_INTERVAL 0.25f
+
+struct benchmark_keyframe {
+    float time;
+    glm::vec3 position;
+    // Euler angles like camera.rotation
+    glm::vec3 rotation;
+};
+
+// Text file, one entry per line and # starts a comment:
+//   map <name>                     bsp in the maps folder the path belongs to
+//   timestep <seconds>
+//   key <time> <x> <y> <z> <rx> <ry> <rz>
+// Keyframes have to be sorted by time.
+struct benchmark_path {
+    std::string map;
+    float timestep;
+    std::vector<benchmark_keyframe> keyframes;
+};
+
+struct benchmark_frame {
+    // Begin of the previous frame to the begin of this one, and recording plus submitting this one
+    float frameMilliseconds;
+    float cpuMilliseconds;
+    uint32_t drawCalls;
+    uint32_t visibleFaces;
+    uint32_t culledFaces[BSP_CULL_STAT_COUNT];
+};
+
+struct benchmark_run {
+    benchmark_path path;
+    // Simulated frames so far, warmup included
+    uint32_t frameIndex;
+    uint64_t firstMeasuredFrame;
+    // Renderer frame number of the next GPU frame to take from the profiler's history
+    uint64_t nextGpuFrame;
+    std::vector<benchmark_frame> frames;
+    std::vector<float> gpuMilliseconds;
+};
+
+struct benchmark_recorder {
+    benchmark_path path;
+    std::chrono::high_resolution_clock::time_point start;
+};
+
+bool load_benchmark_path(const std::string& file, benchmark_path* outPath);
+bool save_benchmark_path(const std::string& file, const benchmark_path* path);
+// Positions are interpolated linearly and rotations along the shorter arc, times outside the path are clamped
+void benchmark_path_camera(const benchmark_path* path, float time, camera* c);
+
+void init_benchmark_run(benchmark_run* run, const benchmark_path* path);
+// Places the camera for the next frame, false once the path has been played back
+bool benchmark_next_frame(benchmark_run* run, vulkan_renderer* renderer, camera* c);
+// Call after renderer_end_frame
+void benchmark_end_frame(benchmark_run* run, vulkan_renderer* renderer, const bsp_rendering_data* renderingData);
+// JSON with the percentiles of the frame times, draw and culling statistics and the settings they were taken with
+bool benchmark_write_report(const benchmark_run* run, vulkan_renderer* renderer, const bsp_rendering_data* renderingData, const std::string& file);
+
+void init_benchmark_recorder(benchmark_recorder* recorder, const std::string& map);
+// Adds a keyframe every BENCHMARK_RECORD_INTERVAL seconds of real time
+void benchmark_record_camera(benchmark_recorder* recorder, const camera* c);
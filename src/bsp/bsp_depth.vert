@@ -0,0 +1,48 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#version 450 core
+
+// Depth prepass, only the quantised position of bsp_vertex is bound
+layout(location = 0) in uvec4 inPosition;
+
+layout(std140, set = 2, binding = 0) uniform ViewBlock {
+    mat4 viewProjection;
+    float positionStep;
+} View;
+
+// Only the origin is read, the layout matches bsp_shader.vert
+struct FaceDraw {
+    vec3 origin;
+    float lightmapStyleStride;
+    vec2 uvOffset;
+    uint material;
+    uint lightmap;
+    uint normal;
+    uint tangent;
+    float tangentSign;
+    uint uvScale;
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer FaceDraws {
+    FaceDraw faceDraws[];
+};
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = View.viewProjection * vec4(faceDraws[inPosition.w].origin + vec3(inPosition.xyz) * View.positionStep, 1);
+}
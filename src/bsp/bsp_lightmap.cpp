@@ -0,0 +1,540 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bsp_lightmap.h"
+#include "../profiler.h"
+
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "../dearimgui/imstb_rectpack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHTMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+// Share of a page that is handed to it when spreading rects over new pages, the rest is slack for the packer
+#define LIGHTMAP_PAGE_FILL 0.85
+// Bump mapped faces store the unbumped lightmap followed by one per bump basis vector for every style
+#define LIGHTMAP_BUMP_COUNT 4
+#define LIGHTMAP_BENCHMARK_RUNS 10
+
+struct lightmap_page {
+    stbrp_context context;
+    std::vector<stbrp_node> nodes;
+};
+
+// Largest value E5B9G9R9 can hold, (2^9 - 1) / 2^9 * 2^(31 - 15)
+#define E5B9G9R9_MAX 65408.0f
+
+size_t bsp_lightmap_luxel_size(bsp_lightmap_format format) {
+    return format == LIGHTMAP_FORMAT_FP16 ? 8 : 4;
+}
+
+VkFormat bsp_lightmap_vk_format(bsp_lightmap_format format) {
+    switch (format) {
+        case LIGHTMAP_FORMAT_FP16:
+            return VK_FORMAT_R16G16B16A16_SFLOAT;
+        case LIGHTMAP_FORMAT_E5B9G9R9:
+            return VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+        default:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+static const char* lightmap_format_name(bsp_lightmap_format format) {
+    switch (format) {
+        case LIGHTMAP_FORMAT_FP16:
+            return "FP16";
+        case LIGHTMAP_FORMAT_E5B9G9R9:
+            return "E5B9G9R9";
+        default:
+            return "LDR";
+    }
+}
+
+static uint32_t float_bits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static float bits_float(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t bsp_float_to_half(float f) {
+    uint32_t bits = float_bits(f);
+
+    if (bits < (113u << 23)) {
+        // Below the smallest normal half, adding 0.5 lines the mantissa up with the half denormal
+        float denormMagic = bits_float(126u << 23);
+        return (uint16_t)(float_bits(f + denormMagic) - float_bits(denormMagic));
+    }
+
+    uint32_t mantissaOdd = (bits >> 13) & 1;
+    bits += ((uint32_t)(15 - 127) << 23) + 0xfff + mantissaOdd;
+    return (uint16_t)(bits >> 13);
+}
+
+// Follows the shared exponent conversion from the Vulkan specification
+static uint32_t float_to_e5b9g9r9(const float* rgb) {
+    float maxChannel = 0.0f;
+    float channels[3];
+    for (int c = 0; c < 3; c++) {
+        channels[c] = std::min(std::max(rgb[c], 0.0f), E5B9G9R9_MAX);
+        maxChannel = std::max(maxChannel, channels[c]);
+    }
+
+    int sharedExponent = std::max(-16, (int)((float_bits(maxChannel) >> 23) & 0xff) - 127) + 16;
+    if ((uint32_t)(maxChannel / ldexpf(1.0f, sharedExponent - 24) + 0.5f) == 512) {
+        sharedExponent++;
+    }
+
+    uint32_t packed = (uint32_t)sharedExponent << 27;
+    for (int c = 0; c < 3; c++) {
+        packed |= (uint32_t)(channels[c] / ldexpf(1.0f, sharedExponent - 24) + 0.5f) << (9 * c);
+    }
+    return packed;
+}
+
+static void decode_lightmap_sample(bsp_lightmap_format format, const unsigned char* sample, unsigned char* outLuxel) {
+    float light[3];
+    float scale = ldexpf(1.0f, (signed char)sample[3]) / 255.0f;
+    for (int c = 0; c < 3; c++) {
+        light[c] = sample[c] * scale;
+    }
+
+    if (format == LIGHTMAP_FORMAT_FP16) {
+        uint16_t halfs[4];
+        for (int c = 0; c < 3; c++) {
+            halfs[c] = bsp_float_to_half(std::min(light[c], FP16_MAX));
+        }
+        halfs[3] = 0x3c00;
+        memcpy(outLuxel, halfs, sizeof(halfs));
+    } else if (format == LIGHTMAP_FORMAT_E5B9G9R9) {
+        uint32_t packed = float_to_e5b9g9r9(light);
+        memcpy(outLuxel, &packed, sizeof(packed));
+    } else {
+        for (int c = 0; c < 3; c++) {
+            outLuxel[c] = (unsigned char)(sqrtf(std::min(light[c] / LIGHTMAP_RANGE, 1.0f)) * 255.0f + 0.5f);
+        }
+        outLuxel[3] = 255;
+    }
+}
+
+#ifdef LIGHTMAP_SSE2
+// Light of four samples, one register per sample with the channels in xyz. w is garbage.
+static inline void decode_rgbe4(const unsigned char* samples, __m128* outLight) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i packedSamples = _mm_loadu_si128((const __m128i*)samples);
+
+    // The exponent byte becomes the float exponent of each sample's scale, exponents below the float range flush to zero
+    __m128i exponent = _mm_srai_epi32(packedSamples, 24);
+    __m128i scaleBits = _mm_slli_epi32(_mm_add_epi32(exponent, _mm_set1_epi32(127)), 23);
+    scaleBits = _mm_and_si128(scaleBits, _mm_cmpgt_epi32(exponent, _mm_set1_epi32(-127)));
+    __m128 scale = _mm_mul_ps(_mm_castsi128_ps(scaleBits), _mm_set1_ps(1.0f / 255.0f));
+
+    __m128i low = _mm_unpacklo_epi8(packedSamples, zero);
+    __m128i high = _mm_unpackhi_epi8(packedSamples, zero);
+
+    outLight[0] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), _mm_shuffle_ps(scale, scale, _MM_SHUFFLE(0, 0, 0, 0)));
+    outLight[1] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), _mm_shuffle_ps(scale, scale, _MM_SHUFFLE(1, 1, 1, 1)));
+    outLight[2] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), _mm_shuffle_ps(scale, scale, _MM_SHUFFLE(2, 2, 2, 2)));
+    outLight[3] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), _mm_shuffle_ps(scale, scale, _MM_SHUFFLE(3, 3, 3, 3)));
+}
+
+static inline __m128i select_si128(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Same as bsp_float_to_half for four values
+static inline __m128i float_to_half4(__m128 f) {
+    __m128i bits = _mm_castps_si128(f);
+
+    __m128 denormMagic = _mm_castsi128_ps(_mm_set1_epi32(126 << 23));
+    __m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(f, denormMagic)), _mm_castps_si128(denormMagic));
+
+    __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(bits, _mm_set1_epi32(((15 - 127) << 23) + 0xfff));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissaOdd), 13);
+
+    return select_si128(_mm_cmplt_epi32(bits, _mm_set1_epi32(113 << 23)), denormal, normal);
+}
+
+static void decode_ldr4(const unsigned char* samples, unsigned char* outLuxels) {
+    const __m128 normalize = _mm_set1_ps(1.0f / LIGHTMAP_RANGE);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 light[4];
+    decode_rgbe4(samples, light);
+
+    __m128i encoded[4];
+    for (int i = 0; i < 4; i++) {
+        __m128 normalized = _mm_min_ps(_mm_mul_ps(light[i], normalize), one);
+        encoded[i] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(normalized), _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+    }
+
+    // The exponent lane ends up as garbage in alpha, which is overwritten
+    __m128i luxels = _mm_packus_epi16(_mm_packs_epi32(encoded[0], encoded[1]), _mm_packs_epi32(encoded[2], encoded[3]));
+    _mm_storeu_si128((__m128i*)outLuxels, _mm_or_si128(luxels, _mm_set1_epi32((int)0xff000000)));
+}
+
+static void decode_fp16_4(const unsigned char* samples, unsigned char* outLuxels) {
+    const __m128 fp16Max = _mm_set1_ps(FP16_MAX);
+    const __m128i colorMask = _mm_set_epi32(0, -1, -1, -1);
+    const __m128i alpha = _mm_set_epi32(0x3c00, 0, 0, 0);
+
+    __m128 light[4];
+    decode_rgbe4(samples, light);
+
+    __m128i halfs[4];
+    for (int i = 0; i < 4; i++) {
+        halfs[i] = _mm_or_si128(_mm_and_si128(float_to_half4(_mm_min_ps(light[i], fp16Max)), colorMask), alpha);
+    }
+
+    // Halfs are at most 0x7bff, so the signed saturation of the pack never kicks in
+    _mm_storeu_si128((__m128i*)outLuxels, _mm_packs_epi32(halfs[0], halfs[1]));
+    _mm_storeu_si128((__m128i*)(outLuxels + 16), _mm_packs_epi32(halfs[2], halfs[3]));
+}
+
+static void decode_e5b9g9r9_4(const unsigned char* samples, unsigned char* outLuxels) {
+    const __m128 maxValue = _mm_set1_ps(E5B9G9R9_MAX);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    __m128 light[4];
+    decode_rgbe4(samples, light);
+
+    // One register per channel from here on
+    _MM_TRANSPOSE4_PS(light[0], light[1], light[2], light[3]);
+    __m128 r = _mm_min_ps(light[0], maxValue);
+    __m128 g = _mm_min_ps(light[1], maxValue);
+    __m128 b = _mm_min_ps(light[2], maxValue);
+    __m128 maxChannel = _mm_max_ps(r, _mm_max_ps(g, b));
+
+    __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(maxChannel), 23), _mm_set1_epi32(127));
+    __m128i minExponent = _mm_set1_epi32(-16);
+    exponent = select_si128(_mm_cmpgt_epi32(exponent, minExponent), exponent, minExponent);
+    __m128i sharedExponent = _mm_add_epi32(exponent, _mm_set1_epi32(16));
+
+    // 2^(24 - sharedExponent) turns a channel into its mantissa
+    __m128 inverseScale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127 + 24), sharedExponent), 23));
+
+    // Rounding can carry the largest channel into the next exponent
+    __m128i maxMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(maxChannel, inverseScale), half));
+    __m128i carry = _mm_cmpeq_epi32(maxMantissa, _mm_set1_epi32(512));
+    sharedExponent = _mm_sub_epi32(sharedExponent, carry);
+    inverseScale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127 + 24), sharedExponent), 23));
+
+    __m128i rMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, inverseScale), half));
+    __m128i gMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, inverseScale), half));
+    __m128i bMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, inverseScale), half));
+
+    __m128i packed = _mm_or_si128(_mm_or_si128(rMantissa, _mm_slli_epi32(gMantissa, 9)),
+                                  _mm_or_si128(_mm_slli_epi32(bMantissa, 18), _mm_slli_epi32(sharedExponent, 27)));
+    _mm_storeu_si128((__m128i*)outLuxels, packed);
+}
+#endif
+
+void bsp_decode_lightmap_samples(bsp_lightmap_format format, const unsigned char* samples, size_t count, unsigned char* outLuxels) {
+    size_t luxelSize = bsp_lightmap_luxel_size(format);
+    size_t i = 0;
+
+#ifdef LIGHTMAP_SSE2
+    for (; i + 4 <= count; i += 4) {
+        if (format == LIGHTMAP_FORMAT_FP16) {
+            decode_fp16_4(samples + i * 4, outLuxels + i * luxelSize);
+        } else if (format == LIGHTMAP_FORMAT_E5B9G9R9) {
+            decode_e5b9g9r9_4(samples + i * 4, outLuxels + i * luxelSize);
+        } else {
+            decode_ldr4(samples + i * 4, outLuxels + i * luxelSize);
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        decode_lightmap_sample(format, samples + i * 4, outLuxels + i * luxelSize);
+    }
+}
+
+static int face_style_count(const face* f) {
+    int styleCount = 0;
+    while (styleCount < MAX_LIGHTSTYLES && f->styles[styleCount] != LIGHTSTYLE_NONE) {
+        styleCount++;
+    }
+    return styleCount;
+}
+
+static bool face_is_bumped(const bsp_parsed* bsp, const face* f) {
+    return f->surfaceInfoIndex >= 0 && (bsp->surfaceInfos[f->surfaceInfoIndex].flags & SURF_BUMPLIGHT);
+}
+
+// Removes the packed rects and remembers where they went, returns how many were packed
+static size_t take_packed_rects(std::vector<stbrp_rect>& rects, int page, bsp_lightmap_atlas* atlas) {
+    size_t packed = 0;
+
+    auto remaining = std::remove_if(rects.begin(), rects.end(), [&](const stbrp_rect& rect) {
+        if (!rect.was_packed) {
+            return false;
+        }
+
+        bsp_lightmap_rect& target = rect.id < 0 ? atlas->fullbright : atlas->faces[rect.id];
+        target.page = page;
+        target.x = rect.x;
+        target.y = rect.y;
+        packed++;
+        return true;
+    });
+    rects.erase(remaining, rects.end());
+
+    return packed;
+}
+
+// Spreads the rects over fresh pages that are packed in parallel, whatever doesn't fit is tried in the free space of
+// all pages before the next round of pages is started
+static void pack_lightmap_rects(std::vector<stbrp_rect> rects, job_system* jobs, bsp_lightmap_atlas* atlas) {
+    std::deque<lightmap_page> pages;
+
+    std::sort(rects.begin(), rects.end(), [](const stbrp_rect& a, const stbrp_rect& b) {
+        return a.h != b.h ? a.h > b.h : a.w > b.w;
+    });
+
+    while (!rects.empty()) {
+        for (size_t page = 0; page < pages.size() && !rects.empty(); page++) {
+            stbrp_pack_rects(&pages[page].context, rects.data(), rects.size());
+            take_packed_rects(rects, page, atlas);
+        }
+
+        if (rects.empty()) {
+            break;
+        }
+
+        size_t area = 0;
+        for (const stbrp_rect& rect : rects) {
+            area += rect.w * rect.h;
+        }
+
+        size_t pageArea = atlas->pageSize * atlas->pageSize;
+        size_t newPageCount = std::max<size_t>(1, (size_t)ceil(area / (pageArea * LIGHTMAP_PAGE_FILL)));
+        size_t firstPage = pages.size();
+
+        // Dealing the sorted rects out in turn gives every page a similar mix of large and small ones
+        std::vector<std::vector<stbrp_rect>> groups(newPageCount);
+        for (size_t i = 0; i < rects.size(); i++) {
+            groups[i % newPageCount].push_back(rects[i]);
+        }
+
+        for (size_t i = 0; i < newPageCount; i++) {
+            pages.emplace_back();
+            pages.back().nodes.resize(atlas->pageSize);
+            stbrp_init_target(&pages.back().context, atlas->pageSize, atlas->pageSize, pages.back().nodes.data(), pages.back().nodes.size());
+        }
+
+        job_system_parallel_for(jobs, newPageCount, [&](size_t i) {
+            stbrp_pack_rects(&pages[firstPage + i].context, groups[i].data(), groups[i].size());
+        });
+
+        size_t packed = 0;
+        rects.clear();
+        for (size_t i = 0; i < newPageCount; i++) {
+            packed += take_packed_rects(groups[i], firstPage + i, atlas);
+            rects.insert(rects.end(), groups[i].begin(), groups[i].end());
+        }
+
+        if (packed == 0) {
+            std::cout << "Could not pack " << rects.size() << " lightmaps!" << std::endl;
+            break;
+        }
+
+        std::stable_sort(rects.begin(), rects.end(), [](const stbrp_rect& a, const stbrp_rect& b) {
+            return a.h != b.h ? a.h > b.h : a.w > b.w;
+        });
+    }
+
+    atlas->pageCount = pages.size();
+}
+
+bsp_lightmap_atlas build_bsp_lightmap_atlas(bsp_parsed* bsp, job_system* jobs, bsp_lightmap_format format) {
+    PROFILE_ZONE("build_bsp_lightmap_atlas");
+    bsp_lightmap_atlas atlas = {};
+    atlas.format = format;
+    atlas.hdr = bsp->lightingHDRSize > 0;
+    atlas.pageSize = LIGHTMAP_PAGE_SIZE;
+
+    const unsigned char* lighting = atlas.hdr ? bsp->lightingHDR : bsp->lighting;
+    size_t lightingSize = atlas.hdr ? bsp->lightingHDRSize : bsp->lightingSize;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    bsp_lightmap_rect noLightmap = { -1, 0, 0, 0, 0, 0 };
+    atlas.faces.resize(bsp->faceCount, noLightmap);
+    atlas.fullbright = { -1, 0, 0, 1, 1, 1 };
+
+    std::vector<stbrp_rect> rects;
+    stbrp_rect fullbrightRect = {};
+    fullbrightRect.id = -1;
+    fullbrightRect.w = 1;
+    fullbrightRect.h = 1;
+    rects.push_back(fullbrightRect);
+
+    size_t usedLuxels = 1;
+    size_t styleCount = 0;
+
+    for (int i = 0; i < bsp->faceCount; i++) {
+        const face* f = bsp->faces + i;
+        int faceStyles = face_style_count(f);
+
+        int lightOffset = atlas.hdr ? f->lightOffsetHDR : f->lightOffset;
+
+        if (lightOffset < 0 || faceStyles == 0 || f->surfaceInfoIndex < 0) {
+            continue;
+        }
+
+        int width = f->lightmapSize[0] + 1;
+        int height = f->lightmapSize[1] + 1;
+        size_t sampleBytes = (size_t)width * height * faceStyles * (face_is_bumped(bsp, f) ? LIGHTMAP_BUMP_COUNT : 1) * 4;
+
+        if (width <= 0 || height <= 0 || lightOffset + sampleBytes > lightingSize) {
+            continue;
+        }
+
+        if (width * faceStyles > (int)atlas.pageSize || height > (int)atlas.pageSize) {
+            std::cout << "Lightmap of face " << i << " does not fit a page!" << std::endl;
+            continue;
+        }
+
+        atlas.faces[i] = { -1, 0, 0, width, height, faceStyles };
+
+        stbrp_rect rect = {};
+        rect.id = i;
+        rect.w = width * faceStyles;
+        rect.h = height;
+        rects.push_back(rect);
+
+        usedLuxels += rect.w * rect.h;
+        styleCount += faceStyles;
+    }
+
+    size_t faceCount = rects.size() - 1;
+    pack_lightmap_rects(rects, jobs, &atlas);
+
+    // Faces whose rect could not be placed stay unlit
+    std::vector<std::vector<int>> pageFaces(atlas.pageCount);
+    for (int i = 0; i < atlas.faces.size(); i++) {
+        if (atlas.faces[i].page >= 0) {
+            pageFaces[atlas.faces[i].page].push_back(i);
+        }
+    }
+
+    size_t luxelSize = bsp_lightmap_luxel_size(format);
+    size_t pageBytes = (size_t)atlas.pageSize * atlas.pageSize * luxelSize;
+    atlas.pixels.resize(pageBytes * atlas.pageCount);
+
+    job_system_parallel_for(jobs, atlas.pageCount, [&](size_t page) {
+        unsigned char* pagePixels = atlas.pixels.data() + page * pageBytes;
+
+        for (int faceIndex : pageFaces[page]) {
+            const face* f = bsp->faces + faceIndex;
+            const bsp_lightmap_rect& rect = atlas.faces[faceIndex];
+            size_t styleSamples = (size_t)rect.width * rect.height * (face_is_bumped(bsp, f) ? LIGHTMAP_BUMP_COUNT : 1);
+
+            for (int style = 0; style < rect.styleCount; style++) {
+                const unsigned char* samples = lighting + (atlas.hdr ? f->lightOffsetHDR : f->lightOffset) + style * styleSamples * 4;
+
+                for (int row = 0; row < rect.height; row++) {
+                    unsigned char* target = pagePixels + ((size_t)(rect.y + row) * atlas.pageSize + rect.x + style * rect.width) * luxelSize;
+                    bsp_decode_lightmap_samples(format, samples + (size_t)row * rect.width * 4, rect.width, target);
+                }
+            }
+        }
+    });
+
+    if (atlas.fullbright.page >= 0) {
+        // 255 * 2^0 / 255 is a light of exactly 1
+        const unsigned char fullbrightSample[4] = { 255, 255, 255, 0 };
+        unsigned char* fullbright = atlas.pixels.data() + atlas.fullbright.page * pageBytes + ((size_t)atlas.fullbright.y * atlas.pageSize + atlas.fullbright.x) * luxelSize;
+        bsp_decode_lightmap_samples(format, fullbrightSample, 1, fullbright);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double fill = atlas.pageCount > 0 ? 100.0 * usedLuxels / ((double)atlas.pageSize * atlas.pageSize * atlas.pageCount) : 0.0;
+    std::cout << "Lightmap atlas: " << (atlas.hdr ? "HDR" : "LDR") << " lighting as " << lightmap_format_name(format) << ", " << faceCount << " faces with " << styleCount << " styles on " << atlas.pageCount << " pages of "
+              << atlas.pageSize << "x" << atlas.pageSize << ", " << fill << "% filled (" << pageBytes * atlas.pageCount / (1024.0 * 1024.0) << " MB), built in "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    return atlas;
+}
+
+glm::vec2 bsp_lightmap_uv(const bsp_parsed* bsp, const bsp_lightmap_atlas* atlas, int faceIndex, const glm::vec3& position) {
+    const bsp_lightmap_rect& rect = atlas->faces[faceIndex];
+
+    if (rect.page < 0) {
+        return glm::vec2(atlas->fullbright.x + 0.5f, atlas->fullbright.y + 0.5f) / (float)atlas->pageSize;
+    }
+
+    const face* f = bsp->faces + faceIndex;
+    const surfaceInfo* info = bsp->surfaceInfos + f->surfaceInfoIndex;
+
+    // Luxel centers sit on whole luxel coordinates, so the samples of the face are hit exactly
+    float s = glm::dot(glm::vec4(position, 1.0f), info->lightmapVecs[0]) - f->lightmapMins[0];
+    float t = glm::dot(glm::vec4(position, 1.0f), info->lightmapVecs[1]) - f->lightmapMins[1];
+
+    return glm::vec2(rect.x + s + 0.5f, rect.y + t + 0.5f) / (float)atlas->pageSize;
+}
+
+void bsp_lightmap_benchmark(bsp_parsed* bsp) {
+    bool hdr = bsp->lightingHDRSize > 0;
+    const unsigned char* lighting = hdr ? bsp->lightingHDR : bsp->lighting;
+    size_t sampleCount = (hdr ? bsp->lightingHDRSize : bsp->lightingSize) / 4;
+
+    if (sampleCount == 0) {
+        std::cout << "Lightmap benchmark: map has no lighting" << std::endl;
+        return;
+    }
+
+    std::cout << "Lightmap benchmark: " << sampleCount << " " << (hdr ? "HDR" : "LDR") << " samples, best of "
+              << LIGHTMAP_BENCHMARK_RUNS << " runs" << std::endl;
+
+    const bsp_lightmap_format formats[] = { LIGHTMAP_FORMAT_LDR, LIGHTMAP_FORMAT_FP16, LIGHTMAP_FORMAT_E5B9G9R9 };
+    for (bsp_lightmap_format format : formats) {
+        std::vector<unsigned char> luxels(sampleCount * bsp_lightmap_luxel_size(format));
+
+        double bestMilliseconds = 0.0;
+        for (int run = 0; run < LIGHTMAP_BENCHMARK_RUNS; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            bsp_decode_lightmap_samples(format, lighting, sampleCount, luxels.data());
+            auto end = std::chrono::high_resolution_clock::now();
+
+            double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+            if (run == 0 || milliseconds < bestMilliseconds) {
+                bestMilliseconds = milliseconds;
+            }
+        }
+
+        std::cout << "  " << lightmap_format_name(format) << ": " << sampleCount / (bestMilliseconds * 1000.0) << " MLuxels/s, "
+                  << luxels.size() / (1024.0 * 1024.0) << " MB (" << bsp_lightmap_luxel_size(format) << " bytes per luxel)" << std::endl;
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef VULKAN_TEST_BSP_LIGHTMAP_H
+#define VULKAN_TEST_BSP_LIGHTMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "bsp_loader.h"
+#include "../jobs.h"
+
+#define LIGHTMAP_PAGE_SIZE 1024
+// LDR lightmaps are stored as sqrt(light / LIGHTMAP_RANGE), so the shader squares and scales them back
+#define LIGHTMAP_RANGE 8.0f
+#define FP16_MAX 65504.0f
+
+enum bsp_lightmap_format {
+    // RGBA8 with the sqrt encoding above, 4 bytes per luxel
+    LIGHTMAP_FORMAT_LDR,
+    // RGBA16F, 8 bytes per luxel
+    LIGHTMAP_FORMAT_FP16,
+    // Shared exponent with 9 bit mantissas, 4 bytes per luxel
+    LIGHTMAP_FORMAT_E5B9G9R9
+};
+
+// Where the lightmap of a face ended up, the styles are placed next to each other starting at x
+struct bsp_lightmap_rect {
+    // -1 if the face has no lightmap
+    int page;
+    int x;
+    int y;
+    // Size of one style in luxels
+    int width;
+    int height;
+    int styleCount;
+};
+
+struct bsp_lightmap_atlas {
+    bsp_lightmap_format format;
+    // True if the luxels came from the HDR lighting lump
+    bool hdr;
+    uint32_t pageSize;
+    uint32_t pageCount;
+    // Pages after each other, ready to upload as texture array
+    std::vector<unsigned char> pixels;
+    // One entry per bsp face
+    std::vector<bsp_lightmap_rect> faces;
+    // Luxel with a light of 1 used by faces without lightmap
+    bsp_lightmap_rect fullbright;
+};
+
+// Decodes the lightmaps of all faces and packs them into as few pages as possible, preferring the HDR lighting if
+// the map has it. Pages are packed and filled in parallel on jobs.
+bsp_lightmap_atlas build_bsp_lightmap_atlas(bsp_parsed* bsp, job_system* jobs, bsp_lightmap_format format);
+
+// Atlas coordinates of a position on a face, for faces without lightmap the center of the fullbright luxel
+glm::vec2 bsp_lightmap_uv(const bsp_parsed* bsp, const bsp_lightmap_atlas* atlas, int faceIndex, const glm::vec3& position);
+
+// Only handles positive values up to FP16_MAX, rounds to nearest even
+uint16_t bsp_float_to_half(float f);
+
+size_t bsp_lightmap_luxel_size(bsp_lightmap_format format);
+VkFormat bsp_lightmap_vk_format(bsp_lightmap_format format);
+
+// Converts count ColorRGBExp32 samples to format
+void bsp_decode_lightmap_samples(bsp_lightmap_format format, const unsigned char* samples, size_t count, unsigned char* outLuxels);
+
+// Decodes the whole lighting lump with every format and prints throughput and memory
+void bsp_lightmap_benchmark(bsp_parsed* bsp);
+
+#endif //VULKAN_TEST_BSP_LIGHTMAP_H
@@ -19,7 +19,10 @@
 #include <fstream>
 #include <iostream>
 #include <unordered_map>
+#include <cstring>
+#include <algorithm>
 #include "../vulkan/vulkan_utils.h"
+#include "../profiler.h"
 
 #define IDBSPHEADER	(('P'<<24)+('S'<<16)+('B'<<8)+'V')
 #define HEADER_LUMPS 64
@@ -70,6 +73,14 @@ struct dtexdata_t
     int	        view_width, view_height;
 };
 
+struct texinfo_t
+{
+    float	textureVecs[2][4];	// [s/t][xyz offset]
+    float	lightmapVecs[2][4];	// [s/t][xyz offset] - length is in units of texels/area
+    int	    flags;			// miptex flags overrides
+    int	    texdata;		// Pointer to texture name, size, etc.
+};
+
 struct dnode_t
 {
     int		planenum;	// index into plane array
@@ -161,6 +172,7 @@ void convertTree(bspTree* node, plane* splittingPlanes, dnode_t* nodes, dleaf_t*
 }
 
 void* read_lump(dheader_t* bspHeader, std::ifstream& stream, int lumpNumber, size_t objectSize, size_t* outObjectCount) {
+    PROFILE_ZONE("read_lump");
     lump_t lump = bspHeader->lumps[lumpNumber];
 
     void* alloc = malloc(lump.filelength);
@@ -174,7 +186,42 @@ void* read_lump(dheader_t* bspHeader, std::ifstream& stream, int lumpNumber, siz
     return alloc;
 }
 
+// The lump starts with the cluster count and a PVS and PAS offset per cluster, the sets are run length encoded:
+// a zero byte is followed by the number of zero bytes it stands for
+static unsigned char* decompress_visibility(const unsigned char* vis, size_t visSize, int clusterCount, size_t rowSize) {
+    PROFILE_ZONE("decompress_visibility");
+    unsigned char* visibility = new unsigned char[std::max<size_t>((size_t)clusterCount * rowSize, 1)];
+    const int* offsets = (const int*)(vis + sizeof(int));
+
+    for (int cluster = 0; cluster < clusterCount; cluster++) {
+        unsigned char* row = visibility + (size_t)cluster * rowSize;
+        size_t in = (size_t)offsets[cluster * 2];
+        size_t out = 0;
+
+        while (out < rowSize && in < visSize) {
+            if (vis[in] != 0) {
+                row[out++] = vis[in++];
+                continue;
+            }
+
+            size_t zeros = in + 1 < visSize ? vis[in + 1] : 0;
+            zeros = std::min(zeros, rowSize - out);
+            memset(row + out, 0, zeros);
+            out += zeros;
+            in += 2;
+        }
+
+        // Corrupt or truncated data makes the rest of the row visible rather than hiding geometry
+        if (out < rowSize) {
+            memset(row + out, 0xFF, rowSize - out);
+        }
+    }
+
+    return visibility;
+}
+
 bsp_parsed* load_bsp(const std::string& file) {
+    PROFILE_ZONE("load_bsp");
     std::ifstream fs(file, std::ios::binary);
 
     if (!fs.is_open()) {
@@ -206,17 +253,64 @@ bsp_parsed* load_bsp(const std::string& file) {
     size_t facesCount;
     dface_t* lfaces = (dface_t*)read_lump(&bspheader, fs, 7, sizeof(dface_t), &facesCount);
 
+    // HDR faces only differ in where their lightmaps are, maps without them use the same offsets for both
+    size_t hdrFacesCount;
+    dface_t* lfacesHDR = (dface_t*)read_lump(&bspheader, fs, 58, sizeof(dface_t), &hdrFacesCount);
+
     // Visibility information
-    int* vis = (int*)read_lump(&bspheader, fs, 4, 0, nullptr);
+    size_t visSize;
+    unsigned char* vis = (unsigned char*)read_lump(&bspheader, fs, 4, 1, &visSize);
+    int clusterCount = visSize >= sizeof(int) ? *(int*)vis : 0;
+    if (clusterCount < 0 || sizeof(int) + (size_t)clusterCount * 2 * sizeof(int) > visSize) {
+        clusterCount = 0;
+    }
 
     face* faces = new face[facesCount];
 
     for (int i = 0; i < facesCount; i++) {
         faces[i].edgeCount = lfaces[i].numedges;
         faces[i].firstSurfedgeIndex = lfaces[i].firstedge;
+        faces[i].surfaceInfoIndex = lfaces[i].texinfo;
+        faces[i].displacement = lfaces[i].dispinfo != -1;
+        faces[i].lightOffset = lfaces[i].lightofs;
+        faces[i].cluster = -1;
+        faces[i].lightOffsetHDR = hdrFacesCount == facesCount ? lfacesHDR[i].lightofs : lfaces[i].lightofs;
+        memcpy(faces[i].styles, lfaces[i].styles, sizeof(faces[i].styles));
+
+        for (int axis = 0; axis < 2; axis++) {
+            faces[i].lightmapMins[axis] = lfaces[i].LightmapTextureMinsInLuxels[axis];
+            faces[i].lightmapSize[axis] = lfaces[i].LightmapTextureSizeInLuxels[axis];
+        }
     }
 
     free(lfaces);
+    free(lfacesHDR);
+
+    // Read surface infos
+    size_t texinfoCount;
+    texinfo_t* ltexinfo = (texinfo_t*)read_lump(&bspheader, fs, 6, sizeof(texinfo_t), &texinfoCount);
+
+    surfaceInfo* surfaceInfos = new surfaceInfo[texinfoCount];
+
+    for (int i = 0; i < texinfoCount; i++) {
+        surfaceInfos[i].flags = ltexinfo[i].flags;
+        surfaceInfos[i].textureIndex = ltexinfo[i].texdata;
+
+        for (int axis = 0; axis < 2; axis++) {
+            surfaceInfos[i].textureVecs[axis] = glm::vec4(ltexinfo[i].textureVecs[axis][0], ltexinfo[i].textureVecs[axis][1],
+                                                          ltexinfo[i].textureVecs[axis][2], ltexinfo[i].textureVecs[axis][3]);
+            surfaceInfos[i].lightmapVecs[axis] = glm::vec4(ltexinfo[i].lightmapVecs[axis][0], ltexinfo[i].lightmapVecs[axis][1],
+                                                           ltexinfo[i].lightmapVecs[axis][2], ltexinfo[i].lightmapVecs[axis][3]);
+        }
+    }
+
+    free(ltexinfo);
+
+    // Read lighting
+    size_t lightingSize;
+    unsigned char* lighting = (unsigned char*)read_lump(&bspheader, fs, 8, 1, &lightingSize);
+    size_t lightingHDRSize;
+    unsigned char* lightingHDR = (unsigned char*)read_lump(&bspheader, fs, 53, 1, &lightingHDRSize);
 
     // Read texinfo
     size_t texdataCount;
@@ -252,14 +346,41 @@ bsp_parsed* load_bsp(const std::string& file) {
     unsigned short* leaffaces = (unsigned short*)read_lump(&bspheader, fs, 16, sizeof(unsigned short), &leaffaceCount);
     plane* splittingPlanes = (plane*)read_lump(&bspheader, fs, 1, sizeof(plane), &planeCount);
 
+    for (int i = 0; i < leafCount; i++) {
+        for (int j = 0; j < leafs[i].numleaffaces && leafs[i].firstleafface + j < leaffaceCount; j++) {
+            unsigned short faceIndex = leaffaces[leafs[i].firstleafface + j];
+
+            if (faceIndex < facesCount && faces[faceIndex].cluster < 0) {
+                faces[faceIndex].cluster = leafs[i].cluster;
+            }
+        }
+    }
+
     bspTree* trees = new bspTree[modelCount];
 
     for (int i = 0; i < modelCount; i++) {
         dnode_t* headNode = nodes + models[i].headnode;
 
-        convertTree(trees + i, splittingPlanes, nodes, leafs, leaffaces, faces, *vis, headNode->children[0], headNode->children[1]);
+        convertTree(trees + i, splittingPlanes, nodes, leafs, leaffaces, faces, clusterCount, headNode->children[0], headNode->children[1]);
+    }
+
+    bsp_node* pointNodes = new bsp_node[nodeCount];
+    for (size_t i = 0; i < nodeCount; i++) {
+        pointNodes[i].splittingPlane = splittingPlanes[nodes[i].planenum];
+        pointNodes[i].children[0] = nodes[i].children[0];
+        pointNodes[i].children[1] = nodes[i].children[1];
+    }
+
+    short* leafClusters = new short[leafCount];
+    for (size_t i = 0; i < leafCount; i++) {
+        leafClusters[i] = leafs[i].cluster;
     }
 
+    size_t visibilityRowSize = ((size_t)clusterCount + 7) / 8;
+    unsigned char* visibility = decompress_visibility(vis, visSize, clusterCount, visibilityRowSize);
+    int worldHeadNode = modelCount > 0 ? models[0].headnode : -1;
+
+    free(vis);
     free(models);
     free(leafs);
     free(nodes);
@@ -276,14 +397,29 @@ bsp_parsed* load_bsp(const std::string& file) {
     returnStruct->faceCount = facesCount;
     returnStruct->textures = texInfo;
     returnStruct->textureCount = texdataCount;
+    returnStruct->surfaceInfos = surfaceInfos;
+    returnStruct->surfaceInfoCount = texinfoCount;
+    returnStruct->lighting = lighting;
+    returnStruct->lightingSize = lightingSize;
+    returnStruct->lightingHDR = lightingHDR;
+    returnStruct->lightingHDRSize = lightingHDRSize;
     returnStruct->bspTrees = trees;
     returnStruct->bspTreeCount = modelCount;
+    returnStruct->nodes = pointNodes;
+    returnStruct->nodeCount = nodeCount;
+    returnStruct->worldHeadNode = worldHeadNode;
+    returnStruct->leafClusters = leafClusters;
+    returnStruct->leafCount = leafCount;
+    returnStruct->visibility = visibility;
+    returnStruct->visibilityRowSize = visibilityRowSize;
+    returnStruct->clusterCount = clusterCount;
 
     return returnStruct;
 }
 
 /*
 bsp_geometry_vulkan create_geometry_from_bsp(vulkan_renderer* renderer, bsp_parsed* bsp) {
+    PROFILE_ZONE("create_geometry_from_bsp");
     bsp_geometry_vulkan geometry = {};
 
     vulkan_createBuffer(renderer, bsp->verticesCount * sizeof(vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, geometry.vertexBuffer, geometry.vertexBufferMemory);
@@ -422,12 +558,8 @@ bsp_geometry_vulkan create_geometry_from_bsp(vulkan_renderer* renderer, bsp_pars
     dynamicState.dynamicStateCount = 0;
     dynamicState.pDynamicStates = nullptr;
 
-    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 0;
-    layoutInfo.pBindings = nullptr;
-
-    if (vkCreateDescriptorSetLayout(renderer->init_objects.device, &layoutInfo, nullptr, &geometry.descriptorSetLayout) != VK_SUCCESS) {
+    geometry.descriptorSetLayout = vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, nullptr, 0);
+    if (geometry.descriptorSetLayout == VK_NULL_HANDLE) {
         throw std::runtime_error("failed to create descriptor set layout!");
     }
 
@@ -472,4 +604,24 @@ bsp_geometry_vulkan create_geometry_from_bsp(vulkan_renderer* renderer, bsp_pars
 
     return geometry;
 }
-*/
\ No newline at end of file
+*/
+int bsp_find_cluster(const bsp_parsed* bsp, glm::vec3 position) {
+    if (bsp->clusterCount == 0 || bsp->worldHeadNode < 0) {
+        return -1;
+    }
+
+    int node = bsp->worldHeadNode;
+    while (node >= 0 && (size_t)node < bsp->nodeCount) {
+        const plane& splittingPlane = bsp->nodes[node].splittingPlane;
+        float distance = glm::dot(splittingPlane.normal, position) - splittingPlane.distance;
+        node = bsp->nodes[node].children[distance >= 0.0f ? 0 : 1];
+    }
+
+    size_t leaf = (size_t)(-(node + 1));
+    if (node >= 0 || leaf >= bsp->leafCount) {
+        return -1;
+    }
+
+    int cluster = bsp->leafClusters[leaf];
+    return cluster < bsp->clusterCount ? cluster : -1;
+}
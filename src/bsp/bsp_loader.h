@@ -23,6 +23,20 @@
 #include "../vulkan/vulkan_renderer.h"
 #include <unordered_map>
 
+// texinfo surface flags
+#define SURF_LIGHT      0x0001
+#define SURF_SKY2D      0x0002
+#define SURF_SKY        0x0004
+#define SURF_WARP       0x0008
+#define SURF_TRANS      0x0010
+#define SURF_NOPORTAL   0x0020
+#define SURF_TRIGGER    0x0040
+#define SURF_NODRAW     0x0080
+#define SURF_HINT       0x0100
+#define SURF_SKIP       0x0200
+#define SURF_NOLIGHT    0x0400
+#define SURF_BUMPLIGHT  0x0800
+
 struct vertex {
     float x;
     float y;
@@ -34,9 +48,36 @@ struct edge {
     unsigned short v[2];
 };
 
+// Light styles of a face that are not used
+#define LIGHTSTYLE_NONE 255
+#define MAX_LIGHTSTYLES 4
+
 struct face {
     int firstSurfedgeIndex;
     int edgeCount;
+    // Index into surfaceInfos, -1 if the face has none
+    int surfaceInfoIndex;
+    bool displacement;
+    // Byte offset into the lighting lump, -1 if the face is not lit
+    int lightOffset;
+    // Same for the HDR lighting lump
+    int lightOffsetHDR;
+    unsigned char styles[MAX_LIGHTSTYLES];
+    // Lightmap rectangle in luxels, the lightmap has lightmapSize + 1 samples per axis
+    int lightmapMins[2];
+    int lightmapSize[2];
+    // Visibility cluster of the first leaf that references the face, -1 if no leaf does
+    int cluster;
+};
+
+struct surfaceInfo {
+    int flags;
+    // World position to texel, xyz is the axis and w the offset
+    glm::vec4 textureVecs[2];
+    // World position to luxel, xyz is the axis and w the offset
+    glm::vec4 lightmapVecs[2];
+    // Index into textures, -1 if the surface has no texture
+    int textureIndex;
 };
 
 struct textureInfo {
@@ -64,6 +105,13 @@ enum bspNodeType {
     LEAF
 };
 
+// Compact copy of a dnode_t for point lookups
+struct bsp_node {
+    plane splittingPlane;
+    // Negative children are leaves, encoded as -(leaf + 1)
+    int children[2];
+};
+
 struct bspTree {
     bspTree* childs[2];
     bspNodeType type;
@@ -82,12 +130,33 @@ struct bsp_parsed {
     size_t faceCount;
     textureInfo* textures;
     size_t textureCount;
+    surfaceInfo* surfaceInfos;
+    size_t surfaceInfoCount;
+    // ColorRGBExp32 lightmap samples of all faces
+    unsigned char* lighting;
+    size_t lightingSize;
+    // Same layout in HDR, empty if the map was compiled without HDR
+    unsigned char* lightingHDR;
+    size_t lightingHDRSize;
     bspTree* bspTrees;
     size_t bspTreeCount;
+    // Nodes of all models, the world starts at worldHeadNode
+    bsp_node* nodes;
+    size_t nodeCount;
+    int worldHeadNode;
+    short* leafClusters;
+    size_t leafCount;
+    // Decompressed potentially visible sets, one row of visibilityRowSize bytes per cluster, bit n set if cluster n is visible
+    unsigned char* visibility;
+    size_t visibilityRowSize;
+    int clusterCount;
 };
 
 bsp_parsed* load_bsp(const std::string& file);
 
+// Cluster of the world leaf that contains position, -1 if the leaf is solid or the map has no visibility
+int bsp_find_cluster(const bsp_parsed* bsp, glm::vec3 position);
+
 /*
 struct bsp_geometry_vulkan {
     VkBuffer vertexBuffer;
@@ -0,0 +1,561 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bsp_materials.h"
+#include "../texture/mipmap.h"
+#include "../texture/bc_encoder.h"
+#include "../texture/texture_cache.h"
+#include "../profiler.h"
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cctype>
+
+#define MISSING_TEXTURE_SIZE 8
+
+#define MATERIAL_MIP_FILTER MIP_FILTER_KAISER
+// Opaque textures always use BC1, textures with alpha this format
+#define MATERIAL_ALPHA_BC_FORMAT BC_FORMAT_BC7
+#define MATERIAL_BC7_QUALITY 2
+#define MATERIAL_ENCODER_SETTINGS ((MATERIAL_ALPHA_BC_FORMAT << 8) | MATERIAL_BC7_QUALITY)
+
+#define COOKED_TEXTURE_MAGIC (('X'<<24)+('E'<<16)+('T'<<8)+'C')
+#define COOKED_TEXTURE_VERSION 2
+
+// Identifies the source of a cooked texture, hashed together with the top level pixels
+struct cooked_texture_key {
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t filter;
+    uint32_t encoderSettings;
+};
+
+struct cooked_texture_header {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+};
+
+// Everything that decides what a cached texture looks like, hashed together with the VTF path
+struct texture_cache_key_info {
+    uint32_t version;
+    uint32_t crc;
+    uint32_t length;
+    uint32_t allowBlockCompression;
+    uint32_t filter;
+    uint32_t encoderSettings;
+};
+
+struct material_compression_stats {
+    std::mutex mutex;
+    int compressed;
+    int fromCache;
+    double megapixels;
+    double encodeMilliseconds;
+    double psnrSum;
+};
+
+enum material_mips_result {
+    MIPS_COMPLETE,
+    MIPS_GENERATED,
+    MIPS_FROM_CACHE,
+    MIPS_UNSUPPORTED
+};
+
+static std::string to_lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](char c) { return (char)tolower(c); });
+    return s;
+}
+
+// Returns the value of a key in a VMT file, quoted or unquoted. Keys are case insensitive.
+static std::string vmt_find_value(const std::string& vmt, const std::string& key) {
+    size_t position = 0;
+
+    while ((position = vmt.find(key, position)) != std::string::npos) {
+        size_t end = position + key.size();
+        position = end;
+
+        // Make sure we matched the whole key and not part of a longer one like $basetexture2
+        bool keyStart = position == key.size() || vmt[position - key.size() - 1] == '"' || isspace((unsigned char)vmt[position - key.size() - 1]);
+        if (!keyStart || (end < vmt.size() && vmt[end] != '"' && !isspace((unsigned char)vmt[end]))) {
+            continue;
+        }
+
+        if (end < vmt.size() && vmt[end] == '"') {
+            end++;
+        }
+
+        while (end < vmt.size() && (vmt[end] == ' ' || vmt[end] == '\t')) {
+            end++;
+        }
+
+        if (end >= vmt.size() || vmt[end] == '\n' || vmt[end] == '\r') {
+            continue;
+        }
+
+        bool quoted = vmt[end] == '"';
+        if (quoted) {
+            end++;
+        }
+
+        size_t valueEnd = end;
+        while (valueEnd < vmt.size() && vmt[valueEnd] != '"' && vmt[valueEnd] != '\n' && vmt[valueEnd] != '\r'
+               && (quoted || !isspace((unsigned char)vmt[valueEnd]))) {
+            valueEnd++;
+        }
+
+        return vmt.substr(end, valueEnd - end);
+    }
+
+    return "";
+}
+
+// Follows the VMT of a material to the VPK entry of its base texture
+static const vpk_directory_entry* find_material_texture(vpk_directory* vpk, const std::string& materialName) {
+    std::string materialPath = "materials/" + materialName;
+    const vpk_directory_entry* vmtEntry = vpk_find_entry(vpk, "vmt", materialPath);
+
+    std::string baseTexture;
+
+    // Patch materials reference their parent through include, follow a few levels of those
+    for (int depth = 0; depth < 4 && vmtEntry != nullptr; depth++) {
+        std::vector<unsigned char> vmtData;
+        if (!vpk_read_entry(vpk, vmtEntry, vmtData)) {
+            return nullptr;
+        }
+
+        std::string vmt = to_lower(std::string(vmtData.begin(), vmtData.end()));
+        baseTexture = vmt_find_value(vmt, "$basetexture");
+
+        if (!baseTexture.empty()) {
+            break;
+        }
+
+        std::string include = vmt_find_value(vmt, "include");
+        if (include.empty()) {
+            break;
+        }
+
+        if (include.size() > 4 && include.compare(include.size() - 4, 4, ".vmt") == 0) {
+            include.resize(include.size() - 4);
+        }
+
+        vmtEntry = vpk_find_entry(vpk, "vmt", include);
+    }
+
+    if (baseTexture.empty()) {
+        return nullptr;
+    }
+
+    if (baseTexture.size() > 4 && baseTexture.compare(baseTexture.size() - 4, 4, ".vtf") == 0) {
+        baseTexture.resize(baseTexture.size() - 4);
+    }
+
+    return vpk_find_entry(vpk, "vtf", "materials/" + baseTexture);
+}
+
+static bool load_material_texture(vpk_directory* vpk, const vpk_directory_entry* vtfEntry, vtf_texture* outTexture) {
+    std::vector<unsigned char> vtfData;
+    if (!vpk_read_entry(vpk, vtfEntry, vtfData)) {
+        return false;
+    }
+
+    return load_vtf(vtfData.data(), vtfData.size(), outTexture);
+}
+
+void bsp_material_missing_texture(vtf_texture* outTexture) {
+    outTexture->width = MISSING_TEXTURE_SIZE;
+    outTexture->height = MISSING_TEXTURE_SIZE;
+    outTexture->mipCount = 1;
+    outTexture->format = VK_FORMAT_R8G8B8A8_UNORM;
+    outTexture->data.resize(MISSING_TEXTURE_SIZE * MISSING_TEXTURE_SIZE * 4);
+    outTexture->mipOffsets = { 0 };
+
+    for (int y = 0; y < MISSING_TEXTURE_SIZE; y++) {
+        for (int x = 0; x < MISSING_TEXTURE_SIZE; x++) {
+            unsigned char* pixel = outTexture->data.data() + (y * MISSING_TEXTURE_SIZE + x) * 4;
+            bool magenta = ((x / (MISSING_TEXTURE_SIZE / 2)) + (y / (MISSING_TEXTURE_SIZE / 2))) % 2 == 0;
+
+            pixel[0] = magenta ? 255 : 0;
+            pixel[1] = 0;
+            pixel[2] = magenta ? 255 : 0;
+            pixel[3] = 255;
+        }
+    }
+}
+
+static uint64_t cooked_texture_source_key(const vtf_texture* texture, uint32_t encoderSettings) {
+    cooked_texture_key keyInfo = { COOKED_TEXTURE_VERSION, texture->width, texture->height, (uint32_t)texture->format, MATERIAL_MIP_FILTER, encoderSettings };
+    size_t topSize = vtf_mip_size(texture->format, texture->width, texture->height);
+
+    return cooked_hash(texture->data.data() + texture->mipOffsets[0], topSize, cooked_hash(&keyInfo, sizeof(keyInfo)));
+}
+
+static bool read_cooked_texture(cooked_store* cooked, const char* kind, uint64_t key, vtf_texture* texture) {
+    std::vector<unsigned char> cookedData;
+    if (!cooked_store_read(cooked, kind, key, cookedData) || cookedData.size() < sizeof(cooked_texture_header)) {
+        return false;
+    }
+
+    cooked_texture_header header;
+    memcpy(&header, cookedData.data(), sizeof(header));
+
+    if (header.magic != COOKED_TEXTURE_MAGIC || header.width != texture->width || header.height != texture->height
+        || header.mipCount == 0 || header.mipCount > mip_chain_length(texture->width, texture->height)) {
+        return false;
+    }
+
+    VkFormat format = (VkFormat)header.format;
+    std::vector<size_t> mipOffsets(header.mipCount);
+    size_t totalSize = 0;
+    for (uint32_t i = 0; i < header.mipCount; i++) {
+        mipOffsets[i] = totalSize;
+        totalSize += vtf_mip_size(format, std::max(texture->width >> i, 1u), std::max(texture->height >> i, 1u));
+    }
+
+    if (cookedData.size() != sizeof(header) + totalSize) {
+        return false;
+    }
+
+    texture->format = format;
+    texture->data.assign(cookedData.begin() + sizeof(header), cookedData.end());
+    texture->mipOffsets = mipOffsets;
+    texture->mipCount = header.mipCount;
+
+    return true;
+}
+
+static void write_cooked_texture(cooked_store* cooked, const char* kind, uint64_t key, const vtf_texture* texture) {
+    cooked_texture_header header = { COOKED_TEXTURE_MAGIC, (uint32_t)texture->format, texture->width, texture->height, texture->mipCount };
+
+    std::vector<unsigned char> cookedData(sizeof(header) + texture->data.size());
+    memcpy(cookedData.data(), &header, sizeof(header));
+    memcpy(cookedData.data() + sizeof(header), texture->data.data(), texture->data.size());
+
+    cooked_store_write(cooked, kind, key, cookedData.data(), cookedData.size());
+}
+
+static bool is_uncompressed_rgba8(const vtf_texture* texture) {
+    return texture->format == VK_FORMAT_R8G8B8A8_UNORM || texture->format == VK_FORMAT_B8G8R8A8_UNORM;
+}
+
+static material_mips_result complete_mip_chain(vtf_texture* texture, cooked_store* cooked) {
+    if (texture->mipCount >= mip_chain_length(texture->width, texture->height)) {
+        return MIPS_COMPLETE;
+    }
+
+    if (!is_uncompressed_rgba8(texture)) {
+        return MIPS_UNSUPPORTED;
+    }
+
+    uint64_t key = cooked_texture_source_key(texture, 0);
+
+    if (cooked != nullptr && read_cooked_texture(cooked, "mips", key, texture)) {
+        return MIPS_FROM_CACHE;
+    }
+
+    // Base textures are authored in sRGB
+    std::vector<unsigned char> mipData;
+    std::vector<size_t> mipOffsets;
+    mip_generate_rgba8(texture->data.data() + texture->mipOffsets[0], texture->width, texture->height, MATERIAL_MIP_FILTER, true, mipData, mipOffsets);
+
+    texture->data = std::move(mipData);
+    texture->mipOffsets = mipOffsets;
+    texture->mipCount = mipOffsets.size();
+
+    if (cooked != nullptr) {
+        write_cooked_texture(cooked, "mips", key, texture);
+    }
+
+    return MIPS_GENERATED;
+}
+
+static bool has_alpha(const vtf_texture* texture) {
+    const unsigned char* pixels = texture->data.data() + texture->mipOffsets[0];
+
+    for (size_t i = 0; i < (size_t)texture->width * texture->height; i++) {
+        if (pixels[i * 4 + 3] != 255) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Replaces all mips of an RGBA8 or BGRA8 texture by their block compressed version
+static void compress_texture(vtf_texture* texture, material_compression_stats* stats) {
+    bc_format format = has_alpha(texture) ? MATERIAL_ALPHA_BC_FORMAT : BC_FORMAT_BC1;
+    VkFormat vkFormat = format == BC_FORMAT_BC1 ? VK_FORMAT_BC1_RGB_UNORM_BLOCK
+                      : format == BC_FORMAT_BC3 ? VK_FORMAT_BC3_UNORM_BLOCK
+                      : VK_FORMAT_BC7_UNORM_BLOCK;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<unsigned char> compressedData;
+    std::vector<size_t> mipOffsets(texture->mipCount);
+    std::vector<unsigned char> rgba;
+    double psnr = 0.0;
+    size_t pixelCount = 0;
+
+    for (uint32_t mip = 0; mip < texture->mipCount; mip++) {
+        uint32_t mipWidth = std::max(texture->width >> mip, 1u);
+        uint32_t mipHeight = std::max(texture->height >> mip, 1u);
+        const unsigned char* pixels = texture->data.data() + texture->mipOffsets[mip];
+
+        if (texture->format == VK_FORMAT_B8G8R8A8_UNORM) {
+            rgba.assign(pixels, pixels + (size_t)mipWidth * mipHeight * 4);
+            for (size_t i = 0; i < rgba.size(); i += 4) {
+                std::swap(rgba[i], rgba[i + 2]);
+            }
+            pixels = rgba.data();
+        }
+
+        mipOffsets[mip] = compressedData.size();
+        compressedData.resize(compressedData.size() + bc_image_size(format, mipWidth, mipHeight));
+
+        // Already running inside a material job, so every texture is encoded on a single thread
+        bc_encode_image(nullptr, format, MATERIAL_BC7_QUALITY, pixels, mipWidth, mipHeight, compressedData.data() + mipOffsets[mip]);
+        pixelCount += (size_t)mipWidth * mipHeight;
+
+        if (mip == 0) {
+            psnr = bc_psnr(format, pixels, mipWidth, mipHeight, compressedData.data());
+        }
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    texture->format = vkFormat;
+    texture->data = std::move(compressedData);
+    texture->mipOffsets = mipOffsets;
+
+    std::lock_guard<std::mutex> lock(stats->mutex);
+    stats->compressed++;
+    stats->megapixels += pixelCount / 1000000.0;
+    stats->encodeMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+    stats->psnrSum += psnr;
+}
+
+static uint64_t texture_cache_key(const vpk_directory_entry* vtfEntry, bool allowBlockCompression) {
+    texture_cache_key_info keyInfo = { COOKED_TEXTURE_VERSION, vtfEntry->crc, (uint32_t)(vtfEntry->preload.size() + vtfEntry->archiveLength),
+                                       allowBlockCompression, MATERIAL_MIP_FILTER, MATERIAL_ENCODER_SETTINGS };
+    std::string path = vtfEntry->path + "/" + vtfEntry->filename;
+
+    return cooked_hash(path.data(), path.size(), cooked_hash(&keyInfo, sizeof(keyInfo)));
+}
+
+static void use_cached_texture(bsp_material* material, const texture_cache* cache, const texture_cache_entry* entry) {
+    material->texture.format = (VkFormat)entry->format;
+    material->texture.width = entry->width;
+    material->texture.height = entry->height;
+    material->texture.mipCount = entry->mipCount;
+    material->texture.mipOffsets.assign(entry->mipOffsets, entry->mipOffsets + entry->mipCount);
+    material->texture.data.clear();
+    material->texture.data.shrink_to_fit();
+
+    material->cachedData = texture_cache_data(cache, entry);
+    material->cachedSize = entry->dataSize;
+}
+
+// Writes every cacheable material into a new texture cache and points the materials at it
+static void rebuild_texture_cache(bsp_material_set* set, const std::string& path) {
+    // Materials that were hits still point into the old mapping, which has to go before it can be replaced
+    for (bsp_material& material : set->materials) {
+        if (material.cachedData != nullptr) {
+            material.texture.data.assign(material.cachedData, material.cachedData + material.cachedSize);
+            material.cachedData = nullptr;
+            material.cachedSize = 0;
+        }
+    }
+
+    if (set->cache != nullptr) {
+        texture_cache_close(set->cache);
+        set->cache = nullptr;
+    }
+
+    std::vector<texture_cache_source> sources;
+    for (bsp_material& material : set->materials) {
+        if (material.cacheKey == 0 || material.texture.mipCount > TEXTURE_CACHE_MAX_MIPS) {
+            continue;
+        }
+
+        texture_cache_source source = {};
+        source.entry.key = material.cacheKey;
+        source.entry.format = material.texture.format;
+        source.entry.width = material.texture.width;
+        source.entry.height = material.texture.height;
+        source.entry.mipCount = material.texture.mipCount;
+        source.entry.dataSize = material.texture.data.size();
+        std::copy(material.texture.mipOffsets.begin(), material.texture.mipOffsets.end(), source.entry.mipOffsets);
+        source.data = material.texture.data.data();
+        sources.push_back(source);
+    }
+
+    if (!texture_cache_write(path, sources)) {
+        return;
+    }
+
+    set->cache = texture_cache_open(path);
+    if (set->cache == nullptr) {
+        return;
+    }
+
+    for (bsp_material& material : set->materials) {
+        const texture_cache_entry* entry = material.cacheKey != 0 ? texture_cache_find(set->cache, material.cacheKey) : nullptr;
+        if (entry != nullptr) {
+            use_cached_texture(&material, set->cache, entry);
+        }
+    }
+}
+
+const unsigned char* bsp_material_data(const bsp_material* material) {
+    return material->cachedData != nullptr ? material->cachedData : material->texture.data.data();
+}
+
+size_t bsp_material_data_size(const bsp_material* material) {
+    return material->cachedData != nullptr ? material->cachedSize : material->texture.data.size();
+}
+
+bsp_material_set* load_bsp_materials(bsp_parsed* bsp, vpk_directory* vpk, job_system* jobs, cooked_store* cooked, bool allowBlockCompression) {
+    PROFILE_ZONE("load_bsp_materials");
+    bsp_material_set* set = new bsp_material_set();
+    set->materials.resize(bsp->textureCount);
+    set->cache = nullptr;
+
+    std::vector<bsp_material>& materials = set->materials;
+
+    // One texture cache per map, named after its material list
+    uint64_t cacheName = cooked_hash(&allowBlockCompression, sizeof(allowBlockCompression));
+    for (int i = 0; i < bsp->textureCount; i++) {
+        cacheName = cooked_hash(bsp->textures[i].textureName.data(), bsp->textures[i].textureName.size(), cacheName);
+    }
+
+    std::string cachePath;
+    if (cooked != nullptr) {
+        cachePath = cooked_store_path(cooked, "texcache", cacheName);
+        set->cache = texture_cache_open(cachePath);
+    }
+
+    std::atomic<int> missingCount(0);
+    std::atomic<int> cacheHits(0);
+    std::atomic<int> cacheMisses(0);
+    std::atomic<int> generatedMips(0);
+    std::atomic<int> cachedMips(0);
+    material_compression_stats compressionStats = {};
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    job_system_parallel_for(jobs, materials.size(), [&](size_t i) {
+        PROFILE_ZONE("load material");
+        bsp_material& material = materials[i];
+        material.name = to_lower(bsp->textures[i].textureName);
+        material.cacheKey = 0;
+        material.cachedData = nullptr;
+        material.cachedSize = 0;
+
+        const vpk_directory_entry* vtfEntry = vpk != nullptr ? find_material_texture(vpk, material.name) : nullptr;
+
+        if (vtfEntry != nullptr) {
+            material.cacheKey = texture_cache_key(vtfEntry, allowBlockCompression);
+
+            const texture_cache_entry* cacheEntry = set->cache != nullptr ? texture_cache_find(set->cache, material.cacheKey) : nullptr;
+            if (cacheEntry != nullptr) {
+                use_cached_texture(&material, set->cache, cacheEntry);
+                material.loaded = true;
+                cacheHits++;
+                return;
+            }
+
+            cacheMisses++;
+        }
+
+        material.loaded = vtfEntry != nullptr && load_material_texture(vpk, vtfEntry, &material.texture);
+
+        if (material.loaded && !allowBlockCompression && vtf_is_block_compressed(material.texture.format)) {
+            material.loaded = false;
+        }
+
+        if (!material.loaded) {
+            bsp_material_missing_texture(&material.texture);
+            material.cacheKey = 0;
+            missingCount++;
+        }
+
+        // Uncompressed textures are block compressed once and then come straight from the cooked store
+        bool compress = allowBlockCompression && material.loaded && is_uncompressed_rgba8(&material.texture);
+        uint64_t compressedKey = compress ? cooked_texture_source_key(&material.texture, MATERIAL_ENCODER_SETTINGS) : 0;
+
+        if (compress && cooked != nullptr && read_cooked_texture(cooked, "bc", compressedKey, &material.texture)) {
+            std::lock_guard<std::mutex> lock(compressionStats.mutex);
+            compressionStats.fromCache++;
+            return;
+        }
+
+        material_mips_result mipsResult = complete_mip_chain(&material.texture, cooked);
+        if (mipsResult == MIPS_GENERATED) {
+            generatedMips++;
+        } else if (mipsResult == MIPS_FROM_CACHE) {
+            cachedMips++;
+        }
+
+        if (compress) {
+            compress_texture(&material.texture, &compressionStats);
+
+            if (cooked != nullptr) {
+                write_cooked_texture(cooked, "bc", compressedKey, &material.texture);
+            }
+        }
+    });
+
+    if (cooked != nullptr && cacheMisses > 0) {
+        rebuild_texture_cache(set, cachePath);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::cout << "Loaded " << materials.size() - missingCount << " of " << materials.size() << " materials in "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    int cacheLookups = cacheHits + cacheMisses;
+    std::cout << "Texture cache: " << cacheHits << " of " << cacheLookups << " hits ("
+              << (cacheLookups > 0 ? 100.0 * cacheHits / cacheLookups : 0.0) << "%)" << std::endl;
+
+    std::cout << "Mip chains: " << generatedMips << " generated, " << cachedMips << " from cooked store" << std::endl;
+
+    if (compressionStats.compressed > 0) {
+        std::cout << "Block compressed " << compressionStats.compressed << " textures (" << compressionStats.megapixels << " MPixels) at "
+                  << compressionStats.megapixels / (compressionStats.encodeMilliseconds / 1000.0) << " MPixels/s per thread, average PSNR "
+                  << compressionStats.psnrSum / compressionStats.compressed << " dB" << std::endl;
+    }
+    std::cout << "Block compressed textures from cooked store: " << compressionStats.fromCache << std::endl;
+
+    return set;
+}
+
+void unload_bsp_materials(bsp_material_set* set) {
+    if (set->cache != nullptr) {
+        texture_cache_close(set->cache);
+    }
+
+    delete set;
+}
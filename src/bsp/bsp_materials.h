@@ -0,0 +1,58 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef VULKAN_TEST_BSP_MATERIALS_H
+#define VULKAN_TEST_BSP_MATERIALS_H
+
+#include <string>
+#include <vector>
+#include "bsp_loader.h"
+#include "vpk.h"
+#include "vtf.h"
+#include "../jobs.h"
+#include "../cooked_store.h"
+#include "../texture/texture_cache.h"
+
+struct bsp_material {
+    std::string name;
+    // False if the material or its base texture could not be found, texture then holds a checkerboard
+    bool loaded;
+    // Key of the texture in the texture cache, 0 if it is not cached
+    uint64_t cacheKey;
+    // Textures from the texture cache only have their metadata in texture, the data stays in the mapped file
+    vtf_texture texture;
+    const unsigned char* cachedData;
+    size_t cachedSize;
+};
+
+struct bsp_material_set {
+    std::vector<bsp_material> materials;
+    texture_cache* cache;
+};
+
+// Loads the base texture of every texdata entry on the job system, materials[i] belongs to bsp->textures[i].
+// With a cooked store the finished textures of the map are kept in a texture cache keyed by the VPK entry CRC,
+// misses get a full mip chain generated and are block compressed before the cache is rewritten.
+// Block compressed textures are replaced by the missing texture if allowBlockCompression is false.
+bsp_material_set* load_bsp_materials(bsp_parsed* bsp, vpk_directory* vpk, job_system* jobs, cooked_store* cooked, bool allowBlockCompression);
+void unload_bsp_materials(bsp_material_set* set);
+
+const unsigned char* bsp_material_data(const bsp_material* material);
+size_t bsp_material_data_size(const bsp_material* material);
+
+void bsp_material_missing_texture(vtf_texture* outTexture);
+
+#endif //VULKAN_TEST_BSP_MATERIALS_H
@@ -15,125 +15,983 @@
 */
 
 #include "bsp_rendering.h"
+#include "bsp_materials.h"
+#include "bsp_lightmap.h"
 #include "../vulkan/vulkan_utils.h"
+#include "../vulkan/vulkan_depth_pyramid.h"
+#include "../radix_sort.h"
+#include "../profiler.h"
 #include <stdexcept>
+#include <cstring>
+#include <cstddef>
+#include <cfloat>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <chrono>
 
-bsp_rendering_data bsp_rendering_prepare(bsp_parsed* bsp, vulkan_renderer* renderer) {
-    bsp_rendering_data renderingData;
+// Surfaces that are never drawn as world geometry
+#define BSP_HIDDEN_SURFACES (SURF_NODRAW | SURF_SKY | SURF_SKY2D | SURF_SKIP | SURF_HINT | SURF_TRIGGER)
 
-    // Create Vertex Buffer
-    vulkan_createBuffer(renderer, bsp->verticesCount * sizeof(vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, renderingData.vertexBuffer, renderingData.vertexBufferMemory);
+// Where the texture of a material ended up after uploading
+struct bsp_material_slot {
+    uint32_t descriptorSetIndex;
+    uint32_t material;
+};
 
-    void* bufferAddress;
-    vkMapMemory(renderer->init_objects.device, renderingData.vertexBufferMemory, 0, bsp->verticesCount * sizeof(vertex), 0, &bufferAddress);
-    memcpy(bufferAddress, bsp->vertices, bsp->verticesCount * sizeof(vertex));
-    vkUnmapMemory(renderer->init_objects.device, renderingData.vertexBufferMemory);
+// Uniform buffer of bsp_cull.comp, std140 layout of CullParameters
+struct bsp_cull_parameters {
+    glm::mat4 previousViewProjection;
+    glm::vec4 frustumPlanes[6];
+    glm::vec4 cameraPosition;
+    uint32_t faceCount;
+    int32_t cameraCluster;
+    uint32_t visibilityRowSize;
+    uint32_t flags;
+    uint32_t statsOffset;
+    uint32_t pyramidWidth;
+    uint32_t pyramidHeight;
+    uint32_t pyramidLevels;
+};
 
-    renderingData.bspTrees.resize(bsp->bspTreeCount);
-    for (int i = 0; i < bsp->bspTreeCount; i++) {
-        renderingData.bspTrees[i] = bsp->bspTrees[i];
+// Written to the frame ring once per frame, std140 layout of View in bsp_shader.vert and bsp_depth.vert
+struct bsp_view_uniforms {
+    glm::mat4 viewProjection;
+    // Size of one quantised position step, see bsp_position_step
+    float positionStep;
+    float padding[3];
+};
+
+static VkDeviceSize upload_materials_bindless(std::vector<bsp_material>& materials, vulkan_renderer* renderer, bsp_rendering_data* renderingData, std::vector<bsp_material_slot>& outSlots) {
+    PROFILE_ZONE("upload_materials_bindless");
+    outSlots.resize(materials.size());
+
+    std::vector<std::vector<VkDeviceSize>> mipOffsets(materials.size());
+    std::vector<vulkan_image_upload> uploads;
+    VkDeviceSize uploadSize = 0;
+
+    for (int i = 0; i < materials.size(); i++) {
+        vtf_texture& texture = materials[i].texture;
+        bsp_material_image materialImage = {};
+
+        mipOffsets[i].assign(texture.mipOffsets.begin(), texture.mipOffsets.end());
+
+        vulkan_createImageArray(renderer, texture.width, texture.height, 1, texture.mipCount, texture.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialImage.image, materialImage.allocation);
+        materialImage.view = vulkan_createImageView(renderer, materialImage.image, VK_IMAGE_VIEW_TYPE_2D, texture.format, 1, texture.mipCount);
+
+        vulkan_image_upload upload = { materialImage.image, texture.width, texture.height, 1, texture.mipCount, mipOffsets[i].data(),
+                                       bsp_material_data(&materials[i]), bsp_material_data_size(&materials[i]) };
+        uploads.push_back(upload);
+        uploadSize += upload.size;
+
+        renderingData->materialImages.push_back(materialImage);
+        outSlots[i] = { 0, (uint32_t)i };
+    }
+
+    vulkan_uploadImages(renderer, uploads.data(), uploads.size());
+
+    return uploadSize;
+}
+
+// Textures with the same format, size and mip count share a texture array, split when exceeding maxImageArrayLayers
+static VkDeviceSize upload_materials_arrays(std::vector<bsp_material>& materials, vulkan_renderer* renderer, uint32_t maxLayers, bsp_rendering_data* renderingData, std::vector<bsp_material_slot>& outSlots) {
+    PROFILE_ZONE("upload_materials_arrays");
+    outSlots.resize(materials.size());
+
+    std::map<std::tuple<VkFormat, uint32_t, uint32_t, uint32_t>, std::vector<uint32_t>> groups;
+    for (int i = 0; i < materials.size(); i++) {
+        vtf_texture& texture = materials[i].texture;
+        groups[std::make_tuple(texture.format, texture.width, texture.height, texture.mipCount)].push_back(i);
     }
 
-    int indicesCount = 0;
+    // Layer data has to stay alive until it is copied into the staging ring at the end
+    std::vector<std::vector<VkDeviceSize>> mipOffsets;
+    std::vector<std::vector<unsigned char>> layerData;
+    std::vector<vulkan_image_upload> uploads;
+    VkDeviceSize uploadSize = 0;
+
+    for (auto& group : groups) {
+        VkFormat format = std::get<0>(group.first);
+        uint32_t width = std::get<1>(group.first);
+        uint32_t height = std::get<2>(group.first);
+        uint32_t mipCount = std::get<3>(group.first);
+
+        for (size_t first = 0; first < group.second.size(); first += maxLayers) {
+            uint32_t layers = (uint32_t)std::min<size_t>(maxLayers, group.second.size() - first);
+
+            // Vulkan expects all layers of a mip next to each other
+            std::vector<VkDeviceSize> arrayMipOffsets(mipCount);
+            std::vector<unsigned char> arrayData;
+            for (uint32_t mip = 0; mip < mipCount; mip++) {
+                size_t mipSize = vtf_mip_size(format, std::max(width >> mip, 1u), std::max(height >> mip, 1u));
 
-    /*
-    for (auto& clusterPair : bsp->clusters) {
-        cluster* c = clusterPair.second;
+                arrayMipOffsets[mip] = arrayData.size();
+                arrayData.resize(arrayData.size() + mipSize * layers);
 
-        for (face* f : c->faces) {
-            indicesCount += f->edgeCount;
-            if (f->edgeCount > 3) {
-                indicesCount += indicesCount - 3;
+                for (uint32_t layer = 0; layer < layers; layer++) {
+                    bsp_material& material = materials[group.second[first + layer]];
+                    memcpy(arrayData.data() + arrayMipOffsets[mip] + layer * mipSize, bsp_material_data(&material) + material.texture.mipOffsets[mip], mipSize);
+                }
+            }
+
+            for (uint32_t layer = 0; layer < layers; layer++) {
+                outSlots[group.second[first + layer]] = { (uint32_t)renderingData->materialImages.size(), layer };
             }
+
+            bsp_material_image materialImage = {};
+            vulkan_createImageArray(renderer, width, height, layers, mipCount, format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialImage.image, materialImage.allocation);
+            materialImage.view = vulkan_createImageView(renderer, materialImage.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, format, layers, mipCount);
+
+            mipOffsets.push_back(std::move(arrayMipOffsets));
+            layerData.push_back(std::move(arrayData));
+
+            vulkan_image_upload upload = { materialImage.image, width, height, layers, mipCount, mipOffsets.back().data(), layerData.back().data(), layerData.back().size() };
+            uploads.push_back(upload);
+            uploadSize += upload.size;
+
+            renderingData->materialImages.push_back(materialImage);
         }
     }
 
-    short* indexBuffer = (short*) malloc(sizeof(short) * indicesCount);
-    int currentIndex = 0;
+    vulkan_uploadImages(renderer, uploads.data(), uploads.size());
 
-    for (auto& clusterPair : bsp->clusters) {
-        cluster* c = clusterPair.second;
+    return uploadSize;
+}
 
-        bsp_cluster_rendering_data clusterRenderingData;
-        
-        for (face* f : c->faces) {
-            bsp_face_rendering_data face = {};
+static void create_material_descriptors(vulkan_renderer* renderer, bsp_rendering_data* renderingData) {
+    VkDevice device = renderer->init_objects.device;
+    uint32_t imageCount = (uint32_t)renderingData->materialImages.size();
 
-            short fanVertex = bsp->edges[abs(bsp->surfedges[f->firstSurfedgeIndex])].v[0];
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    VkDescriptorPoolSize poolSizes[2] = {};
+    uint32_t bindingCount;
+    uint32_t setCount;
 
-            for (int j = 1; j < f->edgeCount - 1; j++) {
-                int surfedge = bsp->surfedges[f->firstSurfedgeIndex + j];
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.pPoolSizes = poolSizes;
 
-                int abssurfedge = abs(surfedge);
-                edge e = bsp->edges[abssurfedge];
-                
-                face.indexBufferOffset = currentIndex;
-                indexBuffer[currentIndex++] = fanVertex;
+    // Only the last binding of a bindless set may have a variable count
+    VkDescriptorBindingFlagsEXT bindingFlags[2] = { 0, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT };
 
-                if (surfedge == abssurfedge) {
-                    indexBuffer[currentIndex++] = e.v[0];
-                    indexBuffer[currentIndex++] = e.v[1];
-                }
-                else {
-                    indexBuffer[currentIndex++] = e.v[1];
-                    indexBuffer[currentIndex++] = e.v[0];
-                }
-            }
+    if (renderingData->bindless) {
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[0].pImmutableSamplers = &renderingData->sampler;
+
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[1].descriptorCount = imageCount;
+        bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        bindingCount = 2;
+
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+        poolSizes[0].descriptorCount = 1;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        poolSizes[1].descriptorCount = imageCount;
+        poolInfo.poolSizeCount = 2;
+
+        setCount = 1;
+    } else {
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = 1;
+        bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[0].pImmutableSamplers = &renderingData->sampler;
+
+        bindingCount = 1;
+
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[0].descriptorCount = imageCount;
+        poolInfo.poolSizeCount = 1;
+
+        setCount = imageCount;
+    }
+
+    // The variable count set stays in a pool of its own, the allocator's pools aren't sized for it
+    renderingData->descriptorSetLayout = vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, bindings, bindingCount, renderingData->bindless ? bindingFlags : nullptr);
+    if (renderingData->descriptorSetLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+
+    poolInfo.maxSets = setCount;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &renderingData->descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    std::vector<VkDescriptorSetLayout> setLayouts(setCount, renderingData->descriptorSetLayout);
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = renderingData->descriptorPool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts = setLayouts.data();
+
+    VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variableCountInfo = {};
+    variableCountInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+    variableCountInfo.descriptorSetCount = 1;
+    variableCountInfo.pDescriptorCounts = &imageCount;
+
+    if (renderingData->bindless) {
+        allocInfo.pNext = &variableCountInfo;
+    }
+
+    renderingData->descriptorSets.resize(setCount);
+    if (vkAllocateDescriptorSets(device, &allocInfo, renderingData->descriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+
+    std::vector<VkDescriptorImageInfo> imageInfos(imageCount);
+    for (uint32_t i = 0; i < imageCount; i++) {
+        imageInfos[i].imageView = renderingData->materialImages[i].view;
+        imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    std::vector<VkWriteDescriptorSet> writes;
+
+    if (renderingData->bindless) {
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = renderingData->descriptorSets[0];
+        write.dstBinding = 1;
+        write.dstArrayElement = 0;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        write.descriptorCount = imageCount;
+        write.pImageInfo = imageInfos.data();
+        writes.push_back(write);
+    } else {
+        for (uint32_t i = 0; i < imageCount; i++) {
+            VkWriteDescriptorSet write = {};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = renderingData->descriptorSets[i];
+            write.dstBinding = 0;
+            write.dstArrayElement = 0;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            write.descriptorCount = 1;
+            write.pImageInfo = &imageInfos[i];
+            writes.push_back(write);
+        }
+    }
+
+    vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+}
+
+// Sort key layout from the most significant bit: descriptor set, material, lightmap page and cluster
+#define SORT_KEY_CLUSTER_BITS 16
+#define SORT_KEY_LIGHTMAP_PAGE_BITS 12
+#define SORT_KEY_MATERIAL_BITS 20
+#define SORT_KEY_DESCRIPTOR_SET_BITS 16
+
+static uint64_t sort_key_field(uint64_t value, int bits) {
+    return value & ((1ull << bits) - 1);
+}
+
+// Faces without lightmap or cluster sort after the others of their material
+static uint64_t bsp_face_sort_key(uint32_t descriptorSetIndex, uint32_t material, int lightmapPage, int cluster) {
+    uint64_t key = sort_key_field(descriptorSetIndex, SORT_KEY_DESCRIPTOR_SET_BITS);
+    key = (key << SORT_KEY_MATERIAL_BITS) | sort_key_field(material, SORT_KEY_MATERIAL_BITS);
+    key = (key << SORT_KEY_LIGHTMAP_PAGE_BITS) | sort_key_field((uint32_t)lightmapPage, SORT_KEY_LIGHTMAP_PAGE_BITS);
+    key = (key << SORT_KEY_CLUSTER_BITS) | sort_key_field((uint32_t)cluster, SORT_KEY_CLUSTER_BITS);
+    return key;
+}
+
+// HDR lighting keeps 4 bytes per luxel with the shared exponent format where it can be filtered
+static bsp_lightmap_format choose_lightmap_format(bsp_parsed* bsp, vulkan_renderer* renderer) {
+    if (bsp->lightingHDRSize == 0) {
+        return LIGHTMAP_FORMAT_LDR;
+    }
+
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(renderer->init_objects.physicalDevice, bsp_lightmap_vk_format(LIGHTMAP_FORMAT_E5B9G9R9), &properties);
+
+    if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) {
+        return LIGHTMAP_FORMAT_E5B9G9R9;
+    }
+    return LIGHTMAP_FORMAT_FP16;
+}
+
+static void create_lightmap_resources(vulkan_renderer* renderer, const bsp_lightmap_atlas* atlas, bsp_rendering_data* renderingData) {
+    PROFILE_ZONE("create_lightmap_resources");
+    VkDevice device = renderer->init_objects.device;
+    bsp_material_image& lightmapImage = renderingData->lightmapImage;
+
+    VkFormat format = bsp_lightmap_vk_format(atlas->format);
+    VkDeviceSize mipOffset = 0;
+    vulkan_createImageArray(renderer, atlas->pageSize, atlas->pageSize, atlas->pageCount, 1, format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lightmapImage.image, lightmapImage.allocation);
+    vulkan_uploadImage(renderer, lightmapImage.image, atlas->pageSize, atlas->pageSize, atlas->pageCount, 1, &mipOffset, atlas->pixels.data(), atlas->pixels.size());
+    lightmapImage.view = vulkan_createImageView(renderer, lightmapImage.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, format, atlas->pageCount, 1);
+
+    // Lightmaps of neighbouring faces touch in the atlas, so there is no filtering across mips or the page border
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &renderingData->lightmapSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create lightmap sampler!");
+    }
+
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    binding.pImmutableSamplers = &renderingData->lightmapSampler;
+
+    renderingData->lightmapSetLayout = vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, &binding, 1);
+    if (renderingData->lightmapSetLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to create lightmap descriptor set layout!");
+    }
+
+    renderingData->lightmapDescriptorSet = vulkan_allocatePersistentDescriptorSet(renderer->descriptorAllocator, renderingData->lightmapSetLayout);
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageView = lightmapImage.view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = renderingData->lightmapDescriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+// Set 2 of the world pipelines. The frame ring's buffers never change, so each frame slot's set is written once.
+static void create_draw_descriptors(vulkan_renderer* renderer, bsp_rendering_data* renderingData) {
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    renderingData->drawSetLayout = vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, bindings, 2);
+    if (renderingData->drawSetLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to create bsp draw descriptor set layout!");
+    }
+
+    renderingData->drawDescriptorSets.resize(renderer->frames.size());
+    for (uint32_t i = 0; i < renderingData->drawDescriptorSets.size(); i++) {
+        VkDescriptorSet descriptorSet = vulkan_allocatePersistentDescriptorSet(renderer->descriptorAllocator, renderingData->drawSetLayout);
+        renderingData->drawDescriptorSets[i] = descriptorSet;
 
-            clusterRenderingData.faces.push_back(face);
+        VkDescriptorBufferInfo bufferInfos[2] = {};
+        bufferInfos[0].buffer = vulkan_frameRingBuffer(renderer->frameRing, i);
+        bufferInfos[0].offset = 0;
+        bufferInfos[0].range = sizeof(bsp_view_uniforms);
+        bufferInfos[1].buffer = renderingData->drawBuffer;
+        bufferInfos[1].offset = 0;
+        bufferInfos[1].range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet writes[2] = {};
+        for (uint32_t j = 0; j < 2; j++) {
+            writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[j].dstSet = descriptorSet;
+            writes[j].dstBinding = j;
+            writes[j].descriptorCount = 1;
+            writes[j].descriptorType = bindings[j].descriptorType;
+            writes[j].pBufferInfo = &bufferInfos[j];
         }
-        
-        renderingData.clusterRenderingData[clusterPair.first] = clusterRenderingData;
+
+        vkUpdateDescriptorSets(renderer->init_objects.device, 2, writes, 0, nullptr);
+    }
+}
+
+static glm::vec3 bsp_face_vertex(const bsp_parsed* bsp, const face* f, int index) {
+    int surfedge = bsp->surfedges[f->firstSurfedgeIndex + index];
+    edge e = bsp->edges[abs(surfedge)];
+    vertex v = bsp->vertices[surfedge >= 0 ? e.v[0] : e.v[1]];
+    return glm::vec3(v.x, v.y, v.z);
+}
+
+// Octahedral normal and tangent frame of a face. The tangent is the texture s axis made perpendicular to the normal.
+static void encode_face_frame(glm::vec3 normal, const glm::vec3& textureS, const glm::vec3& textureT, bsp_gpu_draw* draw, bsp_vertex_error* error) {
+    // Degenerate faces have no plane
+    if (glm::length(normal) < 0.5f) {
+        normal = glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    glm::vec3 tangent = textureS - normal * glm::dot(normal, textureS);
+    if (glm::length(tangent) < 1e-6f) {
+        tangent = fabsf(normal.x) < 0.9f ? glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)) : glm::cross(normal, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+    tangent = glm::normalize(tangent);
+
+    draw->normal = bsp_octahedral_encode(normal);
+    draw->tangent = bsp_octahedral_encode(tangent);
+    draw->tangentSign = glm::dot(glm::cross(normal, tangent), textureT) < 0.0f ? -1.0f : 1.0f;
+
+    // From the chord, acos of a float dot product can't resolve angles this small
+    float normalChord = std::min(glm::length(bsp_octahedral_decode(draw->normal) - normal), 2.0f);
+    float tangentChord = std::min(glm::length(bsp_octahedral_decode(draw->tangent) - tangent), 2.0f);
+    error->normal = std::max(error->normal, glm::degrees(2.0f * asinf(normalChord * 0.5f)));
+    error->tangent = std::max(error->tangent, glm::degrees(2.0f * asinf(tangentChord * 0.5f)));
+}
+
+// Bounding sphere around the vertex average and the plane of the face. Faces are wound clockwise seen from the front,
+// the same convention the pipeline culls back faces with.
+static bsp_gpu_face bsp_gpu_face_record(const bsp_float_vertex* faceVertices, int vertexCount, int cluster) {
+    bsp_gpu_face record = {};
+
+    glm::vec3 center(0.0f);
+    for (int i = 0; i < vertexCount; i++) {
+        center += faceVertices[i].position;
+    }
+    center /= (float)vertexCount;
+
+    float radius = 0.0f;
+    for (int i = 0; i < vertexCount; i++) {
+        radius = std::max(radius, glm::length(faceVertices[i].position - center));
+    }
+    record.boundingSphere = glm::vec4(center, radius);
+
+    glm::vec3 p0 = faceVertices[0].position;
+    glm::vec3 normal = glm::cross(faceVertices[2].position - p0, faceVertices[1].position - p0);
+    float length = glm::length(normal);
+    // Degenerate faces get a plane every camera is in front of
+    record.plane = length > 1e-6f ? glm::vec4(normal / length, glm::dot(normal / length, p0)) : glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+
+    record.cluster = cluster;
+    return record;
+}
+
+// Allocated from the frame's descriptor pools, so the pyramid view is always the current one even after the
+// swapchain was recreated
+static VkDescriptorSet write_cull_descriptors(bsp_rendering_data* renderingData, vulkan_renderer* renderer, const bsp_cull_frame& frame) {
+    VkDescriptorSet descriptorSet = vulkan_allocateFrameDescriptorSet(renderer->descriptorAllocator, renderingData->cullSetLayout);
+
+    VkDescriptorBufferInfo bufferInfos[5] = {};
+    bufferInfos[0].buffer = renderingData->gpuFaceBuffer;
+    bufferInfos[1].buffer = renderingData->visibilityBuffer;
+    bufferInfos[2].buffer = frame.commandBuffer;
+    bufferInfos[3].buffer = frame.countBuffer;
+    bufferInfos[4].buffer = vulkan_frameRingBuffer(renderer->frameRing, renderer->currentFrame);
+
+    VkWriteDescriptorSet writes[6] = {};
+    for (uint32_t i = 0; i < 5; i++) {
+        bufferInfos[i].offset = 0;
+        bufferInfos[i].range = i == 4 ? sizeof(bsp_cull_parameters) : VK_WHOLE_SIZE;
+
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = i == 4 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+
+    // Only sampled while the pyramid is valid
+    VkDescriptorImageInfo pyramidInfo = {};
+    pyramidInfo.sampler = renderer->depthPyramid->sampler;
+    pyramidInfo.imageView = renderer->depthPyramid->view;
+    pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    writes[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[5].dstSet = descriptorSet;
+    writes[5].dstBinding = 5;
+    writes[5].descriptorCount = 1;
+    writes[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[5].pImageInfo = &pyramidInfo;
+
+    vkUpdateDescriptorSets(renderer->init_objects.device, 6, writes, 0, nullptr);
+    return descriptorSet;
+}
+
+// Faces, visibility, commands and counts, then the parameters and the depth pyramid. The parameters are written to the
+// frame ring, which reflection can't know, so their binding is switched to a dynamic one. VK_NULL_HANDLE if the
+// bindings don't match.
+static VkDescriptorSetLayout cull_set_layout(vulkan_renderer* renderer, vulkan_shader_reflection& reflection) {
+    if (reflection.sets.size() != 1 || reflection.sets[0].size() != 6 || reflection.sets[0][4].descriptorType != VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+        return VK_NULL_HANDLE;
+    }
+
+    reflection.sets[0][4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    return vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, reflection.sets[0].data(), 6);
+}
+
+// Takes ownership of the shader module, VK_NULL_HANDLE if the pipeline can't be created
+static VkPipeline create_cull_pipeline(vulkan_renderer* renderer, bsp_rendering_data* renderingData, VkShaderModule cullShader) {
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = cullShader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = renderingData->cullPipelineLayout;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline pipeline;
+    if (vulkan_createComputePipeline(renderer->init_objects.device, renderer->pipelineCache, &pipelineInfo, "bsp cull", &pipeline) != VK_SUCCESS) {
+        pipeline = VK_NULL_HANDLE;
+    }
+
+    vkDestroyShaderModule(renderer->init_objects.device, cullShader, nullptr);
+    return pipeline;
+}
+
+static void create_cull_resources(vulkan_renderer* renderer, bsp_rendering_data* renderingData, const std::vector<bsp_gpu_face>& gpuFaces) {
+    PROFILE_ZONE("create_cull_resources");
+    VkDevice device = renderer->init_objects.device;
+    bsp_parsed* bsp = renderingData->bsp;
+
+    VkDeviceSize faceBufferSize = std::max<size_t>(gpuFaces.size(), 1) * sizeof(bsp_gpu_face);
+    vulkan_createBuffer(renderer, faceBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderingData->gpuFaceBuffer, renderingData->gpuFaceAllocation);
+    vulkan_queueBufferUpload(renderer->uploader, renderingData->gpuFaceBuffer, 0, gpuFaces.data(), gpuFaces.size() * sizeof(bsp_gpu_face));
+
+    // The shader reads whole words, so the last row is padded
+    VkDeviceSize visibilitySize = (VkDeviceSize)bsp->clusterCount * bsp->visibilityRowSize;
+    VkDeviceSize visibilityBufferSize = std::max<VkDeviceSize>((visibilitySize + 3) & ~(VkDeviceSize)3, 4);
+    vulkan_createBuffer(renderer, visibilityBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderingData->visibilityBuffer, renderingData->visibilityAllocation);
+    vulkan_queueBufferUpload(renderer->uploader, renderingData->visibilityBuffer, 0, bsp->visibility, visibilitySize);
+
+    vulkan_shader_reflection reflection;
+    VkShaderModule cullShader = vulkan_createShaderModule(renderer, "bsp_cull_comp.spv", &reflection);
+    renderingData->cullSetLayout = cull_set_layout(renderer, reflection);
+    if (renderingData->cullSetLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to create bsp cull descriptor set layout!");
     }
 
-    vulkan_createBuffer(renderer, indicesCount * sizeof(short), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, renderingData.indexBuffer, renderingData.indexBufferMemory);
+    uint32_t frameCount = renderer->frames.size();
 
-    vkMapMemory(renderer->init_objects.device, renderingData.indexBufferMemory, 0, indicesCount * sizeof(short), 0, &bufferAddress);
-    memcpy(bufferAddress, indexBuffer, indicesCount * sizeof(short));
-    vkUnmapMemory(renderer->init_objects.device, renderingData.indexBufferMemory);
-    */
+    // Frames in flight each get their own commands and counts, the previous frame may still draw from its own
+    VkDeviceSize commandBufferSize = std::max<size_t>(gpuFaces.size(), 1) * sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize countBufferSize = (renderingData->batches.size() + BSP_CULL_STAT_COUNT) * sizeof(uint32_t);
+    renderingData->cullFrames.resize(frameCount);
 
-    // Create Pipeline for Rendering Operations
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vulkan_createShaderModule(renderer, "bsp_vert.spv");
-    vertShaderStageInfo.pName = "main";
+    for (bsp_cull_frame& frame : renderingData->cullFrames) {
+        vulkan_createBuffer(renderer, commandBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.commandBuffer, frame.commandAllocation);
+        vulkan_createBuffer(renderer, countBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.countBuffer, frame.countAllocation);
+        frame.submitted = false;
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &renderingData->cullSetLayout;
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = vulkan_createShaderModule(renderer, "bsp_frag.spv");
-    fragShaderStageInfo.pName = "main";
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &renderingData->cullPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    renderingData->cullPipeline = create_cull_pipeline(renderer, renderingData, cullShader);
+    if (renderingData->cullPipeline == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to create bsp cull pipeline!");
+    }
+}
+
+void bsp_rendering_reload_shaders(bsp_rendering_data* renderingData, vulkan_renderer* renderer, const std::vector<std::string>& shaders) {
+    if (!renderingData->gpuDrivenSupported || std::find(shaders.begin(), shaders.end(), "bsp_cull_comp.spv") == shaders.end()) {
+        return;
+    }
+
+    // The set layout is shared with the frame's descriptor sets, only the code may change
+    vulkan_shader_reflection reflection;
+    VkShaderModule cullShader;
+    try {
+        cullShader = vulkan_createShaderModule(renderer, "bsp_cull_comp.spv", &reflection);
+    } catch (const std::runtime_error& error) {
+        std::cout << "Could not reload bsp_cull_comp.spv: " << error.what() << std::endl;
+        return;
+    }
+
+    if (cull_set_layout(renderer, reflection) != renderingData->cullSetLayout) {
+        std::cout << "Bindings of bsp_cull_comp.spv changed, restart to apply" << std::endl;
+        vkDestroyShaderModule(renderer->init_objects.device, cullShader, nullptr);
+        return;
+    }
+
+    // The old pipeline keeps culling if the new one can't be created
+    VkPipeline cullPipeline = create_cull_pipeline(renderer, renderingData, cullShader);
+    if (cullPipeline == VK_NULL_HANDLE) {
+        std::cout << "Could not create bsp cull pipeline, keeping the old one" << std::endl;
+        return;
+    }
+
+    vkDeviceWaitIdle(renderer->init_objects.device);
+    vkDestroyPipeline(renderer->init_objects.device, renderingData->cullPipeline, nullptr);
+    renderingData->cullPipeline = cullPipeline;
+}
+
+bsp_rendering_data bsp_rendering_prepare(bsp_parsed* bsp, vpk_directory* vpk, job_system* jobs, cooked_store* cooked, vulkan_pipeline_library* pipelines, vulkan_renderer* renderer) {
+    PROFILE_ZONE("bsp_rendering_prepare");
+    bsp_rendering_data renderingData = {};
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(renderer->init_objects.physicalDevice, &deviceProperties);
+
+    bsp_material_set* materialSet = load_bsp_materials(bsp, vpk, jobs, cooked, renderer->init_objects.enabledFeatures.textureCompressionBC);
+    std::vector<bsp_material>& materials = materialSet->materials;
+    if (materials.empty()) {
+        bsp_material missing = {};
+        bsp_material_missing_texture(&missing.texture);
+        materials.push_back(missing);
+    }
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+    // Fall back to texture arrays if the device can't index that many images from one stage
+    renderingData.bindless = renderer->init_objects.descriptorIndexing
+        && materials.size() <= deviceProperties.limits.maxPerStageDescriptorSampledImages;
+
+    std::cout << "Rendering materials " << (renderingData.bindless ? "bindless" : "with texture arrays") << std::endl;
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = renderer->init_objects.enabledFeatures.samplerAnisotropy;
+    samplerInfo.maxAnisotropy = std::min(16.0f, deviceProperties.limits.maxSamplerAnisotropy);
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    if (vkCreateSampler(renderer->init_objects.device, &samplerInfo, nullptr, &renderingData.sampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create bsp sampler!");
+    }
+
+    auto uploadStart = std::chrono::high_resolution_clock::now();
+
+    std::vector<bsp_material_slot> materialSlots;
+    VkDeviceSize uploadSize;
+    if (renderingData.bindless) {
+        uploadSize = upload_materials_bindless(materials, renderer, &renderingData, materialSlots);
+    } else {
+        uploadSize = upload_materials_arrays(materials, renderer, deviceProperties.limits.maxImageArrayLayers, &renderingData, materialSlots);
+    }
+
+    // The copies keep running on the transfer queue while the lightmaps are built, only staging is timed
+    vulkan_flushUploads(renderer->uploader);
+
+    auto uploadEnd = std::chrono::high_resolution_clock::now();
+    double uploadSeconds = std::chrono::duration<double>(uploadEnd - uploadStart).count();
+
+    std::cout << "Staged " << uploadSize / (1024.0 * 1024.0) << " MB of material textures in " << uploadSeconds * 1000.0 << " ms ("
+              << uploadSize / (1024.0 * 1024.0) / uploadSeconds << " MB/s, " << renderer->uploader->ringStalls << " waits for ring space)" << std::endl;
+
+    unload_bsp_materials(materialSet);
+
+    create_material_descriptors(renderer, &renderingData);
+
+    bsp_lightmap_atlas lightmapAtlas = build_bsp_lightmap_atlas(bsp, jobs, choose_lightmap_format(bsp, renderer));
+    create_lightmap_resources(renderer, &lightmapAtlas, &renderingData);
+
+    // Faces are drawn in sort key order, which groups them by descriptor set so every set is bound once
+    std::vector<uint64_t> sortKeys;
+    std::vector<uint32_t> drawnFaces;
+    for (int i = 0; i < bsp->faceCount; i++) {
+        face* f = bsp->faces + i;
+
+        if (f->displacement || f->surfaceInfoIndex < 0 || f->edgeCount < 3) {
+            continue;
+        }
+
+        surfaceInfo* info = bsp->surfaceInfos + f->surfaceInfoIndex;
+        if ((info->flags & BSP_HIDDEN_SURFACES) || info->textureIndex < 0 || info->textureIndex >= bsp->textureCount) {
+            continue;
+        }
+
+        const bsp_material_slot& slot = materialSlots[info->textureIndex];
+        sortKeys.push_back(bsp_face_sort_key(slot.descriptorSetIndex, slot.material, lightmapAtlas.faces[i].page, f->cluster));
+        drawnFaces.push_back(i);
+    }
+
+    radix_sort(sortKeys, drawnFaces);
+
+    // Draw indices are 16 bit in the vertices, which covers every face a bsp can have
+    if (drawnFaces.size() > 65536) {
+        throw std::runtime_error("too many faces for 16 bit draw indices!");
+    }
+
+    // One position step for the whole map, the largest face decides it
+    float maxFaceExtent = 0.0f;
+    for (uint32_t faceIndex : drawnFaces) {
+        face* f = bsp->faces + faceIndex;
+        glm::vec3 positionMin = bsp_face_vertex(bsp, f, 0);
+        glm::vec3 positionMax = positionMin;
+        for (int j = 1; j < f->edgeCount; j++) {
+            glm::vec3 position = bsp_face_vertex(bsp, f, j);
+            positionMin = glm::min(positionMin, position);
+            positionMax = glm::max(positionMax, position);
+        }
+        glm::vec3 extent = positionMax - positionMin;
+        maxFaceExtent = std::max(maxFaceExtent, std::max(extent.x, std::max(extent.y, extent.z)));
+    }
+    renderingData.positionStep = bsp_position_step(maxFaceExtent);
+    renderingData.vertexError = {};
+    renderingData.floatUVs = false;
+    float floatUVError = 0.0f;
+
+    // Faces get their own vertices since the draw index is stored per vertex. UVs relative to the face's offset are
+    // kept for the float UV fallback.
+    std::vector<bsp_vertex> vertices;
+    std::vector<glm::vec2> relativeUVs;
+    std::vector<uint32_t> indices;
+    std::vector<bsp_gpu_draw> draws;
+    std::vector<bsp_gpu_face> gpuFaces;
+    std::vector<bsp_float_vertex> faceVertices;
+    renderingData.faces.resize(bsp->faceCount);
+
+    for (size_t i = 0; i < drawnFaces.size(); i++) {
+        int faceIndex = drawnFaces[i];
+        face* f = bsp->faces + faceIndex;
+        const surfaceInfo* info = bsp->surfaceInfos + f->surfaceInfoIndex;
+        const bsp_material_slot& slot = materialSlots[info->textureIndex];
+
+        // Texture vectors are in texels of the source texture
+        const textureInfo& texture = bsp->textures[info->textureIndex];
+        glm::vec2 textureSize(std::max(texture.width, 1), std::max(texture.height, 1));
+
+        const bsp_lightmap_rect& lightmapRect = lightmapAtlas.faces[faceIndex].page >= 0 ? lightmapAtlas.faces[faceIndex] : lightmapAtlas.fullbright;
+
+        // Float vertices first, the face's origin and UV offset come from their minimum
+        faceVertices.resize(f->edgeCount);
+        glm::vec3 positionMin(FLT_MAX);
+        glm::vec2 uvMin(FLT_MAX);
+        glm::vec2 uvMax(-FLT_MAX);
+        for (int j = 0; j < f->edgeCount; j++) {
+            bsp_float_vertex& faceVertex = faceVertices[j];
+            faceVertex.position = bsp_face_vertex(bsp, f, j);
+            faceVertex.uv = glm::vec2(glm::dot(glm::vec4(faceVertex.position, 1.0f), info->textureVecs[0]),
+                                      glm::dot(glm::vec4(faceVertex.position, 1.0f), info->textureVecs[1])) / textureSize;
+            faceVertex.lightmapUV = bsp_lightmap_uv(bsp, &lightmapAtlas, faceIndex, faceVertex.position);
+            faceVertex.face = (uint32_t)i;
+
+            positionMin = glm::min(positionMin, faceVertex.position);
+            uvMin = glm::min(uvMin, faceVertex.uv);
+            uvMax = glm::max(uvMax, faceVertex.uv);
+        }
+
+        gpuFaces.push_back(bsp_gpu_face_record(faceVertices.data(), f->edgeCount, f->cluster));
+        bsp_gpu_face& gpuFace = gpuFaces.back();
+
+        bsp_gpu_draw draw = {};
+        draw.origin = bsp_position_origin(positionMin, renderingData.positionStep);
+        draw.uvOffset = glm::floor(uvMin);
+        glm::vec2 uvScale = bsp_uv_scale(uvMax - draw.uvOffset);
+        draw.uvScale = bsp_pack_uv_scale(uvScale);
+        draw.material = slot.material;
+        draw.lightmap = (uint32_t)lightmapRect.page | ((uint32_t)lightmapRect.styleCount << 16);
+        draw.lightmapStyleStride = lightmapAtlas.faces[faceIndex].page >= 0 ? (float)lightmapRect.width / lightmapAtlas.pageSize : 0.0f;
+        encode_face_frame(glm::vec3(gpuFace.plane), glm::vec3(info->textureVecs[0]), glm::vec3(info->textureVecs[1]), &draw, &renderingData.vertexError);
+        draws.push_back(draw);
+
+        // Half a unorm step of the face's scale, large tiled faces can't keep 16 bit UVs
+        glm::vec2 uvErrorBound = uvScale / 131070.0f * textureSize;
+        renderingData.floatUVs = renderingData.floatUVs || std::max(uvErrorBound.x, uvErrorBound.y) > BSP_MAX_UV_ERROR;
+
+        uint32_t firstVertex = vertices.size();
+        for (int j = 0; j < f->edgeCount; j++) {
+            const bsp_float_vertex& faceVertex = faceVertices[j];
+            vertices.push_back(bsp_encode_vertex(faceVertex.position, faceVertex.uv, faceVertex.lightmapUV, (uint16_t)i, draw.origin, draw.uvOffset, uvScale, renderingData.positionStep));
+            relativeUVs.push_back(faceVertex.uv - draw.uvOffset);
+
+            glm::vec3 position;
+            glm::vec2 uv;
+            glm::vec2 lightmapUV;
+            bsp_decode_vertex(vertices.back(), draw.origin, draw.uvOffset, uvScale, renderingData.positionStep, &position, &uv, &lightmapUV);
+
+            bsp_vertex_error& error = renderingData.vertexError;
+            glm::vec2 uvError = glm::abs(uv - faceVertex.uv) * textureSize;
+            glm::vec2 lightmapUVError = glm::abs(lightmapUV - faceVertex.lightmapUV) * (float)lightmapAtlas.pageSize;
+            error.position = std::max(error.position, glm::length(position - faceVertex.position));
+            error.uv = std::max(error.uv, std::max(uvError.x, uvError.y));
+            glm::vec2 floatError = glm::abs(relativeUVs.back() + draw.uvOffset - faceVertex.uv) * textureSize;
+            floatUVError = std::max(floatUVError, std::max(floatError.x, floatError.y));
+            error.lightmapUV = std::max(error.lightmapUV, std::max(lightmapUVError.x, lightmapUVError.y));
+        }
+
+        bsp_face_rendering_data& faceData = renderingData.faces[faceIndex];
+        faceData.indexBufferOffset = indices.size();
+
+        for (int j = 1; j < f->edgeCount - 1; j++) {
+            indices.push_back(firstVertex);
+            indices.push_back(firstVertex + j);
+            indices.push_back(firstVertex + j + 1);
+        }
+
+        faceData.indicesCount = indices.size() - faceData.indexBufferOffset;
+
+        if (renderingData.batches.empty() || renderingData.batches.back().descriptorSetIndex != slot.descriptorSetIndex) {
+            bsp_draw_batch batch = {};
+            batch.firstIndex = faceData.indexBufferOffset;
+            batch.descriptorSetIndex = slot.descriptorSetIndex;
+            batch.firstFace = i;
+            renderingData.batches.push_back(batch);
+        }
+
+        renderingData.batches.back().indexCount += faceData.indicesCount;
+        renderingData.batches.back().faceCount++;
+
+        gpuFace.firstIndex = faceData.indexBufferOffset;
+        gpuFace.indexCount = faceData.indicesCount;
+        gpuFace.batch = renderingData.batches.size() - 1;
+        gpuFace.batchFirstDraw = renderingData.batches.back().firstFace;
+        gpuFace.drawIndex = i;
+    }
+
+    std::cout << "Sorted " << drawnFaces.size() << " faces into " << renderingData.batches.size() << " batches" << std::endl;
+
+    // Positions and lightmap UVs stay quantised, only the UVs go back to floats
+    std::vector<bsp_float_uv_vertex> floatUVVertices;
+    if (renderingData.floatUVs) {
+        std::cout << "A face exceeds " << BSP_MAX_UV_ERROR << " texels with 16 bit UVs (" << renderingData.vertexError.uv << "), using float UVs" << std::endl;
+        renderingData.vertexError.uv = floatUVError;
+
+        floatUVVertices.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            bsp_float_uv_vertex& vertex = floatUVVertices[i];
+            memcpy(vertex.position, vertices[i].position, sizeof(vertex.position));
+            vertex.uv[0] = relativeUVs[i].x;
+            vertex.uv[1] = relativeUVs[i].y;
+            memcpy(vertex.lightmapUV, vertices[i].lightmapUV, sizeof(vertex.lightmapUV));
+        }
+
+        for (bsp_gpu_draw& draw : draws) {
+            draw.uvScale = bsp_pack_uv_scale(glm::vec2(1.0f));
+        }
+    }
+
+    renderingData.vertexCount = vertices.size();
+    renderingData.vertexStride = renderingData.floatUVs ? sizeof(bsp_float_uv_vertex) : sizeof(bsp_vertex);
+    const void* vertexData = renderingData.floatUVs ? (const void*)floatUVVertices.data() : (const void*)vertices.data();
+    VkDeviceSize vertexDataSize = (VkDeviceSize)vertices.size() * renderingData.vertexStride;
+
+    const bsp_vertex_error& vertexError = renderingData.vertexError;
+    std::cout << "Quantised " << vertices.size() << " vertices to " << renderingData.vertexStride << " bytes (" << vertexDataSize / (1024.0 * 1024.0) << " MB, "
+              << vertices.size() * sizeof(bsp_float_vertex) / (1024.0 * 1024.0) << " MB as floats) with a position step of " << renderingData.positionStep << std::endl;
+    std::cout << "Largest quantisation error: " << vertexError.position << " units, " << vertexError.uv << " texels, " << vertexError.lightmapUV << " luxels, "
+              << vertexError.normal << " degrees normals, " << vertexError.tangent << " degrees tangents" << std::endl;
+
+    // Create Vertex Buffer
+    VkDeviceSize vertexBufferSize = std::max<VkDeviceSize>(vertexDataSize, renderingData.vertexStride);
+    vulkan_createBuffer(renderer, vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderingData.vertexBuffer, renderingData.vertexBufferAllocation);
+    vulkan_queueBufferUpload(renderer->uploader, renderingData.vertexBuffer, 0, vertexData, vertexDataSize);
+
+    // Create Index Buffer
+    VkDeviceSize indexBufferSize = std::max<size_t>(indices.size(), 1) * sizeof(uint32_t);
+    vulkan_createBuffer(renderer, indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderingData.indexBuffer, renderingData.indexBufferAllocation);
+    vulkan_queueBufferUpload(renderer->uploader, renderingData.indexBuffer, 0, indices.data(), indices.size() * sizeof(uint32_t));
+
+    VkDeviceSize drawBufferSize = std::max<size_t>(draws.size(), 1) * sizeof(bsp_gpu_draw);
+    vulkan_createBuffer(renderer, drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderingData.drawBuffer, renderingData.drawAllocation);
+    vulkan_queueBufferUpload(renderer->uploader, renderingData.drawBuffer, 0, draws.data(), draws.size() * sizeof(bsp_gpu_draw));
+    create_draw_descriptors(renderer, &renderingData);
+
+    renderingData.bsp = bsp;
+    renderingData.gpuFaceCount = gpuFaces.size();
+    renderingData.cullFlags = BSP_CULL_FRUSTUM | BSP_CULL_PVS | BSP_CULL_BACKFACE | BSP_CULL_OCCLUSION;
+    renderingData.gpuVisibleFaces = 0;
+    renderingData.drawCalls = 0;
+    renderingData.previousFrameRendered = false;
+    // Without the count draw every face keeps its command, which needs multi draw to draw a batch at once
+    renderingData.gpuDrivenSupported = renderer->init_objects.cmdDrawIndexedIndirectCount != nullptr || renderer->init_objects.enabledFeatures.multiDrawIndirect;
+    renderingData.gpuDriven = renderingData.gpuDrivenSupported;
+    if (renderingData.gpuDrivenSupported) {
+        create_cull_resources(renderer, &renderingData, gpuFaces);
+    }
+
+    // Copies run on the transfer queue while the pipeline is created
+    vulkan_flushUploads(renderer->uploader);
+
+    renderingData.bspTrees.resize(bsp->bspTreeCount);
+    for (int i = 0; i < bsp->bspTreeCount; i++) {
+        renderingData.bspTrees[i] = bsp->bspTrees[i];
+    }
+
+    // Pipelines come from the library, the fill pipeline is compiled right away and is the fallback for all variants
+    renderingData.pipelines = pipelines;
 
     VkVertexInputBindingDescription bindingDescription = {};
     bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(vertex);
+    bindingDescription.stride = renderingData.vertexStride;
     bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
+    // The draw index rides along in w, so the depth prepass gets it with the position
     VkVertexInputAttributeDescription positionAttribute = {};
     positionAttribute.binding = 0;
     positionAttribute.location = 0;
-    positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-    positionAttribute.offset = 0;
+    positionAttribute.format = VK_FORMAT_R16G16B16A16_UINT;
+    positionAttribute.offset = renderingData.floatUVs ? offsetof(bsp_float_uv_vertex, position) : offsetof(bsp_vertex, position);
+
+    VkVertexInputAttributeDescription uvAttribute = {};
+    uvAttribute.binding = 0;
+    uvAttribute.location = 1;
+    uvAttribute.format = renderingData.floatUVs ? VK_FORMAT_R32G32_SFLOAT : VK_FORMAT_R16G16_UNORM;
+    uvAttribute.offset = renderingData.floatUVs ? offsetof(bsp_float_uv_vertex, uv) : offsetof(bsp_vertex, uv);
+
+    VkVertexInputAttributeDescription lightmapUVAttribute = {};
+    lightmapUVAttribute.binding = 0;
+    lightmapUVAttribute.location = 2;
+    lightmapUVAttribute.format = VK_FORMAT_R16G16_UNORM;
+    lightmapUVAttribute.offset = renderingData.floatUVs ? offsetof(bsp_float_uv_vertex, lightmapUV) : offsetof(bsp_vertex, lightmapUV);
 
     VkVertexInputAttributeDescription inputAttributes[] = {
-        positionAttribute
+        positionAttribute,
+        uvAttribute,
+        lightmapUVAttribute
     };
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = 1;
-    vertexInputInfo.pVertexAttributeDescriptions = inputAttributes;
+    // The view projection comes from the frame ring, push constants are left for data that changes per draw
+    VkDescriptorSetLayout setLayouts[] = { renderingData.descriptorSetLayout, renderingData.lightmapSetLayout, renderingData.drawSetLayout };
 
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 3;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+
+    if (vkCreatePipelineLayout(renderer->init_objects.device, &pipelineLayoutInfo, nullptr, &renderingData.pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    vulkan_pipeline_key key = vulkan_defaultPipelineKey();
+    key.layout = renderingData.pipelineLayout;
+    key.renderPass = renderer->render_pass;
+    key.vertexShader = vulkan_pipelineShader(pipelines, "bsp_vert.spv");
+    key.fragmentShader = vulkan_pipelineShader(pipelines, renderingData.bindless ? "bsp_frag.spv" : "bsp_array_frag.spv");
+    key.vertexLayout = vulkan_pipelineVertexLayout(pipelines, &bindingDescription, 1, inputAttributes, 3);
+    // Only LDR lightmaps need to be decoded in the shader
+    key.fragmentSpecialization = lightmapAtlas.format == LIGHTMAP_FORMAT_LDR;
+    key.cullMode = VK_CULL_MODE_BACK_BIT;
+    key.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    key.blendEnable = VK_TRUE;
+
+    renderingData.pipelineKey = key;
+    renderingData.pipeline = vulkan_requestPipeline(pipelines, key, "bsp", true);
+    renderingData.wireframePipeline = PIPELINE_INVALID;
+    renderingData.wireframe = false;
+    renderingData.depthVertexLayout = vulkan_pipelineVertexLayout(pipelines, &bindingDescription, 1, &positionAttribute, 1);
+    renderingData.depthPipeline = PIPELINE_INVALID;
+    renderingData.depthPrepass = false;
+    renderingData.jobs = jobs;
+    renderingData.parallelRecording = true;
+    renderer_reserve_recording_threads(renderer, job_system_thread_count(jobs));
+
+    return renderingData;
+}
+
+// Every secondary starts without state, so each chunk binds everything itself
+static void bind_draw_state(bsp_rendering_data* renderingData, vulkan_renderer* renderer, VkCommandBuffer commandBuffer, VkPipeline pipeline, uint32_t viewOffset) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
     VkViewport viewport = {};
     viewport.x = 0.0f;
@@ -142,126 +1000,295 @@ bsp_rendering_data bsp_rendering_prepare(bsp_parsed* bsp, vulkan_renderer* rende
     viewport.height = (float)renderer->init_objects.swapchainExtent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
     VkRect2D scissor = {};
     scissor.offset = { 0, 0 };
     scissor.extent = renderer->init_objects.swapchainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    VkPipelineViewportStateCreateInfo viewportState = {};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
-
-    VkPipelineRasterizationStateCreateInfo rasterizer = {};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_LINE;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-
-    VkPipelineMultisampleStateCreateInfo multisampling = {};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    multisampling.minSampleShading = 1.0f;
-    multisampling.pSampleMask = nullptr;
-    multisampling.alphaToCoverageEnable = VK_FALSE;
-    multisampling.alphaToOneEnable = VK_FALSE;
-
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_TRUE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-    VkPipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-
-    VkPipelineDynamicStateCreateInfo dynamicState = {};
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = 0;
-    dynamicState.pDynamicStates = nullptr;
-
-    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 0;
-    layoutInfo.pBindings = nullptr;
-
-    if (vkCreateDescriptorSetLayout(renderer->init_objects.device, &layoutInfo, nullptr, &renderingData.descriptorSetLayout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor set layout!");
+    VkBuffer vertexBuffers[] = { renderingData->vertexBuffer };
+    VkDeviceSize offsets[] = { 0 };
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, renderingData->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    VkDescriptorSet descriptorSets[] = { renderingData->lightmapDescriptorSet, renderingData->drawDescriptorSets[renderer->currentFrame] };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderingData->pipelineLayout, 1, 2, descriptorSets, 1, &viewOffset);
+}
+
+// Only positions are read, so the material sets don't matter. Returns the number of draws recorded
+static uint32_t record_depth_batches(bsp_rendering_data* renderingData, vulkan_renderer* renderer, VkCommandBuffer commandBuffer, VkPipeline depthPipeline,
+                                 uint32_t viewOffset, size_t firstBatch, size_t lastBatch) {
+    bind_draw_state(renderingData, renderer, commandBuffer, depthPipeline, viewOffset);
+    uint32_t drawCount = 0;
+    for (size_t i = firstBatch; i < lastBatch; i++) {
+        vkCmdDrawIndexed(commandBuffer, renderingData->batches[i].indexCount, 1, renderingData->batches[i].firstIndex, 0, 0);
+        drawCount++;
     }
+    return drawCount;
+}
 
-    VkPushConstantRange pushConstantRange = {};
-    pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(glm::mat4);
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+// Returns the number of draws recorded
+static uint32_t record_batches(bsp_rendering_data* renderingData, vulkan_renderer* renderer, VkCommandBuffer commandBuffer, VkPipeline pipeline,
+                               uint32_t viewOffset, size_t firstBatch, size_t lastBatch) {
+    bind_draw_state(renderingData, renderer, commandBuffer, pipeline, viewOffset);
+    uint32_t drawCount = 0;
+    for (size_t i = firstBatch; i < lastBatch; i++) {
+        const bsp_draw_batch& batch = renderingData->batches[i];
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderingData->pipelineLayout, 0, 1, &renderingData->descriptorSets[batch.descriptorSetIndex], 0, nullptr);
+        vkCmdDrawIndexed(commandBuffer, batch.indexCount, 1, batch.firstIndex, 0, 0);
+        drawCount++;
+    }
+    return drawCount;
+}
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &renderingData.descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+// Planes of the clip space volume with the normals pointing inwards, a point p is inside if dot(xyz, p) + w >= 0 for all of them
+static void frustum_planes(const glm::mat4& viewProjection, glm::vec4* outPlanes) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
 
-    if (vkCreatePipelineLayout(renderer->init_objects.device, &pipelineLayoutInfo, nullptr, &renderingData.pipelineLayout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout!");
+    // The near plane uses -w <= z, which also holds for a [0, 1] depth range and only culls a little less there
+    outPlanes[0] = rows[3] + rows[0];
+    outPlanes[1] = rows[3] - rows[0];
+    outPlanes[2] = rows[3] + rows[1];
+    outPlanes[3] = rows[3] - rows[1];
+    outPlanes[4] = rows[3] + rows[2];
+    outPlanes[5] = rows[3] - rows[2];
+
+    for (int i = 0; i < 6; i++) {
+        outPlanes[i] /= glm::length(glm::vec3(outPlanes[i]));
     }
+}
 
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = &dynamicState;
-    pipelineInfo.layout = renderingData.pipelineLayout;
-    pipelineInfo.renderPass = renderer->render_pass;
-    pipelineInfo.basePipelineIndex = -1;
+// Runs ahead of the render pass in the frame's primary command buffer
+static void record_culling(bsp_rendering_data* renderingData, vulkan_renderer* renderer, bsp_cull_frame& frame, camera* c, const glm::mat4& viewProjection, bool compact) {
+    PROFILE_ZONE("record_culling");
+    VkCommandBuffer commandBuffer = renderer->frame_command_buffer;
+    size_t batchCount = renderingData->batches.size();
 
-    if (vkCreateGraphicsPipelines(renderer->init_objects.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &renderingData.pipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create bsp pipeline!");
+    // The slot's fence was waited for in renderer_begin_frame, so its counts from the last use are final
+    if (frame.submitted) {
+        const uint32_t* counts = (const uint32_t*)frame.countAllocation.mapped;
+        uint32_t visibleFaces = 0;
+        for (size_t i = 0; i < batchCount; i++) {
+            visibleFaces += counts[i];
+        }
+        renderingData->gpuVisibleFaces = visibleFaces;
+        memcpy(renderingData->gpuCulledFaces, counts + batchCount, sizeof(renderingData->gpuCulledFaces));
     }
 
-    vkDestroyShaderModule(renderer->init_objects.device, vertShaderStageInfo.module, nullptr);
-    vkDestroyShaderModule(renderer->init_objects.device, fragShaderStageInfo.module, nullptr);
+    uint32_t cullScope = vulkan_beginGpuScope(renderer->gpuProfiler, commandBuffer, "bsp culling");
+    vkCmdFillBuffer(commandBuffer, frame.countBuffer, 0, VK_WHOLE_SIZE, 0);
 
-    return renderingData;
+    VkMemoryBarrier clearBarrier = {};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+    vulkan_depth_pyramid* pyramid = renderer->depthPyramid;
+    VkDescriptorSet descriptorSet = write_cull_descriptors(renderingData, renderer, frame);
+
+    uint32_t parameterOffset;
+    bsp_cull_parameters* parameters = (bsp_cull_parameters*)vulkan_frameRingAllocate(renderer->frameRing, sizeof(bsp_cull_parameters), &parameterOffset);
+    parameters->previousViewProjection = renderingData->previousViewProjection;
+    frustum_planes(viewProjection, parameters->frustumPlanes);
+    parameters->cameraPosition = glm::vec4(c->position, 1.0f);
+    parameters->faceCount = renderingData->gpuFaceCount;
+    parameters->cameraCluster = bsp_find_cluster(renderingData->bsp, c->position);
+    parameters->visibilityRowSize = renderingData->bsp->visibilityRowSize;
+    parameters->flags = renderingData->cullFlags & (BSP_CULL_FRUSTUM | BSP_CULL_PVS | BSP_CULL_BACKFACE);
+    if (compact) {
+        parameters->flags |= BSP_CULL_COMPACT;
+    }
+    // The pyramid only matches the previous view projection if the last frame drew the world and built it
+    if ((renderingData->cullFlags & BSP_CULL_OCCLUSION) && pyramid->valid && renderingData->previousFrameRendered) {
+        parameters->flags |= BSP_CULL_OCCLUSION;
+    }
+    parameters->statsOffset = (uint32_t)batchCount;
+    parameters->pyramidWidth = pyramid->width;
+    parameters->pyramidHeight = pyramid->height;
+    parameters->pyramidLevels = pyramid->levels;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, renderingData->cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, renderingData->cullPipelineLayout, 0, 1, &descriptorSet, 1, &parameterOffset);
+    vkCmdDispatch(commandBuffer, (renderingData->gpuFaceCount + BSP_CULL_GROUP_SIZE - 1) / BSP_CULL_GROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier cullBarrier = {};
+    cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+    vulkan_endGpuScope(renderer->gpuProfiler, commandBuffer, cullScope);
+
+    frame.submitted = true;
+}
+
+static void draw_indirect_batch(bsp_rendering_data* renderingData, vulkan_renderer* renderer, VkCommandBuffer commandBuffer, const bsp_cull_frame& frame, size_t batchIndex) {
+    const bsp_draw_batch& batch = renderingData->batches[batchIndex];
+    VkDeviceSize commandOffset = (VkDeviceSize)batch.firstFace * sizeof(VkDrawIndexedIndirectCommand);
+
+    if (renderer->init_objects.cmdDrawIndexedIndirectCount != nullptr) {
+        renderer->init_objects.cmdDrawIndexedIndirectCount(commandBuffer, frame.commandBuffer, commandOffset, frame.countBuffer, batchIndex * sizeof(uint32_t), batch.faceCount, sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+        vkCmdDrawIndexedIndirect(commandBuffer, frame.commandBuffer, commandOffset, batch.faceCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+// CPU cost only depends on the number of batches, the face count lives on the GPU. Returns the number of indirect
+// draws recorded
+static uint32_t record_indirect_batches(bsp_rendering_data* renderingData, vulkan_renderer* renderer, const bsp_cull_frame& frame, VkPipeline pipeline, VkPipeline depthPipeline, uint32_t viewOffset) {
+    VkCommandBuffer commandBuffer = renderer->command_buffer;
+    uint32_t drawCount = 0;
+
+    if (depthPipeline != VK_NULL_HANDLE) {
+        bind_draw_state(renderingData, renderer, commandBuffer, depthPipeline, viewOffset);
+        for (size_t i = 0; i < renderingData->batches.size(); i++) {
+            draw_indirect_batch(renderingData, renderer, commandBuffer, frame, i);
+            drawCount++;
+        }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    } else {
+        bind_draw_state(renderingData, renderer, commandBuffer, pipeline, viewOffset);
+    }
+
+    for (size_t i = 0; i < renderingData->batches.size(); i++) {
+        const bsp_draw_batch& batch = renderingData->batches[i];
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderingData->pipelineLayout, 0, 1, &renderingData->descriptorSets[batch.descriptorSetIndex], 0, nullptr);
+        draw_indirect_batch(renderingData, renderer, commandBuffer, frame, i);
+        drawCount++;
+    }
+    return drawCount;
 }
 
 void bsp_render(bsp_rendering_data* renderingData, vulkan_renderer* renderer, camera* c) {
-    vkCmdBindPipeline(renderer->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderingData->pipeline);
+    PROFILE_ZONE("bsp_render");
+    // Compiled on a worker the first time it is needed, the fill pipeline is drawn until it is ready
+    if (renderingData->wireframe && renderingData->wireframePipeline == PIPELINE_INVALID) {
+        vulkan_pipeline_key key = renderingData->pipelineKey;
+        key.polygonMode = VK_POLYGON_MODE_LINE;
+        key.cullMode = VK_CULL_MODE_NONE;
+        renderingData->wireframePipeline = vulkan_requestPipeline(renderingData->pipelines, key, "bsp wireframe", false);
+    }
 
-    VkBuffer vertexBuffers[] = { renderingData->vertexBuffer };
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(renderer->command_buffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(renderer->command_buffer, renderingData->indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    if (renderingData->depthPrepass && renderingData->depthPipeline == PIPELINE_INVALID) {
+        vulkan_pipeline_key key = renderingData->pipelineKey;
+        key.vertexShader = vulkan_pipelineShader(renderingData->pipelines, "bsp_depth_vert.spv");
+        key.fragmentShader = PIPELINE_INVALID;
+        key.vertexLayout = renderingData->depthVertexLayout;
+        key.fragmentSpecialization = 0;
+        key.blendEnable = VK_FALSE;
+        key.colorWriteMask = 0;
+        renderingData->depthPipeline = vulkan_requestPipeline(renderingData->pipelines, key, "bsp depth", false);
+    }
 
+    uint32_t pipelineIndex = renderingData->wireframe ? renderingData->wireframePipeline : renderingData->pipeline;
+    VkPipeline pipeline = vulkan_getPipeline(renderingData->pipelines, pipelineIndex, renderingData->pipeline);
     glm::mat4 mvp = calculateViewProjection(*c);
-    vkCmdPushConstants(renderer->command_buffer, renderingData->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvp), &mvp);
 
-    //bsp_cluster_rendering_data* cluster = renderingData->clusterRenderingData.data();
-    for (auto& clusterPair : renderingData->clusterRenderingData) {
-        bsp_cluster_rendering_data* cluster = &clusterPair.second;
-        for (const bsp_face_rendering_data& face : cluster->faces) {
-            vkCmdDrawIndexed(renderer->command_buffer, face.indicesCount, 1, face.indexBufferOffset, 0, 0);
+    // Lines would fail the depth test against the filled prepass, and nothing replaces it while it compiles
+    VkPipeline depthPipeline = VK_NULL_HANDLE;
+    if (renderingData->depthPrepass && !renderingData->wireframe && vulkan_pipelineReady(renderingData->pipelines, renderingData->depthPipeline)) {
+        depthPipeline = vulkan_getPipeline(renderingData->pipelines, renderingData->depthPipeline, renderingData->pipeline);
+    }
+
+    // Written once, every chunk binds it at the same offset
+    uint32_t viewOffset;
+    bsp_view_uniforms* view = (bsp_view_uniforms*)vulkan_frameRingAllocate(renderer->frameRing, sizeof(bsp_view_uniforms), &viewOffset);
+    view->viewProjection = mvp;
+    view->positionStep = renderingData->positionStep;
+
+    if (renderingData->gpuDriven && renderingData->gpuDrivenSupported) {
+        bsp_cull_frame& frame = renderingData->cullFrames[renderer->currentFrame];
+        record_culling(renderingData, renderer, frame, c, mvp, renderer->init_objects.cmdDrawIndexedIndirectCount != nullptr);
+        renderingData->drawCalls = record_indirect_batches(renderingData, renderer, frame, pipeline, depthPipeline, viewOffset);
+
+        renderer->buildDepthPyramid = renderer->buildDepthPyramid || (renderingData->cullFlags & BSP_CULL_OCCLUSION) != 0;
+        renderingData->previousViewProjection = mvp;
+        renderingData->previousFrameRendered = true;
+        return;
+    }
+
+    renderingData->previousFrameRendered = false;
+
+    size_t batchCount = renderingData->batches.size();
+    size_t chunkCount = std::min<size_t>(job_system_thread_count(renderingData->jobs) * BSP_RECORD_CHUNKS_PER_THREAD, batchCount / BSP_MIN_BATCHES_PER_CHUNK);
+
+    if (!renderingData->parallelRecording || chunkCount < 2) {
+        renderingData->drawCalls = 0;
+        if (depthPipeline != VK_NULL_HANDLE) {
+            renderingData->drawCalls += record_depth_batches(renderingData, renderer, renderer->command_buffer, depthPipeline, viewOffset, 0, batchCount);
+        }
+        renderingData->drawCalls += record_batches(renderingData, renderer, renderer->command_buffer, pipeline, viewOffset, 0, batchCount);
+        return;
+    }
+
+    // Contiguous ranges keep the sorted batch order, the secondaries are executed in chunk order. With a prepass each
+    // chunk records its depth range into a second secondary and all of those go first, so the shaded pass of every
+    // chunk is tested against the depth of the whole world and not just of the chunks in front of it.
+    size_t passCount = depthPipeline != VK_NULL_HANDLE ? 2 : 1;
+    std::vector<VkCommandBuffer> commandBuffers(chunkCount * passCount);
+    std::vector<uint32_t> chunkDrawCounts(chunkCount, 0);
+    job_system_parallel_for(renderingData->jobs, chunkCount, [&](size_t chunk) {
+        uint32_t threadIndex = job_system_thread_index();
+        size_t firstBatch = batchCount * chunk / chunkCount;
+        size_t lastBatch = batchCount * (chunk + 1) / chunkCount;
+
+        if (depthPipeline != VK_NULL_HANDLE) {
+            VkCommandBuffer depthCommandBuffer = renderer_begin_secondary(renderer, threadIndex);
+            chunkDrawCounts[chunk] += record_depth_batches(renderingData, renderer, depthCommandBuffer, depthPipeline, viewOffset, firstBatch, lastBatch);
+            vkEndCommandBuffer(depthCommandBuffer);
+            commandBuffers[chunk] = depthCommandBuffer;
         }
+
+        VkCommandBuffer commandBuffer = renderer_begin_secondary(renderer, threadIndex);
+        chunkDrawCounts[chunk] += record_batches(renderingData, renderer, commandBuffer, pipeline, viewOffset, firstBatch, lastBatch);
+        vkEndCommandBuffer(commandBuffer);
+        commandBuffers[(passCount - 1) * chunkCount + chunk] = commandBuffer;
+    });
+
+    renderer_execute_secondaries(renderer, commandBuffers.data(), (uint32_t)commandBuffers.size());
+
+    renderingData->drawCalls = 0;
+    for (uint32_t drawCount : chunkDrawCounts) {
+        renderingData->drawCalls += drawCount;
     }
+}
+
+void bsp_rendering_deinit(bsp_rendering_data* renderingData, vulkan_renderer* renderer) {
+    VkDevice device = renderer->init_objects.device;
 
-}
\ No newline at end of file
+    // The pipelines belong to the library
+    vkDestroyPipelineLayout(device, renderingData->pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, renderingData->descriptorPool, nullptr);
+
+    for (bsp_material_image& materialImage : renderingData->materialImages) {
+        vkDestroyImageView(device, materialImage.view, nullptr);
+        vulkan_destroyImage(renderer, materialImage.image, materialImage.allocation);
+    }
+
+    vkDestroySampler(device, renderingData->sampler, nullptr);
+
+    vkDestroyImageView(device, renderingData->lightmapImage.view, nullptr);
+    vulkan_destroyImage(renderer, renderingData->lightmapImage.image, renderingData->lightmapImage.allocation);
+    vkDestroySampler(device, renderingData->lightmapSampler, nullptr);
+
+    if (renderingData->gpuDrivenSupported) {
+        vkDestroyPipeline(device, renderingData->cullPipeline, nullptr);
+        vkDestroyPipelineLayout(device, renderingData->cullPipelineLayout, nullptr);
+
+        for (bsp_cull_frame& frame : renderingData->cullFrames) {
+            vulkan_destroyBuffer(renderer, frame.commandBuffer, frame.commandAllocation);
+            vulkan_destroyBuffer(renderer, frame.countBuffer, frame.countAllocation);
+        }
+
+        vulkan_destroyBuffer(renderer, renderingData->visibilityBuffer, renderingData->visibilityAllocation);
+        vulkan_destroyBuffer(renderer, renderingData->gpuFaceBuffer, renderingData->gpuFaceAllocation);
+    }
+
+    vulkan_destroyBuffer(renderer, renderingData->drawBuffer, renderingData->drawAllocation);
+    vulkan_destroyBuffer(renderer, renderingData->indexBuffer, renderingData->indexBufferAllocation);
+    vulkan_destroyBuffer(renderer, renderingData->vertexBuffer, renderingData->vertexBufferAllocation);
+}
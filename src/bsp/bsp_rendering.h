@@ -14,33 +14,188 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#pragma once
+
 #include "bsp_loader.h"
+#include "bsp_vertex.h"
+#include "vpk.h"
 #include "../camera.h"
+#include "../jobs.h"
+#include "../cooked_store.h"
+#include "../vulkan/vulkan_pipeline_library.h"
+
+// Batches are recorded in parallel once there are enough for two chunks
+#define BSP_MIN_BATCHES_PER_CHUNK 64
+#define BSP_RECORD_CHUNKS_PER_THREAD 2
+
+// Culling shader switches, see bsp_cull.comp
+#define BSP_CULL_COMPACT  0x1
+#define BSP_CULL_FRUSTUM  0x2
+#define BSP_CULL_PVS      0x4
+#define BSP_CULL_BACKFACE 0x8
+#define BSP_CULL_OCCLUSION 0x10
+#define BSP_CULL_GROUP_SIZE 64
+
+// Faces culled by each test, counted after the per batch counts. A face only counts for the first test it fails.
+#define BSP_CULL_STAT_PVS       0
+#define BSP_CULL_STAT_FRUSTUM   1
+#define BSP_CULL_STAT_BACKFACE  2
+#define BSP_CULL_STAT_OCCLUSION 3
+#define BSP_CULL_STAT_COUNT     4
+
+// Per face data of the world shaders, uploaded once and selected by the draw index in each bsp_vertex. std430 layout
+// of FaceDraw in bsp_shader.vert.
+struct bsp_gpu_draw {
+    // Grid point the quantised positions are relative to
+    glm::vec3 origin;
+    // Distance to the next style in the atlas
+    float lightmapStyleStride;
+    // Whole texture repeats taken out of the UVs
+    glm::vec2 uvOffset;
+    // Texture index when rendering bindless, texture array layer otherwise
+    uint32_t material;
+    // Lightmap page in the low 16 bits, style count above
+    uint32_t lightmap;
+    // Octahedral plane normal and texture s axis, the bitangent is cross(normal, tangent) * tangentSign. Not shaded
+    // with yet, so the shaders leave them alone.
+    uint32_t normal;
+    uint32_t tangent;
+    float tangentSign;
+    // Span of the unorm16 UVs as two half floats, see bsp_uv_scale. 1 with float UVs.
+    uint32_t uvScale;
+};
 
 struct bsp_face_rendering_data {
     int indexBufferOffset;
     int indicesCount;
 };
 
-struct bsp_cluster_rendering_data {
-    std::vector<bsp_face_rendering_data> faces;
+// Range of the index buffer that is drawn with one descriptor set
+struct bsp_draw_batch {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t descriptorSetIndex;
+    // Faces in sorted order, also the batch's range of the indirect command buffer
+    uint32_t firstFace;
+    uint32_t faceCount;
+};
+
+// Per face record of the culling shader, std430 layout of Face in bsp_cull.comp
+struct bsp_gpu_face {
+    glm::vec4 boundingSphere;
+    // Front facing side has dot(xyz, p) > w
+    glm::vec4 plane;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t cluster;
+    uint32_t batch;
+    uint32_t batchFirstDraw;
+    // Slot of the face when commands are not compacted
+    uint32_t drawIndex;
+    uint32_t padding[2];
+};
+
+// Written by the culling shader and read by the indirect draws of one frame slot
+struct bsp_cull_frame {
+    VkBuffer commandBuffer;
+    vulkan_allocation commandAllocation;
+    // Visible faces per batch and the culled counts, host visible so the statistics can be read once the slot's
+    // fence signalled
+    VkBuffer countBuffer;
+    vulkan_allocation countAllocation;
+    bool submitted;
+};
+
+struct bsp_material_image {
+    VkImage image;
+    vulkan_allocation allocation;
+    VkImageView view;
 };
 
 struct bsp_rendering_data {
     std::vector<bspTree> bspTrees;
-    std::unordered_map<short, bsp_cluster_rendering_data> clusterRenderingData;
+    // One entry per bsp face, faces that are not drawn have no indices
+    std::vector<bsp_face_rendering_data> faces;
+    std::vector<bsp_draw_batch> batches;
+
+    // Bindless uses one image per material, the fallback one texture array per format and size
+    bool bindless;
+    std::vector<bsp_material_image> materialImages;
+    VkSampler sampler;
+
+    // All lightmap pages in one texture array, bound as set 1
+    bsp_material_image lightmapImage;
+    VkSampler lightmapSampler;
+    VkDescriptorSetLayout lightmapSetLayout;
+    VkDescriptorSet lightmapDescriptorSet;
 
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    vulkan_allocation vertexBufferAllocation;
+    // Quantisation of the vertices, reported against the float layout they were built from
+    uint32_t vertexCount;
+    float positionStep;
+    bsp_vertex_error vertexError;
+    // A face would exceed BSP_MAX_UV_ERROR with 16 bit UVs, the vertices are bsp_float_uv_vertex
+    bool floatUVs;
+    uint32_t vertexStride;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    vulkan_allocation indexBufferAllocation;
+    // bsp_gpu_draw of every drawn face in draw order
+    VkBuffer drawBuffer;
+    vulkan_allocation drawAllocation;
+    // Set 2, the view block in the renderer's frame ring and the draw records. One set per frame slot, the block is
+    // selected with a dynamic offset.
+    VkDescriptorSetLayout drawSetLayout;
+    std::vector<VkDescriptorSet> drawDescriptorSets;
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
-    VkDescriptorSet descriptorSet;
+    std::vector<VkDescriptorSet> descriptorSets;
     VkPipelineLayout pipelineLayout;
-    VkPipeline pipeline;
+    vulkan_pipeline_library* pipelines;
+    // Key of the fill pipeline, variants are derived from it
+    vulkan_pipeline_key pipelineKey;
+    uint32_t pipeline;
+    uint32_t wireframePipeline;
+    bool wireframe;
+    // Position only pass that fills the depth buffer before the shaded one, compiled when first enabled
+    uint32_t depthVertexLayout;
+    uint32_t depthPipeline;
+    bool depthPrepass;
+    // Splits the batches into chunks recorded into secondary command buffers on the workers
+    job_system* jobs;
+    bool parallelRecording;
+
+    // GPU driven path: a compute shader culls every face and each batch is drawn with one indirect draw
+    bool gpuDrivenSupported;
+    bool gpuDriven;
+    uint32_t cullFlags;
+    // Camera cluster lookups and the visibility that is uploaded for the shader
+    bsp_parsed* bsp;
+    uint32_t gpuFaceCount;
+    VkBuffer gpuFaceBuffer;
+    vulkan_allocation gpuFaceAllocation;
+    VkBuffer visibilityBuffer;
+    vulkan_allocation visibilityAllocation;
+    VkDescriptorSetLayout cullSetLayout;
+    VkPipelineLayout cullPipelineLayout;
+    VkPipeline cullPipeline;
+    std::vector<bsp_cull_frame> cullFrames;
+    // Occlusion culling tests against the renderer's depth pyramid of the last frame, reprojected with its camera
+    glm::mat4 previousViewProjection;
+    bool previousFrameRendered;
+    // Faces that passed culling and the ones each test removed in the last frame that finished on the GPU
+    uint32_t gpuVisibleFaces;
+    uint32_t gpuCulledFaces[BSP_CULL_STAT_COUNT];
+    // Draw commands recorded by the last bsp_render on whichever path it took, prepass draws included.
+    // An indirect draw counts once however many faces survive culling
+    uint32_t drawCalls;
 };
 
-bsp_rendering_data bsp_rendering_prepare(bsp_parsed* bsp, vulkan_renderer* renderer);
+bsp_rendering_data bsp_rendering_prepare(bsp_parsed* bsp, vpk_directory* vpk, job_system* jobs, cooked_store* cooked, vulkan_pipeline_library* pipelines, vulkan_renderer* renderer);
+
+void bsp_render(bsp_rendering_data* renderingData, vulkan_renderer* renderer, camera* c);
+
+// Rebuilds the cull pipeline if its shader is among the reloaded ones, the world pipelines belong to the library
+void bsp_rendering_reload_shaders(bsp_rendering_data* renderingData, vulkan_renderer* renderer, const std::vector<std::string>& shaders);
 
-void bsp_render(bsp_rendering_data* renderingData, vulkan_renderer* renderer, camera* c);
\ No newline at end of file
+void bsp_rendering_deinit(bsp_rendering_data* renderingData, vulkan_renderer* renderer);
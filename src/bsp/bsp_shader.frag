@@ -13,11 +13,38 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
-
 #version 450 core
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 uv;
+layout(location = 1) flat in uint material;
+layout(location = 2) in vec3 lightmapUV;
+layout(location = 3) flat in uint lightmap;
 
 layout(location = 0) out vec4 color;
 
+layout(set = 0, binding = 0) uniform sampler materialSampler;
+layout(set = 0, binding = 1) uniform texture2D materialTextures[];
+
+// LDR lightmaps are stored as sqrt(light / LIGHTMAP_RANGE), HDR ones hold the light itself, see bsp_lightmap.h
+#define LIGHTMAP_RANGE 8.0
+layout(constant_id = 0) const bool lightmapSqrtEncoded = true;
+
+layout(set = 1, binding = 0) uniform sampler2DArray lightmaps;
+
+vec3 sampleLightmap() {
+    float page = float(lightmap & 0xffffu);
+    uint styleCount = lightmap >> 16;
+
+    vec3 light = vec3(0);
+    for (uint style = 0; style < styleCount; style++) {
+        vec3 luxel = texture(lightmaps, vec3(lightmapUV.x + float(style) * lightmapUV.z, lightmapUV.y, page)).rgb;
+        light += lightmapSqrtEncoded ? luxel * luxel * LIGHTMAP_RANGE : luxel;
+    }
+    return light;
+}
+
 void main() {
-    color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    vec4 albedo = texture(sampler2D(materialTextures[nonuniformEXT(material)], materialSampler), uv);
+    color = vec4(albedo.rgb * sampleLightmap(), albedo.a);
 }
\ No newline at end of file
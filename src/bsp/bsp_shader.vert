@@ -13,15 +13,50 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
-
 #version 450 core
 
-layout(location = 0) in vec3 pos;
+// Quantised bsp_vertex: xyz are position steps from the face's origin, w is the face's draw index
+layout(location = 0) in uvec4 inPosition;
+// Relative to the face's UV offset, unorm16 across its UV scale or floats with a scale of 1
+layout(location = 1) in vec2 inUV;
+layout(location = 2) in vec2 inLightmapUV;
+
+layout(location = 0) out vec2 uv;
+layout(location = 1) flat out uint material;
+layout(location = 2) out vec3 lightmapUV;
+layout(location = 3) flat out uint lightmap;
+
+// Written to the frame ring once per frame, see bsp_view_uniforms
+layout(std140, set = 2, binding = 0) uniform ViewBlock {
+    mat4 viewProjection;
+    float positionStep;
+} View;
+
+// Static per face data indexed by the face's draw index, see bsp_gpu_draw
+struct FaceDraw {
+    vec3 origin;
+    float lightmapStyleStride;
+    vec2 uvOffset;
+    uint material;
+    uint lightmap;
+    uint normal;
+    uint tangent;
+    float tangentSign;
+    uint uvScale;
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer FaceDraws {
+    FaceDraw faceDraws[];
+};
 
-layout(push_constant) uniform PushConsantBlock {
-    mat4 mvp;
-} PushConstant;
+// Has to match bsp_depth.vert exactly so the depth prepass and the color pass agree
+invariant gl_Position;
 
 void main() {
-    gl_Position = PushConstant.mvp * vec4(pos, 1);
+    FaceDraw draw = faceDraws[inPosition.w];
+    uv = inUV * unpackHalf2x16(draw.uvScale) + draw.uvOffset;
+    material = draw.material;
+    lightmapUV = vec3(inLightmapUV, draw.lightmapStyleStride);
+    lightmap = draw.lightmap;
+    gl_Position = View.viewProjection * vec4(draw.origin + vec3(inPosition.xyz) * View.positionStep, 1);
 }
\ No newline at end of file
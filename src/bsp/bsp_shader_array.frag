@@ -0,0 +1,49 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#version 450 core
+
+layout(location = 0) in vec2 uv;
+layout(location = 1) flat in uint material;
+layout(location = 2) in vec3 lightmapUV;
+layout(location = 3) flat in uint lightmap;
+
+layout(location = 0) out vec4 color;
+
+// Fallback without descriptor indexing, material is the layer inside the bound array
+layout(set = 0, binding = 0) uniform sampler2DArray materialTextures;
+
+// LDR lightmaps are stored as sqrt(light / LIGHTMAP_RANGE), HDR ones hold the light itself, see bsp_lightmap.h
+#define LIGHTMAP_RANGE 8.0
+layout(constant_id = 0) const bool lightmapSqrtEncoded = true;
+
+layout(set = 1, binding = 0) uniform sampler2DArray lightmaps;
+
+vec3 sampleLightmap() {
+    float page = float(lightmap & 0xffffu);
+    uint styleCount = lightmap >> 16;
+
+    vec3 light = vec3(0);
+    for (uint style = 0; style < styleCount; style++) {
+        vec3 luxel = texture(lightmaps, vec3(lightmapUV.x + float(style) * lightmapUV.z, lightmapUV.y, page)).rgb;
+        light += lightmapSqrtEncoded ? luxel * luxel * LIGHTMAP_RANGE : luxel;
+    }
+    return light;
+}
+
+void main() {
+    vec4 albedo = texture(materialTextures, vec3(uv, float(material)));
+    color = vec4(albedo.rgb * sampleLightmap(), albedo.a);
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "bsp_vertex.h"
+#include "bsp_lightmap.h"
+
+#include <algorithm>
+#include <cmath>
+
+static int16_t float_to_snorm16(float f) {
+    return (int16_t)roundf(std::min(std::max(f, -1.0f), 1.0f) * 32767.0f);
+}
+
+static float snorm16_to_float(int16_t s) {
+    return std::max((float)s / 32767.0f, -1.0f);
+}
+
+// Starts where origin + offset * step is still exact in a float for coordinates up to 16384. The origin can be up to a
+// step below the face, so one step of the range is kept for that.
+float bsp_position_step(float extent) {
+    float step = 1.0f / 1024.0f;
+    while (step * 65534.0f < extent) {
+        step *= 2.0f;
+    }
+    return step;
+}
+
+glm::vec3 bsp_position_origin(const glm::vec3& min, float step) {
+    return glm::floor(min / step) * step;
+}
+
+glm::vec2 bsp_uv_scale(const glm::vec2& span) {
+    glm::vec2 scale;
+    for (int i = 0; i < 2; i++) {
+        // Half floats are normal from 2^-14 and reach 2^15 as a power of two
+        scale[i] = 1.0f / 1024.0f;
+        while (scale[i] < span[i] && scale[i] < 32768.0f) {
+            scale[i] *= 2.0f;
+        }
+    }
+    return scale;
+}
+
+uint32_t bsp_pack_uv_scale(const glm::vec2& uvScale) {
+    return (uint32_t)bsp_float_to_half(uvScale.x) | ((uint32_t)bsp_float_to_half(uvScale.y) << 16);
+}
+
+bsp_vertex bsp_encode_vertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec2& lightmapUV, uint16_t face,
+                             const glm::vec3& origin, const glm::vec2& uvOffset, const glm::vec2& uvScale, float step) {
+    bsp_vertex vertex = {};
+
+    for (int i = 0; i < 3; i++) {
+        vertex.position[i] = (uint16_t)std::min(roundf((position[i] - origin[i]) / step), 65535.0f);
+    }
+    vertex.position[3] = face;
+
+    for (int i = 0; i < 2; i++) {
+        vertex.uv[i] = (uint16_t)roundf(std::min(std::max((uv[i] - uvOffset[i]) / uvScale[i], 0.0f), 1.0f) * 65535.0f);
+        vertex.lightmapUV[i] = (uint16_t)roundf(std::min(std::max(lightmapUV[i], 0.0f), 1.0f) * 65535.0f);
+    }
+
+    return vertex;
+}
+
+void bsp_decode_vertex(const bsp_vertex& vertex, const glm::vec3& origin, const glm::vec2& uvOffset, const glm::vec2& uvScale, float step,
+                       glm::vec3* outPosition, glm::vec2* outUV, glm::vec2* outLightmapUV) {
+    *outPosition = origin + glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) * step;
+    *outUV = glm::vec2(vertex.uv[0], vertex.uv[1]) / 65535.0f * uvScale + uvOffset;
+    *outLightmapUV = glm::vec2(vertex.lightmapUV[0], vertex.lightmapUV[1]) / 65535.0f;
+}
+
+uint32_t bsp_octahedral_encode(const glm::vec3& direction) {
+    glm::vec3 n = direction / (fabsf(direction.x) + fabsf(direction.y) + fabsf(direction.z));
+    glm::vec2 p(n.x, n.y);
+
+    // The lower half is folded over the diagonals onto the outer triangles
+    if (n.z < 0.0f) {
+        p = glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    return (uint16_t)float_to_snorm16(p.x) | ((uint32_t)(uint16_t)float_to_snorm16(p.y) << 16);
+}
+
+glm::vec3 bsp_octahedral_decode(uint32_t packed) {
+    glm::vec2 p(snorm16_to_float((int16_t)(packed & 0xffff)), snorm16_to_float((int16_t)(packed >> 16)));
+    glm::vec3 n(p.x, p.y, 1.0f - fabsf(p.x) - fabsf(p.y));
+
+    float fold = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -fold : fold;
+    n.y += n.y >= 0.0f ? -fold : fold;
+    return glm::normalize(n);
+}
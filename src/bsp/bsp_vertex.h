@@ -0,0 +1,88 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef VULKAN_TEST_BSP_VERTEX_H
+#define VULKAN_TEST_BSP_VERTEX_H
+
+#include <cstdint>
+#include "bsp_loader.h"
+
+// Largest UV error in texels the 16 bit UVs may have, maps with a face above it are drawn with bsp_float_uv_vertex
+#define BSP_MAX_UV_ERROR 0.25f
+
+// Quantised world vertex, decoded by bsp_shader.vert and bsp_depth.vert with the face's bsp_gpu_draw record
+struct bsp_vertex {
+    // xyz in position steps from the face's origin, w is the draw index of the face
+    uint16_t position[4];
+    // unorm16 across the face's uvScale from its uvOffset. The error grows with the UV span of the face, half of
+    // uvScale / 65535 repeats, which is uniform over the face unlike half floats.
+    uint16_t uv[2];
+    // Lightmap atlas coordinates of the first style as unorm16
+    uint16_t lightmapUV[2];
+};
+
+// Fallback for maps with faces too large for 16 bit UVs. UVs are relative to the face's uvOffset like in bsp_vertex,
+// with a uvScale of 1 the shaders don't need to know.
+struct bsp_float_uv_vertex {
+    uint16_t position[4];
+    float uv[2];
+    uint16_t lightmapUV[2];
+};
+
+// The float layout the vertices are quantised from, only kept to report what quantising saves
+struct bsp_float_vertex {
+    glm::vec3 position;
+    glm::vec2 uv;
+    glm::vec2 lightmapUV;
+    uint32_t face;
+};
+
+// Largest difference between the decoded and the source values over all vertices and faces
+struct bsp_vertex_error {
+    // World units
+    float position;
+    // Texels of the face's texture and luxels of the lightmap page
+    float uv;
+    float lightmapUV;
+    // Degrees
+    float normal;
+    float tangent;
+};
+
+// Smallest power of two step that spans extent in 16 bits. The whole map uses one step and faces put their origin on
+// its grid, so a vertex shared by neighbouring faces decodes to the same position in all of them.
+float bsp_position_step(float extent);
+// Grid point at or below the smallest coordinates of a face
+glm::vec3 bsp_position_origin(const glm::vec3& min, float step);
+
+// Smallest power of two at or above the UV span of a face, exact as a half float
+glm::vec2 bsp_uv_scale(const glm::vec2& span);
+// Both scales as half floats in the layout of GLSL's packHalf2x16
+uint32_t bsp_pack_uv_scale(const glm::vec2& uvScale);
+
+// uvOffset has to be at or below the smallest UV of the face and uvScale cover the rest, lightmapUV in [0, 1]
+bsp_vertex bsp_encode_vertex(const glm::vec3& position, const glm::vec2& uv, const glm::vec2& lightmapUV, uint16_t face,
+                             const glm::vec3& origin, const glm::vec2& uvOffset, const glm::vec2& uvScale, float step);
+// Same arithmetic as the shaders
+void bsp_decode_vertex(const bsp_vertex& vertex, const glm::vec3& origin, const glm::vec2& uvOffset, const glm::vec2& uvScale, float step,
+                       glm::vec3* outPosition, glm::vec2* outUV, glm::vec2* outLightmapUV);
+
+// Unit vector folded onto an octahedron, two snorm16 in the layout of GLSL's packSnorm2x16
+uint32_t bsp_octahedral_encode(const glm::vec3& direction);
+glm::vec3 bsp_octahedral_decode(uint32_t packed);
+
+#endif //VULKAN_TEST_BSP_VERTEX_H
@@ -18,6 +18,11 @@
 
 #include <fstream>
 #include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cctype>
+#include "../profiler.h"
 
 #pragma pack(push, 1)
 struct VPKHeader_v2
@@ -58,7 +63,8 @@ struct VPKDirectoryEntry
     // Otherwise, the number of bytes stored starting at EntryOffset.
     unsigned int EntryLength;
 
-    const unsigned short Terminator = 0xffff;
+    // Always 0xffff. Read from the file like the rest, a const member would make the struct impossible to memcpy into.
+    unsigned short Terminator;
 };
 #pragma pack(pop)
 
@@ -69,7 +75,10 @@ std::string vpkdir_readstring(char* tree, unsigned int* p) {
 }
 
 vpk_directory* load_vpk(std::string folder, std::string packname) {
+    PROFILE_ZONE("load_vpk");
     vpk_directory* dir = new vpk_directory();
+    dir->folder = folder;
+    dir->pakname = packname;
 
     std::ifstream fs(folder + packname + "_dir.vpk", std::ios::binary);
 
@@ -84,6 +93,8 @@ vpk_directory* load_vpk(std::string folder, std::string packname) {
         throw std::runtime_error(folder + packname + "_dir.vpk" + " is not a valid vpk v2 directory!");
     }
 
+    dir->embeddedDataOffset = sizeof(header) + header.TreeSize;
+
     char* tree = new char[header.TreeSize];
     unsigned int read = 0;
 
@@ -123,17 +134,23 @@ vpk_directory* load_vpk(std::string folder, std::string packname) {
                 memcpy(&entry, tree + p, sizeof(entry));
                 p += sizeof(entry);
 
+                if (entry.Terminator != 0xffff) {
+                    delete[] tree;
+                    throw std::runtime_error(folder + packname + "_dir.vpk" + " has a corrupted directory tree!");
+                }
+
                 vpk_directory_entry centry = {};
                 centry.filename = filename;
                 centry.path = path;
                 centry.extension = extension;
 
                 if (entry.PreloadBytes != 0) {
-                    centry.preload.reserve(entry.PreloadBytes);
+                    centry.preload.resize(entry.PreloadBytes);
                     memcpy(centry.preload.data(), tree + p, entry.PreloadBytes);
                     p += entry.PreloadBytes;
                 }
                 
+                centry.crc = entry.CRC;
                 centry.archiveIndex = entry.ArchiveIndex;
                 centry.archiveLength = entry.EntryLength;
                 centry.archiveOffset = entry.EntryOffset;
@@ -146,4 +163,56 @@ vpk_directory* load_vpk(std::string folder, std::string packname) {
     delete[] tree;
 
     return dir;
-}
\ No newline at end of file
+}
+
+const vpk_directory_entry* vpk_find_entry(vpk_directory* dir, const std::string& extension, const std::string& path) {
+    auto extensionEntries = dir->entries.find(extension);
+    if (extensionEntries == dir->entries.end()) {
+        return nullptr;
+    }
+
+    // Paths inside the directory are always lowercase with forward slashes
+    std::string normalized = path;
+    std::transform(normalized.begin(), normalized.end(), normalized.begin(), [](char c) { return c == '\\' ? '/' : (char)tolower(c); });
+
+    auto entry = extensionEntries->second.find(normalized);
+    if (entry == extensionEntries->second.end()) {
+        return nullptr;
+    }
+
+    return &entry->second;
+}
+
+bool vpk_read_entry(vpk_directory* dir, const vpk_directory_entry* entry, std::vector<unsigned char>& outData) {
+    PROFILE_ZONE("vpk_read_entry");
+    outData.resize(entry->preload.size() + entry->archiveLength);
+    memcpy(outData.data(), entry->preload.data(), entry->preload.size());
+
+    if (entry->archiveLength == 0) {
+        return true;
+    }
+
+    std::string archiveFile;
+    unsigned int offset = entry->archiveOffset;
+
+    if ((unsigned short)entry->archiveIndex == 0x7fff) {
+        archiveFile = dir->folder + dir->pakname + "_dir.vpk";
+        offset += dir->embeddedDataOffset;
+    } else {
+        char archiveName[16];
+        snprintf(archiveName, sizeof(archiveName), "_%03d.vpk", entry->archiveIndex);
+        archiveFile = dir->folder + dir->pakname + archiveName;
+    }
+
+    std::ifstream fs(archiveFile, std::ios::binary);
+
+    if (!fs.is_open()) {
+        std::cout << "Could not open " << archiveFile << std::endl;
+        return false;
+    }
+
+    fs.seekg(offset, std::ios::beg);
+    fs.read((char*)outData.data() + entry->preload.size(), entry->archiveLength);
+
+    return fs.good();
+}
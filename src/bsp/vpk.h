@@ -26,17 +26,25 @@ struct vpk_directory_entry {
     std::string path;
     std::string filename;
     std::vector<unsigned char> preload;
+    // CRC32 of the file data, changes whenever the file does
+    unsigned int crc;
     short archiveIndex;
     int archiveOffset;
     int archiveLength;
 };
 
 struct vpk_directory {
+    std::string folder;
     std::string pakname;
+    // Offset of the data section that follows the directory tree in the _dir file
+    unsigned int embeddedDataOffset;
     //std::unordered_map < std::string, std::unordered_map<std::string, std::unordered_map<std::string, vpk_directory_entry>>> entries;
     std::unordered_map < std::string, std::unordered_map < std::string, vpk_directory_entry >> entries;
 };
 
 vpk_directory* load_vpk(std::string folder, std::string packname);
 
+const vpk_directory_entry* vpk_find_entry(vpk_directory* dir, const std::string& extension, const std::string& path);
+bool vpk_read_entry(vpk_directory* dir, const vpk_directory_entry* entry, std::vector<unsigned char>& outData);
+
 #endif //VULKAN_TEST_VPK_H
@@ -0,0 +1,340 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vtf.h"
+
+#include <cstring>
+#include <algorithm>
+
+#define TEXTUREFLAGS_ENVMAP 0x4000
+
+enum VTFImageFormat {
+    IMAGE_FORMAT_NONE = -1,
+    IMAGE_FORMAT_RGBA8888 = 0,
+    IMAGE_FORMAT_ABGR8888,
+    IMAGE_FORMAT_RGB888,
+    IMAGE_FORMAT_BGR888,
+    IMAGE_FORMAT_RGB565,
+    IMAGE_FORMAT_I8,
+    IMAGE_FORMAT_IA88,
+    IMAGE_FORMAT_P8,
+    IMAGE_FORMAT_A8,
+    IMAGE_FORMAT_RGB888_BLUESCREEN,
+    IMAGE_FORMAT_BGR888_BLUESCREEN,
+    IMAGE_FORMAT_ARGB8888,
+    IMAGE_FORMAT_BGRA8888,
+    IMAGE_FORMAT_DXT1,
+    IMAGE_FORMAT_DXT3,
+    IMAGE_FORMAT_DXT5,
+    IMAGE_FORMAT_BGRX8888,
+    IMAGE_FORMAT_BGR565,
+    IMAGE_FORMAT_BGRX5551,
+    IMAGE_FORMAT_BGRA4444,
+    IMAGE_FORMAT_DXT1_ONEBITALPHA,
+    IMAGE_FORMAT_BGRA5551,
+    IMAGE_FORMAT_UV88,
+    IMAGE_FORMAT_UVWQ8888,
+    IMAGE_FORMAT_RGBA16161616F,
+    IMAGE_FORMAT_RGBA16161616,
+    IMAGE_FORMAT_UVLX8888
+};
+
+#pragma pack(push, 1)
+struct VTFHeader
+{
+    char            signature[4];       // "VTF\0"
+    unsigned int    version[2];         // major, minor
+    unsigned int    headerSize;         // size of the header including resource entries
+    unsigned short  width;
+    unsigned short  height;
+    unsigned int    flags;
+    unsigned short  frames;
+    unsigned short  firstFrame;
+    unsigned char   padding0[4];
+    float           reflectivity[3];
+    unsigned char   padding1[4];
+    float           bumpmapScale;
+    int             highResImageFormat;
+    unsigned char   mipmapCount;
+    int             lowResImageFormat;  // always DXT1 or none
+    unsigned char   lowResImageWidth;
+    unsigned char   lowResImageHeight;
+
+    // 7.2+
+    unsigned short  depth;
+
+    // 7.3+
+    unsigned char   padding2[3];
+    unsigned int    numResources;
+    unsigned char   padding3[8];
+};
+
+struct VTFResourceEntry
+{
+    unsigned char   tag[3];
+    unsigned char   flags;
+    unsigned int    offset;
+};
+#pragma pack(pop)
+
+static size_t vtf_image_size(int format, uint32_t width, uint32_t height) {
+    switch (format) {
+        case IMAGE_FORMAT_DXT1:
+        case IMAGE_FORMAT_DXT1_ONEBITALPHA:
+            return std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * 8;
+        case IMAGE_FORMAT_DXT3:
+        case IMAGE_FORMAT_DXT5:
+            return std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * 16;
+        case IMAGE_FORMAT_I8:
+        case IMAGE_FORMAT_P8:
+        case IMAGE_FORMAT_A8:
+            return width * height;
+        case IMAGE_FORMAT_RGB565:
+        case IMAGE_FORMAT_IA88:
+        case IMAGE_FORMAT_BGR565:
+        case IMAGE_FORMAT_BGRX5551:
+        case IMAGE_FORMAT_BGRA4444:
+        case IMAGE_FORMAT_BGRA5551:
+        case IMAGE_FORMAT_UV88:
+            return width * height * 2;
+        case IMAGE_FORMAT_RGB888:
+        case IMAGE_FORMAT_BGR888:
+        case IMAGE_FORMAT_RGB888_BLUESCREEN:
+        case IMAGE_FORMAT_BGR888_BLUESCREEN:
+            return width * height * 3;
+        case IMAGE_FORMAT_RGBA8888:
+        case IMAGE_FORMAT_ABGR8888:
+        case IMAGE_FORMAT_ARGB8888:
+        case IMAGE_FORMAT_BGRA8888:
+        case IMAGE_FORMAT_BGRX8888:
+        case IMAGE_FORMAT_UVWQ8888:
+        case IMAGE_FORMAT_UVLX8888:
+            return width * height * 4;
+        case IMAGE_FORMAT_RGBA16161616F:
+        case IMAGE_FORMAT_RGBA16161616:
+            return width * height * 8;
+        default:
+            return 0;
+    }
+}
+
+static VkFormat vtf_native_format(int format) {
+    switch (format) {
+        case IMAGE_FORMAT_DXT1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case IMAGE_FORMAT_DXT1_ONEBITALPHA: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case IMAGE_FORMAT_DXT3: return VK_FORMAT_BC2_UNORM_BLOCK;
+        case IMAGE_FORMAT_DXT5: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case IMAGE_FORMAT_RGBA8888: return VK_FORMAT_R8G8B8A8_UNORM;
+        case IMAGE_FORMAT_BGRA8888: return VK_FORMAT_B8G8R8A8_UNORM;
+        case IMAGE_FORMAT_RGBA16161616F: return VK_FORMAT_R16G16B16A16_SFLOAT;
+        case IMAGE_FORMAT_RGBA16161616: return VK_FORMAT_R16G16B16A16_UNORM;
+        default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+static unsigned char expand5(unsigned int v) { return (unsigned char)((v << 3) | (v >> 2)); }
+static unsigned char expand6(unsigned int v) { return (unsigned char)((v << 2) | (v >> 4)); }
+static unsigned char expand4(unsigned int v) { return (unsigned char)((v << 4) | v); }
+
+// Converts one image of a format Vulkan can't sample directly into RGBA8
+static bool vtf_convert_to_rgba8(int format, const unsigned char* src, uint32_t pixelCount, unsigned char* dst) {
+    for (uint32_t i = 0; i < pixelCount; i++) {
+        unsigned char* out = dst + i * 4;
+
+        switch (format) {
+            case IMAGE_FORMAT_ABGR8888:
+                out[0] = src[i * 4 + 3]; out[1] = src[i * 4 + 2]; out[2] = src[i * 4 + 1]; out[3] = src[i * 4 + 0];
+                break;
+            case IMAGE_FORMAT_ARGB8888:
+                out[0] = src[i * 4 + 1]; out[1] = src[i * 4 + 2]; out[2] = src[i * 4 + 3]; out[3] = src[i * 4 + 0];
+                break;
+            case IMAGE_FORMAT_BGRX8888:
+                out[0] = src[i * 4 + 2]; out[1] = src[i * 4 + 1]; out[2] = src[i * 4 + 0]; out[3] = 255;
+                break;
+            case IMAGE_FORMAT_UVWQ8888:
+            case IMAGE_FORMAT_UVLX8888:
+                memcpy(out, src + i * 4, 4);
+                break;
+            case IMAGE_FORMAT_RGB888:
+            case IMAGE_FORMAT_RGB888_BLUESCREEN:
+                out[0] = src[i * 3 + 0]; out[1] = src[i * 3 + 1]; out[2] = src[i * 3 + 2];
+                out[3] = (format == IMAGE_FORMAT_RGB888_BLUESCREEN && out[0] == 0 && out[1] == 0 && out[2] == 255) ? 0 : 255;
+                break;
+            case IMAGE_FORMAT_BGR888:
+            case IMAGE_FORMAT_BGR888_BLUESCREEN:
+                out[0] = src[i * 3 + 2]; out[1] = src[i * 3 + 1]; out[2] = src[i * 3 + 0];
+                out[3] = (format == IMAGE_FORMAT_BGR888_BLUESCREEN && out[0] == 0 && out[1] == 0 && out[2] == 255) ? 0 : 255;
+                break;
+            case IMAGE_FORMAT_I8:
+                out[0] = out[1] = out[2] = src[i]; out[3] = 255;
+                break;
+            case IMAGE_FORMAT_A8:
+                out[0] = out[1] = out[2] = 0; out[3] = src[i];
+                break;
+            case IMAGE_FORMAT_IA88:
+                out[0] = out[1] = out[2] = src[i * 2]; out[3] = src[i * 2 + 1];
+                break;
+            case IMAGE_FORMAT_UV88:
+                out[0] = src[i * 2]; out[1] = src[i * 2 + 1]; out[2] = 0; out[3] = 255;
+                break;
+            case IMAGE_FORMAT_RGB565:
+            case IMAGE_FORMAT_BGR565: {
+                unsigned int p = src[i * 2] | (src[i * 2 + 1] << 8);
+                unsigned char low = expand5(p & 0x1f), mid = expand6((p >> 5) & 0x3f), high = expand5(p >> 11);
+                // RGB565 stores red in the low bits, BGR565 blue
+                out[0] = format == IMAGE_FORMAT_RGB565 ? low : high;
+                out[1] = mid;
+                out[2] = format == IMAGE_FORMAT_RGB565 ? high : low;
+                out[3] = 255;
+                break;
+            }
+            case IMAGE_FORMAT_BGRX5551:
+            case IMAGE_FORMAT_BGRA5551: {
+                unsigned int p = src[i * 2] | (src[i * 2 + 1] << 8);
+                out[0] = expand5((p >> 10) & 0x1f); out[1] = expand5((p >> 5) & 0x1f); out[2] = expand5(p & 0x1f);
+                out[3] = (format == IMAGE_FORMAT_BGRX5551 || (p & 0x8000)) ? 255 : 0;
+                break;
+            }
+            case IMAGE_FORMAT_BGRA4444: {
+                unsigned int p = src[i * 2] | (src[i * 2 + 1] << 8);
+                out[0] = expand4((p >> 8) & 0xf); out[1] = expand4((p >> 4) & 0xf); out[2] = expand4(p & 0xf); out[3] = expand4(p >> 12);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+size_t vtf_mip_size(VkFormat format, uint32_t width, uint32_t height) {
+    switch (format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            return std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * 8;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+            return std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * 16;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_R16G16B16A16_UNORM:
+            return width * height * 8;
+        default:
+            return width * height * 4;
+    }
+}
+
+bool vtf_is_block_compressed(VkFormat format) {
+    return format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+        || format == VK_FORMAT_BC2_UNORM_BLOCK || format == VK_FORMAT_BC3_UNORM_BLOCK || format == VK_FORMAT_BC7_UNORM_BLOCK;
+}
+
+bool load_vtf(const unsigned char* fileData, size_t fileSize, vtf_texture* outTexture) {
+    if (fileSize < 64) {
+        return false;
+    }
+
+    VTFHeader header = {};
+    memcpy(&header, fileData, std::min(fileSize, sizeof(header)));
+
+    if (memcmp(header.signature, "VTF\0", 4) != 0 || header.version[0] != 7) {
+        return false;
+    }
+
+    uint32_t depth = header.version[1] >= 2 ? std::max<uint32_t>(header.depth, 1) : 1;
+    uint32_t faces = 1;
+    if (header.flags & TEXTUREFLAGS_ENVMAP) {
+        faces = (header.version[1] < 5 && header.firstFrame != 0xffff) ? 7 : 6;
+    }
+
+    size_t highResOffset = 0;
+
+    if (header.version[1] >= 3) {
+        bool found = false;
+        for (unsigned int i = 0; i < header.numResources; i++) {
+            size_t entryOffset = 80 + i * sizeof(VTFResourceEntry);
+            if (entryOffset + sizeof(VTFResourceEntry) > fileSize) {
+                break;
+            }
+
+            VTFResourceEntry entry;
+            memcpy(&entry, fileData + entryOffset, sizeof(entry));
+
+            if (entry.tag[0] == 0x30 && entry.tag[1] == 0 && entry.tag[2] == 0) {
+                highResOffset = entry.offset;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            return false;
+        }
+    } else {
+        highResOffset = header.headerSize;
+        if (header.lowResImageFormat != IMAGE_FORMAT_NONE) {
+            highResOffset += vtf_image_size(header.lowResImageFormat, header.lowResImageWidth, header.lowResImageHeight);
+        }
+    }
+
+    int format = header.highResImageFormat;
+    uint32_t mipCount = std::max<uint32_t>(header.mipmapCount, 1);
+
+    if (vtf_image_size(format, 1, 1) == 0) {
+        return false;
+    }
+
+    VkFormat nativeFormat = vtf_native_format(format);
+    VkFormat outFormat = nativeFormat != VK_FORMAT_UNDEFINED ? nativeFormat : VK_FORMAT_R8G8B8A8_UNORM;
+
+    outTexture->width = header.width;
+    outTexture->height = header.height;
+    outTexture->mipCount = mipCount;
+    outTexture->format = outFormat;
+    outTexture->mipOffsets.resize(mipCount);
+
+    size_t totalSize = 0;
+    for (uint32_t mip = 0; mip < mipCount; mip++) {
+        outTexture->mipOffsets[mip] = totalSize;
+        totalSize += vtf_mip_size(outFormat, std::max(1u, outTexture->width >> mip), std::max(1u, outTexture->height >> mip));
+    }
+    outTexture->data.resize(totalSize);
+
+    // Mips are stored smallest first, every mip contains all frames, faces and slices
+    size_t offset = highResOffset;
+    for (int mip = mipCount - 1; mip >= 0; mip--) {
+        uint32_t mipWidth = std::max(1u, outTexture->width >> mip);
+        uint32_t mipHeight = std::max(1u, outTexture->height >> mip);
+        uint32_t mipDepth = std::max(1u, depth >> mip);
+        size_t imageSize = vtf_image_size(format, mipWidth, mipHeight);
+
+        if (offset + imageSize > fileSize) {
+            return false;
+        }
+
+        unsigned char* dst = outTexture->data.data() + outTexture->mipOffsets[mip];
+        if (nativeFormat != VK_FORMAT_UNDEFINED) {
+            memcpy(dst, fileData + offset, imageSize);
+        } else if (!vtf_convert_to_rgba8(format, fileData + offset, mipWidth * mipHeight, dst)) {
+            return false;
+        }
+
+        offset += imageSize * std::max<uint32_t>(header.frames, 1) * faces * mipDepth;
+    }
+
+    return true;
+}
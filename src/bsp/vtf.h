@@ -0,0 +1,41 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef VULKAN_TEST_VTF_H
+#define VULKAN_TEST_VTF_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "../vulkan/vulkan_init.h"
+
+struct vtf_texture {
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    VkFormat format;
+    // All mip levels of the first frame, largest first and tightly packed
+    std::vector<unsigned char> data;
+    std::vector<size_t> mipOffsets;
+};
+
+// Parses a VTF file from memory. Formats Vulkan can't sample directly are converted to RGBA8.
+bool load_vtf(const unsigned char* fileData, size_t fileSize, vtf_texture* outTexture);
+
+size_t vtf_mip_size(VkFormat format, uint32_t width, uint32_t height);
+bool vtf_is_block_compressed(VkFormat format);
+
+#endif //VULKAN_TEST_VTF_H
@@ -0,0 +1,110 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "cooked_store.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <functional>
+#include <cstdio>
+
+std::string cooked_store_path(cooked_store* store, const char* kind, uint64_t key) {
+    char filename[32];
+    snprintf(filename, sizeof(filename), "%016llx.", (unsigned long long)key);
+
+    return store->folder + "/" + filename + kind;
+}
+
+cooked_store* init_cooked_store(const std::string& folder) {
+    std::error_code error;
+    std::filesystem::create_directories(folder, error);
+
+    if (error) {
+        std::cout << "Could not create cooked asset folder " << folder << std::endl;
+        return nullptr;
+    }
+
+    cooked_store* store = new cooked_store();
+    store->folder = folder;
+
+    return store;
+}
+
+void deinit_cooked_store(cooked_store* store) {
+    delete store;
+}
+
+uint64_t cooked_hash(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+bool cooked_store_read(cooked_store* store, const char* kind, uint64_t key, std::vector<unsigned char>& outData) {
+    std::ifstream file(cooked_store_path(store, kind, key), std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    size_t filesize = (size_t)file.tellg();
+    outData.resize(filesize);
+
+    file.seekg(0);
+    file.read((char*)outData.data(), filesize);
+
+    return file.good();
+}
+
+bool cooked_store_write(cooked_store* store, const char* kind, uint64_t key, const void* data, size_t size) {
+    std::string path = cooked_store_path(store, kind, key);
+
+    // Write to a temporary file first so readers never see half written entries
+    std::string temporaryPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open()) {
+            std::cout << "Could not open " << temporaryPath << std::endl;
+            return false;
+        }
+
+        file.write((const char*)data, size);
+
+        if (!file.good()) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    return true;
+}
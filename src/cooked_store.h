@@ -0,0 +1,41 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#define COOKED_HASH_SEED 0xcbf29ce484222325ull
+
+// Directory of processed assets, every entry is one file named after its 64 bit key
+struct cooked_store {
+    std::string folder;
+};
+
+cooked_store* init_cooked_store(const std::string& folder);
+void deinit_cooked_store(cooked_store* store);
+
+// FNV-1a, chain calls by passing the previous hash as seed
+uint64_t cooked_hash(const void* data, size_t size, uint64_t seed = COOKED_HASH_SEED);
+
+// Path of an entry, for data that is not read through cooked_store_read (e.g. memory mapped)
+std::string cooked_store_path(cooked_store* store, const char* kind, uint64_t key);
+
+bool cooked_store_read(cooked_store* store, const char* kind, uint64_t key, std::vector<unsigned char>& outData);
+bool cooked_store_write(cooked_store* store, const char* kind, uint64_t key, const void* data, size_t size);
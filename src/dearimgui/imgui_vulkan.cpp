@@ -16,6 +16,7 @@
 
 #include "imgui_vulkan.h"
 #include "../vulkan/vulkan_utils.h"
+#include "../profiler.h"
 #include <string>
 #include <iostream>
 
@@ -24,6 +25,9 @@
 #include <glm/gtx/transform.hpp>
 #include <algorithm>
 
+// Smallest per frame vertex and index buffer, enough for the debug windows without growing
+#define IMGUIVK_MIN_BUFFER_SIZE (64 * 1024)
+
 struct pushconstant_block {
     glm::vec2 scale;
     glm::vec2 translate;
@@ -95,6 +99,10 @@ void ImGui_ImplGlfw_CharCallback(GLFWwindow* window, unsigned int c)
 
 bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window) {
     imgui->window = window;
+    imgui->frameBuffers.assign(renderer->frames.size(), imguivk_frame_buffers{});
+    imgui->bufferAllocations = 0;
+    imgui->frameCount = 0;
+    imgui->lastFrameBytes = 0;
 
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO();
@@ -160,68 +168,13 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
     int memorySize = width * height * 4;
 
     // Upload texture to GPU
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    vulkan_createBuffer(renderer, memorySize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(renderer->init_objects.device, stagingBufferMemory, 0, memorySize, 0, &data);
-    memcpy(data, pixels, (size_t)memorySize);
-    vkUnmapMemory(renderer->init_objects.device, stagingBufferMemory);
-
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
-
-    vulkan_createImage(renderer, width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+    vulkan_createImage(renderer, width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, imgui->textureImageAllocation);
 
     imgui->textureImage = textureImage;
-    imgui->textureImageMemory = textureImageMemory;
-
-    VkCommandBuffer commandBuffer = vulkan_beginSingleTimeCommandBuffer(renderer);
-
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.image = textureImage;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-    VkImageMemoryBarrier barrier2 = barrier;
-    barrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier2.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {(uint32_t)width, (uint32_t)height, 1};
-
-    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    barrier2.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier2.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier2);
-
-    vulkan_endSingleTimeCommandBuffer(renderer, commandBuffer);
-
-    vkDestroyBuffer(renderer->init_objects.device, stagingBuffer, nullptr);
-    vkFreeMemory(renderer->init_objects.device, stagingBufferMemory, nullptr);
+
+    VkDeviceSize mipOffset = 0;
+    vulkan_uploadImage(renderer, textureImage, width, height, 1, 1, &mipOffset, pixels, memorySize);
 
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -265,13 +218,16 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vulkan_createShaderModule(renderer, "imgui_vert.spv");
+    vulkan_shader_reflection reflection;
+    vertShaderStageInfo.module = vulkan_createShaderModule(renderer, "imgui_vert.spv", &reflection);
     vertShaderStageInfo.pName = "main";
 
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = vulkan_createShaderModule(renderer, "imgui_frag.spv");
+    vulkan_shader_reflection fragmentReflection;
+    fragShaderStageInfo.module = vulkan_createShaderModule(renderer, "imgui_frag.spv", &fragmentReflection);
+    vulkan_mergeReflection(&reflection, fragmentReflection);
     fragShaderStageInfo.pName = "main";
 
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
@@ -371,6 +327,13 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
     colorBlending.attachmentCount = 1;
     colorBlending.pAttachments = &colorBlendAttachment;
 
+    // The render pass has a depth attachment, the UI is drawn over everything without touching it
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_FALSE;
+    depthStencil.depthWriteEnable = VK_FALSE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
     VkDynamicState dynamicStates[] = {
         VK_DYNAMIC_STATE_SCISSOR,
         VK_DYNAMIC_STATE_VIEWPORT
@@ -381,27 +344,22 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
     dynamicState.dynamicStateCount = 2;
     dynamicState.pDynamicStates = dynamicStates;
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-    samplerLayoutBinding.binding = 0;
-    samplerLayoutBinding.descriptorCount = 1;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    
-    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &samplerLayoutBinding;
-
-    if (vkCreateDescriptorSetLayout(renderer->init_objects.device, &layoutInfo, nullptr, &imgui->descriptorSetLayout) != VK_SUCCESS) {
+    // The font texture and the scale and translation of the vertices
+    if (reflection.sets.size() != 1 || reflection.sets[0].size() != 1 || reflection.pushConstantSize != sizeof(pushconstant_block)) {
+        throw std::runtime_error("imgui shaders don't match pushconstant_block!");
+    }
+
+    imgui->pushConstantStages = reflection.pushConstantStages;
+    imgui->descriptorSetLayout = vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, reflection.sets[0].data(), 1);
+    if (imgui->descriptorSetLayout == VK_NULL_HANDLE) {
         throw std::runtime_error("failed to create descriptor set layout!");
         return false;
     }
 
     VkPushConstantRange pushConstantRange = {};
     pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(pushconstant_block);
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.size = reflection.pushConstantSize;
+    pushConstantRange.stageFlags = reflection.pushConstantStages;
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -424,7 +382,7 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr;
+    pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = imgui->pipelineLayout;
@@ -432,36 +390,14 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
     pipelineInfo.basePipelineIndex = -1;
 
     VkPipeline graphicsPipeline;
-    if (vkCreateGraphicsPipelines(renderer->init_objects.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &imgui->pipeline) != VK_SUCCESS) {
+    if (vulkan_createGraphicsPipeline(renderer->init_objects.device, renderer->pipelineCache, &pipelineInfo, "imgui", &imgui->pipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create framebuffer!");
     }
 
     vkDestroyShaderModule(renderer->init_objects.device, vertShaderStageInfo.module, nullptr);
     vkDestroyShaderModule(renderer->init_objects.device, fragShaderStageInfo.module, nullptr);
 
-    VkDescriptorPoolSize poolSize = {};
-    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSize.descriptorCount = 1;
-
-    VkDescriptorPoolCreateInfo poolInfo = {};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
-    poolInfo.maxSets = 1;
-
-    if (vkCreateDescriptorPool(renderer->init_objects.device, &poolInfo, nullptr, &imgui->descriptorPool) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor pool!");
-    }
-
-    VkDescriptorSetAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = imgui->descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = &imgui->descriptorSetLayout;
-
-    if (vkAllocateDescriptorSets(renderer->init_objects.device, &allocInfo, &imgui->descriptorSet) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate descriptor sets!");
-    }
+    imgui->descriptorSet = vulkan_allocatePersistentDescriptorSet(renderer->descriptorAllocator, imgui->descriptorSetLayout);
 
     VkDescriptorImageInfo imageInfo = {};
     imageInfo.sampler = imgui->sampler;
@@ -483,6 +419,7 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
 }
 
 void imguivk_beginFrame(vulkan_renderer* renderer, imguivk* imgui) {
+    PROFILE_ZONE("imguivk_beginFrame");
     ImGuiIO& io = ImGui::GetIO();
 
     int w, h;
@@ -535,17 +472,6 @@ void imguivk_beginFrame(vulkan_renderer* renderer, imguivk* imgui) {
         glfwSetInputMode(imgui->window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
 
-    for (VkBuffer buffer : imgui->oldBuffers) {
-        vkDestroyBuffer(renderer->init_objects.device, buffer, nullptr);
-    }
-
-    for (VkDeviceMemory memory : imgui->oldDeviceMemory) {
-        vkFreeMemory(renderer->init_objects.device, memory, nullptr);
-    }
-
-    imgui->oldBuffers.clear();
-    imgui->oldDeviceMemory.clear();
-
     ImGui::NewFrame();
 
     ImGui::Begin("Mouse");
@@ -554,7 +480,19 @@ void imguivk_beginFrame(vulkan_renderer* renderer, imguivk* imgui) {
     ImGui::End();
 }
 
+// Replaces a frame buffer that is too small, with headroom so a slowly growing UI doesn't reallocate every frame
+static void grow_frame_buffer(vulkan_renderer* renderer, imguivk* imgui, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, vulkan_allocation& allocation, VkDeviceSize& capacity) {
+    if (capacity > 0) {
+        vulkan_destroyBuffer(renderer, buffer, allocation);
+    }
+
+    capacity = std::max(std::max(size, capacity + capacity / 2), (VkDeviceSize)IMGUIVK_MIN_BUFFER_SIZE);
+    vulkan_createBuffer(renderer, capacity, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, allocation);
+    imgui->bufferAllocations++;
+}
+
 void imguivk_endFrame(vulkan_renderer* renderer, imguivk* imgui) {
+    PROFILE_ZONE("imguivk_endFrame");
     ImGui::EndFrame();
     ImGui::Render();
 
@@ -572,39 +510,51 @@ void imguivk_endFrame(vulkan_renderer* renderer, imguivk* imgui) {
 
     vkCmdBindPipeline(renderer->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, imgui->pipeline);
 
-    vkCmdPushConstants(renderer->command_buffer, imgui->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushconstant_block), &pushconstant);
+    vkCmdPushConstants(renderer->command_buffer, imgui->pipelineLayout, imgui->pushConstantStages, 0, sizeof(pushconstant_block), &pushconstant);
     vkCmdSetViewport(renderer->command_buffer, 0, 1, &viewport);
 
     ImDrawData* drawData = ImGui::GetDrawData();
+    if (drawData->TotalVtxCount == 0) {
+        return;
+    }
 
-    for (int n = 0; n < drawData->CmdListsCount; n++)
-    {
-        const ImDrawList* cmd_list = drawData->CmdLists[n];
-        const ImDrawVert* vtx_buffer = cmd_list->VtxBuffer.Data;  // vertex buffer generated by Dear ImGui
-        const ImDrawIdx* idx_buffer = cmd_list->IdxBuffer.Data;   // index buffer generated by Dear ImGui
+    VkDeviceSize vertexSize = drawData->TotalVtxCount * sizeof(ImDrawVert);
+    VkDeviceSize indexSize = drawData->TotalIdxCount * sizeof(ImDrawIdx);
 
-        VkBuffer vertexBuffer, indexBuffer;
-        VkDeviceMemory vertexBufferMemory, indexBufferMemory;
+    // The frame slot's fence was waited on in renderer_begin_frame, so its buffers are free to overwrite or replace
+    imguivk_frame_buffers& buffers = imgui->frameBuffers[renderer->currentFrame];
+    if (vertexSize > buffers.vertexCapacity) {
+        grow_frame_buffer(renderer, imgui, vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, buffers.vertexBuffer, buffers.vertexAllocation, buffers.vertexCapacity);
+    }
+    if (indexSize > buffers.indexCapacity) {
+        grow_frame_buffer(renderer, imgui, indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, buffers.indexBuffer, buffers.indexAllocation, buffers.indexCapacity);
+    }
 
-        vulkan_createBuffer(renderer, cmd_list->VtxBuffer.size_in_bytes(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexBuffer, vertexBufferMemory);
-        vulkan_createBuffer(renderer, cmd_list->IdxBuffer.size_in_bytes(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indexBuffer, indexBufferMemory);
+    ImDrawVert* vertices = (ImDrawVert*)buffers.vertexAllocation.mapped;
+    ImDrawIdx* indices = (ImDrawIdx*)buffers.indexAllocation.mapped;
+    for (int n = 0; n < drawData->CmdListsCount; n++) {
+        const ImDrawList* cmd_list = drawData->CmdLists[n];
+        memcpy(vertices, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.size_in_bytes());
+        memcpy(indices, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.size_in_bytes());
+        vertices += cmd_list->VtxBuffer.Size;
+        indices += cmd_list->IdxBuffer.Size;
+    }
 
-        void* buffer;
-        vkMapMemory(renderer->init_objects.device, vertexBufferMemory, 0, cmd_list->VtxBuffer.size_in_bytes(), 0, &buffer);
-        memcpy(buffer, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.size_in_bytes());
-        vkUnmapMemory(renderer->init_objects.device, vertexBufferMemory);
+    imgui->frameCount++;
+    imgui->lastFrameBytes = vertexSize + indexSize;
 
-        vkMapMemory(renderer->init_objects.device, indexBufferMemory, 0, cmd_list->IdxBuffer.size_in_bytes(), 0, &buffer);
-        memcpy(buffer, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.size_in_bytes());
-        vkUnmapMemory(renderer->init_objects.device, indexBufferMemory);
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(renderer->command_buffer, 0, 1, &buffers.vertexBuffer, &offset);
+    vkCmdBindIndexBuffer(renderer->command_buffer, buffers.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    vkCmdBindDescriptorSets(renderer->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, imgui->pipelineLayout, 0, 1, &imgui->descriptorSet, 0, nullptr);
 
-        VkBuffer vertexBuffers[] = {vertexBuffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(renderer->command_buffer, 0, 1, vertexBuffers, offsets);
-        vkCmdBindIndexBuffer(renderer->command_buffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-        vkCmdBindDescriptorSets(renderer->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, imgui->pipelineLayout, 0, 1, &imgui->descriptorSet, 0, nullptr);
+    // Every draw list starts at its own base vertex and first index in the shared buffers
+    int32_t vertexOffset = 0;
+    uint32_t indexOffset = 0;
 
-        VkDeviceSize indexBufferOffset = 0;
+    for (int n = 0; n < drawData->CmdListsCount; n++)
+    {
+        const ImDrawList* cmd_list = drawData->CmdLists[n];
 
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
         {
@@ -624,33 +574,288 @@ void imguivk_endFrame(vulkan_renderer* renderer, imguivk* imgui) {
 				scissorRect.extent = renderer->init_objects.swapchainExtent;
 				scissorRect.offset = {0, 0};
 				vkCmdSetScissor(renderer->command_buffer, 0, 1, &scissorRect);
-                vkCmdDrawIndexed(renderer->command_buffer, pcmd->ElemCount, 1, indexBufferOffset, 0, 0);
+                vkCmdDrawIndexed(renderer->command_buffer, pcmd->ElemCount, 1, indexOffset, vertexOffset, 0);
             }
-            indexBufferOffset += pcmd->ElemCount;
+            indexOffset += pcmd->ElemCount;
         }
 
-        imgui->oldBuffers.push_back(vertexBuffer);
-        imgui->oldBuffers.push_back(indexBuffer);
-        imgui->oldDeviceMemory.push_back(vertexBufferMemory);
-        imgui->oldDeviceMemory.push_back(indexBufferMemory);
+        vertexOffset += cmd_list->VtxBuffer.Size;
     }
 }
 
-void imguivk_deinit(vulkan_renderer* renderer, imguivk* imgui) {
-    for (const auto& buffer : imgui->oldBuffers) {
-        vkDestroyBuffer(renderer->init_objects.device, buffer, nullptr);
+void imguivk_frameMetricsWindow(vulkan_renderer* renderer) {
+    const vulkan_frame_metrics& metrics = renderer->metrics;
+
+    float averageFrame = 0.0f;
+    float averageFenceWait = 0.0f;
+    for (int i = 0; i < RENDERER_METRICS_HISTORY; i++) {
+        averageFrame += metrics.frameHistory[i] / RENDERER_METRICS_HISTORY;
+        averageFenceWait += metrics.fenceWaitHistory[i] / RENDERER_METRICS_HISTORY;
     }
 
-    for (const auto& memory : imgui->oldDeviceMemory) {
-        vkFreeMemory(renderer->init_objects.device, memory, nullptr);
+    // Share of the frame the CPU kept working instead of waiting for the GPU to finish an older frame
+    float overlap = averageFrame > 0.0f ? 100.0f * (1.0f - averageFenceWait / averageFrame) : 0.0f;
+
+    ImGui::Begin("Frame timing");
+    ImGui::Text("Frames in flight: %d", (int)renderer->frames.size());
+    if (!renderer->init_objects.headless) {
+        static const VkPresentModeKHR presentModes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+        static const char* presentModeNames[] = { "FIFO", "Mailbox", "Immediate", "FIFO relaxed" };
+
+        int current = 0;
+        for (int i = 0; i < IM_ARRAYSIZE(presentModes); i++) {
+            if (presentModes[i] == renderer->init_objects.requestedPresentMode) {
+                current = i;
+            }
+        }
+
+        // Unsupported modes fall back to FIFO when the swapchain is recreated
+        if (ImGui::Combo("Present mode", &current, presentModeNames, IM_ARRAYSIZE(presentModeNames))) {
+            renderer->init_objects.requestedPresentMode = presentModes[current];
+            renderer->swapchainDirty = true;
+        }
+        ImGui::Checkbox("Low latency", &renderer->lowLatency);
+
+        const char* activeName = "other";
+        for (int i = 0; i < IM_ARRAYSIZE(presentModes); i++) {
+            if (presentModes[i] == renderer->init_objects.presentMode) {
+                activeName = presentModeNames[i];
+            }
+        }
+        ImGui::Text("Swapchain: %s, %d images, %ux%u", activeName, (int)renderer->framebuffers.size(),
+            renderer->init_objects.swapchainExtent.width, renderer->init_objects.swapchainExtent.height);
+    }
+    ImGui::Text("Frame: %.2f ms (%.1f fps)", metrics.frameMilliseconds, averageFrame > 0.0f ? 1000.0f / averageFrame : 0.0f);
+    ImGui::Text("Fence wait: %.2f ms", metrics.fenceWaitMilliseconds);
+    ImGui::Text("Acquire: %.2f ms", metrics.acquireMilliseconds);
+    ImGui::Text("CPU record and submit: %.2f ms", metrics.cpuMilliseconds);
+    ImGui::Text("Secondary command buffers: %u", metrics.secondaryCommandBuffers);
+    ImGui::Text("CPU/GPU overlap: %.1f%%", overlap);
+    if (renderer->statisticsQueries != VK_NULL_HANDLE) {
+        ImGui::Text("Overdraw: %.2f (%llu fragments)", metrics.overdraw, (unsigned long long)metrics.fragmentInvocations);
     }
+    ImGui::PlotLines("Frame ms", metrics.frameHistory, RENDERER_METRICS_HISTORY, metrics.historyOffset, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+    ImGui::PlotLines("Fence wait ms", metrics.fenceWaitHistory, RENDERER_METRICS_HISTORY, metrics.historyOffset, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+    ImGui::End();
+}
+
+void imguivk_memoryStatsWindow(vulkan_renderer* renderer, imguivk* imgui) {
+    vulkan_allocator* allocator = renderer->allocator;
+
+    vulkan_memory_stats total;
+    std::vector<vulkan_memory_stats> heaps(allocator->memoryProperties.memoryHeapCount);
+    vulkan_getMemoryStats(allocator, &total, heaps.data());
+
+    ImGui::Begin("Device memory");
+    ImGui::Text("Allocations: %u in %u blocks, %u dedicated", total.allocationCount, total.blockCount, total.dedicatedCount);
+    ImGui::Text("vkAllocateMemory calls: %llu", (unsigned long long)allocator->deviceAllocations);
+    ImGui::Text("Descriptor pools: %u, %u sets last frame, %u cached layouts", renderer->descriptorAllocator->poolCount, renderer->descriptorAllocator->setsLastFrame,
+                (uint32_t)renderer->descriptorLayouts->entries.size());
+    ImGui::Text("Frame ring: %.1f KB last frame, %.1f KB peak of %.1f KB per slot", renderer->frameRing->usedLastFrame / 1024.0f, renderer->frameRing->peakUsed / 1024.0f,
+                renderer->frameRing->size / 1024.0f);
+    ImGui::Text("ImGui geometry: %.1f KB last frame, %u buffer allocations in %llu frames", imgui->lastFrameBytes / 1024.0f, imgui->bufferAllocations, (unsigned long long)imgui->frameCount);
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        const vulkan_memory_stats& heap = heaps[i];
+        if (heap.blockCount == 0 && heap.dedicatedCount == 0) {
+            continue;
+        }
 
+        bool deviceLocal = allocator->memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        ImGui::Separator();
+        ImGui::Text("Heap %u%s", i, deviceLocal ? " (device local)" : "");
+        ImGui::Text("Blocks: %.1f of %.1f MB used", heap.usedBytes / (1024.0f * 1024.0f), heap.blockBytes / (1024.0f * 1024.0f));
+        ImGui::Text("Dedicated: %.1f MB", heap.dedicatedBytes / (1024.0f * 1024.0f));
+        ImGui::Text("Largest free range: %.1f KB", heap.largestFreeRange / 1024.0f);
+    }
+    ImGui::End();
+}
+
+void imguivk_pipelineLibraryWindow(vulkan_pipeline_library* library, bool* wireframe) {
+    uint32_t compiling = 0;
+    for (const vulkan_pipeline_entry& entry : library->entries) {
+        if (entry.state.load() == PIPELINE_COMPILING) {
+            compiling++;
+        }
+    }
+
+    ImGui::Begin("Pipelines");
+    ImGui::Text("Pipelines: %u, %u compiling", (uint32_t)library->entries.size(), compiling);
+    ImGui::Text("Requests: %u, %u deduplicated", library->requests, library->deduplicated);
+    ImGui::Text("Fallback binds: %llu", (unsigned long long)library->fallbackBinds);
+    ImGui::Checkbox("Wireframe", wireframe);
+    ImGui::End();
+}
+
+void imguivk_gpuProfilerWindow(vulkan_gpu_profiler* profiler) {
+    ImGui::Begin("GPU profiler");
+    if (!profiler->supported) {
+        ImGui::Text("The graphics queue has no timestamps");
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Checkbox("Pause", &profiler->paused);
+    ImGui::SameLine();
+    if (ImGui::Button("Export trace")) {
+        vulkan_exportGpuTrace(profiler, "gpu_trace.json");
+    }
+
+    if (profiler->history.empty()) {
+        ImGui::End();
+        return;
+    }
+
+    const vulkan_gpu_frame& latest = profiler->history.back();
+
+    std::vector<float> frameHistory;
+    for (const vulkan_gpu_frame& frame : profiler->history) {
+        frameHistory.push_back((float)frame.durationMilliseconds);
+    }
+    ImGui::Text("GPU frame: %.3f ms", latest.durationMilliseconds);
+    ImGui::PlotLines("GPU ms", frameHistory.data(), (int)frameHistory.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 60));
+
+    ImGui::Columns(3, "gpu scopes");
+    ImGui::Text("Scope");
+    ImGui::NextColumn();
+    ImGui::Text("ms");
+    ImGui::NextColumn();
+    ImGui::Text("Average ms");
+    ImGui::NextColumn();
+    ImGui::Separator();
+
+    for (const vulkan_gpu_scope& scope : latest.scopes) {
+        // Names are string literals, so the same scope has the same pointer in every frame
+        double total = 0.0;
+        uint32_t count = 0;
+        for (const vulkan_gpu_frame& frame : profiler->history) {
+            for (const vulkan_gpu_scope& other : frame.scopes) {
+                if (other.name == scope.name) {
+                    total += other.durationMilliseconds;
+                    count++;
+                }
+            }
+        }
+
+        ImGui::Text("%*s%s", (int)scope.depth * 2, "", scope.name);
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", scope.durationMilliseconds);
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", count > 0 ? total / count : 0.0);
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::Separator();
+
+    // One row per nesting depth, the frame spans the whole width
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+    float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    double scale = width / std::max(latest.durationMilliseconds, 0.001);
+    uint32_t rows = 1;
+
+    for (const vulkan_gpu_scope& scope : latest.scopes) {
+        ImVec2 min(origin.x + (float)(scope.beginMilliseconds * scale), origin.y + scope.depth * rowHeight);
+        ImVec2 max(std::max(min.x + 1.0f, origin.x + (float)((scope.beginMilliseconds + scope.durationMilliseconds) * scale)), min.y + rowHeight - 1.0f);
+        float hue = (float)(std::hash<std::string>()(scope.name) % 360) / 360.0f;
+
+        drawList->AddRectFilled(min, max, ImColor::HSV(hue, 0.6f, 0.7f));
+        drawList->PushClipRect(min, max, true);
+        drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32_WHITE, scope.name);
+        drawList->PopClipRect();
+
+        if (ImGui::IsMouseHoveringRect(min, max)) {
+            ImGui::SetTooltip("%s: %.3f ms at %.3f ms", scope.name, scope.durationMilliseconds, scope.beginMilliseconds);
+        }
+        rows = std::max(rows, scope.depth + 1);
+    }
+    ImGui::Dummy(ImVec2(width, rows * rowHeight));
+
+    ImGui::End();
+}
+
+void imguivk_cpuProfilerWindow() {
+    // Kept between frames so pausing holds on to a frame
+    static std::vector<profiler_thread_events> threads;
+    static uint64_t frameBegin = 0;
+    static uint64_t frameEnd = 0;
+    static bool paused = false;
+
+    ImGui::Begin("CPU profiler");
+
+    bool enabled = profiler_enabled.load(std::memory_order_relaxed);
+    if (ImGui::Checkbox("Enabled", &enabled)) {
+        profiler_set_enabled(enabled);
+    }
+    ImGui::SameLine();
+    ImGui::Checkbox("Pause", &paused);
+    ImGui::SameLine();
+    if (ImGui::Button("Export trace")) {
+        profiler_export_trace("cpu_trace.json");
+    }
+
+    if (!paused && profiler_last_frame(&frameBegin, &frameEnd)) {
+        profiler_collect(frameBegin, frameEnd, threads);
+    }
+
+    double frameMilliseconds = (frameEnd - frameBegin) / 1000000.0;
+    ImGui::Text("CPU frame: %.3f ms", frameMilliseconds);
+    ImGui::Separator();
+
+    // A block of rows per thread, zones are clipped to the frame and stacked by depth
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+    float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    double scale = width / std::max((double)(frameEnd - frameBegin), 1.0);
+
+    for (const profiler_thread_events& thread : threads) {
+        if (thread.events.empty()) {
+            continue;
+        }
+
+        ImGui::Text("%s", thread.name.c_str());
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        uint32_t rows = 1;
+
+        for (const profiler_event& event : thread.events) {
+            uint64_t begin = std::max(event.beginNanoseconds, frameBegin) - frameBegin;
+            uint64_t end = std::min(event.endNanoseconds, frameEnd) - frameBegin;
+
+            ImVec2 min(origin.x + (float)(begin * scale), origin.y + event.depth * rowHeight);
+            ImVec2 max(std::max(min.x + 1.0f, origin.x + (float)(end * scale)), min.y + rowHeight - 1.0f);
+            float hue = (float)(std::hash<std::string>()(event.name) % 360) / 360.0f;
+
+            drawList->AddRectFilled(min, max, ImColor::HSV(hue, 0.6f, 0.7f));
+            drawList->PushClipRect(min, max, true);
+            drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32_WHITE, event.name);
+            drawList->PopClipRect();
+
+            if (ImGui::IsMouseHoveringRect(min, max)) {
+                ImGui::SetTooltip("%s: %.3f ms at %.3f ms", event.name, (event.endNanoseconds - event.beginNanoseconds) / 1000000.0,
+                                  ((double)event.beginNanoseconds - (double)frameBegin) / 1000000.0);
+            }
+            rows = std::max(rows, event.depth + 1);
+        }
+        ImGui::Dummy(ImVec2(width, rows * rowHeight));
+    }
+
+    ImGui::End();
+}
+
+void imguivk_deinit(vulkan_renderer* renderer, imguivk* imgui) {
     vkDestroyPipeline(renderer->init_objects.device, imgui->pipeline, nullptr);
     vkDestroyPipelineLayout(renderer->init_objects.device, imgui->pipelineLayout, nullptr);
-    vkDestroyDescriptorPool(renderer->init_objects.device, imgui->descriptorPool, nullptr);
-    vkDestroyDescriptorSetLayout(renderer->init_objects.device, imgui->descriptorSetLayout, nullptr);
     vkDestroySampler(renderer->init_objects.device, imgui->sampler, nullptr);
     vkDestroyImageView(renderer->init_objects.device, imgui->imageView, nullptr);
-    vkFreeMemory(renderer->init_objects.device, imgui->textureImageMemory, nullptr);
-    vkDestroyImage(renderer->init_objects.device, imgui->textureImage, nullptr);
+    vulkan_destroyImage(renderer, imgui->textureImage, imgui->textureImageAllocation);
+
+    for (imguivk_frame_buffers& buffers : imgui->frameBuffers) {
+        if (buffers.vertexCapacity > 0) {
+            vulkan_destroyBuffer(renderer, buffers.vertexBuffer, buffers.vertexAllocation);
+        }
+        if (buffers.indexCapacity > 0) {
+            vulkan_destroyBuffer(renderer, buffers.indexBuffer, buffers.indexAllocation);
+        }
+    }
+    imgui->frameBuffers.clear();
 }
\ No newline at end of file
@@ -17,21 +17,35 @@
 #pragma once
 
 #include "../vulkan/vulkan_renderer.h"
+#include "../vulkan/vulkan_pipeline_library.h"
 #include "imgui.h"
 
+// Geometry of all draw lists of a frame, packed back to back. One per frame in flight, reused once its fence is waited on
+struct imguivk_frame_buffers {
+    VkBuffer vertexBuffer;
+    vulkan_allocation vertexAllocation;
+    VkDeviceSize vertexCapacity;
+    VkBuffer indexBuffer;
+    vulkan_allocation indexAllocation;
+    VkDeviceSize indexCapacity;
+};
+
 struct imguivk {
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    vulkan_allocation textureImageAllocation;
     VkImageView imageView;
     VkSampler sampler;
     VkDescriptorSetLayout descriptorSetLayout;
-    VkDescriptorPool descriptorPool;
     VkDescriptorSet descriptorSet;
     VkPipelineLayout pipelineLayout;
+    VkShaderStageFlags pushConstantStages;
     VkPipeline pipeline;
-    std::vector<VkBuffer> oldBuffers;
-    std::vector<VkDeviceMemory> oldDeviceMemory;
     GLFWwindow* window;
+    std::vector<imguivk_frame_buffers> frameBuffers;
+    // Buffers created because the geometry outgrew the old ones, over frameCount frames
+    uint32_t bufferAllocations;
+    uint64_t frameCount;
+    VkDeviceSize lastFrameBytes;
 };
 
 bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window);
@@ -39,4 +53,19 @@ bool imguivk_init(vulkan_renderer* renderer, imguivk* imgui, GLFWwindow* window)
 void imguivk_beginFrame(vulkan_renderer* renderer, imguivk* imgui);
 void imguivk_endFrame(vulkan_renderer* renderer, imguivk* imgui);
 
+// Frame time, fence waits and CPU/GPU overlap of the renderer
+void imguivk_frameMetricsWindow(vulkan_renderer* renderer);
+
+// Block and dedicated usage of the device memory allocator per heap and the ImGui geometry buffers
+void imguivk_memoryStatsWindow(vulkan_renderer* renderer, imguivk* imgui);
+
+// Pipeline library counters and a toggle for the wireframe variant
+void imguivk_pipelineLibraryWindow(vulkan_pipeline_library* library, bool* wireframe);
+
+// Scope timings of the last resolved GPU frame, their averages over the history and a timeline of the frame
+void imguivk_gpuProfilerWindow(vulkan_gpu_profiler* profiler);
+
+// Flame view of the zones every thread recorded during the last frame
+void imguivk_cpuProfilerWindow();
+
 void imguivk_deinit(vulkan_renderer* renderer, imguivk* imgui);
\ No newline at end of file
@@ -0,0 +1,151 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "jobs.h"
+#include "profiler.h"
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <string>
+
+static thread_local unsigned int threadIndex = 0;
+
+static void worker_main(job_system* jobs, unsigned int index) {
+    threadIndex = index;
+    std::string threadName = "worker " + std::to_string(index);
+    profiler_set_thread_name(threadName.c_str());
+
+    while (true) {
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(jobs->mutex);
+            jobs->jobAvailable.wait(lock, [jobs]() { return jobs->quit || !jobs->queue.empty(); });
+
+            if (jobs->queue.empty()) {
+                return;
+            }
+
+            job = std::move(jobs->queue.front());
+            jobs->queue.pop_front();
+        }
+
+        PROFILE_ZONE("job");
+        job();
+    }
+}
+
+job_system* init_job_system(unsigned int workerCount) {
+    job_system* jobs = new job_system();
+    jobs->quit = false;
+
+    for (unsigned int i = 0; i < workerCount; i++) {
+        jobs->workers.emplace_back(worker_main, jobs, i + 1);
+    }
+
+    return jobs;
+}
+
+void deinit_job_system(job_system* jobs) {
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->quit = true;
+    }
+
+    jobs->jobAvailable.notify_all();
+
+    for (std::thread& worker : jobs->workers) {
+        worker.join();
+    }
+
+    delete jobs;
+}
+
+unsigned int job_system_default_worker_count() {
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+
+    // Leave one core for the main thread
+    return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+}
+
+unsigned int job_system_thread_index() {
+    return threadIndex;
+}
+
+unsigned int job_system_thread_count(job_system* jobs) {
+    return (unsigned int)jobs->workers.size() + 1;
+}
+
+void job_system_submit(job_system* jobs, std::function<void()> job) {
+    if (jobs->workers.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->queue.push_back(std::move(job));
+    }
+
+    jobs->jobAvailable.notify_one();
+}
+
+// Shared with the helpers, a helper that only starts after the loop is done must not touch the caller's stack
+struct parallel_for_state {
+    std::atomic<size_t> nextIndex;
+    size_t count;
+    size_t completed;
+    const std::function<void(size_t)>* function;
+    std::mutex doneMutex;
+    std::condition_variable done;
+};
+
+static void parallel_for_work(parallel_for_state* state) {
+    size_t index;
+    size_t finished = 0;
+    while ((index = state->nextIndex.fetch_add(1)) < state->count) {
+        (*state->function)(index);
+        finished++;
+    }
+
+    if (finished > 0) {
+        std::lock_guard<std::mutex> lock(state->doneMutex);
+        state->completed += finished;
+        state->done.notify_all();
+    }
+}
+
+void job_system_parallel_for(job_system* jobs, size_t count, const std::function<void(size_t)>& function) {
+    std::shared_ptr<parallel_for_state> state = std::make_shared<parallel_for_state>();
+    state->nextIndex = 0;
+    state->count = count;
+    state->completed = 0;
+    state->function = &function;
+
+    // Returns once every index is done instead of waiting for all helpers, which may sit behind long jobs in the queue
+    size_t helperCount = std::min<size_t>(jobs->workers.size(), count > 0 ? count - 1 : 0);
+    for (size_t i = 0; i < helperCount; i++) {
+        job_system_submit(jobs, [state]() {
+            parallel_for_work(state.get());
+        });
+    }
+
+    parallel_for_work(state.get());
+
+    std::unique_lock<std::mutex> lock(state->doneMutex);
+    state->done.wait(lock, [&]() { return state->completed == count; });
+}
@@ -0,0 +1,49 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+struct job_system {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    bool quit;
+};
+
+// workerCount 0 runs everything on the calling thread
+job_system* init_job_system(unsigned int workerCount);
+void deinit_job_system(job_system* jobs);
+
+unsigned int job_system_default_worker_count();
+
+// 0 on threads that are not workers, worker i gets i + 1. Lets jobs pick per-thread resources without locking.
+unsigned int job_system_thread_index();
+// Upper bound of job_system_thread_index() for this job system
+unsigned int job_system_thread_count(job_system* jobs);
+
+void job_system_submit(job_system* jobs, std::function<void()> job);
+
+// Calls function for every index in [0, count) on the workers and the calling thread, returns when all are done.
+// Must not be called from inside a job.
+void job_system_parallel_for(job_system* jobs, size_t count, const std::function<void(size_t)>& function);
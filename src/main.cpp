@@ -15,6 +15,8 @@
 */
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -26,37 +28,104 @@
 #include "camera.h"
 #include "bsp/vpk.h"
 #include "bsp/bsp_rendering.h"
+#include "bsp/bsp_lightmap.h"
+#include "jobs.h"
+#include "cooked_store.h"
+#include "profiler.h"
+#include "benchmark.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 
-int main() {
-	if (glfwInit() != GLFW_TRUE) {
-		std::cout << "GLFW cant be initialized" << std::endl;
-	}
-
-	if (glfwVulkanSupported() != GLFW_TRUE) {
-		std::cout << "Vulkan is not supported on this platform!" << std::endl;
+int main(int argc, char** argv) {
+	// Headless runs render a fixed number of frames without a window and can write every readbackInterval-th one to disk
+	bool headless = false;
+	uint64_t headlessFrames = 300;
+	uint64_t readbackInterval = 0;
+	// Benchmarks play a camera path back instead of taking input, recordings write the flown path on exit
+	std::string benchmarkPathFile;
+	std::string benchmarkReportFile = "benchmark_report.json";
+	std::string recordPathFile;
+	// Swapchain requests, an image count of 0 lets the swapchain pick one more than the minimum
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t swapchainImageCount = 0;
+	bool lowLatency = false;
+	// Watches the shader sources and rebuilds pipelines when they change
+	bool shaderDev = false;
+	// Times decoding the lighting lump of the loaded map in every lightmap format
+	bool lightmapBenchmark = false;
+
+	// Checked this early so loading shows up in traces too
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		if (argument == "--profile") {
+			profiler_set_enabled(true);
+		} else if (argument == "--headless") {
+			headless = true;
+		} else if (argument == "--frames" && i + 1 < argc) {
+			headlessFrames = std::stoull(argv[++i]);
+		} else if (argument == "--readback" && i + 1 < argc) {
+			readbackInterval = std::stoull(argv[++i]);
+		} else if (argument == "--benchmark" && i + 1 < argc) {
+			benchmarkPathFile = argv[++i];
+		} else if (argument == "--benchmark-report" && i + 1 < argc) {
+			benchmarkReportFile = argv[++i];
+		} else if (argument == "--record-path" && i + 1 < argc) {
+			recordPathFile = argv[++i];
+		} else if (argument == "--present-mode" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "mailbox") {
+				presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+			} else if (mode == "immediate") {
+				presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			} else if (mode == "fifo_relaxed") {
+				presentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+			} else if (mode != "fifo") {
+				std::cout << "Unknown present mode " << mode << ", using fifo" << std::endl;
+			}
+		} else if (argument == "--swapchain-images" && i + 1 < argc) {
+			swapchainImageCount = (uint32_t)std::stoul(argv[++i]);
+		} else if (argument == "--low-latency") {
+			lowLatency = true;
+		} else if (argument == "--shader-dev") {
+			shaderDev = true;
+		} else if (argument == "--lightmap-benchmark") {
+			lightmapBenchmark = true;
+		}
 	}
+	profiler_set_thread_name("main");
 
     vulkan_init_parameters init_params = {};
 
 	init_params.width = 1280;
 	init_params.height = 720;
+	init_params.headless = headless;
+	init_params.presentMode = presentMode;
+	// Fewer images also means fewer frames the presentation engine can queue up
+	init_params.swapchainImageCount = swapchainImageCount == 0 && lowLatency ? 2 : swapchainImageCount;
+
+	GLFWwindow* window = nullptr;
+	if (!headless) {
+		if (glfwInit() != GLFW_TRUE) {
+			std::cout << "GLFW cant be initialized" << std::endl;
+		}
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-	GLFWwindow* window = glfwCreateWindow(init_params.width, init_params.height, "Vulkan", nullptr, nullptr);
+		if (glfwVulkanSupported() != GLFW_TRUE) {
+			std::cout << "Vulkan is not supported on this platform!" << std::endl;
+		}
 
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+		window = glfwCreateWindow(init_params.width, init_params.height, "Vulkan", nullptr, nullptr);
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-    std::vector<const char*> requiredExtensions;
-    for (int i = 0; i < glfwExtensionCount; i++) {
-        init_params.instanceExtensions.push_back(glfwExtensions[i]);
-    }
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		for (uint32_t i = 0; i < glfwExtensionCount; i++) {
+			init_params.instanceExtensions.push_back(glfwExtensions[i]);
+		}
 
-    init_params.deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+		init_params.deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+    init_params.useDescriptorIndexing = true;
 
 //#ifndef NDEBUG
 	init_params.useValidationLayers = true;
@@ -78,7 +147,7 @@ int main() {
         return 1;
 	}
 
-	vulkan_renderer* renderer = init_renderer(objects);
+	vulkan_renderer* renderer = init_renderer(objects, RENDERER_DEFAULT_FRAMES_IN_FLIGHT);
 	if (renderer == nullptr) {
 		std::cout << "Error initializing Vulkan!" << std::endl;
 		deinit_vulkan(&objects);
@@ -86,70 +155,192 @@ int main() {
         glfwTerminate();
         return 1;
 	}
+	renderer->lowLatency = lowLatency;
 	std::cout << "Vulkan has been initialized" << std::endl;
 
+	// Nothing to show the UI on without a window
 	imguivk imgui;
-	imguivk_init(renderer, &imgui, window);
-
-	std::cout << "DearImGui has been intialized" << std::endl;
+	if (!headless) {
+		imguivk_init(renderer, &imgui, window);
+		std::cout << "DearImGui has been intialized" << std::endl;
+	}
 
 	std::string csgo_folder = "C:\\Program Files (x86)\\Steam\\steamapps\\common\\Counter-Strike Global Offensive\\csgo\\";
 	//std::string csgo_folder = "/Users/kaizi99/Library/Application Support/Steam/steamapps/common/Counter-Strike Global Offensive/csgo/";
-	std::cout << "Loading: de_train.bsp" << std::endl;
+	std::string map = "de_train";
 
-	bsp_parsed* parsed = load_bsp(csgo_folder + "maps/de_train.bsp");
-	//bsp_rendering_data bsp_rendering = bsp_rendering_prepare(parsed, renderer);
+	benchmark_path benchmarkPath;
+	bool benchmarking = !benchmarkPathFile.empty() && load_benchmark_path(benchmarkPathFile, &benchmarkPath);
+	if (benchmarking && !benchmarkPath.map.empty()) {
+		map = benchmarkPath.map;
+	}
+
+	std::cout << "Loading: " << map << ".bsp" << std::endl;
+
+	bsp_parsed* parsed = load_bsp(csgo_folder + "maps/" + map + ".bsp");
 
 	//std::string gmod_folder = "C:\\Program Files (x86)\\Steam\\steamapps\\common\\GarrysMod\\garrysmod\\";
 	//bsp_parsed* parsed = load_bsp(gmod_folder + "maps\\gm_construct.bsp");
 
 	assert(parsed != nullptr);
 
-	//bsp_rendering_data bsp_rendering = bsp_rendering_prepare(parsed, renderer);
+	if (lightmapBenchmark) {
+		bsp_lightmap_benchmark(parsed);
+	}
 
-	/*
     vpk_directory* vpk = load_vpk(csgo_folder, "pak01");
 
-	for (int i = 0; i < parsed->textureCount; i++) {
-		std::string textureName = parsed->textures[i].textureName;
-		std::string toSearch = "materials/" + textureName;
+	job_system* jobs = init_job_system(job_system_default_worker_count());
+	cooked_store* cooked = init_cooked_store("cooked");
 
-		auto entry = vpk->entries["vmt"].find(toSearch);
+	vulkan_pipeline_library* pipelines = init_pipeline_library(renderer, jobs);
 
-		if (entry == vpk->entries["vmt"].end()) {
-
-		}
-
-		std::cout << textureName << std::endl;
-	}
-	*/
+	bsp_rendering_data bsp_rendering = bsp_rendering_prepare(parsed, vpk, jobs, cooked, pipelines, renderer);
+	vulkan_printMemoryStats(renderer->allocator);
 
 	camera c;
 	c.position = glm::vec3(-50, -1300, -20);
 	c.rotation = glm::vec3(0.0f);
+	c.rotationQuat = glm::quat(c.rotation);
 	c.fov = 90;
 	c.aspectRatio = (float)init_params.width / (float)init_params.height;
 
-	while (!glfwWindowShouldClose(window)) {
-	    glfwPollEvents();
+	benchmark_run benchmark;
+	if (benchmarking) {
+		init_benchmark_run(&benchmark, &benchmarkPath);
+	}
+
+	benchmark_recorder recorder;
+	bool recording = !recordPathFile.empty() && !headless;
+	if (recording) {
+		init_benchmark_recorder(&recorder, map);
+	}
+
+	auto renderBegin = std::chrono::high_resolution_clock::now();
+	while (headless ? benchmarking || renderer->frameNumber < headlessFrames : !glfwWindowShouldClose(window)) {
+		if (benchmarking && !benchmark_next_frame(&benchmark, renderer, &c)) {
+			break;
+		}
+
+		profiler_frame_mark();
+		PROFILE_ZONE("frame");
+
+		if (!headless) {
+			PROFILE_ZONE("poll events");
+			glfwPollEvents();
+		}
+
+		if (shaderDev && !headless) {
+			std::vector<std::string> reloaded = vulkan_pollShaderSources(renderer->shaders);
+			if (!reloaded.empty()) {
+				vulkan_reloadPipelineShaders(pipelines, reloaded);
+				bsp_rendering_reload_shaders(&bsp_rendering, renderer, reloaded);
+				renderer_reload_shaders(renderer, reloaded);
+			}
+		}
 
 		renderer_begin_frame(renderer);
+		// The swapchain may have been recreated with a new size
+		c.aspectRatio = (float)renderer->init_objects.swapchainExtent.width / (float)renderer->init_objects.swapchainExtent.height;
 
-		imguivk_beginFrame(renderer, &imgui);
+		if (headless && readbackInterval > 0 && renderer->frameNumber % readbackInterval == 0) {
+			renderer_request_readback(renderer, "frame_" + std::to_string(renderer->frameNumber) + ".ppm");
+		}
 
-		bool metrics = true;
-		ImGui::ShowMetricsWindow(&metrics);
+		if (!headless) {
+			imguivk_beginFrame(renderer, &imgui);
+
+			bool metrics = true;
+			ImGui::ShowMetricsWindow(&metrics);
+			imguivk_frameMetricsWindow(renderer);
+			imguivk_gpuProfilerWindow(renderer->gpuProfiler);
+			imguivk_cpuProfilerWindow();
+			imguivk_memoryStatsWindow(renderer, &imgui);
+			imguivk_pipelineLibraryWindow(pipelines, &bsp_rendering.wireframe);
+
+			ImGui::Begin("Recording");
+			ImGui::Checkbox("Parallel recording", &bsp_rendering.parallelRecording);
+			ImGui::Text("Batches: %u", (uint32_t)bsp_rendering.batches.size());
+			{
+				// The depth prepass fetches the interleaved vertices a second time
+				double vertexMegabytes = (double)bsp_rendering.vertexCount * bsp_rendering.vertexStride / (1024.0 * 1024.0);
+				double floatMegabytes = bsp_rendering.vertexCount * sizeof(bsp_float_vertex) / (1024.0 * 1024.0);
+				double passes = bsp_rendering.depthPrepass ? 2.0 : 1.0;
+				ImGui::Text("Vertices: %u, %.2f MB quantised, %.2f MB as floats", bsp_rendering.vertexCount, vertexMegabytes, floatMegabytes);
+				ImGui::Text("Vertex fetch per frame without culling: %.2f MB, %.2f MB as floats", vertexMegabytes * passes, floatMegabytes * passes);
+				ImGui::Text("Quantisation error: %.4f units, %.3f texels, %.3f luxels", bsp_rendering.vertexError.position, bsp_rendering.vertexError.uv, bsp_rendering.vertexError.lightmapUV);
+				if (bsp_rendering.floatUVs) {
+					ImGui::Text("Float UVs, a face is too large for 16 bit UVs");
+				}
+			}
+			if (bsp_rendering.gpuDrivenSupported) {
+				ImGui::Checkbox("GPU driven", &bsp_rendering.gpuDriven);
+				ImGui::CheckboxFlags("Frustum culling", &bsp_rendering.cullFlags, BSP_CULL_FRUSTUM);
+				ImGui::CheckboxFlags("PVS culling", &bsp_rendering.cullFlags, BSP_CULL_PVS);
+				ImGui::CheckboxFlags("Backface culling", &bsp_rendering.cullFlags, BSP_CULL_BACKFACE);
+				ImGui::CheckboxFlags("Occlusion culling", &bsp_rendering.cullFlags, BSP_CULL_OCCLUSION);
+				ImGui::Text("Visible faces: %u of %u", bsp_rendering.gpuVisibleFaces, bsp_rendering.gpuFaceCount);
+				ImGui::Text("Culled by PVS: %u, frustum: %u, backface: %u, occlusion: %u", bsp_rendering.gpuCulledFaces[BSP_CULL_STAT_PVS], bsp_rendering.gpuCulledFaces[BSP_CULL_STAT_FRUSTUM],
+					bsp_rendering.gpuCulledFaces[BSP_CULL_STAT_BACKFACE], bsp_rendering.gpuCulledFaces[BSP_CULL_STAT_OCCLUSION]);
+			}
+			ImGui::Checkbox("Depth prepass", &bsp_rendering.depthPrepass);
+			ImGui::End();
+
+			if (!benchmarking) {
+				PROFILE_ZONE("update camera");
+				updateCamera(&c, window);
+			}
+			if (recording) {
+				benchmark_record_camera(&recorder, &c);
+			}
+		}
 
-		updateCamera(&c, window);
-		//bsp_render(&bsp_rendering, renderer, &c);
+		// Chunks recorded on the workers end up between the two timestamps since secondaries execute in order
+		uint32_t worldScope = vulkan_beginGpuScope(renderer->gpuProfiler, renderer->command_buffer, "world");
+		bsp_render(&bsp_rendering, renderer, &c);
+		vulkan_endGpuScope(renderer->gpuProfiler, renderer->command_buffer, worldScope);
 
-		imguivk_endFrame(renderer, &imgui);
+		if (!headless) {
+			uint32_t uiScope = vulkan_beginGpuScope(renderer->gpuProfiler, renderer->command_buffer, "imgui");
+			imguivk_endFrame(renderer, &imgui);
+			vulkan_endGpuScope(renderer->gpuProfiler, renderer->command_buffer, uiScope);
+		}
 
 		renderer_end_frame(renderer);
+
+		if (benchmarking) {
+			benchmark_end_frame(&benchmark, renderer, &bsp_rendering);
+		}
 	}
 
 	vkQueueWaitIdle(renderer->init_objects.graphicsQueue);
-	imguivk_deinit(renderer, &imgui);
+	if (headless) {
+		double renderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderBegin).count();
+		std::cout << "Rendered " << renderer->frameNumber << " headless frames in " << renderSeconds * 1000.0 << " ms ("
+			<< renderSeconds * 1000.0 / std::max<uint64_t>(renderer->frameNumber, 1) << " ms per frame)" << std::endl;
+	}
+	if (benchmarking) {
+		benchmark_write_report(&benchmark, renderer, &bsp_rendering, benchmarkReportFile);
+	}
+	if (recording) {
+		save_benchmark_path(recordPathFile, &recorder.path);
+	}
+
+	// Waits for pipelines still compiling on the workers, which use the bsp pipeline layout
+	deinit_pipeline_library(pipelines);
+	bsp_rendering_deinit(&bsp_rendering, renderer);
+	deinit_cooked_store(cooked);
+	deinit_job_system(jobs);
+	if (!headless) {
+		imguivk_deinit(renderer, &imgui);
+	}
+	// The renderer's copy holds the swapchain it recreated last. Headless render targets are owned by the renderer
+	// and destroyed with it, so they must not be destroyed again as swapchain views
+	objects = renderer->init_objects;
+	if (headless) {
+		objects.swapchainImageViews.clear();
+		objects.swapchainImages.clear();
+	}
 	deinit_renderer(renderer);
 	deinit_vulkan(&objects);
 	glfwDestroyWindow(window);
@@ -0,0 +1,210 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "profiler.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+// Fields are atomics so a reader copying a slot that is overwritten at the same time is not a data race, the
+// copy is thrown away afterwards anyway
+struct profiler_slot {
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> beginNanoseconds;
+    std::atomic<uint64_t> endNanoseconds;
+    std::atomic<uint32_t> depth;
+};
+
+// Single writer, the owning thread. Zone i lives at slot i % PROFILER_RING_SIZE, claimed is raised before the
+// slot is overwritten and written after it is complete, like a seqlock.
+struct profiler_ring {
+    std::string name;
+    std::atomic<uint64_t> claimed;
+    std::atomic<uint64_t> written;
+    uint32_t depth;
+    profiler_slot slots[PROFILER_RING_SIZE];
+};
+
+struct profiler_state {
+    std::chrono::high_resolution_clock::time_point start;
+    // Guards the list and the thread names, never taken while recording a zone
+    std::mutex mutex;
+    std::vector<profiler_ring*> rings;
+    std::atomic<uint64_t> frameMarks[PROFILER_FRAME_HISTORY];
+    std::atomic<uint64_t> frameCount;
+
+    profiler_state() : start(std::chrono::high_resolution_clock::now()), frameCount(0) {}
+
+    // Workers are joined before static destruction, so nobody writes anymore
+    ~profiler_state() {
+        for (profiler_ring* ring : rings) {
+            delete ring;
+        }
+    }
+};
+
+static_assert((PROFILER_RING_SIZE & (PROFILER_RING_SIZE - 1)) == 0, "PROFILER_RING_SIZE has to be a power of two");
+
+std::atomic<bool> profiler_enabled(false);
+
+static profiler_state state;
+static thread_local profiler_ring* threadRing = nullptr;
+
+static profiler_ring* thread_ring() {
+    if (threadRing == nullptr) {
+        profiler_ring* ring = new profiler_ring();
+        ring->claimed.store(0);
+        ring->written.store(0);
+        ring->depth = 0;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        ring->name = "thread " + std::to_string(state.rings.size());
+        state.rings.push_back(ring);
+        threadRing = ring;
+    }
+
+    return threadRing;
+}
+
+void profiler_set_enabled(bool enabled) {
+    profiler_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void profiler_set_thread_name(const char* name) {
+    profiler_ring* ring = thread_ring();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    ring->name = name;
+}
+
+uint64_t profiler_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - state.start).count();
+}
+
+void profiler_frame_mark() {
+    uint64_t frame = state.frameCount.load(std::memory_order_relaxed);
+    state.frameMarks[frame % PROFILER_FRAME_HISTORY].store(profiler_now(), std::memory_order_relaxed);
+    state.frameCount.store(frame + 1, std::memory_order_release);
+}
+
+uint64_t profiler_begin_zone() {
+    thread_ring()->depth++;
+    return profiler_now();
+}
+
+void profiler_end_zone(const char* name, uint64_t beginNanoseconds) {
+    uint64_t end = profiler_now();
+    profiler_ring* ring = threadRing;
+    ring->depth--;
+
+    uint64_t index = ring->written.load(std::memory_order_relaxed);
+    ring->claimed.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    profiler_slot& slot = ring->slots[index & (PROFILER_RING_SIZE - 1)];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.beginNanoseconds.store(beginNanoseconds, std::memory_order_relaxed);
+    slot.endNanoseconds.store(end, std::memory_order_relaxed);
+    slot.depth.store(ring->depth, std::memory_order_relaxed);
+    ring->written.store(index + 1, std::memory_order_release);
+}
+
+void profiler_collect(uint64_t beginNanoseconds, uint64_t endNanoseconds, std::vector<profiler_thread_events>& outThreads) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    outThreads.resize(state.rings.size());
+
+    for (size_t i = 0; i < state.rings.size(); i++) {
+        profiler_ring* ring = state.rings[i];
+        profiler_thread_events& thread = outThreads[i];
+        thread.name = ring->name;
+        thread.events.clear();
+
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = written > PROFILER_RING_SIZE ? written - PROFILER_RING_SIZE : 0;
+
+        std::vector<profiler_event> copied;
+        copied.reserve((size_t)(written - first));
+        for (uint64_t index = first; index < written; index++) {
+            const profiler_slot& slot = ring->slots[index & (PROFILER_RING_SIZE - 1)];
+            profiler_event event;
+            event.name = slot.name.load(std::memory_order_relaxed);
+            event.beginNanoseconds = slot.beginNanoseconds.load(std::memory_order_relaxed);
+            event.endNanoseconds = slot.endNanoseconds.load(std::memory_order_relaxed);
+            event.depth = slot.depth.load(std::memory_order_relaxed);
+            copied.push_back(event);
+        }
+
+        // Slots the writer claimed meanwhile may be torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = ring->claimed.load(std::memory_order_relaxed);
+        uint64_t firstIntact = claimed > PROFILER_RING_SIZE ? claimed - PROFILER_RING_SIZE : 0;
+
+        for (uint64_t index = first < firstIntact ? firstIntact : first; index < written; index++) {
+            const profiler_event& event = copied[(size_t)(index - first)];
+            if (event.endNanoseconds > beginNanoseconds && event.beginNanoseconds < endNanoseconds) {
+                thread.events.push_back(event);
+            }
+        }
+    }
+}
+
+bool profiler_last_frame(uint64_t* beginNanoseconds, uint64_t* endNanoseconds) {
+    uint64_t frames = state.frameCount.load(std::memory_order_acquire);
+    if (frames < 2) {
+        return false;
+    }
+
+    *beginNanoseconds = state.frameMarks[(frames - 2) % PROFILER_FRAME_HISTORY].load(std::memory_order_relaxed);
+    *endNanoseconds = state.frameMarks[(frames - 1) % PROFILER_FRAME_HISTORY].load(std::memory_order_relaxed);
+    return true;
+}
+
+bool profiler_export_trace(const std::string& path) {
+    std::vector<profiler_thread_events> threads;
+    profiler_collect(0, UINT64_MAX, threads);
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not write CPU trace " << path << std::endl;
+        return false;
+    }
+
+    // Complete events in microseconds with nanosecond precision, one track per thread
+    size_t eventCount = 0;
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Vulkan-CSGO\"}}";
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1 << ",\"args\":{\"name\":\"" << threads[i].name << "\"}}";
+
+        for (const profiler_event& event : threads[i].events) {
+            file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << i + 1
+                 << ",\"ts\":" << event.beginNanoseconds / 1000.0
+                 << ",\"dur\":" << (event.endNanoseconds - event.beginNanoseconds) / 1000.0 << "}";
+            eventCount++;
+        }
+    }
+
+    file << "\n]}\n";
+
+    std::cout << "Wrote " << eventCount << " CPU zones of " << threads.size() << " threads to " << path << std::endl;
+    return true;
+}
@@ -0,0 +1,88 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Zones per thread that are kept, older ones are overwritten. Has to be a power of two.
+#define PROFILER_RING_SIZE 16384
+#define PROFILER_FRAME_HISTORY 8
+
+// A finished zone, timestamps are nanoseconds since the profiler started
+struct profiler_event {
+    const char* name;
+    uint64_t beginNanoseconds;
+    uint64_t endNanoseconds;
+    // Zones that were open on the thread when this one began
+    uint32_t depth;
+};
+
+struct profiler_thread_events {
+    std::string name;
+    // In the order the zones ended
+    std::vector<profiler_event> events;
+};
+
+// Every zone checks this first, it is the only cost while profiling is off
+extern std::atomic<bool> profiler_enabled;
+
+void profiler_set_enabled(bool enabled);
+// Names the calling thread in the flame view and in traces
+void profiler_set_thread_name(const char* name);
+// Called by the render thread at the beginning of every frame
+void profiler_frame_mark();
+uint64_t profiler_now();
+
+// Each thread writes into a ring of its own that is created on its first zone, only that takes a lock.
+// Use PROFILE_ZONE instead of calling these.
+uint64_t profiler_begin_zone();
+void profiler_end_zone(const char* name, uint64_t beginNanoseconds);
+
+// Copies the zones of all threads that overlap [begin, end). Zones overwritten while copying are left out.
+void profiler_collect(uint64_t beginNanoseconds, uint64_t endNanoseconds, std::vector<profiler_thread_events>& outThreads);
+// Range of the last frame that is complete, false until two frames were marked
+bool profiler_last_frame(uint64_t* beginNanoseconds, uint64_t* endNanoseconds);
+
+// Chrome trace event JSON of everything still in the rings, opens in chrome://tracing and Perfetto
+bool profiler_export_trace(const std::string& path);
+
+// The name has to outlive the profiler and is written to traces as is, so no quotes
+struct profiler_zone {
+    const char* name;
+    uint64_t beginNanoseconds;
+    bool active;
+
+    explicit profiler_zone(const char* zoneName) : name(zoneName), beginNanoseconds(0), active(profiler_enabled.load(std::memory_order_relaxed)) {
+        if (active) {
+            beginNanoseconds = profiler_begin_zone();
+        }
+    }
+
+    ~profiler_zone() {
+        if (active) {
+            profiler_end_zone(name, beginNanoseconds);
+        }
+    }
+};
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) profiler_zone PROFILER_CONCAT(profilerZone, __LINE__)(name)
@@ -0,0 +1,58 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "radix_sort.h"
+
+#include <cstddef>
+
+void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values) {
+    size_t count = keys.size();
+    std::vector<uint64_t> keysScratch(count);
+    std::vector<uint32_t> valuesScratch(count);
+
+    // All histograms in one go over the keys
+    size_t histograms[8][256] = {};
+    for (uint64_t key : keys) {
+        for (int pass = 0; pass < 8; pass++) {
+            histograms[pass][(key >> (pass * 8)) & 0xff]++;
+        }
+    }
+
+    for (int pass = 0; pass < 8; pass++) {
+        size_t* histogram = histograms[pass];
+        int shift = pass * 8;
+
+        if (count == 0 || histogram[(keys[0] >> shift) & 0xff] == count) {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digitCount = histogram[digit];
+            histogram[digit] = offset;
+            offset += digitCount;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            size_t target = histogram[(keys[i] >> shift) & 0xff]++;
+            keysScratch[target] = keys[i];
+            valuesScratch[target] = values[i];
+        }
+
+        keys.swap(keysScratch);
+        values.swap(valuesScratch);
+    }
+}
@@ -0,0 +1,643 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bc_encoder.h"
+#include "../jobs.h"
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BC_SSE2
+#include <emmintrin.h>
+#endif
+
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Refinement passes and whether all four p-bit combinations are tried, per BC7 quality level
+static const int bc7Refinements[BC7_MAX_QUALITY + 1] = { 0, 1, 1, 2, 4 };
+
+// The 16 pixels of a block with one array per channel, so four pixels fit one SSE register
+struct bc_block_soa {
+    alignas(16) float c[4][16];
+};
+
+static void load_block(const unsigned char* pixels, bc_block_soa* block) {
+    for (int i = 0; i < 16; i++) {
+        for (int ch = 0; ch < 4; ch++) {
+            block->c[ch][i] = pixels[i * 4 + ch];
+        }
+    }
+}
+
+// Picks the closest palette entry for every pixel and returns the summed squared error
+static float fit_indices(const bc_block_soa& block, int firstChannel, int channelCount, const float (*palette)[4], int paletteSize, int* outIndices) {
+    float totalError = 0.0f;
+
+#ifdef BC_SSE2
+    for (int p = 0; p < 16; p += 4) {
+        __m128 bestError = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+
+        for (int e = 0; e < paletteSize; e++) {
+            __m128 error = _mm_setzero_ps();
+            for (int ch = firstChannel; ch < firstChannel + channelCount; ch++) {
+                __m128 diff = _mm_sub_ps(_mm_load_ps(&block.c[ch][p]), _mm_set1_ps(palette[e][ch]));
+                error = _mm_add_ps(error, _mm_mul_ps(diff, diff));
+            }
+
+            __m128i less = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+            bestError = _mm_min_ps(error, bestError);
+            bestIndex = _mm_or_si128(_mm_andnot_si128(less, bestIndex), _mm_and_si128(less, _mm_set1_epi32(e)));
+        }
+
+        alignas(16) float errors[4];
+        _mm_store_ps(errors, bestError);
+        _mm_storeu_si128((__m128i*)(outIndices + p), bestIndex);
+        totalError += errors[0] + errors[1] + errors[2] + errors[3];
+    }
+#else
+    for (int p = 0; p < 16; p++) {
+        float bestError = FLT_MAX;
+        int bestIndex = 0;
+
+        for (int e = 0; e < paletteSize; e++) {
+            float error = 0.0f;
+            for (int ch = firstChannel; ch < firstChannel + channelCount; ch++) {
+                float diff = block.c[ch][p] - palette[e][ch];
+                error += diff * diff;
+            }
+
+            if (error < bestError) {
+                bestError = error;
+                bestIndex = e;
+            }
+        }
+
+        outIndices[p] = bestIndex;
+        totalError += bestError;
+    }
+#endif
+
+    return totalError;
+}
+
+// Endpoints along the principal axis of the block, found with a few power iterations on the covariance
+static void principal_endpoints(const bc_block_soa& block, int channelCount, float* outE0, float* outE1) {
+    float mean[4] = {};
+    for (int ch = 0; ch < channelCount; ch++) {
+        for (int i = 0; i < 16; i++) {
+            mean[ch] += block.c[ch][i];
+        }
+        mean[ch] /= 16.0f;
+    }
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int a = 0; a < channelCount; a++) {
+            for (int b = 0; b < channelCount; b++) {
+                covariance[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+            }
+        }
+    }
+
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        float length = 0.0f;
+
+        for (int a = 0; a < channelCount; a++) {
+            for (int b = 0; b < channelCount; b++) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+
+        if (length < 1e-8f) {
+            break;
+        }
+
+        length = std::sqrt(length);
+        for (int a = 0; a < channelCount; a++) {
+            axis[a] = next[a] / length;
+        }
+    }
+
+    float minProjection = FLT_MAX;
+    float maxProjection = -FLT_MAX;
+    for (int i = 0; i < 16; i++) {
+        float projection = 0.0f;
+        for (int ch = 0; ch < channelCount; ch++) {
+            projection += (block.c[ch][i] - mean[ch]) * axis[ch];
+        }
+
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+
+    for (int ch = 0; ch < channelCount; ch++) {
+        outE0[ch] = std::min(255.0f, std::max(0.0f, mean[ch] + axis[ch] * maxProjection));
+        outE1[ch] = std::min(255.0f, std::max(0.0f, mean[ch] + axis[ch] * minProjection));
+    }
+}
+
+// Least squares endpoints for fixed indices, weights[i] is how much pixel i leans towards e1
+static bool refine_endpoints(const bc_block_soa& block, int channelCount, const float* weights, float* outE0, float* outE1) {
+    float a = 0.0f, b = 0.0f, c = 0.0f;
+    float x0[4] = {}, x1[4] = {};
+
+    for (int i = 0; i < 16; i++) {
+        float w1 = weights[i];
+        float w0 = 1.0f - w1;
+
+        a += w0 * w0;
+        b += w0 * w1;
+        c += w1 * w1;
+
+        for (int ch = 0; ch < channelCount; ch++) {
+            x0[ch] += w0 * block.c[ch][i];
+            x1[ch] += w1 * block.c[ch][i];
+        }
+    }
+
+    float determinant = a * c - b * b;
+    if (std::fabs(determinant) < 1e-6f) {
+        return false;
+    }
+
+    for (int ch = 0; ch < channelCount; ch++) {
+        outE0[ch] = std::min(255.0f, std::max(0.0f, (c * x0[ch] - b * x1[ch]) / determinant));
+        outE1[ch] = std::min(255.0f, std::max(0.0f, (a * x1[ch] - b * x0[ch]) / determinant));
+    }
+
+    return true;
+}
+
+static void write_bits(unsigned char* block, int* bitPosition, uint32_t value, int bitCount) {
+    for (int i = 0; i < bitCount; i++, (*bitPosition)++) {
+        if (value & (1u << i)) {
+            block[*bitPosition >> 3] |= 1 << (*bitPosition & 7);
+        }
+    }
+}
+
+static uint32_t read_bits(const unsigned char* block, int* bitPosition, int bitCount) {
+    uint32_t value = 0;
+    for (int i = 0; i < bitCount; i++, (*bitPosition)++) {
+        if (block[*bitPosition >> 3] & (1 << (*bitPosition & 7))) {
+            value |= 1u << i;
+        }
+    }
+    return value;
+}
+
+// BC1
+
+static uint16_t quantize_565(const float* color) {
+    int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+
+    return (uint16_t)((std::min(r, 31) << 11) | (std::min(g, 63) << 5) | std::min(b, 31));
+}
+
+static void expand_565(uint16_t color, float* outColor) {
+    int r = (color >> 11) & 31;
+    int g = (color >> 5) & 63;
+    int b = color & 31;
+
+    outColor[0] = (float)((r << 3) | (r >> 2));
+    outColor[1] = (float)((g << 2) | (g >> 4));
+    outColor[2] = (float)((b << 3) | (b >> 2));
+    outColor[3] = 255.0f;
+}
+
+static void bc1_palette(uint16_t c0, uint16_t c1, float (*outPalette)[4]) {
+    expand_565(c0, outPalette[0]);
+    expand_565(c1, outPalette[1]);
+
+    for (int ch = 0; ch < 4; ch++) {
+        outPalette[2][ch] = (2.0f * outPalette[0][ch] + outPalette[1][ch]) / 3.0f;
+        outPalette[3][ch] = (outPalette[0][ch] + 2.0f * outPalette[1][ch]) / 3.0f;
+    }
+}
+
+static void bc1_encode_color(const bc_block_soa& block, unsigned char* outBlock) {
+    static const float indexWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    float e0[4], e1[4];
+    principal_endpoints(block, 3, e0, e1);
+
+    uint16_t c0 = quantize_565(e0);
+    uint16_t c1 = quantize_565(e1);
+
+    float palette[4][4];
+    int indices[16];
+    bc1_palette(c0, c1, palette);
+    float error = fit_indices(block, 0, 3, palette, 4, indices);
+
+    // One least squares pass on the chosen indices usually gains a dB or two
+    float weights[16];
+    for (int i = 0; i < 16; i++) {
+        weights[i] = indexWeights[indices[i]];
+    }
+
+    if (refine_endpoints(block, 3, weights, e0, e1)) {
+        uint16_t refined0 = quantize_565(e0);
+        uint16_t refined1 = quantize_565(e1);
+
+        float refinedPalette[4][4];
+        int refinedIndices[16];
+        bc1_palette(refined0, refined1, refinedPalette);
+        float refinedError = fit_indices(block, 0, 3, refinedPalette, 4, refinedIndices);
+
+        if (refinedError < error) {
+            c0 = refined0;
+            c1 = refined1;
+            memcpy(indices, refinedIndices, sizeof(indices));
+        }
+    }
+
+    // c0 > c1 selects the four color mode, equal endpoints would select three colors plus transparent black
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        for (int i = 0; i < 16; i++) {
+            indices[i] ^= 1;
+        }
+    } else if (c0 == c1) {
+        memset(indices, 0, sizeof(indices));
+    }
+
+    uint32_t packedIndices = 0;
+    for (int i = 0; i < 16; i++) {
+        packedIndices |= (uint32_t)indices[i] << (i * 2);
+    }
+
+    outBlock[0] = c0 & 0xff;
+    outBlock[1] = c0 >> 8;
+    outBlock[2] = c1 & 0xff;
+    outBlock[3] = c1 >> 8;
+    memcpy(outBlock + 4, &packedIndices, 4);
+}
+
+static void bc1_decode_color(const unsigned char* block, unsigned char* outPixels) {
+    uint16_t c0 = block[0] | (block[1] << 8);
+    uint16_t c1 = block[2] | (block[3] << 8);
+
+    float palette[4][4];
+    bc1_palette(c0, c1, palette);
+
+    uint32_t packedIndices;
+    memcpy(&packedIndices, block + 4, 4);
+
+    for (int i = 0; i < 16; i++) {
+        int index = (packedIndices >> (i * 2)) & 3;
+        for (int ch = 0; ch < 3; ch++) {
+            outPixels[i * 4 + ch] = (unsigned char)(palette[index][ch] + 0.5f);
+        }
+    }
+}
+
+void bc1_encode_block(const unsigned char* pixels, unsigned char* outBlock) {
+    bc_block_soa block;
+    load_block(pixels, &block);
+    bc1_encode_color(block, outBlock);
+}
+
+// BC3
+
+static void bc4_palette(int a0, int a1, float (*outPalette)[4]) {
+    outPalette[0][3] = (float)a0;
+    outPalette[1][3] = (float)a1;
+
+    for (int i = 2; i < 8; i++) {
+        outPalette[i][3] = (float)(((8 - i) * a0 + (i - 1) * a1) / 7);
+    }
+}
+
+static void bc4_encode_alpha(const bc_block_soa& block, unsigned char* outBlock) {
+    float minAlpha = 255.0f;
+    float maxAlpha = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        minAlpha = std::min(minAlpha, block.c[3][i]);
+        maxAlpha = std::max(maxAlpha, block.c[3][i]);
+    }
+
+    // a0 > a1 selects the eight value mode
+    int a0 = (int)maxAlpha;
+    int a1 = (int)minAlpha;
+
+    int indices[16] = {};
+    if (a0 != a1) {
+        float palette[8][4];
+        bc4_palette(a0, a1, palette);
+        fit_indices(block, 3, 1, palette, 8, indices);
+    }
+
+    memset(outBlock, 0, 8);
+    outBlock[0] = (unsigned char)a0;
+    outBlock[1] = (unsigned char)a1;
+
+    int bitPosition = 16;
+    for (int i = 0; i < 16; i++) {
+        write_bits(outBlock, &bitPosition, indices[i], 3);
+    }
+}
+
+static void bc4_decode_alpha(const unsigned char* block, unsigned char* outPixels) {
+    int a0 = block[0];
+    int a1 = block[1];
+
+    float palette[8][4];
+    if (a0 > a1) {
+        bc4_palette(a0, a1, palette);
+    } else {
+        palette[0][3] = (float)a0;
+        palette[1][3] = (float)a1;
+        for (int i = 2; i < 6; i++) {
+            palette[i][3] = (float)(((6 - i) * a0 + (i - 1) * a1) / 5);
+        }
+        palette[6][3] = 0.0f;
+        palette[7][3] = 255.0f;
+    }
+
+    int bitPosition = 16;
+    for (int i = 0; i < 16; i++) {
+        outPixels[i * 4 + 3] = (unsigned char)palette[read_bits(block, &bitPosition, 3)][3];
+    }
+}
+
+void bc3_encode_block(const unsigned char* pixels, unsigned char* outBlock) {
+    bc_block_soa block;
+    load_block(pixels, &block);
+
+    bc4_encode_alpha(block, outBlock);
+    bc1_encode_color(block, outBlock + 8);
+}
+
+// BC7 mode 6
+
+static void bc7_palette(const int* e0, const int* e1, float (*outPalette)[4]) {
+    for (int i = 0; i < 16; i++) {
+        for (int ch = 0; ch < 4; ch++) {
+            outPalette[i][ch] = (float)(((64 - bc7Weights4[i]) * e0[ch] + bc7Weights4[i] * e1[ch] + 32) >> 6);
+        }
+    }
+}
+
+// Quantizes an endpoint to 7 bits per channel plus a shared p-bit, returns the expanded 8 bit values
+static void bc7_quantize(const float* endpoint, int pbit, int* outQuantized, int* outExpanded) {
+    for (int ch = 0; ch < 4; ch++) {
+        int q = (int)((endpoint[ch] - pbit) / 2.0f + 0.5f);
+        q = std::min(127, std::max(0, q));
+
+        outQuantized[ch] = q;
+        outExpanded[ch] = (q << 1) | pbit;
+    }
+}
+
+struct bc7_candidate {
+    int quantized[2][4];
+    int pbits[2];
+    int indices[16];
+    float error;
+};
+
+static void bc7_evaluate(const bc_block_soa& block, const float* e0, const float* e1, bool allPbits, bc7_candidate* best) {
+    for (int p0 = 0; p0 < 2; p0++) {
+        for (int p1 = 0; p1 < 2; p1++) {
+            if (!allPbits && (p0 != p1)) {
+                continue;
+            }
+
+            bc7_candidate candidate;
+            int expanded[2][4];
+            candidate.pbits[0] = p0;
+            candidate.pbits[1] = p1;
+            bc7_quantize(e0, p0, candidate.quantized[0], expanded[0]);
+            bc7_quantize(e1, p1, candidate.quantized[1], expanded[1]);
+
+            float palette[16][4];
+            bc7_palette(expanded[0], expanded[1], palette);
+            candidate.error = fit_indices(block, 0, 4, palette, 16, candidate.indices);
+
+            if (candidate.error < best->error) {
+                *best = candidate;
+            }
+        }
+    }
+}
+
+void bc7_encode_block(const unsigned char* pixels, int quality, unsigned char* outBlock) {
+    quality = std::min(BC7_MAX_QUALITY, std::max(0, quality));
+
+    bc_block_soa block;
+    load_block(pixels, &block);
+
+    float e0[4], e1[4];
+    if (quality == 0) {
+        for (int ch = 0; ch < 4; ch++) {
+            e0[ch] = *std::min_element(block.c[ch], block.c[ch] + 16);
+            e1[ch] = *std::max_element(block.c[ch], block.c[ch] + 16);
+        }
+    } else {
+        principal_endpoints(block, 4, e0, e1);
+    }
+
+    bool allPbits = quality >= 2;
+
+    bc7_candidate best;
+    best.error = FLT_MAX;
+    bc7_evaluate(block, e0, e1, allPbits, &best);
+
+    for (int pass = 0; pass < bc7Refinements[quality] && best.error > 0.0f; pass++) {
+        float weights[16];
+        for (int i = 0; i < 16; i++) {
+            weights[i] = bc7Weights4[best.indices[i]] / 64.0f;
+        }
+
+        if (!refine_endpoints(block, 4, weights, e0, e1)) {
+            break;
+        }
+
+        bc7_evaluate(block, e0, e1, allPbits, &best);
+    }
+
+    // The anchor index of the first pixel has no most significant bit, swap the endpoints if it would need one
+    if (best.indices[0] >= 8) {
+        for (int ch = 0; ch < 4; ch++) {
+            std::swap(best.quantized[0][ch], best.quantized[1][ch]);
+        }
+        std::swap(best.pbits[0], best.pbits[1]);
+
+        for (int i = 0; i < 16; i++) {
+            best.indices[i] = 15 - best.indices[i];
+        }
+    }
+
+    memset(outBlock, 0, 16);
+    int bitPosition = 0;
+
+    write_bits(outBlock, &bitPosition, 1 << 6, 7);
+    for (int ch = 0; ch < 4; ch++) {
+        write_bits(outBlock, &bitPosition, best.quantized[0][ch], 7);
+        write_bits(outBlock, &bitPosition, best.quantized[1][ch], 7);
+    }
+    write_bits(outBlock, &bitPosition, best.pbits[0], 1);
+    write_bits(outBlock, &bitPosition, best.pbits[1], 1);
+
+    for (int i = 0; i < 16; i++) {
+        write_bits(outBlock, &bitPosition, best.indices[i], i == 0 ? 3 : 4);
+    }
+}
+
+static void bc7_decode_block(const unsigned char* block, unsigned char* outPixels) {
+    if ((block[0] & 0x7f) != (1 << 6)) {
+        // Not written by this encoder, show it in magenta
+        for (int i = 0; i < 16; i++) {
+            outPixels[i * 4 + 0] = 255;
+            outPixels[i * 4 + 1] = 0;
+            outPixels[i * 4 + 2] = 255;
+            outPixels[i * 4 + 3] = 255;
+        }
+        return;
+    }
+
+    int bitPosition = 7;
+    int endpoints[2][4];
+    for (int ch = 0; ch < 4; ch++) {
+        endpoints[0][ch] = read_bits(block, &bitPosition, 7);
+        endpoints[1][ch] = read_bits(block, &bitPosition, 7);
+    }
+
+    int p0 = read_bits(block, &bitPosition, 1);
+    int p1 = read_bits(block, &bitPosition, 1);
+    for (int ch = 0; ch < 4; ch++) {
+        endpoints[0][ch] = (endpoints[0][ch] << 1) | p0;
+        endpoints[1][ch] = (endpoints[1][ch] << 1) | p1;
+    }
+
+    float palette[16][4];
+    bc7_palette(endpoints[0], endpoints[1], palette);
+
+    for (int i = 0; i < 16; i++) {
+        int index = read_bits(block, &bitPosition, i == 0 ? 3 : 4);
+        for (int ch = 0; ch < 4; ch++) {
+            outPixels[i * 4 + ch] = (unsigned char)palette[index][ch];
+        }
+    }
+}
+
+size_t bc_block_size(bc_format format) {
+    return format == BC_FORMAT_BC1 ? 8 : 16;
+}
+
+size_t bc_image_size(bc_format format, uint32_t width, uint32_t height) {
+    return (size_t)std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * bc_block_size(format);
+}
+
+void bc_decode_block(bc_format format, const unsigned char* block, unsigned char* outPixels) {
+    switch (format) {
+        case BC_FORMAT_BC1:
+            bc1_decode_color(block, outPixels);
+            for (int i = 0; i < 16; i++) {
+                outPixels[i * 4 + 3] = 255;
+            }
+            break;
+        case BC_FORMAT_BC3:
+            bc4_decode_alpha(block, outPixels);
+            bc1_decode_color(block + 8, outPixels);
+            break;
+        case BC_FORMAT_BC7:
+            bc7_decode_block(block, outPixels);
+            break;
+    }
+}
+
+static void read_block(const unsigned char* pixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, unsigned char* outPixels) {
+    for (uint32_t y = 0; y < 4; y++) {
+        uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+
+        for (uint32_t x = 0; x < 4; x++) {
+            uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+            memcpy(outPixels + (y * 4 + x) * 4, pixels + ((size_t)sourceY * width + sourceX) * 4, 4);
+        }
+    }
+}
+
+void bc_encode_image(job_system* jobs, bc_format format, int quality, const unsigned char* pixels, uint32_t width, uint32_t height, unsigned char* outData) {
+    uint32_t blocksX = std::max(1u, (width + 3) / 4);
+    uint32_t blocksY = std::max(1u, (height + 3) / 4);
+    size_t blockSize = bc_block_size(format);
+
+    auto encodeRow = [&](size_t blockY) {
+        unsigned char blockPixels[64];
+
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+            read_block(pixels, width, height, blockX, (uint32_t)blockY, blockPixels);
+            unsigned char* outBlock = outData + (blockY * blocksX + blockX) * blockSize;
+
+            switch (format) {
+                case BC_FORMAT_BC1: bc1_encode_block(blockPixels, outBlock); break;
+                case BC_FORMAT_BC3: bc3_encode_block(blockPixels, outBlock); break;
+                case BC_FORMAT_BC7: bc7_encode_block(blockPixels, quality, outBlock); break;
+            }
+        }
+    };
+
+    if (jobs != nullptr) {
+        job_system_parallel_for(jobs, blocksY, encodeRow);
+    } else {
+        for (uint32_t blockY = 0; blockY < blocksY; blockY++) {
+            encodeRow(blockY);
+        }
+    }
+}
+
+double bc_psnr(bc_format format, const unsigned char* pixels, uint32_t width, uint32_t height, const unsigned char* compressed) {
+    uint32_t blocksX = std::max(1u, (width + 3) / 4);
+    size_t blockSize = bc_block_size(format);
+    int channels = format == BC_FORMAT_BC1 ? 3 : 4;
+
+    double squaredError = 0.0;
+    unsigned char decoded[64];
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            // Decode each block once per row of pixels, this only runs for statistics
+            if ((x & 3) == 0) {
+                bc_decode_block(format, compressed + ((y / 4) * blocksX + x / 4) * blockSize, decoded);
+            }
+
+            const unsigned char* source = pixels + ((size_t)y * width + x) * 4;
+            const unsigned char* result = decoded + ((y & 3) * 4 + (x & 3)) * 4;
+
+            for (int ch = 0; ch < channels; ch++) {
+                double diff = (double)source[ch] - result[ch];
+                squaredError += diff * diff;
+            }
+        }
+    }
+
+    double meanSquaredError = squaredError / ((double)width * height * channels);
+    if (meanSquaredError <= 0.0) {
+        return 99.0;
+    }
+
+    return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
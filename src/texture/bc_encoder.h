@@ -0,0 +1,48 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+struct job_system;
+
+enum bc_format {
+    BC_FORMAT_BC1,
+    BC_FORMAT_BC3,
+    // Only mode 6 (one subset, RGBA with 4 bit indices) is written
+    BC_FORMAT_BC7
+};
+
+#define BC7_MAX_QUALITY 4
+
+size_t bc_block_size(bc_format format);
+size_t bc_image_size(bc_format format, uint32_t width, uint32_t height);
+
+// Blocks are 4x4 RGBA8 pixels in row major order
+void bc1_encode_block(const unsigned char* pixels, unsigned char* outBlock);
+void bc3_encode_block(const unsigned char* pixels, unsigned char* outBlock);
+// quality ranges from 0 (bounding box endpoints) to BC7_MAX_QUALITY (PCA, all p-bits, several refinement passes)
+void bc7_encode_block(const unsigned char* pixels, int quality, unsigned char* outBlock);
+
+void bc_decode_block(bc_format format, const unsigned char* block, unsigned char* outPixels);
+
+// Encodes an RGBA8 image, edge blocks repeat the last row and column. Rows of blocks are spread over jobs if not null.
+void bc_encode_image(job_system* jobs, bc_format format, int quality, const unsigned char* pixels, uint32_t width, uint32_t height, unsigned char* outData);
+
+// PSNR in dB of the compressed image against its source, alpha only counts for formats that store it
+double bc_psnr(bc_format format, const unsigned char* pixels, uint32_t width, uint32_t height, const unsigned char* compressed);
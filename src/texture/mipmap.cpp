@@ -0,0 +1,305 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "mipmap.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_SSE2
+#include <emmintrin.h>
+#endif
+
+#define SRGB_ENCODE_TABLE_SIZE 4096
+#define KAISER_ALPHA 4.0f
+#define KAISER_RADIUS 2.0f
+
+// One RGBA pixel in linear float
+#ifdef MIP_SSE2
+typedef __m128 mip_pixel;
+
+static inline mip_pixel pixel_zero() { return _mm_setzero_ps(); }
+static inline mip_pixel pixel_load(const float* p) { return _mm_loadu_ps(p); }
+static inline void pixel_store(float* p, mip_pixel v) { _mm_storeu_ps(p, v); }
+static inline mip_pixel pixel_madd(mip_pixel acc, mip_pixel v, float w) { return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w))); }
+#else
+struct mip_pixel {
+    float v[4];
+};
+
+static inline mip_pixel pixel_zero() { return { { 0.0f, 0.0f, 0.0f, 0.0f } }; }
+static inline mip_pixel pixel_load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+static inline void pixel_store(float* p, mip_pixel v) { p[0] = v.v[0]; p[1] = v.v[1]; p[2] = v.v[2]; p[3] = v.v[3]; }
+static inline mip_pixel pixel_madd(mip_pixel acc, mip_pixel v, float w) {
+    for (int i = 0; i < 4; i++) {
+        acc.v[i] += v.v[i] * w;
+    }
+    return acc;
+}
+#endif
+
+struct srgb_tables {
+    float decode[256];
+    unsigned char encode[SRGB_ENCODE_TABLE_SIZE];
+};
+
+static const srgb_tables& get_srgb_tables() {
+    static const srgb_tables tables = []() {
+        srgb_tables t;
+
+        for (int i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            t.decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+
+        for (int i = 0; i < SRGB_ENCODE_TABLE_SIZE; i++) {
+            float l = i / (float)(SRGB_ENCODE_TABLE_SIZE - 1);
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            t.encode[i] = (unsigned char)std::min(255.0f, c * 255.0f + 0.5f);
+        }
+
+        return t;
+    }();
+
+    return tables;
+}
+
+// Source taps of every destination pixel along one axis, padded to the same count with zero weights
+struct mip_taps {
+    int tapCount;
+    std::vector<int> indices;
+    std::vector<float> weights;
+};
+
+static float bessel_i0(float x) {
+    float sum = 1.0f;
+    float term = 1.0f;
+
+    for (int k = 1; k < 20; k++) {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static float kaiser_sinc(float x) {
+    float t = x / KAISER_RADIUS;
+    if (std::fabs(t) >= 1.0f) {
+        return 0.0f;
+    }
+
+    float sinc = x == 0.0f ? 1.0f : std::sin(3.14159265f * x) / (3.14159265f * x);
+    float window = bessel_i0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / bessel_i0(KAISER_ALPHA);
+
+    return sinc * window;
+}
+
+static mip_taps build_taps(uint32_t srcSize, uint32_t dstSize, mip_filter filter) {
+    mip_taps taps;
+    float scale = srcSize / (float)dstSize;
+
+    float radius = filter == MIP_FILTER_BOX ? scale * 0.5f : KAISER_RADIUS * scale;
+    taps.tapCount = srcSize == dstSize ? 1 : (int)std::ceil(radius * 2.0f) + 1;
+    taps.indices.resize(dstSize * taps.tapCount, 0);
+    taps.weights.resize(dstSize * taps.tapCount, 0.0f);
+
+    for (uint32_t i = 0; i < dstSize; i++) {
+        int* indices = taps.indices.data() + i * taps.tapCount;
+        float* weights = taps.weights.data() + i * taps.tapCount;
+
+        if (srcSize == dstSize) {
+            indices[0] = i;
+            weights[0] = 1.0f;
+            continue;
+        }
+
+        // Center of the destination pixel in source pixel space
+        float center = (i + 0.5f) * scale;
+        int first = (int)std::floor(center - radius);
+        float weightSum = 0.0f;
+
+        for (int t = 0; t < taps.tapCount; t++) {
+            int source = first + t;
+            float weight;
+
+            if (filter == MIP_FILTER_BOX) {
+                // Coverage of the source pixel by the destination footprint
+                float lo = std::max((float)source, center - radius);
+                float hi = std::min((float)source + 1.0f, center + radius);
+                weight = std::max(0.0f, hi - lo);
+            } else {
+                weight = kaiser_sinc((source + 0.5f - center) / scale);
+            }
+
+            // Textures repeat, so wrap around at the borders
+            indices[t] = ((source % (int)srcSize) + srcSize) % srcSize;
+            weights[t] = weight;
+            weightSum += weight;
+        }
+
+        for (int t = 0; t < taps.tapCount; t++) {
+            weights[t] /= weightSum;
+        }
+    }
+
+    return taps;
+}
+
+static void downsample(const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t dstWidth, uint32_t dstHeight,
+                       mip_filter filter, std::vector<float>& scratch) {
+    mip_taps horizontal = build_taps(srcWidth, dstWidth, filter);
+    mip_taps vertical = build_taps(srcHeight, dstHeight, filter);
+
+    // Horizontal pass into scratch, dstWidth x srcHeight
+    scratch.resize((size_t)dstWidth * srcHeight * 4);
+
+    for (uint32_t y = 0; y < srcHeight; y++) {
+        const float* srcRow = src + (size_t)y * srcWidth * 4;
+        float* scratchRow = scratch.data() + (size_t)y * dstWidth * 4;
+
+        for (uint32_t x = 0; x < dstWidth; x++) {
+            const int* indices = horizontal.indices.data() + x * horizontal.tapCount;
+            const float* weights = horizontal.weights.data() + x * horizontal.tapCount;
+
+            mip_pixel acc = pixel_zero();
+            for (int t = 0; t < horizontal.tapCount; t++) {
+                acc = pixel_madd(acc, pixel_load(srcRow + indices[t] * 4), weights[t]);
+            }
+
+            pixel_store(scratchRow + x * 4, acc);
+        }
+    }
+
+    // Vertical pass, accumulating whole rows for better locality
+    for (uint32_t y = 0; y < dstHeight; y++) {
+        const int* indices = vertical.indices.data() + y * vertical.tapCount;
+        const float* weights = vertical.weights.data() + y * vertical.tapCount;
+        float* dstRow = dst + (size_t)y * dstWidth * 4;
+
+        std::fill(dstRow, dstRow + dstWidth * 4, 0.0f);
+
+        for (int t = 0; t < vertical.tapCount; t++) {
+            if (weights[t] == 0.0f) {
+                continue;
+            }
+
+            const float* scratchRow = scratch.data() + (size_t)indices[t] * dstWidth * 4;
+            for (uint32_t x = 0; x < dstWidth; x++) {
+                pixel_store(dstRow + x * 4, pixel_madd(pixel_load(dstRow + x * 4), pixel_load(scratchRow + x * 4), weights[t]));
+            }
+        }
+    }
+}
+
+static void decode_level(const unsigned char* pixels, size_t pixelCount, bool srgb, float* outLinear) {
+    const srgb_tables& tables = get_srgb_tables();
+
+    for (size_t i = 0; i < pixelCount * 4; i += 4) {
+        for (int c = 0; c < 3; c++) {
+            outLinear[i + c] = srgb ? tables.decode[pixels[i + c]] : pixels[i + c] / 255.0f;
+        }
+        outLinear[i + 3] = pixels[i + 3] / 255.0f;
+    }
+}
+
+static void encode_level(const float* linear, size_t pixelCount, bool srgb, unsigned char* outPixels) {
+    const srgb_tables& tables = get_srgb_tables();
+
+#ifdef MIP_SSE2
+    // Color channels index the encode table (or scale to 255 without srgb), alpha always scales to 255
+    const __m128 scale = srgb ? _mm_setr_ps(SRGB_ENCODE_TABLE_SIZE - 1, SRGB_ENCODE_TABLE_SIZE - 1, SRGB_ENCODE_TABLE_SIZE - 1, 255.0f)
+                              : _mm_set1_ps(255.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (size_t i = 0; i < pixelCount * 4; i += 4) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i), zero), one);
+        __m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half));
+
+        alignas(16) int32_t values[4];
+        _mm_store_si128((__m128i*)values, q);
+
+        for (int c = 0; c < 3; c++) {
+            outPixels[i + c] = srgb ? tables.encode[values[c]] : (unsigned char)values[c];
+        }
+        outPixels[i + 3] = (unsigned char)values[3];
+    }
+#else
+    for (size_t i = 0; i < pixelCount * 4; i += 4) {
+        for (int c = 0; c < 4; c++) {
+            float v = std::min(std::max(linear[i + c], 0.0f), 1.0f);
+
+            if (srgb && c < 3) {
+                outPixels[i + c] = tables.encode[(int)(v * (SRGB_ENCODE_TABLE_SIZE - 1) + 0.5f)];
+            } else {
+                outPixels[i + c] = (unsigned char)(v * 255.0f + 0.5f);
+            }
+        }
+    }
+#endif
+}
+
+uint32_t mip_chain_length(uint32_t width, uint32_t height) {
+    uint32_t length = 1;
+    uint32_t size = std::max(width, height);
+
+    while (size > 1) {
+        size >>= 1;
+        length++;
+    }
+
+    return length;
+}
+
+void mip_generate_rgba8(const unsigned char* pixels, uint32_t width, uint32_t height, mip_filter filter, bool srgb,
+                        std::vector<unsigned char>& outData, std::vector<size_t>& outMipOffsets) {
+    uint32_t mipCount = mip_chain_length(width, height);
+
+    size_t totalSize = 0;
+    outMipOffsets.resize(mipCount);
+    for (uint32_t i = 0; i < mipCount; i++) {
+        outMipOffsets[i] = totalSize;
+        totalSize += (size_t)std::max(width >> i, 1u) * std::max(height >> i, 1u) * 4;
+    }
+
+    outData.resize(totalSize);
+    std::copy(pixels, pixels + (size_t)width * height * 4, outData.begin());
+
+    // Every level is filtered from the previous one while staying in linear float, so rounding never accumulates
+    std::vector<float> current((size_t)width * height * 4);
+    std::vector<float> next;
+    std::vector<float> scratch;
+    decode_level(pixels, (size_t)width * height, srgb, current.data());
+
+    uint32_t levelWidth = width;
+    uint32_t levelHeight = height;
+
+    for (uint32_t i = 1; i < mipCount; i++) {
+        uint32_t nextWidth = std::max(levelWidth >> 1, 1u);
+        uint32_t nextHeight = std::max(levelHeight >> 1, 1u);
+
+        next.resize((size_t)nextWidth * nextHeight * 4);
+        downsample(current.data(), levelWidth, levelHeight, next.data(), nextWidth, nextHeight, filter, scratch);
+        encode_level(next.data(), (size_t)nextWidth * nextHeight, srgb, outData.data() + outMipOffsets[i]);
+
+        std::swap(current, next);
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+}
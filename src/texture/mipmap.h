@@ -0,0 +1,35 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+enum mip_filter {
+    MIP_FILTER_BOX,
+    // Kaiser windowed sinc, sharper than the box filter at the cost of slight ringing
+    MIP_FILTER_KAISER
+};
+
+uint32_t mip_chain_length(uint32_t width, uint32_t height);
+
+// Builds the full mip chain of a 4 channel 8 bit image. Filtering happens in linear space, with srgb the color
+// channels are decoded before and encoded after filtering, alpha is always linear.
+// outData receives all levels including the top one, largest first and tightly packed.
+void mip_generate_rgba8(const unsigned char* pixels, uint32_t width, uint32_t height, mip_filter filter, bool srgb,
+                        std::vector<unsigned char>& outData, std::vector<size_t>& outMipOffsets);
@@ -0,0 +1,147 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "texture_cache.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+#define TEXTURE_CACHE_MAGIC (('K'<<24)+('P'<<16)+('X'<<8)+'T')
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_ALIGNMENT 16
+
+struct texture_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+texture_cache* texture_cache_open(const std::string& path) {
+    mapped_file* file = map_file(path);
+    if (file == nullptr) {
+        return nullptr;
+    }
+
+    texture_cache_header header;
+    if (file->size < sizeof(header)) {
+        unmap_file(file);
+        return nullptr;
+    }
+
+    memcpy(&header, file->data, sizeof(header));
+
+    size_t entriesEnd = sizeof(header) + (size_t)header.entryCount * sizeof(texture_cache_entry);
+    if (header.magic != TEXTURE_CACHE_MAGIC || header.version != TEXTURE_CACHE_VERSION || entriesEnd > file->size) {
+        std::cout << path << " is not a valid texture cache!" << std::endl;
+        unmap_file(file);
+        return nullptr;
+    }
+
+    const texture_cache_entry* entries = (const texture_cache_entry*)(file->data + sizeof(header));
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+        if (entries[i].dataOffset + entries[i].dataSize > file->size || entries[i].mipCount > TEXTURE_CACHE_MAX_MIPS) {
+            std::cout << path << " is truncated!" << std::endl;
+            unmap_file(file);
+            return nullptr;
+        }
+    }
+
+    texture_cache* cache = new texture_cache();
+    cache->file = file;
+    cache->entries = entries;
+    cache->entryCount = header.entryCount;
+
+    return cache;
+}
+
+void texture_cache_close(texture_cache* cache) {
+    unmap_file(cache->file);
+    delete cache;
+}
+
+const texture_cache_entry* texture_cache_find(const texture_cache* cache, uint64_t key) {
+    const texture_cache_entry* end = cache->entries + cache->entryCount;
+    const texture_cache_entry* entry = std::lower_bound(cache->entries, end, key, [](const texture_cache_entry& e, uint64_t k) { return e.key < k; });
+
+    if (entry == end || entry->key != key) {
+        return nullptr;
+    }
+
+    return entry;
+}
+
+const unsigned char* texture_cache_data(const texture_cache* cache, const texture_cache_entry* entry) {
+    return cache->file->data + entry->dataOffset;
+}
+
+bool texture_cache_write(const std::string& path, std::vector<texture_cache_source> sources) {
+    std::sort(sources.begin(), sources.end(), [](const texture_cache_source& a, const texture_cache_source& b) { return a.entry.key < b.entry.key; });
+    sources.erase(std::unique(sources.begin(), sources.end(), [](const texture_cache_source& a, const texture_cache_source& b) { return a.entry.key == b.entry.key; }), sources.end());
+
+    texture_cache_header header = { TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, (uint32_t)sources.size(), 0 };
+
+    uint64_t offset = sizeof(header) + sources.size() * sizeof(texture_cache_entry);
+    for (texture_cache_source& source : sources) {
+        offset = (offset + TEXTURE_CACHE_ALIGNMENT - 1) & ~(uint64_t)(TEXTURE_CACHE_ALIGNMENT - 1);
+        source.entry.dataOffset = offset;
+        offset += source.entry.dataSize;
+    }
+
+    // The old cache may still be mapped, so never write over it directly
+    std::string temporaryPath = path + ".tmp";
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open()) {
+            std::cout << "Could not open " << temporaryPath << std::endl;
+            return false;
+        }
+
+        file.write((const char*)&header, sizeof(header));
+        for (const texture_cache_source& source : sources) {
+            file.write((const char*)&source.entry, sizeof(source.entry));
+        }
+
+        const char padding[TEXTURE_CACHE_ALIGNMENT] = {};
+        uint64_t position = sizeof(header) + sources.size() * sizeof(texture_cache_entry);
+
+        for (const texture_cache_source& source : sources) {
+            file.write(padding, source.entry.dataOffset - position);
+            file.write((const char*)source.data, source.entry.dataSize);
+            position = source.entry.dataOffset + source.entry.dataSize;
+        }
+
+        if (!file.good()) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+
+    if (error) {
+        std::cout << "Could not replace " << path << std::endl;
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    return true;
+}
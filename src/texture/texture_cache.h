@@ -0,0 +1,60 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "../mapped_file.h"
+
+#define TEXTURE_CACHE_MAX_MIPS 16
+
+// One texture in upload layout: mips largest first, every mip holds its data tightly packed
+struct texture_cache_entry {
+    uint64_t key;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    // Offset from the start of the file, 16 byte aligned
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    // Relative to dataOffset
+    uint64_t mipOffsets[TEXTURE_CACHE_MAX_MIPS];
+};
+
+// A memory mapped container of textures, entries are sorted by key
+struct texture_cache {
+    mapped_file* file;
+    const texture_cache_entry* entries;
+    uint32_t entryCount;
+};
+
+struct texture_cache_source {
+    // dataOffset is filled in by the writer
+    texture_cache_entry entry;
+    const unsigned char* data;
+};
+
+texture_cache* texture_cache_open(const std::string& path);
+void texture_cache_close(texture_cache* cache);
+
+const texture_cache_entry* texture_cache_find(const texture_cache* cache, uint64_t key);
+const unsigned char* texture_cache_data(const texture_cache* cache, const texture_cache_entry* entry);
+
+bool texture_cache_write(const std::string& path, std::vector<texture_cache_source> sources);
@@ -0,0 +1,253 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "vulkan_depth_pyramid.h"
+#include "vulkan_utils.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Push constants of depth_pyramid.comp
+struct depth_pyramid_reduce {
+    int32_t sourceSize[2];
+    int32_t destinationSize[2];
+};
+
+static void write_reduce_set(VkDevice device, VkDescriptorSet set, VkSampler sampler, VkImageView source, VkImageLayout sourceLayout, VkImageView destination) {
+    VkDescriptorImageInfo sourceInfo = {};
+    sourceInfo.sampler = sampler;
+    sourceInfo.imageView = source;
+    sourceInfo.imageLayout = sourceLayout;
+
+    VkDescriptorImageInfo destinationInfo = {};
+    destinationInfo.imageView = destination;
+    destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet writes[2] = {};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].dstSet = set;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorCount = 1;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].pImageInfo = &sourceInfo;
+
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = set;
+    writes[1].dstBinding = 1;
+    writes[1].descriptorCount = 1;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writes[1].pImageInfo = &destinationInfo;
+
+    vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+}
+
+vulkan_depth_pyramid* init_depth_pyramid(vulkan_renderer* renderer) {
+    VkDevice device = renderer->init_objects.device;
+    vulkan_depth_pyramid* pyramid = new vulkan_depth_pyramid();
+
+    // Sizes round down like the mip chain does, the last texel of an odd level is folded into its neighbour by the shader
+    pyramid->width = std::max(renderer->init_objects.swapchainExtent.width / 2, 1u);
+    pyramid->height = std::max(renderer->init_objects.swapchainExtent.height / 2, 1u);
+    pyramid->levels = 1;
+    while (std::max(pyramid->width, pyramid->height) >> pyramid->levels > 0) {
+        pyramid->levels++;
+    }
+
+    if (!vulkan_createImageArray(renderer, pyramid->width, pyramid->height, 1, pyramid->levels, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pyramid->image, pyramid->allocation)) {
+        throw std::runtime_error("failed to create depth pyramid image!");
+    }
+
+    pyramid->view = vulkan_createImageView(renderer, pyramid->image, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R32_SFLOAT, 1, pyramid->levels);
+    pyramid->levelViews.resize(pyramid->levels);
+    for (uint32_t i = 0; i < pyramid->levels; i++) {
+        pyramid->levelViews[i] = vulkan_createImageSubresourceView(renderer, pyramid->image, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 1);
+    }
+
+    // Descriptors of the culling shaders point at it before the first build, so it is in GENERAL from the start
+    VkCommandBuffer commandBuffer = vulkan_beginSingleTimeCommandBuffer(renderer);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid->image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = pyramid->levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    vulkan_endSingleTimeCommandBuffer(renderer, commandBuffer);
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = (float)pyramid->levels;
+
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &pyramid->sampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid sampler!");
+    }
+
+    // The source level and the level written
+    vulkan_shader_reflection reflection;
+    VkShaderModule reduceShader = vulkan_createShaderModule(renderer, "depth_pyramid_comp.spv", &reflection);
+    if (reflection.sets.size() != 1 || reflection.sets[0].size() != 2 || reflection.pushConstantSize != sizeof(depth_pyramid_reduce)) {
+        throw std::runtime_error("depth pyramid shader doesn't match depth_pyramid_reduce!");
+    }
+
+    pyramid->setLayout = vulkan_getDescriptorSetLayout(renderer->descriptorLayouts, reflection.sets[0].data(), 2);
+    if (pyramid->setLayout == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+
+    uint32_t setCount = (uint32_t)renderer->depthTargets.size() + pyramid->levels - 1;
+
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = setCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = setCount;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = setCount;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pyramid->descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    std::vector<VkDescriptorSetLayout> setLayouts(setCount, pyramid->setLayout);
+    std::vector<VkDescriptorSet> sets(setCount);
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pyramid->descriptorPool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts = setLayouts.data();
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate descriptor sets!");
+    }
+
+    pyramid->depthSets.assign(sets.begin(), sets.begin() + renderer->depthTargets.size());
+    pyramid->levelSets.assign(sets.begin() + renderer->depthTargets.size(), sets.end());
+
+    for (size_t i = 0; i < renderer->depthTargets.size(); i++) {
+        write_reduce_set(device, pyramid->depthSets[i], pyramid->sampler, renderer->depthTargets[i].sampledView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, pyramid->levelViews[0]);
+    }
+    for (uint32_t i = 1; i < pyramid->levels; i++) {
+        write_reduce_set(device, pyramid->levelSets[i - 1], pyramid->sampler, pyramid->levelViews[i - 1], VK_IMAGE_LAYOUT_GENERAL, pyramid->levelViews[i]);
+    }
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = reflection.pushConstantSize;
+    pushConstantRange.stageFlags = reflection.pushConstantStages;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &pyramid->setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pyramid->pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = reduceShader;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pyramid->pipelineLayout;
+    pipelineInfo.basePipelineIndex = -1;
+
+    if (vulkan_createComputePipeline(device, renderer->pipelineCache, &pipelineInfo, "depth pyramid", &pyramid->pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid pipeline!");
+    }
+
+    vkDestroyShaderModule(device, pipelineInfo.stage.module, nullptr);
+
+    return pyramid;
+}
+
+void deinit_depth_pyramid(vulkan_renderer* renderer, vulkan_depth_pyramid* pyramid) {
+    VkDevice device = renderer->init_objects.device;
+
+    vkDestroyPipeline(device, pyramid->pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pyramid->pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, pyramid->descriptorPool, nullptr);
+    vkDestroySampler(device, pyramid->sampler, nullptr);
+
+    for (VkImageView view : pyramid->levelViews) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    vkDestroyImageView(device, pyramid->view, nullptr);
+    vulkan_destroyImage(renderer, pyramid->image, pyramid->allocation);
+
+    delete pyramid;
+}
+
+void vulkan_buildDepthPyramid(vulkan_renderer* renderer, vulkan_depth_pyramid* pyramid, VkCommandBuffer commandBuffer, uint32_t swapchainImageIndex) {
+    // Culling earlier in this frame read the last pyramid
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramid->pipeline);
+
+    depth_pyramid_reduce reduce = {};
+    reduce.sourceSize[0] = (int32_t)renderer->init_objects.swapchainExtent.width;
+    reduce.sourceSize[1] = (int32_t)renderer->init_objects.swapchainExtent.height;
+
+    for (uint32_t level = 0; level < pyramid->levels; level++) {
+        reduce.destinationSize[0] = std::max((int32_t)pyramid->width >> level, 1);
+        reduce.destinationSize[1] = std::max((int32_t)pyramid->height >> level, 1);
+
+        VkDescriptorSet set = level == 0 ? pyramid->depthSets[swapchainImageIndex] : pyramid->levelSets[level - 1];
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramid->pipelineLayout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pyramid->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(reduce), &reduce);
+        vkCmdDispatch(commandBuffer, (reduce.destinationSize[0] + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE,
+                      (reduce.destinationSize[1] + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+
+        // The last one makes the whole pyramid visible to the culling of the next frame
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        reduce.sourceSize[0] = reduce.destinationSize[0];
+        reduce.sourceSize[1] = reduce.destinationSize[1];
+    }
+
+    pyramid->valid = true;
+}
@@ -0,0 +1,53 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "vulkan_renderer.h"
+
+#define DEPTH_PYRAMID_GROUP_SIZE 8
+
+// Max reduction of the depth buffer for occlusion culling. Level 0 is half the swapchain extent and
+// every texel holds the farthest depth of the texels it covers, so whatever is behind a texel at any level is hidden.
+struct vulkan_depth_pyramid {
+    VkImage image;
+    vulkan_allocation allocation;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    // All levels for sampling, one view per level for the storage writes
+    VkImageView view;
+    std::vector<VkImageView> levelViews;
+    VkSampler sampler;
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descriptorPool;
+    // Level 0 reduces the depth attachment of one swapchain image, level i the level before it
+    std::vector<VkDescriptorSet> depthSets;
+    std::vector<VkDescriptorSet> levelSets;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    // Built at the end of the last submitted frame, stale otherwise
+    bool valid;
+};
+
+// Needs the renderer's depth attachments, the pyramid is sized for the current swapchain extent
+vulkan_depth_pyramid* init_depth_pyramid(vulkan_renderer* renderer);
+void deinit_depth_pyramid(vulkan_renderer* renderer, vulkan_depth_pyramid* pyramid);
+
+// Recorded after the render pass into the frame's primary. The pyramid is always in GENERAL and is ready for
+// compute reads of later commands on the graphics queue.
+void vulkan_buildDepthPyramid(vulkan_renderer* renderer, vulkan_depth_pyramid* pyramid, VkCommandBuffer commandBuffer, uint32_t swapchainImageIndex);
@@ -0,0 +1,220 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "vulkan_descriptors.h"
+#include "../cooked_store.h"
+
+#include <stdexcept>
+
+// Descriptors per set of each type a pool reserves, sized after what the bsp, imgui and pyramid layouts use
+static const struct {
+    VkDescriptorType type;
+    float perSet;
+} pool_ratios[] = {
+    { VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f },
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f },
+    { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 2.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f },
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+};
+
+vulkan_descriptor_layout_cache* init_descriptor_layout_cache(VkDevice device) {
+    vulkan_descriptor_layout_cache* cache = new vulkan_descriptor_layout_cache();
+    cache->device = device;
+    return cache;
+}
+
+void deinit_descriptor_layout_cache(vulkan_descriptor_layout_cache* cache) {
+    for (vulkan_descriptor_layout_entry& entry : cache->entries) {
+        vkDestroyDescriptorSetLayout(cache->device, entry.layout, nullptr);
+    }
+
+    delete cache;
+}
+
+VkDescriptorSetLayout vulkan_getDescriptorSetLayout(vulkan_descriptor_layout_cache* cache, const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount,
+                                                    const VkDescriptorBindingFlagsEXT* bindingFlags, VkDescriptorSetLayoutCreateFlags flags) {
+    std::vector<uint64_t> key;
+    key.push_back(flags);
+    key.push_back(bindingFlags != nullptr);
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        const VkDescriptorSetLayoutBinding& binding = bindings[i];
+        key.push_back(((uint64_t)binding.binding << 32) | (uint64_t)binding.descriptorType);
+        key.push_back(((uint64_t)binding.descriptorCount << 32) | (uint64_t)binding.stageFlags);
+        key.push_back(bindingFlags != nullptr ? bindingFlags[i] : 0);
+
+        if (binding.pImmutableSamplers != nullptr) {
+            for (uint32_t j = 0; j < binding.descriptorCount; j++) {
+                key.push_back((uint64_t)binding.pImmutableSamplers[j]);
+            }
+        }
+    }
+
+    uint64_t hash = cooked_hash(key.data(), key.size() * sizeof(uint64_t));
+
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    cache->requests++;
+
+    std::vector<uint32_t>& candidates = cache->entriesByHash[hash];
+    for (uint32_t index : candidates) {
+        if (cache->entries[index].key == key) {
+            return cache->entries[index].layout;
+        }
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsInfo.bindingCount = bindingCount;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.flags = flags;
+    layoutInfo.bindingCount = bindingCount;
+    layoutInfo.pBindings = bindings;
+    if (bindingFlags != nullptr) {
+        layoutInfo.pNext = &bindingFlagsInfo;
+    }
+
+    vulkan_descriptor_layout_entry entry;
+    entry.key = std::move(key);
+    if (vkCreateDescriptorSetLayout(cache->device, &layoutInfo, nullptr, &entry.layout) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    candidates.push_back((uint32_t)cache->entries.size());
+    cache->entries.push_back(std::move(entry));
+    return cache->entries.back().layout;
+}
+
+vulkan_descriptor_allocator* init_descriptor_allocator(VkDevice device, uint32_t frameSlots) {
+    vulkan_descriptor_allocator* allocator = new vulkan_descriptor_allocator();
+    allocator->device = device;
+    allocator->frames.resize(frameSlots);
+    return allocator;
+}
+
+static void destroy_pools(VkDevice device, std::vector<VkDescriptorPool>& pools) {
+    for (VkDescriptorPool pool : pools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+
+    pools.clear();
+}
+
+void deinit_descriptor_allocator(vulkan_descriptor_allocator* allocator) {
+    for (vulkan_descriptor_frame& frame : allocator->frames) {
+        destroy_pools(allocator->device, frame.pools);
+    }
+
+    destroy_pools(allocator->device, allocator->persistent.pools);
+    destroy_pools(allocator->device, allocator->freePools);
+    delete allocator;
+}
+
+void vulkan_descriptorAllocatorBeginFrame(vulkan_descriptor_allocator* allocator, uint32_t slot) {
+    vulkan_descriptor_frame& frame = allocator->frames[slot];
+
+    for (VkDescriptorPool pool : frame.pools) {
+        vkResetDescriptorPool(allocator->device, pool, 0);
+    }
+
+    // Keep as many pools as the slot filled last time, a spike doesn't pin its pools to one slot
+    uint32_t keep = frame.pools.empty() ? 0 : frame.currentPool + 1;
+    allocator->freePools.insert(allocator->freePools.end(), frame.pools.begin() + keep, frame.pools.end());
+    frame.pools.resize(keep);
+
+    allocator->setsLastFrame = allocator->frames[allocator->currentFrame].allocatedSets;
+    allocator->currentFrame = slot;
+    frame.currentPool = 0;
+    frame.allocatedSets = 0;
+}
+
+static VkDescriptorPool create_pool(vulkan_descriptor_allocator* allocator) {
+    if (!allocator->freePools.empty()) {
+        VkDescriptorPool pool = allocator->freePools.back();
+        allocator->freePools.pop_back();
+        return pool;
+    }
+
+    VkDescriptorPoolSize poolSizes[sizeof(pool_ratios) / sizeof(pool_ratios[0])];
+    uint32_t poolSizeCount = 0;
+    for (const auto& ratio : pool_ratios) {
+        poolSizes[poolSizeCount].type = ratio.type;
+        poolSizes[poolSizeCount].descriptorCount = (uint32_t)(ratio.perSet * DESCRIPTOR_POOL_SETS);
+        poolSizeCount++;
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = poolSizeCount;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = DESCRIPTOR_POOL_SETS;
+
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(allocator->device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    allocator->poolCount++;
+    return pool;
+}
+
+static VkDescriptorSet allocate_set(vulkan_descriptor_allocator* allocator, vulkan_descriptor_frame& frame, VkDescriptorSetLayout layout) {
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    // Usually succeeds on the current pool, a full one is skipped for the rest of the frame
+    while (true) {
+        bool fresh = frame.currentPool == frame.pools.size();
+        if (fresh) {
+            frame.pools.push_back(create_pool(allocator));
+        }
+
+        allocInfo.descriptorPool = frame.pools[frame.currentPool];
+
+        VkDescriptorSet set;
+        VkResult result = vkAllocateDescriptorSets(allocator->device, &allocInfo, &set);
+        if (result == VK_SUCCESS) {
+            frame.allocatedSets++;
+            return set;
+        }
+
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+
+        // An empty pool that can't hold the set never will
+        if (fresh) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+        frame.currentPool++;
+    }
+}
+
+VkDescriptorSet vulkan_allocateFrameDescriptorSet(vulkan_descriptor_allocator* allocator, VkDescriptorSetLayout layout) {
+    return allocate_set(allocator, allocator->frames[allocator->currentFrame], layout);
+}
+
+VkDescriptorSet vulkan_allocatePersistentDescriptorSet(vulkan_descriptor_allocator* allocator, VkDescriptorSetLayout layout) {
+    return allocate_set(allocator, allocator->persistent, layout);
+}
@@ -0,0 +1,83 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "vulkan_init.h"
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+
+// Sets one pool of the descriptor allocator holds, the descriptor counts per type scale with it
+#define DESCRIPTOR_POOL_SETS 128
+
+struct vulkan_descriptor_layout_entry {
+    // Flags, bindings, binding flags and immutable sampler handles flattened into words, compared on hash collisions
+    std::vector<uint64_t> key;
+    VkDescriptorSetLayout layout;
+};
+
+// Deduplicates descriptor set layouts by their bindings. Layouts live until the cache is destroyed, so owners never
+// destroy them and two owners asking for the same bindings share one layout.
+struct vulkan_descriptor_layout_cache {
+    VkDevice device;
+    std::vector<vulkan_descriptor_layout_entry> entries;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> entriesByHash;
+    uint32_t requests;
+    std::mutex mutex;
+};
+
+vulkan_descriptor_layout_cache* init_descriptor_layout_cache(VkDevice device);
+void deinit_descriptor_layout_cache(vulkan_descriptor_layout_cache* cache);
+
+// May be called from any thread. bindingFlags is nullptr or has one entry per binding, immutable samplers are part of
+// the key by handle. Returns VK_NULL_HANDLE if the layout couldn't be created.
+VkDescriptorSetLayout vulkan_getDescriptorSetLayout(vulkan_descriptor_layout_cache* cache, const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount,
+                                                    const VkDescriptorBindingFlagsEXT* bindingFlags = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0);
+
+// Pools one frame slot allocated from, reset together once the slot's fence signalled
+struct vulkan_descriptor_frame {
+    std::vector<VkDescriptorPool> pools;
+    // Pools before this one are full
+    uint32_t currentPool;
+    uint32_t allocatedSets;
+};
+
+// Hands out descriptor sets from growable lists of pools. Frame sets are only valid while their frame is recorded and
+// in flight, all pools of a slot are reset at once and kept for the next time the slot comes around. Persistent sets
+// live as long as the allocator. Render thread only.
+struct vulkan_descriptor_allocator {
+    VkDevice device;
+    std::vector<vulkan_descriptor_frame> frames;
+    uint32_t currentFrame;
+    vulkan_descriptor_frame persistent;
+    // Reset pools beyond what the slots kept, reused before new pools are created
+    std::vector<VkDescriptorPool> freePools;
+    uint32_t poolCount;
+    uint32_t setsLastFrame;
+};
+
+vulkan_descriptor_allocator* init_descriptor_allocator(VkDevice device, uint32_t frameSlots);
+void deinit_descriptor_allocator(vulkan_descriptor_allocator* allocator);
+
+// Called once the fence of the slot was waited for, every set the slot allocated last time is invalid afterwards
+void vulkan_descriptorAllocatorBeginFrame(vulkan_descriptor_allocator* allocator, uint32_t slot);
+
+// Throw if no pool could be created. Layouts with variable descriptor counts or update after bind bindings need pools
+// of their own.
+VkDescriptorSet vulkan_allocateFrameDescriptorSet(vulkan_descriptor_allocator* allocator, VkDescriptorSetLayout layout);
+VkDescriptorSet vulkan_allocatePersistentDescriptorSet(vulkan_descriptor_allocator* allocator, VkDescriptorSetLayout layout);
@@ -0,0 +1,81 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "vulkan_frame_ring.h"
+#include "vulkan_renderer.h"
+#include "vulkan_utils.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+vulkan_frame_ring* init_frame_ring(vulkan_renderer* renderer, uint32_t frameSlots, VkDeviceSize size) {
+    vulkan_frame_ring* ring = new vulkan_frame_ring();
+    ring->renderer = renderer;
+    ring->size = size;
+    ring->currentSlot = 0;
+    ring->head = 0;
+    ring->usedLastFrame = 0;
+    ring->peakUsed = 0;
+
+    // Both limits are powers of two, so the larger one satisfies the other
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(renderer->init_objects.physicalDevice, &properties);
+    ring->alignment = std::max<VkDeviceSize>(16, std::max(properties.limits.minUniformBufferOffsetAlignment, properties.limits.minStorageBufferOffsetAlignment));
+
+    ring->slots.resize(frameSlots);
+    for (vulkan_frame_ring_slot& slot : ring->slots) {
+        if (!vulkan_createBuffer(renderer, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, slot.buffer, slot.allocation)) {
+            throw std::runtime_error("failed to create frame ring buffer!");
+        }
+    }
+
+    return ring;
+}
+
+void deinit_frame_ring(vulkan_frame_ring* ring) {
+    for (vulkan_frame_ring_slot& slot : ring->slots) {
+        vulkan_destroyBuffer(ring->renderer, slot.buffer, slot.allocation);
+    }
+
+    delete ring;
+}
+
+void vulkan_frameRingBeginFrame(vulkan_frame_ring* ring, uint32_t slot) {
+    // The head still holds what the frame recorded before this one used
+    VkDeviceSize used = std::min(ring->head.load(), ring->size);
+    ring->usedLastFrame = used;
+    ring->peakUsed = std::max(ring->peakUsed, used);
+
+    ring->currentSlot = slot;
+    ring->head = 0;
+}
+
+void* vulkan_frameRingAllocate(vulkan_frame_ring* ring, VkDeviceSize size, uint32_t* outOffset) {
+    VkDeviceSize alignedSize = (size + ring->alignment - 1) / ring->alignment * ring->alignment;
+    VkDeviceSize offset = ring->head.fetch_add(alignedSize);
+    if (offset + size > ring->size) {
+        throw std::runtime_error("frame ring is full!");
+    }
+
+    *outOffset = (uint32_t)offset;
+    return (char*)ring->slots[ring->currentSlot].allocation.mapped + offset;
+}
+
+VkBuffer vulkan_frameRingBuffer(vulkan_frame_ring* ring, uint32_t slot) {
+    return ring->slots[slot].buffer;
+}
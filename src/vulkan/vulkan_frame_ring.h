@@ -0,0 +1,59 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "vulkan_memory.h"
+#include <atomic>
+#include <vector>
+
+// Bytes of per frame data one frame slot can hold
+#define FRAME_RING_SIZE (4ull * 1024 * 1024)
+
+struct vulkan_renderer;
+
+// Host visible and persistently mapped, written by the CPU while the slot's frame is recorded
+struct vulkan_frame_ring_slot {
+    VkBuffer buffer;
+    vulkan_allocation allocation;
+};
+
+// Per frame uniform and storage data, handed out linearly from the buffer of the frame slot that is recorded. The
+// buffers live as long as the ring, so descriptor sets point at them once and select the data with dynamic offsets.
+// Allocating is lock free, workers recording secondaries may allocate while the render thread does.
+struct vulkan_frame_ring {
+    vulkan_renderer* renderer;
+    std::vector<vulkan_frame_ring_slot> slots;
+    VkDeviceSize size;
+    // Offsets are aligned for uniform and storage buffer descriptors alike
+    VkDeviceSize alignment;
+    uint32_t currentSlot;
+    std::atomic<VkDeviceSize> head;
+    VkDeviceSize usedLastFrame;
+    VkDeviceSize peakUsed;
+};
+
+vulkan_frame_ring* init_frame_ring(vulkan_renderer* renderer, uint32_t frameSlots, VkDeviceSize size);
+void deinit_frame_ring(vulkan_frame_ring* ring);
+
+// Called once the fence of the slot was waited for, the slot's data of its last frame is overwritten afterwards
+void vulkan_frameRingBeginFrame(vulkan_frame_ring* ring, uint32_t slot);
+
+// May be called from any thread while a frame is recorded. Returns the mapped memory, outOffset is the dynamic offset
+// into the current slot's buffer. Throws if the slot is full.
+void* vulkan_frameRingAllocate(vulkan_frame_ring* ring, VkDeviceSize size, uint32_t* outOffset);
+VkBuffer vulkan_frameRingBuffer(vulkan_frame_ring* ring, uint32_t slot);
@@ -0,0 +1,212 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "vulkan_gpu_profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+vulkan_gpu_profiler* init_gpu_profiler(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t frameSlots) {
+    vulkan_gpu_profiler* profiler = new vulkan_gpu_profiler();
+    profiler->slots.resize(frameSlots);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t validBits = queueFamily < queueFamilyCount ? queueFamilies[queueFamily].timestampValidBits : 0;
+    if (validBits == 0) {
+        std::cout << "GPU profiler disabled, the graphics queue has no timestamps" << std::endl;
+        return profiler;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    profiler->nanosecondsPerTick = properties.limits.timestampPeriod;
+    profiler->timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = frameSlots * GPU_PROFILER_MAX_SCOPES * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &profiler->queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool!");
+    }
+
+    profiler->supported = true;
+    return profiler;
+}
+
+void deinit_gpu_profiler(VkDevice device, vulkan_gpu_profiler* profiler) {
+    if (profiler->supported) {
+        vkDestroyQueryPool(device, profiler->queryPool, nullptr);
+    }
+
+    delete profiler;
+}
+
+static double ticks_to_milliseconds(const vulkan_gpu_profiler* profiler, int64_t ticks) {
+    return (double)ticks * profiler->nanosecondsPerTick / 1000000.0;
+}
+
+static void resolve_slot(VkDevice device, vulkan_gpu_profiler* profiler, uint32_t slotIndex) {
+    vulkan_gpu_profiler_slot& slot = profiler->slots[slotIndex];
+    if (slot.names.empty() || profiler->paused) {
+        return;
+    }
+
+    // Value and availability per query, scopes that were never ended or executed are skipped
+    uint32_t queryCount = (uint32_t)slot.names.size() * 2;
+    std::vector<uint64_t> results(queryCount * 2);
+    VkResult result = vkGetQueryPoolResults(device, profiler->queryPool, slotIndex * GPU_PROFILER_MAX_SCOPES * 2, queryCount, results.size() * sizeof(uint64_t), results.data(),
+                                            2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+        return;
+    }
+
+    std::vector<uint64_t> begins;
+    std::vector<uint64_t> ends;
+    std::vector<const char*> names;
+    uint64_t frameBegin = UINT64_MAX;
+
+    for (size_t i = 0; i < slot.names.size(); i++) {
+        const uint64_t* query = &results[i * 4];
+        if (query[1] == 0 || query[3] == 0) {
+            continue;
+        }
+
+        uint64_t begin = query[0] & profiler->timestampMask;
+        uint64_t end = query[2] & profiler->timestampMask;
+        begins.push_back(begin);
+        ends.push_back(std::max(begin, end));
+        names.push_back(slot.names[i]);
+        frameBegin = std::min(frameBegin, begin);
+    }
+
+    if (names.empty()) {
+        return;
+    }
+
+    if (!profiler->hasFirstTimestamp) {
+        profiler->firstTimestamp = frameBegin;
+        profiler->hasFirstTimestamp = true;
+    }
+
+    vulkan_gpu_frame frame = {};
+    frame.frameNumber = slot.frameNumber;
+    frame.beginMilliseconds = ticks_to_milliseconds(profiler, (int64_t)(frameBegin - profiler->firstTimestamp));
+
+    for (size_t i = 0; i < names.size(); i++) {
+        vulkan_gpu_scope scope = {};
+        scope.name = names[i];
+        scope.beginMilliseconds = ticks_to_milliseconds(profiler, (int64_t)(begins[i] - frameBegin));
+        scope.durationMilliseconds = ticks_to_milliseconds(profiler, (int64_t)(ends[i] - begins[i]));
+        frame.scopes.push_back(scope);
+        frame.durationMilliseconds = std::max(frame.durationMilliseconds, scope.beginMilliseconds + scope.durationMilliseconds);
+    }
+
+    // Scopes are recorded in CPU order, which is not the order they nest in on the GPU. Outer scopes sort first.
+    std::sort(frame.scopes.begin(), frame.scopes.end(), [](const vulkan_gpu_scope& a, const vulkan_gpu_scope& b) {
+        if (a.beginMilliseconds != b.beginMilliseconds) {
+            return a.beginMilliseconds < b.beginMilliseconds;
+        }
+        return a.durationMilliseconds > b.durationMilliseconds;
+    });
+
+    std::vector<double> openEnds;
+    for (vulkan_gpu_scope& scope : frame.scopes) {
+        while (!openEnds.empty() && openEnds.back() <= scope.beginMilliseconds) {
+            openEnds.pop_back();
+        }
+        scope.depth = (uint32_t)openEnds.size();
+        openEnds.push_back(scope.beginMilliseconds + scope.durationMilliseconds);
+    }
+
+    profiler->history.push_back(std::move(frame));
+    if (profiler->history.size() > GPU_PROFILER_HISTORY) {
+        profiler->history.pop_front();
+    }
+}
+
+void vulkan_gpuProfilerBeginFrame(VkDevice device, vulkan_gpu_profiler* profiler, VkCommandBuffer commandBuffer, uint32_t slot, uint64_t frameNumber) {
+    if (!profiler->supported) {
+        return;
+    }
+
+    resolve_slot(device, profiler, slot);
+
+    profiler->currentSlot = slot;
+    profiler->slots[slot].names.clear();
+    profiler->slots[slot].frameNumber = frameNumber;
+    vkCmdResetQueryPool(commandBuffer, profiler->queryPool, slot * GPU_PROFILER_MAX_SCOPES * 2, GPU_PROFILER_MAX_SCOPES * 2);
+}
+
+uint32_t vulkan_beginGpuScope(vulkan_gpu_profiler* profiler, VkCommandBuffer commandBuffer, const char* name) {
+    if (!profiler->supported) {
+        return GPU_SCOPE_INVALID;
+    }
+
+    vulkan_gpu_profiler_slot& slot = profiler->slots[profiler->currentSlot];
+    if (slot.names.size() == GPU_PROFILER_MAX_SCOPES) {
+        return GPU_SCOPE_INVALID;
+    }
+
+    uint32_t scope = (uint32_t)slot.names.size();
+    slot.names.push_back(name);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool, (profiler->currentSlot * GPU_PROFILER_MAX_SCOPES + scope) * 2);
+    return scope;
+}
+
+void vulkan_endGpuScope(vulkan_gpu_profiler* profiler, VkCommandBuffer commandBuffer, uint32_t scope) {
+    if (scope == GPU_SCOPE_INVALID) {
+        return;
+    }
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPool, (profiler->currentSlot * GPU_PROFILER_MAX_SCOPES + scope) * 2 + 1);
+}
+
+bool vulkan_exportGpuTrace(const vulkan_gpu_profiler* profiler, const std::string& path) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not write GPU trace " << path << std::endl;
+        return false;
+    }
+
+    // Complete events in microseconds, one thread for the graphics queue
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GPU graphics queue\"}}";
+
+    for (const vulkan_gpu_frame& frame : profiler->history) {
+        for (const vulkan_gpu_scope& scope : frame.scopes) {
+            file << ",\n{\"name\":\"" << scope.name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+                 << ",\"ts\":" << (frame.beginMilliseconds + scope.beginMilliseconds) * 1000.0
+                 << ",\"dur\":" << scope.durationMilliseconds * 1000.0
+                 << ",\"args\":{\"frame\":" << frame.frameNumber << "}}";
+        }
+    }
+
+    file << "\n]}\n";
+
+    std::cout << "Wrote " << profiler->history.size() << " GPU frames to " << path << std::endl;
+    return true;
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "vulkan_init.h"
+#include <deque>
+#include <string>
+
+#define GPU_PROFILER_MAX_SCOPES 64
+#define GPU_PROFILER_HISTORY 240
+#define GPU_SCOPE_INVALID UINT32_MAX
+
+// Timing of one scope, relative to the first timestamp of its frame
+struct vulkan_gpu_scope {
+    const char* name;
+    // Number of scopes around it on the GPU timeline, derived from the timestamps
+    uint32_t depth;
+    double beginMilliseconds;
+    double durationMilliseconds;
+};
+
+struct vulkan_gpu_frame {
+    uint64_t frameNumber;
+    // From the first timestamp the profiler resolved to the first one of this frame
+    double beginMilliseconds;
+    double durationMilliseconds;
+    // Ordered by begin
+    std::vector<vulkan_gpu_scope> scopes;
+};
+
+// Scopes recorded into one frame slot, each owns a begin and end timestamp query
+struct vulkan_gpu_profiler_slot {
+    std::vector<const char*> names;
+    uint64_t frameNumber;
+};
+
+// Timestamp queries around scopes of the graphics queue. Results of a frame slot are read when the slot comes
+// around again, its fence has signalled by then so reading never stalls.
+struct vulkan_gpu_profiler {
+    // The graphics queue family has no valid timestamp bits otherwise, scopes are not recorded then
+    bool supported;
+    VkQueryPool queryPool;
+    double nanosecondsPerTick;
+    uint64_t timestampMask;
+    std::vector<vulkan_gpu_profiler_slot> slots;
+    uint32_t currentSlot;
+    uint64_t firstTimestamp;
+    bool hasFirstTimestamp;
+    // Resolved frames, oldest first
+    std::deque<vulkan_gpu_frame> history;
+    // Stops adding to the history, so a frame can be looked at in the timeline
+    bool paused;
+};
+
+vulkan_gpu_profiler* init_gpu_profiler(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t frameSlots);
+void deinit_gpu_profiler(VkDevice device, vulkan_gpu_profiler* profiler);
+
+// Called once the fence of the slot was waited for. Resolves the scopes the slot recorded last time and resets its
+// queries in the frame's primary, which has to be begun and outside a render pass.
+void vulkan_gpuProfilerBeginFrame(VkDevice device, vulkan_gpu_profiler* profiler, VkCommandBuffer commandBuffer, uint32_t slot, uint64_t frameNumber);
+
+// Render thread only. Scopes may begin and end in different command buffers of the same frame as long as they are
+// executed in that order. The name has to outlive the profiler and is written to traces as is, so no quotes.
+// Returns GPU_SCOPE_INVALID once the slot is full.
+uint32_t vulkan_beginGpuScope(vulkan_gpu_profiler* profiler, VkCommandBuffer commandBuffer, const char* name);
+void vulkan_endGpuScope(vulkan_gpu_profiler* profiler, VkCommandBuffer commandBuffer, uint32_t scope);
+
+// Chrome trace event JSON of the whole history, opens in chrome://tracing and Perfetto
+bool vulkan_exportGpuTrace(const vulkan_gpu_profiler* profiler, const std::string& path);
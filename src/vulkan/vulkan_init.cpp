@@ -41,7 +41,7 @@ static bool createInstance(vulkan_init_parameters init_params, vulkan_objects* o
 	appInfo.applicationVersion = VK_MAKE_VERSION(1,0,0);
 	appInfo.pEngineName = "kaizi Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1,0,0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_1;
 
 	VkInstanceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -153,15 +153,29 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surfa
 		}
 
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+        }
 
         if (presentSupport) {
             indices.presentFamily = i;
         }
 
+		// Prefer a pure DMA family over one that can do compute as well
+		if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+			if (!indices.transferFamily.has_value() || !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+				indices.transferFamily = i;
+			}
+		}
+
 		i++;
 	}
 
+	// Nothing is presented without a surface, the graphics queue stands in so the device setup stays the same
+	if (surface == VK_NULL_HANDLE) {
+		indices.presentFamily = indices.graphicsFamily;
+	}
+
 	return indices;
 }
 
@@ -222,7 +236,9 @@ static bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface, std:
 	}
 
 	bool swapChainAdequate = false;
-	if (matchingExtensions == deviceExtensions.size()) {
+	if (matchingExtensions == deviceExtensions.size() && surface == VK_NULL_HANDLE) {
+		swapChainAdequate = true;
+	} else if (matchingExtensions == deviceExtensions.size()) {
 	    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface);
 
 	    bool correctFormatFound = false;
@@ -287,12 +303,73 @@ static bool init_physical_device(vulkan_init_parameters init_params, vulkan_obje
 	return true;
 }
 
+// Bindless material rendering needs runtime sized, partially bound descriptor arrays indexed non-uniformly
+static bool supportsDescriptorIndexing(VkPhysicalDevice device) {
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device, &deviceProperties);
+
+	if (deviceProperties.apiVersion < VK_API_VERSION_1_1) {
+		return false;
+	}
+
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	bool extensionFound = false;
+	for (const auto& extension : availableExtensions) {
+		if (std::strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0) {
+			extensionFound = true;
+			break;
+		}
+	}
+
+	if (!extensionFound) {
+		return false;
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	VkPhysicalDeviceFeatures2 features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &indexingFeatures;
+
+	vkGetPhysicalDeviceFeatures2(device, &features);
+
+	return indexingFeatures.shaderSampledImageArrayNonUniformIndexing
+		&& indexingFeatures.runtimeDescriptorArray
+		&& indexingFeatures.descriptorBindingPartiallyBound
+		&& indexingFeatures.descriptorBindingVariableDescriptorCount;
+}
+
+static bool supportsDeviceExtension(VkPhysicalDevice device, const char* extensionName) {
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions) {
+		if (std::strcmp(extension.extensionName, extensionName) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static bool init_device_and_queue(vulkan_init_parameters init_params, vulkan_objects* objects) {
 	QueueFamilyIndices indices = findQueueFamilies(objects->physicalDevice, objects->surface);
 	objects->indices = indices;
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+	if (indices.transferFamily.has_value()) {
+		uniqueQueueFamilies.insert(indices.transferFamily.value());
+	}
 
 	float queuePriority = 1.0f;
 
@@ -304,45 +381,99 @@ static bool init_device_and_queue(vulkan_init_parameters init_params, vulkan_obj
         queueCreateInfo.pQueuePriorities = &queuePriority;
         queueCreateInfos.push_back(queueCreateInfo);
 	}
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(objects->physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+	// Wireframe pipeline variants
+	deviceFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid;
+	// GPU driven rendering issues one indirect draw per batch with many commands
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	// Fragment shader invocations per frame for the overdraw statistic, the query spans the secondaries
+	deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+	deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+
+	std::vector<const char*> deviceExtensions = init_params.deviceExtensions;
 
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = queueCreateInfos.size();
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = init_params.deviceExtensions.size();
-	createInfo.ppEnabledExtensionNames = init_params.deviceExtensions.data();
 	createInfo.enabledLayerCount = 0;
 
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	objects->descriptorIndexing = init_params.useDescriptorIndexing && supportsDescriptorIndexing(objects->physicalDevice);
+	if (objects->descriptorIndexing) {
+		indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+		indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+		indexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+
+		deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		createInfo.pNext = &indexingFeatures;
+	}
+
+	bool drawIndirectCount = supportsDeviceExtension(objects->physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	if (drawIndirectCount) {
+		deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	createInfo.enabledExtensionCount = deviceExtensions.size();
+	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
 	if (vkCreateDevice(objects->physicalDevice, &createInfo, nullptr, &(objects->device)) != VK_SUCCESS) {
 		std::cerr << "Could not create device" << std::endl;
 		return false;
 	}
 
+	objects->enabledFeatures = deviceFeatures;
+	objects->cmdDrawIndexedIndirectCount = drawIndirectCount
+		? (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(objects->device, "vkCmdDrawIndexedIndirectCountKHR")
+		: nullptr;
+
 	vkGetDeviceQueue(objects->device, indices.graphicsFamily.value(), 0, &(objects->graphicsQueue));
 	vkGetDeviceQueue(objects->device, indices.presentFamily.value(), 0, &(objects->presentQueue));
+	if (indices.transferFamily.has_value()) {
+		vkGetDeviceQueue(objects->device, indices.transferFamily.value(), 0, &(objects->transferQueue));
+	} else {
+		objects->transferQueue = objects->graphicsQueue;
+	}
 
 	return true;
 }
 
-static bool init_swapchain(vulkan_init_parameters init_params, vulkan_objects* objects) {
+// Creates objects->swapchain from the requested format, present mode and image count. Everything is queried
+// again, so it also works for recreation after the surface changed.
+static bool create_swapchain(vulkan_objects* objects, VkSwapchainKHR oldSwapchain) {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(objects->physicalDevice, objects->surface);
 
     VkSurfaceFormatKHR surfaceFormat;
     for (const auto& availableFormat : swapChainSupport.formats) {
-        if (availableFormat.format == init_params.swapchainImageFormat && availableFormat.colorSpace == init_params.swapchainColorSpace) {
+        if (availableFormat.format == objects->swapchainImageFormat && availableFormat.colorSpace == objects->swapchainColorSpace) {
             surfaceFormat = availableFormat;
         }
     }
 
+    // FIFO is the only mode every implementation has to support
     VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (std::find(swapChainSupport.presentModes.begin(), swapChainSupport.presentModes.end(), objects->requestedPresentMode) != swapChainSupport.presentModes.end()) {
+        presentMode = objects->requestedPresentMode;
+    } else {
+        std::cerr << "Present mode " << objects->requestedPresentMode << " is not supported, using FIFO" << std::endl;
+    }
 
     VkExtent2D swapExtent;
     if (swapChainSupport.capabilities.currentExtent.width != UINT32_MAX) {
         swapExtent = swapChainSupport.capabilities.currentExtent;
     } else {
-        VkExtent2D actualExtent = {init_params.width, init_params.height};
+        int width, height;
+        glfwGetFramebufferSize(objects->window, &width, &height);
+        VkExtent2D actualExtent = {(uint32_t)width, (uint32_t)height};
 
         actualExtent.width = std::clamp(actualExtent.width, swapChainSupport.capabilities.minImageExtent.width, swapChainSupport.capabilities.maxImageExtent.width);
         actualExtent.height = std::clamp(actualExtent.height, swapChainSupport.capabilities.minImageExtent.height, swapChainSupport.capabilities.maxImageExtent.height);
@@ -350,7 +481,13 @@ static bool init_swapchain(vulkan_init_parameters init_params, vulkan_objects* o
         swapExtent = actualExtent;
     }
 
-    uint32_t imageCount = std::max(swapChainSupport.capabilities.minImageCount + 1, swapChainSupport.capabilities.maxImageCount);
+    // A maxImageCount of 0 means there is no limit
+    uint32_t imageCount = objects->requestedImageCount > 0 ? objects->requestedImageCount : swapChainSupport.capabilities.minImageCount + 1;
+    imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
+    if (swapChainSupport.capabilities.maxImageCount > 0) {
+        imageCount = std::min(imageCount, swapChainSupport.capabilities.maxImageCount);
+    }
+
     VkSwapchainCreateInfoKHR createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
     createInfo.surface = objects->surface;
@@ -378,7 +515,7 @@ static bool init_swapchain(vulkan_init_parameters init_params, vulkan_objects* o
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_FALSE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    createInfo.oldSwapchain = oldSwapchain;
 
     if (vkCreateSwapchainKHR(objects->device, &createInfo, nullptr, &objects->swapchain)) {
         std::cerr << "Could not create Swapchain!" << std::endl;
@@ -391,11 +528,40 @@ static bool init_swapchain(vulkan_init_parameters init_params, vulkan_objects* o
 
     objects->swapchainExtent = swapExtent;
     objects->swapchainImageFormat = surfaceFormat.format;
+    objects->presentMode = presentMode;
 
     return true;
 }
 
-static bool init_image_views(vulkan_init_parameters init_params, vulkan_objects* objects) {
+static bool init_swapchain(vulkan_init_parameters init_params, vulkan_objects* objects) {
+    objects->window = init_params.window;
+    objects->swapchainImageFormat = init_params.swapchainImageFormat;
+    objects->swapchainColorSpace = init_params.swapchainColorSpace;
+    objects->requestedPresentMode = init_params.presentMode;
+    objects->requestedImageCount = init_params.swapchainImageCount;
+
+    return create_swapchain(objects, VK_NULL_HANDLE);
+}
+
+// The renderer allocates the images, they only need the size and the format here
+static bool init_headless(vulkan_init_parameters init_params, vulkan_objects* objects) {
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(objects->physicalDevice, init_params.swapchainImageFormat, &properties);
+
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+	if ((properties.optimalTilingFeatures & required) != required) {
+		std::cerr << "Offscreen image format can't be rendered to!" << std::endl;
+		return false;
+	}
+
+	objects->swapchain = VK_NULL_HANDLE;
+	objects->swapchainExtent = {init_params.width, init_params.height};
+	objects->swapchainImageFormat = init_params.swapchainImageFormat;
+
+	return true;
+}
+
+static bool init_image_views(vulkan_objects* objects) {
     objects->swapchainImageViews.resize(objects->swapchainImages.size());
 
     for (size_t i = 0; i < objects->swapchainImages.size(); i++) {
@@ -435,7 +601,9 @@ bool init_vulkan(vulkan_init_parameters init_params, vulkan_objects* objects) {
 			return false;
 	}
 
-	if (!init_surface(init_params, objects)) {
+	objects->headless = init_params.headless;
+	objects->surface = VK_NULL_HANDLE;
+	if (!init_params.headless && !init_surface(init_params, objects)) {
         return false;
     }
 
@@ -447,17 +615,41 @@ bool init_vulkan(vulkan_init_parameters init_params, vulkan_objects* objects) {
 	    return false;
 	}
 
+	if (init_params.headless) {
+		return init_headless(init_params, objects);
+	}
+
 	if (!init_swapchain(init_params, objects)) {
         return false;
     }
 
-	if (!init_image_views(init_params, objects)) {
+	if (!init_image_views(objects)) {
 		return false;
 	}
 	
 	return true;
 }
 
+bool vulkan_recreateSwapchain(vulkan_objects* objects) {
+    for (VkImageView imageView : objects->swapchainImageViews) {
+        vkDestroyImageView(objects->device, imageView, nullptr);
+    }
+    objects->swapchainImageViews.clear();
+
+    // The old swapchain can hand its resources over and is retired either way
+    VkSwapchainKHR oldSwapchain = objects->swapchain;
+    bool created = create_swapchain(objects, oldSwapchain);
+    vkDestroySwapchainKHR(objects->device, oldSwapchain, nullptr);
+
+    if (!created) {
+        objects->swapchain = VK_NULL_HANDLE;
+        objects->swapchainImages.clear();
+        return false;
+    }
+
+    return init_image_views(objects);
+}
+
 void deinit_vulkan(vulkan_objects* objects) {
     for (auto imageView : objects->swapchainImageViews) {
         vkDestroyImageView(objects->device, imageView, nullptr);
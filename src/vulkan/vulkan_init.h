@@ -25,6 +25,8 @@
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Transfer only family for uploads next to rendering, not set if the device has none
+	std::optional<uint32_t> transferFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() && presentFamily.has_value();
@@ -34,17 +36,31 @@ struct QueueFamilyIndices {
 struct vulkan_objects {
 	VkInstance instance;
 	VkDebugUtilsMessengerEXT debugMessenger;
+	// Headless instances have no surface or swapchain, the renderer creates offscreen images of swapchainExtent instead
+	bool headless;
 	VkSurfaceKHR surface;
 	VkPhysicalDevice physicalDevice;
 	VkDevice device;
 	QueueFamilyIndices indices;
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	// Same as graphicsQueue without a transfer family
+	VkQueue transferQueue;
+	GLFWwindow* window;
 	VkSwapchainKHR swapchain;
 	std::vector<VkImage> swapchainImages;
 	VkFormat swapchainImageFormat;
+	VkColorSpaceKHR swapchainColorSpace;
+	// Used for every (re)creation. Unsupported present modes fall back to FIFO, presentMode is the one in use.
+	VkPresentModeKHR requestedPresentMode;
+	uint32_t requestedImageCount;
+	VkPresentModeKHR presentMode;
 	VkExtent2D swapchainExtent;
 	std::vector<VkImageView> swapchainImageViews;
+	VkPhysicalDeviceFeatures enabledFeatures;
+	bool descriptorIndexing;
+	// From VK_KHR_draw_indirect_count, null if the device does not support it
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount;
 };
 
 struct vulkan_init_parameters {
@@ -52,12 +68,22 @@ struct vulkan_init_parameters {
 	std::vector<const char*> instanceExtensions;
 	std::vector<const char*> instanceLayers;
 	std::vector<const char*> deviceExtensions;
+	bool useDescriptorIndexing;
+	// Skips the window surface and the swapchain, window may be null then. Works with software drivers like lavapipe.
+	bool headless;
 	GLFWwindow* window;
 	VkFormat swapchainImageFormat;
 	VkColorSpaceKHR swapchainColorSpace;
+	VkPresentModeKHR presentMode;
+	// 0 asks for one image more than the surface minimum, other counts are clamped to what the surface allows
+	uint32_t swapchainImageCount;
 	uint32_t width;
 	uint32_t height;
 };
 
 bool init_vulkan(vulkan_init_parameters init_params, vulkan_objects* objects);
 void deinit_vulkan(vulkan_objects* objects);
+
+// Replaces the swapchain and its image views after the surface changed or the requested present mode or image count
+// did. Nothing may use the old images anymore.
+bool vulkan_recreateSwapchain(vulkan_objects* objects);
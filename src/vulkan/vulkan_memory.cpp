@@ -0,0 +1,356 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vulkan_memory.h"
+#include "vulkan_tlsf.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static bool allocate_device_memory(vulkan_allocator* allocator, VkDeviceSize size, uint32_t memoryType, const void* pNext, VkDeviceMemory* memory, void** mapped) {
+    if (allocator->liveDeviceAllocations >= allocator->maxMemoryAllocationCount) {
+        return false;
+    }
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = pNext;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    if (vkAllocateMemory(allocator->device, &allocInfo, nullptr, memory) != VK_SUCCESS) {
+        return false;
+    }
+
+    *mapped = nullptr;
+    if (allocator->memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(allocator->device, *memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            vkFreeMemory(allocator->device, *memory, nullptr);
+            return false;
+        }
+    }
+
+    allocator->deviceAllocations++;
+    allocator->liveDeviceAllocations++;
+    return true;
+}
+
+static void free_device_memory(vulkan_allocator* allocator, VkDeviceMemory memory) {
+    vkFreeMemory(allocator->device, memory, nullptr);
+    allocator->liveDeviceAllocations--;
+}
+
+static vulkan_memory_block* create_block(vulkan_allocator* allocator, vulkan_memory_pool* pool) {
+    VkDeviceMemory memory;
+    void* mapped;
+    if (!allocate_device_memory(allocator, pool->blockSize, pool->memoryType, nullptr, &memory, &mapped)) {
+        return nullptr;
+    }
+
+    vulkan_memory_block* block = new vulkan_memory_block();
+    block->memory = memory;
+    block->mapped = mapped;
+    tlsf_init_block(block, pool->blockSize);
+
+    pool->blocks.push_back(block);
+    return block;
+}
+
+static void destroy_block(vulkan_allocator* allocator, vulkan_memory_block* block) {
+    free_device_memory(allocator, block->memory);
+    delete block;
+}
+
+vulkan_allocator* init_allocator(VkPhysicalDevice physicalDevice, VkDevice device) {
+    vulkan_allocator* allocator = new vulkan_allocator();
+    allocator->device = device;
+    allocator->deviceAllocations = 0;
+    allocator->liveDeviceAllocations = 0;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &allocator->memoryProperties);
+
+    allocator->bufferImageGranularity = properties.limits.bufferImageGranularity;
+    allocator->maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+    allocator->pools.resize(allocator->memoryProperties.memoryTypeCount * 2);
+    for (uint32_t i = 0; i < allocator->pools.size(); i++) {
+        uint32_t memoryType = i / 2;
+        VkDeviceSize heapSize = allocator->memoryProperties.memoryHeaps[allocator->memoryProperties.memoryTypes[memoryType].heapIndex].size;
+
+        allocator->pools[i].memoryType = memoryType;
+        allocator->pools[i].blockSize = std::min((VkDeviceSize)MEMORY_BLOCK_SIZE, heapSize / 8);
+    }
+
+    return allocator;
+}
+
+void deinit_allocator(vulkan_allocator* allocator) {
+    uint32_t leaked = (uint32_t)allocator->dedicated.size();
+
+    for (vulkan_memory_pool& pool : allocator->pools) {
+        for (vulkan_memory_block* block : pool.blocks) {
+            leaked += block->allocationCount;
+            destroy_block(allocator, block);
+        }
+    }
+
+    for (vulkan_allocation& allocation : allocator->dedicated) {
+        free_device_memory(allocator, allocation.memory);
+    }
+
+    if (leaked > 0) {
+        std::cout << leaked << " device memory allocations were not freed" << std::endl;
+    }
+
+    delete allocator;
+}
+
+uint32_t vulkan_findMemoryType(vulkan_allocator* allocator, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+    const VkPhysicalDeviceMemoryProperties& memProperties = allocator->memoryProperties;
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+    return 0;
+}
+
+static bool allocate_dedicated(vulkan_allocator* allocator, const VkMemoryRequirements& requirements, uint32_t memoryType, VkBuffer buffer, VkImage image, vulkan_allocation* allocation) {
+    VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.buffer = buffer;
+    dedicatedInfo.image = image;
+
+    VkDeviceMemory memory;
+    void* mapped;
+    if (!allocate_device_memory(allocator, requirements.size, memoryType, &dedicatedInfo, &memory, &mapped)) {
+        return false;
+    }
+
+    allocation->memory = memory;
+    allocation->offset = 0;
+    allocation->size = requirements.size;
+    allocation->mapped = mapped;
+    allocation->memoryType = memoryType;
+    allocation->block = nullptr;
+    allocation->node = TLSF_NONE;
+
+    allocator->dedicated.push_back(*allocation);
+    return true;
+}
+
+static bool allocate_memory(vulkan_allocator* allocator, const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimal, bool preferDedicated, VkBuffer buffer, VkImage image, vulkan_allocation* allocation) {
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+
+    uint32_t memoryType = vulkan_findMemoryType(allocator, requirements.memoryTypeBits, properties);
+
+    // Without a granularity requirement linear and optimal resources can share blocks
+    bool separate = allocator->bufferImageGranularity > 1 && optimal;
+    vulkan_memory_pool& pool = allocator->pools[memoryType * 2 + (separate ? 1 : 0)];
+
+    if (preferDedicated || requirements.size > pool.blockSize / 2) {
+        return allocate_dedicated(allocator, requirements, memoryType, buffer, image, allocation);
+    }
+
+    VkDeviceSize alignment = std::max(requirements.alignment, (VkDeviceSize)1);
+
+    vulkan_memory_block* block = nullptr;
+    uint32_t node = TLSF_NONE;
+    for (vulkan_memory_block* candidate : pool.blocks) {
+        node = tlsf_allocate(candidate, requirements.size, alignment);
+        if (node != TLSF_NONE) {
+            block = candidate;
+            break;
+        }
+    }
+
+    if (block == nullptr) {
+        block = create_block(allocator, &pool);
+        if (block == nullptr) {
+            // Out of blocks or allocations, a right sized allocation might still fit
+            return allocate_dedicated(allocator, requirements, memoryType, buffer, image, allocation);
+        }
+
+        node = tlsf_allocate(block, requirements.size, alignment);
+    }
+
+    const tlsf_node& allocated = block->nodes[node];
+    block->allocationCount++;
+    block->usedBytes += allocated.size;
+
+    allocation->memory = block->memory;
+    allocation->offset = allocated.offset;
+    allocation->size = requirements.size;
+    allocation->mapped = block->mapped ? (unsigned char*)block->mapped + allocated.offset : nullptr;
+    allocation->memoryType = memoryType;
+    allocation->block = block;
+    allocation->node = node;
+
+    return true;
+}
+
+bool vulkan_allocateBufferMemory(vulkan_allocator* allocator, VkBuffer buffer, VkMemoryPropertyFlags properties, vulkan_allocation* allocation) {
+    VkBufferMemoryRequirementsInfo2 requirementsInfo = {};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.buffer = buffer;
+
+    VkMemoryDedicatedRequirements dedicatedRequirements = {};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 requirements = {};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+
+    vkGetBufferMemoryRequirements2(allocator->device, &requirementsInfo, &requirements);
+
+    bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+    if (!allocate_memory(allocator, requirements.memoryRequirements, properties, false, dedicated, buffer, VK_NULL_HANDLE, allocation)) {
+        return false;
+    }
+
+    vkBindBufferMemory(allocator->device, buffer, allocation->memory, allocation->offset);
+    return true;
+}
+
+bool vulkan_allocateImageMemory(vulkan_allocator* allocator, VkImage image, VkMemoryPropertyFlags properties, vulkan_allocation* allocation) {
+    VkImageMemoryRequirementsInfo2 requirementsInfo = {};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.image = image;
+
+    VkMemoryDedicatedRequirements dedicatedRequirements = {};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 requirements = {};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+
+    vkGetImageMemoryRequirements2(allocator->device, &requirementsInfo, &requirements);
+
+    // All images are created with optimal tiling
+    bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+    if (!allocate_memory(allocator, requirements.memoryRequirements, properties, true, dedicated, VK_NULL_HANDLE, image, allocation)) {
+        return false;
+    }
+
+    vkBindImageMemory(allocator->device, image, allocation->memory, allocation->offset);
+    return true;
+}
+
+void vulkan_freeMemory(vulkan_allocator* allocator, vulkan_allocation* allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+
+    vulkan_memory_block* block = allocation->block;
+    if (block == nullptr) {
+        auto it = std::find_if(allocator->dedicated.begin(), allocator->dedicated.end(), [&](const vulkan_allocation& dedicated) {
+            return dedicated.memory == allocation->memory;
+        });
+        if (it != allocator->dedicated.end()) {
+            free_device_memory(allocator, it->memory);
+            allocator->dedicated.erase(it);
+        }
+
+        allocation->memory = VK_NULL_HANDLE;
+        return;
+    }
+
+    block->allocationCount--;
+    block->usedBytes -= block->nodes[allocation->node].size;
+    tlsf_free(block, allocation->node);
+
+    // Empty blocks are given back unless they are the last one of their pool, per frame buffers would churn otherwise
+    if (block->allocationCount == 0) {
+        for (vulkan_memory_pool& pool : allocator->pools) {
+            auto it = std::find(pool.blocks.begin(), pool.blocks.end(), block);
+            if (it == pool.blocks.end()) {
+                continue;
+            }
+
+            if (pool.blocks.size() > 1) {
+                pool.blocks.erase(it);
+                destroy_block(allocator, block);
+            }
+            break;
+        }
+    }
+
+    allocation->memory = VK_NULL_HANDLE;
+}
+
+void vulkan_getMemoryStats(vulkan_allocator* allocator, vulkan_memory_stats* total, vulkan_memory_stats* heaps) {
+    std::lock_guard<std::mutex> lock(allocator->mutex);
+
+    *total = {};
+    if (heaps) {
+        std::fill(heaps, heaps + allocator->memoryProperties.memoryHeapCount, vulkan_memory_stats{});
+    }
+
+    auto add = [&](uint32_t memoryType, auto fn) {
+        fn(*total);
+        if (heaps) {
+            fn(heaps[allocator->memoryProperties.memoryTypes[memoryType].heapIndex]);
+        }
+    };
+
+    for (vulkan_memory_pool& pool : allocator->pools) {
+        for (vulkan_memory_block* block : pool.blocks) {
+            VkDeviceSize largest = tlsf_largest_free(block);
+            add(pool.memoryType, [&](vulkan_memory_stats& stats) {
+                stats.blockCount++;
+                stats.allocationCount += block->allocationCount;
+                stats.blockBytes += block->size;
+                stats.usedBytes += block->usedBytes;
+                stats.largestFreeRange = std::max(stats.largestFreeRange, largest);
+            });
+        }
+    }
+
+    for (const vulkan_allocation& allocation : allocator->dedicated) {
+        add(allocation.memoryType, [&](vulkan_memory_stats& stats) {
+            stats.dedicatedCount++;
+            stats.allocationCount++;
+            stats.dedicatedBytes += allocation.size;
+        });
+    }
+}
+
+void vulkan_printMemoryStats(vulkan_allocator* allocator) {
+    vulkan_memory_stats total;
+    std::vector<vulkan_memory_stats> heaps(allocator->memoryProperties.memoryHeapCount);
+    vulkan_getMemoryStats(allocator, &total, heaps.data());
+
+    std::cout << "Device memory: " << total.allocationCount << " allocations in " << total.blockCount << " blocks and "
+              << total.dedicatedCount << " dedicated, " << allocator->deviceAllocations << " vkAllocateMemory calls" << std::endl;
+
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        const vulkan_memory_stats& heap = heaps[i];
+        if (heap.blockCount == 0 && heap.dedicatedCount == 0) {
+            continue;
+        }
+
+        std::cout << "  heap " << i << ": " << (heap.usedBytes >> 20) << " of " << (heap.blockBytes >> 20) << " MB used in blocks, "
+                  << (heap.dedicatedBytes >> 20) << " MB dedicated, largest free range " << (heap.largestFreeRange >> 10) << " KB" << std::endl;
+    }
+}
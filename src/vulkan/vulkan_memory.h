@@ -0,0 +1,87 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vulkan_init.h"
+#include <mutex>
+
+// Size of the VkDeviceMemory blocks resources are sub-allocated from, smaller heaps get an eighth of their size
+#define MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+
+struct vulkan_memory_block;
+
+// A range of device memory handed out by the allocator
+struct vulkan_allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Host visible memory stays mapped for its whole lifetime, this points at offset. nullptr otherwise
+    void* mapped;
+    uint32_t memoryType;
+    // nullptr for dedicated allocations
+    vulkan_memory_block* block;
+    uint32_t node;
+};
+
+struct vulkan_memory_stats {
+    uint32_t blockCount;
+    uint32_t dedicatedCount;
+    uint32_t allocationCount;
+    // Bytes of all blocks, bytes handed out from them and bytes in dedicated allocations
+    VkDeviceSize blockBytes;
+    VkDeviceSize usedBytes;
+    VkDeviceSize dedicatedBytes;
+    VkDeviceSize largestFreeRange;
+};
+
+// Blocks of one memory type. Linear and optimal tiling resources get separate pools when the device has a
+// bufferImageGranularity above 1, so neighbours in a block never have to be padded apart.
+struct vulkan_memory_pool {
+    uint32_t memoryType;
+    VkDeviceSize blockSize;
+    std::vector<vulkan_memory_block*> blocks;
+};
+
+struct vulkan_allocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize bufferImageGranularity;
+    uint32_t maxMemoryAllocationCount;
+    // Two per memory type, linear resources first
+    std::vector<vulkan_memory_pool> pools;
+    std::vector<vulkan_allocation> dedicated;
+    // vkAllocateMemory calls over the lifetime of the allocator
+    uint64_t deviceAllocations;
+    uint32_t liveDeviceAllocations;
+    std::mutex mutex;
+};
+
+vulkan_allocator* init_allocator(VkPhysicalDevice physicalDevice, VkDevice device);
+void deinit_allocator(vulkan_allocator* allocator);
+
+// Memory properties are cached, throws if no memory type fits
+uint32_t vulkan_findMemoryType(vulkan_allocator* allocator, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+
+// Allocate memory for the resource and bind it. Resources the driver wants dedicated memory for and resources
+// larger than half a block get a VkDeviceMemory of their own.
+bool vulkan_allocateBufferMemory(vulkan_allocator* allocator, VkBuffer buffer, VkMemoryPropertyFlags properties, vulkan_allocation* allocation);
+bool vulkan_allocateImageMemory(vulkan_allocator* allocator, VkImage image, VkMemoryPropertyFlags properties, vulkan_allocation* allocation);
+void vulkan_freeMemory(vulkan_allocator* allocator, vulkan_allocation* allocation);
+
+// heaps is optional and receives memoryProperties.memoryHeapCount entries
+void vulkan_getMemoryStats(vulkan_allocator* allocator, vulkan_memory_stats* total, vulkan_memory_stats* heaps);
+void vulkan_printMemoryStats(vulkan_allocator* allocator);
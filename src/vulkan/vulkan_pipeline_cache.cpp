@@ -0,0 +1,212 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vulkan_pipeline_cache.h"
+#include "../cooked_store.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#define PIPELINE_CACHE_MAGIC (('C'<<24)+('P'<<16)+('K'<<8)+'V')
+#define PIPELINE_CACHE_VERSION 1
+
+// Vulkan's own header only identifies the device, the driver version is checked through ours
+struct pipeline_cache_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint32_t reserved;
+    uint64_t dataSize;
+    uint64_t dataHash;
+};
+
+static bool read_cache_file(const std::string& path, const VkPhysicalDeviceProperties& properties, std::vector<unsigned char>& outData) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    size_t filesize = (size_t)file.tellg();
+    pipeline_cache_file_header header;
+    if (filesize < sizeof(header)) {
+        std::cout << path << " is not a valid pipeline cache!" << std::endl;
+        return false;
+    }
+
+    file.seekg(0);
+    file.read((char*)&header, sizeof(header));
+
+    if (header.magic != PIPELINE_CACHE_MAGIC || header.version != PIPELINE_CACHE_VERSION || header.dataSize != filesize - sizeof(header)) {
+        std::cout << path << " is not a valid pipeline cache!" << std::endl;
+        return false;
+    }
+
+    if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID || header.driverVersion != properties.driverVersion
+        || memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        std::cout << path << " was written by another device or driver, starting with an empty pipeline cache" << std::endl;
+        return false;
+    }
+
+    outData.resize((size_t)header.dataSize);
+    file.read((char*)outData.data(), outData.size());
+
+    if (!file.good() || cooked_hash(outData.data(), outData.size()) != header.dataHash) {
+        std::cout << path << " is corrupted!" << std::endl;
+        return false;
+    }
+
+    // The driver checks its header too, but a mismatch there is silently ignored and would look like a warm cache
+    VkPipelineCacheHeaderVersionOne vulkanHeader;
+    if (outData.size() < sizeof(vulkanHeader)) {
+        std::cout << path << " has no driver header, starting with an empty pipeline cache" << std::endl;
+        return false;
+    }
+    memcpy(&vulkanHeader, outData.data(), sizeof(vulkanHeader));
+
+    if (vulkanHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || vulkanHeader.vendorID != properties.vendorID
+        || vulkanHeader.deviceID != properties.deviceID || memcmp(vulkanHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        std::cout << path << " has a driver header for another device or driver, starting with an empty pipeline cache" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+vulkan_pipeline_cache* init_pipeline_cache(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    vulkan_pipeline_cache* cache = new vulkan_pipeline_cache();
+    cache->path = path;
+    cache->pipelineCount = 0;
+    cache->creationMilliseconds = 0.0;
+
+    std::vector<unsigned char> data;
+    cache->warm = read_cache_file(path, properties, data);
+
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = cache->warm ? data.size() : 0;
+    createInfo.pInitialData = cache->warm ? data.data() : nullptr;
+
+    if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache->cache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    if (cache->warm) {
+        std::cout << "Loaded " << data.size() / 1024 << " KB pipeline cache from " << path << std::endl;
+    }
+
+    return cache;
+}
+
+static bool write_cache_file(const std::string& path, const VkPhysicalDeviceProperties& properties, const std::vector<unsigned char>& data) {
+    pipeline_cache_file_header header = {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.version = PIPELINE_CACHE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = cooked_hash(data.data(), data.size());
+
+    // Write to a temporary file first so a crash while saving leaves the old cache intact
+    std::string temporaryPath = path + ".tmp";
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open()) {
+            std::cout << "Could not open " << temporaryPath << std::endl;
+            return false;
+        }
+
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)data.data(), data.size());
+
+        if (!file.good()) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+
+    return true;
+}
+
+void deinit_pipeline_cache(VkPhysicalDevice physicalDevice, VkDevice device, vulkan_pipeline_cache* cache) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    size_t size = 0;
+    std::vector<unsigned char> data;
+    if (vkGetPipelineCacheData(device, cache->cache, &size, nullptr) == VK_SUCCESS && size > 0) {
+        data.resize(size);
+        if (vkGetPipelineCacheData(device, cache->cache, &size, data.data()) == VK_SUCCESS) {
+            data.resize(size);
+            if (!write_cache_file(cache->path, properties, data)) {
+                std::cout << "Could not save pipeline cache to " << cache->path << std::endl;
+            }
+        }
+    }
+
+    std::cout << "Created " << cache->pipelineCount << " pipelines in " << cache->creationMilliseconds << " ms with a "
+              << (cache->warm ? "warm" : "cold") << " pipeline cache" << std::endl;
+
+    vkDestroyPipelineCache(device, cache->cache, nullptr);
+    delete cache;
+}
+
+// Pipelines are compiled on job workers too, the VkPipelineCache itself is internally synchronized
+static void record_creation(vulkan_pipeline_cache* cache, const char* name, std::chrono::high_resolution_clock::time_point start) {
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    cache->pipelineCount++;
+    cache->creationMilliseconds += milliseconds;
+
+    std::cout << "Created " << name << " pipeline in " << milliseconds << " ms (" << (cache->warm ? "warm" : "cold") << " cache)" << std::endl;
+}
+
+VkResult vulkan_createGraphicsPipeline(VkDevice device, vulkan_pipeline_cache* cache, const VkGraphicsPipelineCreateInfo* pipelineInfo, const char* name, VkPipeline* pipeline) {
+    auto start = std::chrono::high_resolution_clock::now();
+    VkResult result = vkCreateGraphicsPipelines(device, cache->cache, 1, pipelineInfo, nullptr, pipeline);
+    record_creation(cache, name, start);
+    return result;
+}
+
+VkResult vulkan_createComputePipeline(VkDevice device, vulkan_pipeline_cache* cache, const VkComputePipelineCreateInfo* pipelineInfo, const char* name, VkPipeline* pipeline) {
+    auto start = std::chrono::high_resolution_clock::now();
+    VkResult result = vkCreateComputePipelines(device, cache->cache, 1, pipelineInfo, nullptr, pipeline);
+    record_creation(cache, name, start);
+    return result;
+}
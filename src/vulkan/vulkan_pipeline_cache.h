@@ -0,0 +1,44 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vulkan_init.h"
+#include <string>
+#include <mutex>
+
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+
+// One VkPipelineCache shared by all pipeline creation, persisted between runs
+struct vulkan_pipeline_cache {
+    VkPipelineCache cache;
+    std::string path;
+    // Loaded from disk and accepted for this device and driver
+    bool warm;
+    uint32_t pipelineCount;
+    double creationMilliseconds;
+    // Guards the counters
+    std::mutex mutex;
+};
+
+// Starts empty if the file is missing or was written by another device or driver version
+vulkan_pipeline_cache* init_pipeline_cache(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path);
+// Writes the cache back to path before destroying it
+void deinit_pipeline_cache(VkPhysicalDevice physicalDevice, VkDevice device, vulkan_pipeline_cache* cache);
+
+// Creates the pipeline through the cache and logs how long it took, may be called from any thread
+VkResult vulkan_createGraphicsPipeline(VkDevice device, vulkan_pipeline_cache* cache, const VkGraphicsPipelineCreateInfo* pipelineInfo, const char* name, VkPipeline* pipeline);
+VkResult vulkan_createComputePipeline(VkDevice device, vulkan_pipeline_cache* cache, const VkComputePipelineCreateInfo* pipelineInfo, const char* name, VkPipeline* pipeline);
@@ -0,0 +1,425 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vulkan_pipeline_library.h"
+#include "vulkan_renderer.h"
+#include "vulkan_utils.h"
+#include "../cooked_store.h"
+
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+static_assert(sizeof(vulkan_pipeline_key) == sizeof(VkPipelineLayout) + sizeof(VkRenderPass) + 14 * sizeof(uint32_t), "vulkan_pipeline_key must not have padding, it is hashed as bytes");
+
+// Everything a worker needs, resolved on the render thread so the worker never indexes the library's deques
+struct pipeline_build {
+    vulkan_pipeline_entry* entry;
+    VkShaderModule vertexShader;
+    VkShaderModule fragmentShader;
+    const vulkan_vertex_layout* vertexLayout;
+};
+
+vulkan_pipeline_library* init_pipeline_library(vulkan_renderer* renderer, job_system* jobs) {
+    vulkan_pipeline_library* library = new vulkan_pipeline_library();
+    library->renderer = renderer;
+    library->jobs = jobs;
+    library->compiling = 0;
+    library->requests = 0;
+    library->deduplicated = 0;
+    library->fallbackBinds = 0;
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(renderer->init_objects.physicalDevice, &features);
+    library->fillModeNonSolid = features.fillModeNonSolid;
+
+    return library;
+}
+
+void deinit_pipeline_library(vulkan_pipeline_library* library) {
+    {
+        std::unique_lock<std::mutex> lock(library->mutex);
+        library->compileDone.wait(lock, [library]() { return library->compiling == 0; });
+    }
+
+    VkDevice device = library->renderer->init_objects.device;
+
+    for (vulkan_pipeline_entry& entry : library->entries) {
+        if (entry.state.load() == PIPELINE_READY) {
+            vkDestroyPipeline(device, entry.pipeline, nullptr);
+        }
+    }
+
+    for (vulkan_pipeline_shader& shader : library->shaders) {
+        vkDestroyShaderModule(device, shader.module, nullptr);
+    }
+
+    std::cout << "Pipeline library: " << library->entries.size() << " pipelines for " << library->requests << " requests, "
+              << library->deduplicated << " deduplicated, " << library->fallbackBinds << " fallback binds" << std::endl;
+
+    delete library;
+}
+
+vulkan_pipeline_key vulkan_defaultPipelineKey() {
+    vulkan_pipeline_key key;
+    memset(&key, 0, sizeof(key));
+    key.layout = VK_NULL_HANDLE;
+    key.renderPass = VK_NULL_HANDLE;
+    key.subpass = 0;
+    key.vertexShader = PIPELINE_INVALID;
+    key.fragmentShader = PIPELINE_INVALID;
+    key.vertexLayout = PIPELINE_INVALID;
+    key.fragmentSpecialization = 0;
+    key.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    key.polygonMode = VK_POLYGON_MODE_FILL;
+    key.cullMode = VK_CULL_MODE_BACK_BIT;
+    key.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    key.blendEnable = VK_FALSE;
+    key.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    key.depthTestEnable = VK_TRUE;
+    key.depthWriteEnable = VK_TRUE;
+    key.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    return key;
+}
+
+uint32_t vulkan_pipelineShader(vulkan_pipeline_library* library, const std::string& shaderFile) {
+    for (uint32_t i = 0; i < library->shaders.size(); i++) {
+        if (library->shaders[i].file == shaderFile) {
+            return i;
+        }
+    }
+
+    vulkan_pipeline_shader shader;
+    shader.file = shaderFile;
+    shader.module = vulkan_createShaderModule(library->renderer, shaderFile);
+    library->shaders.push_back(shader);
+    return (uint32_t)library->shaders.size() - 1;
+}
+
+uint32_t vulkan_pipelineVertexLayout(vulkan_pipeline_library* library, const VkVertexInputBindingDescription* bindings, uint32_t bindingCount,
+                                     const VkVertexInputAttributeDescription* attributes, uint32_t attributeCount) {
+    vulkan_vertex_layout layout;
+    layout.bindings.assign(bindings, bindings + bindingCount);
+    layout.attributes.assign(attributes, attributes + attributeCount);
+
+    for (uint32_t i = 0; i < library->vertexLayouts.size(); i++) {
+        const vulkan_vertex_layout& existing = library->vertexLayouts[i];
+        if (existing.bindings.size() == bindingCount && existing.attributes.size() == attributeCount
+            && memcmp(existing.bindings.data(), bindings, bindingCount * sizeof(VkVertexInputBindingDescription)) == 0
+            && memcmp(existing.attributes.data(), attributes, attributeCount * sizeof(VkVertexInputAttributeDescription)) == 0) {
+            return i;
+        }
+    }
+
+    library->vertexLayouts.push_back(layout);
+    return (uint32_t)library->vertexLayouts.size() - 1;
+}
+
+static void compile_pipeline(vulkan_pipeline_library* library, const pipeline_build& build) {
+    const vulkan_pipeline_key& key = build.entry->key;
+
+    VkSpecializationMapEntry specializationEntry = {};
+    specializationEntry.constantID = 0;
+    specializationEntry.offset = 0;
+    specializationEntry.size = sizeof(uint32_t);
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationEntry;
+    specializationInfo.dataSize = sizeof(key.fragmentSpecialization);
+    specializationInfo.pData = &key.fragmentSpecialization;
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = build.vertexShader;
+    shaderStages[0].pName = "main";
+
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = build.fragmentShader;
+    shaderStages[1].pName = "main";
+    shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = (uint32_t)build.vertexLayout->bindings.size();
+    vertexInputInfo.pVertexBindingDescriptions = build.vertexLayout->bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)build.vertexLayout->attributes.size();
+    vertexInputInfo.pVertexAttributeDescriptions = build.vertexLayout->attributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = key.topology;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    // Viewport and scissor are dynamic so pipelines don't depend on the swapchain size
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = key.polygonMode;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = key.cullMode;
+    rasterizer.frontFace = key.frontFace;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = key.colorWriteMask;
+    colorBlendAttachment.blendEnable = key.blendEnable;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = key.depthTestEnable;
+    depthStencil.depthWriteEnable = key.depthWriteEnable;
+    depthStencil.depthCompareOp = key.depthCompareOp;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    VkDynamicState dynamicStates[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = build.fragmentShader != VK_NULL_HANDLE ? 2 : 1;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = key.layout;
+    pipelineInfo.renderPass = key.renderPass;
+    pipelineInfo.subpass = key.subpass;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkResult result = vulkan_createGraphicsPipeline(library->renderer->init_objects.device, library->renderer->pipelineCache, &pipelineInfo,
+                                                    build.entry->name.c_str(), &build.entry->pipeline);
+    if (result != VK_SUCCESS) {
+        std::cout << "Could not create " << build.entry->name << " pipeline" << std::endl;
+    }
+
+    // Release so the render thread sees the pipeline handle once it sees the state
+    build.entry->state.store(result == VK_SUCCESS ? PIPELINE_READY : PIPELINE_FAILED, std::memory_order_release);
+}
+
+uint32_t vulkan_requestPipeline(vulkan_pipeline_library* library, const vulkan_pipeline_key& key, const char* name, bool wait) {
+    uint64_t hash = cooked_hash(&key, sizeof(key));
+    library->requests++;
+
+    std::vector<uint32_t>& candidates = library->entriesByHash[hash];
+    for (uint32_t index : candidates) {
+        if (memcmp(&library->entries[index].key, &key, sizeof(key)) == 0) {
+            library->deduplicated++;
+            if (wait) {
+                std::unique_lock<std::mutex> lock(library->mutex);
+                library->compileDone.wait(lock, [&]() { return library->entries[index].state.load() != PIPELINE_COMPILING; });
+            }
+            return index;
+        }
+    }
+
+    bool fragmentShaderValid = key.fragmentShader == PIPELINE_INVALID || key.fragmentShader < library->shaders.size();
+    if (key.vertexShader >= library->shaders.size() || !fragmentShaderValid || key.vertexLayout >= library->vertexLayouts.size()) {
+        throw std::runtime_error(std::string("invalid pipeline key for ") + name);
+    }
+
+    uint32_t index = (uint32_t)library->entries.size();
+    library->entries.emplace_back();
+    vulkan_pipeline_entry& entry = library->entries.back();
+    entry.key = key;
+    entry.name = name;
+    entry.pipeline = VK_NULL_HANDLE;
+    entry.state.store(PIPELINE_COMPILING);
+    candidates.push_back(index);
+
+    // Without the feature the variant can't exist, draws keep using their fallback
+    if (key.polygonMode != VK_POLYGON_MODE_FILL && !library->fillModeNonSolid) {
+        std::cout << name << " pipeline needs fillModeNonSolid, which this device does not support" << std::endl;
+        entry.state.store(PIPELINE_FAILED);
+        return index;
+    }
+
+    pipeline_build build;
+    build.entry = &entry;
+    build.vertexShader = library->shaders[key.vertexShader].module;
+    build.fragmentShader = key.fragmentShader != PIPELINE_INVALID ? library->shaders[key.fragmentShader].module : VK_NULL_HANDLE;
+    build.vertexLayout = &library->vertexLayouts[key.vertexLayout];
+
+    if (wait) {
+        compile_pipeline(library, build);
+        if (entry.state.load() == PIPELINE_FAILED) {
+            throw std::runtime_error(std::string("failed to create ") + name + " pipeline!");
+        }
+        return index;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(library->mutex);
+        library->compiling++;
+    }
+
+    job_system_submit(library->jobs, [library, build]() {
+        compile_pipeline(library, build);
+
+        // Notified under the lock, deinit may destroy the library as soon as it sees compiling reach zero
+        std::lock_guard<std::mutex> lock(library->mutex);
+        library->compiling--;
+        library->compileDone.notify_all();
+    });
+
+    return index;
+}
+
+void vulkan_reloadPipelineShaders(vulkan_pipeline_library* library, const std::vector<std::string>& shaderFiles) {
+    std::vector<uint32_t> reloaded;
+    for (uint32_t i = 0; i < library->shaders.size(); i++) {
+        if (std::find(shaderFiles.begin(), shaderFiles.end(), library->shaders[i].file) != shaderFiles.end()) {
+            reloaded.push_back(i);
+        }
+    }
+
+    if (reloaded.empty()) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(library->mutex);
+        library->compileDone.wait(lock, [library]() { return library->compiling == 0; });
+    }
+
+    VkDevice device = library->renderer->init_objects.device;
+
+    // Everything is rebuilt next to the old modules and pipelines, which stay in use unless all rebuilds succeed
+    std::vector<VkShaderModule> modules(library->shaders.size(), VK_NULL_HANDLE);
+    for (uint32_t i = 0; i < library->shaders.size(); i++) {
+        modules[i] = library->shaders[i].module;
+    }
+
+    std::vector<uint32_t> rebuilt;
+    std::deque<vulkan_pipeline_entry> rebuiltEntries;
+    bool failed = false;
+
+    for (uint32_t index : reloaded) {
+        try {
+            modules[index] = vulkan_createShaderModule(library->renderer, library->shaders[index].file);
+        } catch (const std::runtime_error& error) {
+            std::cout << "Could not reload " << library->shaders[index].file << ": " << error.what() << std::endl;
+            modules[index] = VK_NULL_HANDLE;
+            failed = true;
+        }
+    }
+
+    // Compiled right here, the fallbacks may be among them and there is nothing else to draw with meanwhile
+    for (uint32_t i = 0; i < library->entries.size() && !failed; i++) {
+        const vulkan_pipeline_entry& entry = library->entries[i];
+        bool usesShader = std::find(reloaded.begin(), reloaded.end(), entry.key.vertexShader) != reloaded.end()
+                          || std::find(reloaded.begin(), reloaded.end(), entry.key.fragmentShader) != reloaded.end();
+        if (!usesShader || entry.state.load() == PIPELINE_FAILED) {
+            continue;
+        }
+
+        rebuiltEntries.emplace_back();
+        vulkan_pipeline_entry& rebuiltEntry = rebuiltEntries.back();
+        rebuiltEntry.key = entry.key;
+        rebuiltEntry.name = entry.name;
+        rebuiltEntry.pipeline = VK_NULL_HANDLE;
+        rebuiltEntry.state.store(PIPELINE_COMPILING);
+        rebuilt.push_back(i);
+
+        pipeline_build build;
+        build.entry = &rebuiltEntry;
+        build.vertexShader = modules[entry.key.vertexShader];
+        build.fragmentShader = entry.key.fragmentShader != PIPELINE_INVALID ? modules[entry.key.fragmentShader] : VK_NULL_HANDLE;
+        build.vertexLayout = &library->vertexLayouts[entry.key.vertexLayout];
+        compile_pipeline(library, build);
+
+        failed = rebuiltEntry.state.load() == PIPELINE_FAILED;
+    }
+
+    if (failed) {
+        for (vulkan_pipeline_entry& rebuiltEntry : rebuiltEntries) {
+            vkDestroyPipeline(device, rebuiltEntry.pipeline, nullptr);
+        }
+        for (uint32_t index : reloaded) {
+            vkDestroyShaderModule(device, modules[index], nullptr);
+        }
+        std::cout << "Keeping the old pipelines" << std::endl;
+        return;
+    }
+
+    vkDeviceWaitIdle(device);
+
+    for (uint32_t index : reloaded) {
+        vkDestroyShaderModule(device, library->shaders[index].module, nullptr);
+        library->shaders[index].module = modules[index];
+    }
+
+    for (uint32_t i = 0; i < rebuilt.size(); i++) {
+        vulkan_pipeline_entry& entry = library->entries[rebuilt[i]];
+        vkDestroyPipeline(device, entry.pipeline, nullptr);
+        entry.pipeline = rebuiltEntries[i].pipeline;
+    }
+
+    std::cout << "Recompiled " << rebuilt.size() << " pipelines" << std::endl;
+}
+
+VkPipeline vulkan_getPipeline(vulkan_pipeline_library* library, uint32_t pipeline, uint32_t fallback) {
+    if (pipeline != PIPELINE_INVALID && library->entries[pipeline].state.load(std::memory_order_acquire) == PIPELINE_READY) {
+        return library->entries[pipeline].pipeline;
+    }
+
+    library->fallbackBinds++;
+    return library->entries[fallback].pipeline;
+}
+
+bool vulkan_pipelineReady(vulkan_pipeline_library* library, uint32_t pipeline) {
+    return pipeline != PIPELINE_INVALID && library->entries[pipeline].state.load(std::memory_order_acquire) == PIPELINE_READY;
+}
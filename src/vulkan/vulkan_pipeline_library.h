@@ -0,0 +1,118 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vulkan_init.h"
+#include "../jobs.h"
+#include <deque>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define PIPELINE_INVALID UINT32_MAX
+
+struct vulkan_renderer;
+
+// Everything that makes two graphics pipelines different. Shaders and vertex layouts are indices into the library,
+// so the key can be hashed and compared as plain bytes. Always start from vulkan_defaultPipelineKey().
+struct vulkan_pipeline_key {
+    VkPipelineLayout layout;
+    VkRenderPass renderPass;
+    uint32_t subpass;
+    uint32_t vertexShader;
+    // PIPELINE_INVALID for depth only pipelines
+    uint32_t fragmentShader;
+    uint32_t vertexLayout;
+    // Value of specialization constant 0 of the fragment shader
+    uint32_t fragmentSpecialization;
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygonMode;
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+    VkBool32 blendEnable;
+    VkColorComponentFlags colorWriteMask;
+    VkBool32 depthTestEnable;
+    VkBool32 depthWriteEnable;
+    VkCompareOp depthCompareOp;
+};
+
+enum vulkan_pipeline_state : uint32_t {
+    PIPELINE_COMPILING,
+    PIPELINE_READY,
+    PIPELINE_FAILED
+};
+
+struct vulkan_pipeline_entry {
+    vulkan_pipeline_key key;
+    std::string name;
+    std::atomic<uint32_t> state;
+    VkPipeline pipeline;
+};
+
+struct vulkan_vertex_layout {
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+struct vulkan_pipeline_shader {
+    std::string file;
+    VkShaderModule module;
+};
+
+// Deduplicates pipelines by key and compiles new ones on the job system. Requests and lookups happen on the render
+// thread, workers only touch the entry they compile.
+struct vulkan_pipeline_library {
+    vulkan_renderer* renderer;
+    job_system* jobs;
+    bool fillModeNonSolid;
+    // Deques so workers can hold on to entries while new ones are added
+    std::deque<vulkan_pipeline_entry> entries;
+    std::deque<vulkan_pipeline_shader> shaders;
+    std::deque<vulkan_vertex_layout> vertexLayouts;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> entriesByHash;
+    std::mutex mutex;
+    std::condition_variable compileDone;
+    uint32_t compiling;
+    uint32_t requests;
+    uint32_t deduplicated;
+    // Draws that had to use the fallback because their pipeline was still compiling
+    uint64_t fallbackBinds;
+};
+
+vulkan_pipeline_library* init_pipeline_library(vulkan_renderer* renderer, job_system* jobs);
+// Waits for outstanding compiles, then destroys all pipelines and shader modules of the library
+void deinit_pipeline_library(vulkan_pipeline_library* library);
+
+vulkan_pipeline_key vulkan_defaultPipelineKey();
+
+// Loaded once per file, the modules live as long as the library
+uint32_t vulkan_pipelineShader(vulkan_pipeline_library* library, const std::string& shaderFile);
+// Development mode, replaces the modules of the reloaded shaders and recompiles every pipeline that uses one of them.
+// Nothing is replaced unless all of them compile. Waits for the device and for outstanding compiles, call outside of a frame.
+void vulkan_reloadPipelineShaders(vulkan_pipeline_library* library, const std::vector<std::string>& shaderFiles);
+uint32_t vulkan_pipelineVertexLayout(vulkan_pipeline_library* library, const VkVertexInputBindingDescription* bindings, uint32_t bindingCount,
+                                     const VkVertexInputAttributeDescription* attributes, uint32_t attributeCount);
+
+// Returns the existing pipeline for an identical key, otherwise starts compiling it on a worker.
+// With wait the pipeline is ready when this returns, use that for fallbacks.
+uint32_t vulkan_requestPipeline(vulkan_pipeline_library* library, const vulkan_pipeline_key& key, const char* name, bool wait);
+// The pipeline if it is ready, otherwise the one of fallback
+VkPipeline vulkan_getPipeline(vulkan_pipeline_library* library, uint32_t pipeline, uint32_t fallback);
+bool vulkan_pipelineReady(vulkan_pipeline_library* library, uint32_t pipeline);
@@ -15,71 +15,450 @@
 */
 
 #include "vulkan_renderer.h"
+#include "vulkan_utils.h"
+#include "vulkan_depth_pyramid.h"
+#include "../profiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <iostream>
+
+static void release_transient_allocations(vulkan_renderer* renderer, vulkan_frame* frame) {
+    for (VkBuffer buffer : frame->transientBuffers) {
+        vkDestroyBuffer(renderer->init_objects.device, buffer, nullptr);
+    }
+
+    for (vulkan_allocation& allocation : frame->transientAllocations) {
+        vulkan_freeMemory(renderer->allocator, &allocation);
+    }
+
+    frame->transientBuffers.clear();
+    frame->transientAllocations.clear();
+}
+
+static bool create_frames(vulkan_renderer* renderer) {
+    VkDevice device = renderer->init_objects.device;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = renderer->init_objects.indices.graphicsFamily.value();
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    // Created signalled so the first wait on every slot returns right away
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (vulkan_frame& frame : renderer->frames) {
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool) != VK_SUCCESS) {
+            return false;
+        }
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS
+            || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore) != VK_SUCCESS
+            || vkCreateFence(device, &fenceInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS) {
+            return false;
+        }
+
+        // The render thread, renderer_reserve_recording_threads adds the others
+        frame.threadCommands.resize(1);
+    }
+
+    return true;
+}
+
+// Also cleans up after a partially failed create_frames, the renderer is zero initialized
+static void destroy_frames(vulkan_renderer* renderer) {
+    VkDevice device = renderer->init_objects.device;
+
+    for (vulkan_frame& frame : renderer->frames) {
+        release_transient_allocations(renderer, &frame);
+
+        if (frame.inFlightFence != VK_NULL_HANDLE) {
+            vkDestroyFence(device, frame.inFlightFence, nullptr);
+        }
+        if (frame.imageAvailableSemaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frame.imageAvailableSemaphore, nullptr);
+        }
+        if (frame.commandPool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(device, frame.commandPool, nullptr);
+        }
+        for (vulkan_thread_commands& commands : frame.threadCommands) {
+            if (commands.pool != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(device, commands.pool, nullptr);
+            }
+        }
+        if (frame.readbackBuffer != VK_NULL_HANDLE) {
+            vulkan_destroyBuffer(renderer, frame.readbackBuffer, frame.readbackAllocation);
+        }
+    }
 
-vulkan_renderer* init_renderer(vulkan_objects init_objects) {
+    renderer->frames.clear();
+}
+
+// The depth pyramid samples the attachment, so the format has to support both
+static VkFormat choose_depth_format(VkPhysicalDevice physicalDevice) {
+    VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM };
+    VkFormatFeatureFlags required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
+    for (VkFormat format : candidates) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        if ((properties.optimalTilingFeatures & required) == required) {
+            return format;
+        }
+    }
+
+    throw std::runtime_error("failed to find a depth format!");
+}
+
+static bool create_render_targets(vulkan_renderer* renderer) {
+    VkDevice device = renderer->init_objects.device;
+    VkExtent2D extent = renderer->init_objects.swapchainExtent;
+
+    // Without a swapchain the renderer owns the color images and everything else treats them as swapchain images
+    if (renderer->init_objects.headless) {
+        VkFormat format = renderer->init_objects.swapchainImageFormat;
+        renderer->init_objects.swapchainImages.resize(RENDERER_OFFSCREEN_IMAGES, VK_NULL_HANDLE);
+        renderer->init_objects.swapchainImageViews.resize(RENDERER_OFFSCREEN_IMAGES, VK_NULL_HANDLE);
+        renderer->offscreenAllocations.resize(RENDERER_OFFSCREEN_IMAGES);
+
+        for (uint32_t i = 0; i < RENDERER_OFFSCREEN_IMAGES; i++) {
+            if (!vulkan_createImage(renderer, extent.width, extent.height, format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, renderer->init_objects.swapchainImages[i], renderer->offscreenAllocations[i])) {
+                return false;
+            }
+
+            renderer->init_objects.swapchainImageViews[i] = vulkan_createImageSubresourceView(renderer, renderer->init_objects.swapchainImages[i], VK_IMAGE_VIEW_TYPE_2D, format,
+                                                                                              VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 1);
+        }
+    }
+
+    VkImageAspectFlags attachmentAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (renderer->depthFormat != VK_FORMAT_D32_SFLOAT && renderer->depthFormat != VK_FORMAT_D16_UNORM) {
+        attachmentAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    renderer->depthTargets.resize(renderer->init_objects.swapchainImageViews.size());
+    for (vulkan_depth_target& target : renderer->depthTargets) {
+        if (!vulkan_createImage(renderer, extent.width, extent.height, renderer->depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target.image, target.allocation)) {
+            return false;
+        }
+
+        target.attachmentView = vulkan_createImageSubresourceView(renderer, target.image, VK_IMAGE_VIEW_TYPE_2D, renderer->depthFormat, attachmentAspect, 0, 1, 1);
+        target.sampledView = vulkan_createImageSubresourceView(renderer, target.image, VK_IMAGE_VIEW_TYPE_2D, renderer->depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 1);
+    }
+
+    renderer->framebuffers.resize(renderer->init_objects.swapchainImageViews.size());
+    for (int i = 0; i < renderer->init_objects.swapchainImageViews.size(); i++) {
+        VkImageView attachments[] = {
+            renderer->init_objects.swapchainImageViews[i],
+            renderer->depthTargets[i].attachmentView
+        };
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderer->render_pass;
+        framebufferInfo.attachmentCount = 2;
+        framebufferInfo.pAttachments = attachments;
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &renderer->framebuffers[i]) != VK_SUCCESS) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Also cleans up after a partially failed create_render_targets
+static void destroy_render_targets(vulkan_renderer* renderer) {
+    VkDevice device = renderer->init_objects.device;
+
+    for (VkFramebuffer framebuffer : renderer->framebuffers) {
+        if (framebuffer != VK_NULL_HANDLE) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+    }
+
+    for (vulkan_depth_target& target : renderer->depthTargets) {
+        if (target.sampledView != VK_NULL_HANDLE) {
+            vkDestroyImageView(device, target.sampledView, nullptr);
+        }
+        if (target.attachmentView != VK_NULL_HANDLE) {
+            vkDestroyImageView(device, target.attachmentView, nullptr);
+        }
+        if (target.image != VK_NULL_HANDLE) {
+            vulkan_destroyImage(renderer, target.image, target.allocation);
+        }
+    }
+
+    renderer->framebuffers.clear();
+    renderer->depthTargets.clear();
+
+    if (renderer->init_objects.headless) {
+        for (size_t i = 0; i < renderer->offscreenAllocations.size(); i++) {
+            if (renderer->init_objects.swapchainImageViews[i] != VK_NULL_HANDLE) {
+                vkDestroyImageView(device, renderer->init_objects.swapchainImageViews[i], nullptr);
+            }
+            if (renderer->init_objects.swapchainImages[i] != VK_NULL_HANDLE) {
+                vulkan_destroyImage(renderer, renderer->init_objects.swapchainImages[i], renderer->offscreenAllocations[i]);
+            }
+        }
+
+        renderer->init_objects.swapchainImageViews.clear();
+        renderer->init_objects.swapchainImages.clear();
+        renderer->offscreenAllocations.clear();
+    }
+}
+
+// Copies the color image of the frame into its readback buffer after the render pass left it in TRANSFER_SRC_OPTIMAL
+static void record_readback(vulkan_renderer* renderer, vulkan_frame* frame) {
+    VkExtent2D extent = renderer->init_objects.swapchainExtent;
+
+    if (frame->readbackBuffer == VK_NULL_HANDLE) {
+        VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+        if (!vulkan_createBuffer(renderer, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                 frame->readbackBuffer, frame->readbackAllocation)) {
+            throw std::runtime_error("failed to create readback buffer!");
+        }
+    }
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {extent.width, extent.height, 1};
+
+    vkCmdCopyImageToBuffer(frame->commandBuffer, renderer->init_objects.swapchainImages[renderer->currentSwapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           frame->readbackBuffer, 1, &region);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = frame->readbackBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(frame->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// Writes a pending readback of the frame as a binary PPM, the frame's fence has to be signalled
+static void write_readback(vulkan_renderer* renderer, vulkan_frame* frame) {
+    if (frame->readbackPath.empty()) {
+        return;
+    }
+
+    std::string path = frame->readbackPath;
+    frame->readbackPath.clear();
+
+    VkFormat format = renderer->init_objects.swapchainImageFormat;
+    bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+    bool rgba = format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+    if (!bgra && !rgba) {
+        std::cout << "Could not write " << path << ", the image format has no 8 bit channels" << std::endl;
+        return;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "Could not write " << path << std::endl;
+        return;
+    }
+
+    VkExtent2D extent = renderer->init_objects.swapchainExtent;
+    const unsigned char* pixels = (const unsigned char*)frame->readbackAllocation.mapped;
+    std::vector<unsigned char> row(extent.width * 3);
+
+    file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+    for (uint32_t y = 0; y < extent.height; y++) {
+        for (uint32_t x = 0; x < extent.width; x++) {
+            const unsigned char* pixel = pixels + ((size_t)y * extent.width + x) * 4;
+            row[x * 3 + 0] = pixel[bgra ? 2 : 0];
+            row[x * 3 + 1] = pixel[1];
+            row[x * 3 + 2] = pixel[bgra ? 0 : 2];
+        }
+        file.write((const char*)row.data(), row.size());
+    }
+}
+
+static bool create_image_semaphores(vulkan_renderer* renderer) {
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    renderer->renderFinishedSemaphores.assign(renderer->framebuffers.size(), VK_NULL_HANDLE);
+    for (VkSemaphore& semaphore : renderer->renderFinishedSemaphores) {
+        if (vkCreateSemaphore(renderer->init_objects.device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+            return false;
+        }
+    }
+
+    renderer->imagesInFlight.assign(renderer->framebuffers.size(), VK_NULL_HANDLE);
+    return true;
+}
+
+static void destroy_image_semaphores(vulkan_renderer* renderer) {
+    for (VkSemaphore semaphore : renderer->renderFinishedSemaphores) {
+        if (semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(renderer->init_objects.device, semaphore, nullptr);
+        }
+    }
+
+    renderer->renderFinishedSemaphores.clear();
+    renderer->imagesInFlight.clear();
+}
+
+// Pipelines only depend on the render pass, which stays compatible as long as the format does, and set viewport
+// and scissor dynamically. Everything sized after the swapchain is rebuilt.
+static void recreate_swapchain(vulkan_renderer* renderer) {
+    PROFILE_ZONE("recreate swapchain");
+    VkDevice device = renderer->init_objects.device;
+
+    // A minimized window has no extent a swapchain could be created with
+    int width = 0;
+    int height = 0;
+    glfwGetFramebufferSize(renderer->init_objects.window, &width, &height);
+    while (width == 0 || height == 0) {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(renderer->init_objects.window, &width, &height);
+    }
+
+    vkDeviceWaitIdle(device);
+
+    VkFormat format = renderer->init_objects.swapchainImageFormat;
+    deinit_depth_pyramid(renderer, renderer->depthPyramid);
+    destroy_image_semaphores(renderer);
+    destroy_render_targets(renderer);
+
+    if (!vulkan_recreateSwapchain(&renderer->init_objects)) {
+        throw std::runtime_error("failed to recreate swapchain!");
+    }
+
+    if (renderer->init_objects.swapchainImageFormat != format) {
+        throw std::runtime_error("failed to recreate swapchain with the same format!");
+    }
+
+    if (!create_render_targets(renderer) || !create_image_semaphores(renderer)) {
+        throw std::runtime_error("failed to create swapchain render targets!");
+    }
+
+    renderer->depthPyramid = init_depth_pyramid(renderer);
+    renderer->swapchainDirty = false;
+    renderer->framebufferSize = { (uint32_t)width, (uint32_t)height };
+}
+
+vulkan_renderer* init_renderer(vulkan_objects init_objects, uint32_t framesInFlight) {
     vulkan_renderer* renderer = new vulkan_renderer();
     renderer->init_objects = init_objects;
-
-    VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = init_objects.swapchainImageFormat;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    renderer->framebufferSize = init_objects.swapchainExtent;
+    if (!init_objects.headless) {
+        int width, height;
+        glfwGetFramebufferSize(init_objects.window, &width, &height);
+        renderer->framebufferSize = { (uint32_t)width, (uint32_t)height };
+    }
+    renderer->allocator = init_allocator(renderer->init_objects.physicalDevice, renderer->init_objects.device);
+    renderer->depthFormat = choose_depth_format(renderer->init_objects.physicalDevice);
+
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = init_objects.swapchainImageFormat;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // Headless frames are only ever copied out of the image
+    attachments[0].finalLayout = init_objects.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    // Stored for the depth pyramid that is built from it after the pass
+    attachments[1].format = renderer->depthFormat;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
     VkSubpassDescription subpass = {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
-
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // The depth image was last read by the pyramid build of an earlier frame and is read by this frame's build next
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    if (init_objects.headless) {
+        // Readbacks copy the color image right after the pass
+        dependencies[1].srcStageMask |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[1].dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+    }
 
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = dependencies;
 
     if (vkCreateRenderPass(renderer->init_objects.device, &renderPassInfo, nullptr, &renderer->render_pass) != VK_SUCCESS) {
+        deinit_allocator(renderer->allocator);
         delete renderer;
         return NULL;
     }
 
-    renderer->framebuffers.resize(renderer->init_objects.swapchainImageViews.size());
-    for (int i = 0; i < renderer->init_objects.swapchainImageViews.size(); i++) {
-        VkImageView attachments[] = {
-            renderer->init_objects.swapchainImageViews[i]
-        };
-
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = renderer->render_pass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = attachments;
-        framebufferInfo.width = renderer->init_objects.swapchainExtent.width;
-        framebufferInfo.height = renderer->init_objects.swapchainExtent.height;
-        framebufferInfo.layers = 1;
-
-        if (vkCreateFramebuffer(renderer->init_objects.device, &framebufferInfo, nullptr, &renderer->framebuffers[i]) != VK_SUCCESS) {
-            //TODO: Delete the already existing framebuffers
-            vkDestroyRenderPass(renderer->init_objects.device, renderer->render_pass, nullptr);
-            delete renderer;
-            return NULL;
-        }
+    if (!create_render_targets(renderer)) {
+        destroy_render_targets(renderer);
+        vkDestroyRenderPass(renderer->init_objects.device, renderer->render_pass, nullptr);
+        deinit_allocator(renderer->allocator);
+        delete renderer;
+        return NULL;
     }
 
     VkCommandPoolCreateInfo poolInfo = {};
@@ -88,122 +467,324 @@ vulkan_renderer* init_renderer(vulkan_objects init_objects) {
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     if (vkCreateCommandPool(renderer->init_objects.device, &poolInfo, nullptr, &renderer->command_pool) != VK_SUCCESS) {
-        for (int i = 0; i < renderer->framebuffers.size(); i++) {
-            vkDestroyFramebuffer(renderer->init_objects.device, renderer->framebuffers[i], nullptr);
-        }
-
+        destroy_render_targets(renderer);
         vkDestroyRenderPass(renderer->init_objects.device, renderer->render_pass, nullptr);
+        deinit_allocator(renderer->allocator);
 
         delete renderer;
         return NULL;
     }
 
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = renderer->command_pool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
+    framesInFlight = std::min(std::max(framesInFlight, 1u), (uint32_t)RENDERER_MAX_FRAMES_IN_FLIGHT);
+    renderer->frames.resize(framesInFlight);
 
-    if (vkAllocateCommandBuffers(renderer->init_objects.device, &allocInfo, &renderer->command_buffer) != VK_SUCCESS) {
+    if (!create_frames(renderer) || !create_image_semaphores(renderer)) {
+        destroy_image_semaphores(renderer);
+        destroy_frames(renderer);
         vkDestroyCommandPool(renderer->init_objects.device, renderer->command_pool, nullptr);
-
-        for (int i = 0; i < renderer->framebuffers.size(); i++) {
-            vkDestroyFramebuffer(renderer->init_objects.device, renderer->framebuffers[i], nullptr);
-        }
-
+        destroy_render_targets(renderer);
         vkDestroyRenderPass(renderer->init_objects.device, renderer->render_pass, nullptr);
+        deinit_allocator(renderer->allocator);
 
         delete renderer;
+
         return NULL;
     }
 
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    
-    if (vkCreateSemaphore(renderer->init_objects.device, &semaphoreInfo, nullptr, &renderer->imageAvailableSemaphore ) != VK_SUCCESS
-        || vkCreateSemaphore(renderer->init_objects.device, &semaphoreInfo, nullptr, &renderer->renderFinishedSemaphore) != VK_SUCCESS) {
-
-        vkFreeCommandBuffers(renderer->init_objects.device, renderer->command_pool, 1, &renderer->command_buffer);
-        vkDestroyCommandPool(renderer->init_objects.device, renderer->command_pool, nullptr);
+    // Secondaries can only execute inside an active query with inherited queries
+    if (renderer->init_objects.enabledFeatures.pipelineStatisticsQuery && renderer->init_objects.enabledFeatures.inheritedQueries) {
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryPoolInfo.queryCount = framesInFlight;
+        queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
 
-        for (int i = 0; i < renderer->framebuffers.size(); i++) {
-            vkDestroyFramebuffer(renderer->init_objects.device, renderer->framebuffers[i], nullptr);
+        if (vkCreateQueryPool(renderer->init_objects.device, &queryPoolInfo, nullptr, &renderer->statisticsQueries) != VK_SUCCESS) {
+            renderer->statisticsQueries = VK_NULL_HANDLE;
         }
-
-        vkDestroyRenderPass(renderer->init_objects.device, renderer->render_pass, nullptr);
-
-        delete renderer;
-
-        return NULL;
     }
 
+    renderer->gpuProfiler = init_gpu_profiler(renderer->init_objects.physicalDevice, renderer->init_objects.device, renderer->init_objects.indices.graphicsFamily.value(), framesInFlight);
+    renderer->uploader = init_uploader(renderer, UPLOAD_RING_SIZE);
+    renderer->pipelineCache = init_pipeline_cache(renderer->init_objects.physicalDevice, renderer->init_objects.device, PIPELINE_CACHE_FILE);
+    renderer->shaders = init_shader_store();
+    renderer->descriptorLayouts = init_descriptor_layout_cache(renderer->init_objects.device);
+    renderer->descriptorAllocator = init_descriptor_allocator(renderer->init_objects.device, framesInFlight);
+    renderer->frameRing = init_frame_ring(renderer, framesInFlight, FRAME_RING_SIZE);
+    renderer->depthPyramid = init_depth_pyramid(renderer);
+    renderer->lastFrameBegin = std::chrono::high_resolution_clock::now();
+
     return renderer;
 }
 
 void deinit_renderer(vulkan_renderer* renderer) {
-    vkQueueWaitIdle(renderer->init_objects.presentQueue);
-    vkDestroySemaphore(renderer->init_objects.device, renderer->imageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(renderer->init_objects.device, renderer->renderFinishedSemaphore, nullptr);
+    vkDeviceWaitIdle(renderer->init_objects.device);
 
-    vkFreeCommandBuffers(renderer->init_objects.device, renderer->command_pool, 1, &renderer->command_buffer);
+    for (vulkan_frame& frame : renderer->frames) {
+        write_readback(renderer, &frame);
+    }
+
+    destroy_image_semaphores(renderer);
+    destroy_frames(renderer);
     vkDestroyCommandPool(renderer->init_objects.device, renderer->command_pool, nullptr);
 
-    for (int i = 0; i < renderer->framebuffers.size(); i++) {
-        vkDestroyFramebuffer(renderer->init_objects.device, renderer->framebuffers[i], nullptr);
+    if (renderer->statisticsQueries != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(renderer->init_objects.device, renderer->statisticsQueries, nullptr);
     }
 
+    deinit_gpu_profiler(renderer->init_objects.device, renderer->gpuProfiler);
+    deinit_depth_pyramid(renderer, renderer->depthPyramid);
+    deinit_descriptor_allocator(renderer->descriptorAllocator);
+    deinit_frame_ring(renderer->frameRing);
+    deinit_descriptor_layout_cache(renderer->descriptorLayouts);
+    deinit_shader_store(renderer->shaders);
+    destroy_render_targets(renderer);
     vkDestroyRenderPass(renderer->init_objects.device, renderer->render_pass, nullptr);
 
+    deinit_pipeline_cache(renderer->init_objects.physicalDevice, renderer->init_objects.device, renderer->pipelineCache);
+    deinit_uploader(renderer->uploader);
+    deinit_allocator(renderer->allocator);
+
     delete renderer;
 }
 
+void renderer_reload_shaders(vulkan_renderer* renderer, const std::vector<std::string>& shaders) {
+    if (std::find(shaders.begin(), shaders.end(), "depth_pyramid_comp.spv") == shaders.end()) {
+        return;
+    }
+
+    // Rebuilt from scratch like after a resize, occlusion culling skips the frame the pyramid is invalid in.
+    // The old pyramid stays if the new shader doesn't work.
+    vulkan_depth_pyramid* pyramid;
+    try {
+        pyramid = init_depth_pyramid(renderer);
+    } catch (const std::runtime_error& error) {
+        std::cout << "Could not reload depth_pyramid_comp.spv: " << error.what() << std::endl;
+        return;
+    }
+
+    vkDeviceWaitIdle(renderer->init_objects.device);
+    deinit_depth_pyramid(renderer, renderer->depthPyramid);
+    renderer->depthPyramid = pyramid;
+}
+
+void renderer_destroy_after_frame(vulkan_renderer* renderer, VkBuffer buffer, const vulkan_allocation& allocation) {
+    vulkan_frame& frame = renderer->frames[renderer->currentFrame];
+    frame.transientBuffers.push_back(buffer);
+    frame.transientAllocations.push_back(allocation);
+}
+
+void renderer_request_readback(vulkan_renderer* renderer, const std::string& path) {
+    if (!renderer->init_objects.headless) {
+        std::cout << "Could not read back " << path << ", only headless frames can be read back" << std::endl;
+        return;
+    }
+
+    renderer->frames[renderer->currentFrame].readbackPath = path;
+}
+
+static float milliseconds_between(std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end) {
+    return std::chrono::duration<float, std::milli>(end - start).count();
+}
+
 void renderer_begin_frame(vulkan_renderer* renderer) {
-    vkQueueWaitIdle(renderer->init_objects.presentQueue);
+    PROFILE_ZONE("renderer_begin_frame");
+    VkDevice device = renderer->init_objects.device;
+    vulkan_frame& frame = renderer->frames[renderer->currentFrame];
+
+    auto frameBegin = std::chrono::high_resolution_clock::now();
+
+    // Only the frame that used this slot before has to be finished, the others keep the GPU busy meanwhile
+    {
+        PROFILE_ZONE("wait for frame fence");
+        vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+
+        if (renderer->lowLatency && renderer->frames.size() > 1) {
+            vulkan_frame& previous = renderer->frames[(renderer->currentFrame + renderer->frames.size() - 1) % renderer->frames.size()];
+            vkWaitForFences(device, 1, &previous.inFlightFence, VK_TRUE, UINT64_MAX);
+        }
+    }
+    write_readback(renderer, &frame);
+    auto fenceEnd = std::chrono::high_resolution_clock::now();
+
+    release_transient_allocations(renderer, &frame);
+    vkResetCommandPool(device, frame.commandPool, 0);
+
+    if (frame.statisticsPending) {
+        uint64_t fragmentInvocations = 0;
+        if (vkGetQueryPoolResults(device, renderer->statisticsQueries, renderer->currentFrame, 1, sizeof(fragmentInvocations), &fragmentInvocations, sizeof(fragmentInvocations),
+                                  VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            VkExtent2D extent = renderer->init_objects.swapchainExtent;
+            renderer->metrics.fragmentInvocations = fragmentInvocations;
+            renderer->metrics.overdraw = (float)((double)fragmentInvocations / ((double)extent.width * extent.height));
+        }
+        frame.statisticsPending = false;
+    }
+
+    for (vulkan_thread_commands& commands : frame.threadCommands) {
+        if (commands.used > 0) {
+            vkResetCommandPool(device, commands.pool, 0);
+            commands.used = 0;
+        }
+    }
+    frame.secondaries.clear();
+    vulkan_descriptorAllocatorBeginFrame(renderer->descriptorAllocator, renderer->currentFrame);
+    vulkan_frameRingBeginFrame(renderer->frameRing, renderer->currentFrame);
+    vulkan_collectUploads(renderer->uploader);
+
+    uint32_t framebufferIndex;
+    {
+        PROFILE_ZONE("acquire image");
+        if (renderer->init_objects.headless) {
+            framebufferIndex = (uint32_t)(renderer->frameNumber % renderer->framebuffers.size());
+        } else {
+            // Not every platform reports a resize as out of date
+            int width, height;
+            glfwGetFramebufferSize(renderer->init_objects.window, &width, &height);
+            if ((uint32_t)width != renderer->framebufferSize.width || (uint32_t)height != renderer->framebufferSize.height) {
+                renderer->swapchainDirty = true;
+            }
+
+            if (renderer->swapchainDirty) {
+                recreate_swapchain(renderer);
+            }
+
+            VkResult result = vkAcquireNextImageKHR(device, renderer->init_objects.swapchain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &framebufferIndex);
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreate_swapchain(renderer);
+                result = vkAcquireNextImageKHR(device, renderer->init_objects.swapchain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &framebufferIndex);
+            }
+
+            // A suboptimal image can still be presented, the swapchain is replaced after that
+            if (result == VK_SUBOPTIMAL_KHR) {
+                renderer->swapchainDirty = true;
+            } else if (result != VK_SUCCESS) {
+                throw std::runtime_error("failed to acquire swapchain image!");
+            }
+        }
+        renderer->currentSwapchainImageIndex = framebufferIndex;
+
+        // With more swapchain images than frames in flight an image can come back while another slot still renders to it
+        if (renderer->imagesInFlight[framebufferIndex] != VK_NULL_HANDLE && renderer->imagesInFlight[framebufferIndex] != frame.inFlightFence) {
+            vkWaitForFences(device, 1, &renderer->imagesInFlight[framebufferIndex], VK_TRUE, UINT64_MAX);
+        }
+        renderer->imagesInFlight[framebufferIndex] = frame.inFlightFence;
+    }
+
+    auto acquireEnd = std::chrono::high_resolution_clock::now();
+
+    vulkan_frame_metrics& metrics = renderer->metrics;
+    metrics.frameMilliseconds = milliseconds_between(renderer->lastFrameBegin, frameBegin);
+    metrics.fenceWaitMilliseconds = milliseconds_between(frameBegin, fenceEnd);
+    metrics.acquireMilliseconds = milliseconds_between(fenceEnd, acquireEnd);
+    metrics.frameHistory[metrics.historyOffset] = metrics.frameMilliseconds;
+    metrics.fenceWaitHistory[metrics.historyOffset] = metrics.fenceWaitMilliseconds;
+    metrics.historyOffset = (metrics.historyOffset + 1) % RENDERER_METRICS_HISTORY;
+
+    renderer->lastFrameBegin = frameBegin;
+    renderer->cpuBegin = acquireEnd;
+
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     beginInfo.pInheritanceInfo = nullptr;
 
-    vkBeginCommandBuffer(renderer->command_buffer, &beginInfo);
+    vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
 
-    uint32_t framebufferIndex;
-    vkAcquireNextImageKHR(renderer->init_objects.device, renderer->init_objects.swapchain, UINT64_MAX, renderer->imageAvailableSemaphore, VK_NULL_HANDLE, &framebufferIndex);
-    renderer->currentSwapchainImageIndex = framebufferIndex;
+    // The fence above covers the timestamps this slot wrote last time
+    vulkan_gpuProfilerBeginFrame(device, renderer->gpuProfiler, frame.commandBuffer, renderer->currentFrame, renderer->frameNumber);
+    renderer->frameScope = vulkan_beginGpuScope(renderer->gpuProfiler, frame.commandBuffer, "frame");
+
+    renderer->frame_command_buffer = frame.commandBuffer;
+    renderer->command_buffer = renderer_begin_secondary(renderer, 0);
+}
+
+void renderer_end_frame(vulkan_renderer* renderer) {
+    PROFILE_ZONE("renderer_end_frame");
+    vulkan_frame& frame = renderer->frames[renderer->currentFrame];
+
+    vkEndCommandBuffer(renderer->command_buffer);
+    frame.secondaries.push_back(renderer->command_buffer);
 
     VkRenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderer->render_pass;
-    renderPassInfo.framebuffer = renderer->framebuffers[framebufferIndex];
+    renderPassInfo.framebuffer = renderer->framebuffers[renderer->currentSwapchainImageIndex];
     renderPassInfo.renderArea.offset = {0, 0};
     renderPassInfo.renderArea.extent = renderer->init_objects.swapchainExtent;
 
-    VkClearValue clearColor = {0.2f, 0.2f, 0.2f, 1.0f};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color = {0.2f, 0.2f, 0.2f, 1.0f};
+    clearValues[1].depthStencil = {1.0f, 0};
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
 
-    vkCmdBeginRenderPass(renderer->command_buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-}
+    if (renderer->statisticsQueries != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(frame.commandBuffer, renderer->statisticsQueries, renderer->currentFrame, 1);
+        vkCmdBeginQuery(frame.commandBuffer, renderer->statisticsQueries, renderer->currentFrame, 0);
+    }
 
-void renderer_end_frame(vulkan_renderer* renderer) {
-    vkCmdEndRenderPass(renderer->command_buffer);
-    vkEndCommandBuffer(renderer->command_buffer);
+    uint32_t renderPassScope = vulkan_beginGpuScope(renderer->gpuProfiler, frame.commandBuffer, "render pass");
+
+    // Begun only now so work recorded into frame_command_buffer during the frame runs ahead of it.
+    // Everything inside the pass is recorded into secondaries so other threads can record in parallel.
+    vkCmdBeginRenderPass(frame.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    vkCmdExecuteCommands(frame.commandBuffer, (uint32_t)frame.secondaries.size(), frame.secondaries.data());
+    vkCmdEndRenderPass(frame.commandBuffer);
+    vulkan_endGpuScope(renderer->gpuProfiler, frame.commandBuffer, renderPassScope);
+
+    if (renderer->statisticsQueries != VK_NULL_HANDLE) {
+        vkCmdEndQuery(frame.commandBuffer, renderer->statisticsQueries, renderer->currentFrame);
+        frame.statisticsPending = true;
+    }
+
+    if (renderer->buildDepthPyramid) {
+        uint32_t pyramidScope = vulkan_beginGpuScope(renderer->gpuProfiler, frame.commandBuffer, "depth pyramid");
+        vulkan_buildDepthPyramid(renderer, renderer->depthPyramid, frame.commandBuffer, renderer->currentSwapchainImageIndex);
+        vulkan_endGpuScope(renderer->gpuProfiler, frame.commandBuffer, pyramidScope);
+    } else {
+        renderer->depthPyramid->valid = false;
+    }
+    renderer->buildDepthPyramid = false;
+
+    if (!frame.readbackPath.empty()) {
+        record_readback(renderer, &frame);
+    }
+
+    vulkan_endGpuScope(renderer->gpuProfiler, frame.commandBuffer, renderer->frameScope);
+    vkEndCommandBuffer(frame.commandBuffer);
+    renderer->metrics.secondaryCommandBuffers = (uint32_t)frame.secondaries.size();
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     
-    VkSemaphore waitSemaphores[] = {renderer->imageAvailableSemaphore};
+    VkSemaphore waitSemaphores[] = {frame.imageAvailableSemaphore};
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
     submitInfo.waitSemaphoreCount = 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &renderer->command_buffer;
+    submitInfo.pCommandBuffers = &frame.commandBuffer;
 
-    VkSemaphore signalSemaphores[] = {renderer->renderFinishedSemaphore};
+    VkSemaphore signalSemaphores[] = {renderer->renderFinishedSemaphores[renderer->currentSwapchainImageIndex]};
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    vkQueueSubmit(renderer->init_objects.graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    // Nothing is acquired or presented, the fence alone orders headless frames
+    if (renderer->init_objects.headless) {
+        submitInfo.waitSemaphoreCount = 0;
+        submitInfo.signalSemaphoreCount = 0;
+    }
+
+    // Copies recorded during the frame have to be ahead of it on the graphics queue
+    vulkan_flushUploads(renderer->uploader);
+
+    vkResetFences(renderer->init_objects.device, 1, &frame.inFlightFence);
+    {
+        PROFILE_ZONE("queue submit");
+        vkQueueSubmit(renderer->init_objects.graphicsQueue, 1, &submitInfo, frame.inFlightFence);
+    }
 
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -216,5 +797,92 @@ void renderer_end_frame(vulkan_renderer* renderer) {
     presentInfo.pSwapchains = swapChains;
     presentInfo.pImageIndices = &renderer->currentSwapchainImageIndex;
     presentInfo.pResults = nullptr;
-    vkQueuePresentKHR(renderer->init_objects.presentQueue, &presentInfo);
-}
\ No newline at end of file
+    if (!renderer->init_objects.headless) {
+        PROFILE_ZONE("present");
+        VkResult result = vkQueuePresentKHR(renderer->init_objects.presentQueue, &presentInfo);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+            renderer->swapchainDirty = true;
+        } else if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to present swapchain image!");
+        }
+    }
+
+    renderer->metrics.cpuMilliseconds = milliseconds_between(renderer->cpuBegin, std::chrono::high_resolution_clock::now());
+
+    renderer->currentFrame = (renderer->currentFrame + 1) % renderer->frames.size();
+    renderer->frameNumber++;
+}
+
+void renderer_reserve_recording_threads(vulkan_renderer* renderer, uint32_t threadCount) {
+    // New slots are zeroed, their pools are created on first use
+    for (vulkan_frame& frame : renderer->frames) {
+        if (frame.threadCommands.size() < threadCount) {
+            frame.threadCommands.resize(threadCount);
+        }
+    }
+}
+
+VkCommandBuffer renderer_begin_secondary(vulkan_renderer* renderer, uint32_t threadIndex) {
+    VkDevice device = renderer->init_objects.device;
+    vulkan_frame& frame = renderer->frames[renderer->currentFrame];
+
+    if (threadIndex >= frame.threadCommands.size()) {
+        throw std::runtime_error("too many recording threads!");
+    }
+
+    // Only this thread touches its slot, command pools are externally synchronized
+    vulkan_thread_commands& commands = frame.threadCommands[threadIndex];
+    if (commands.pool == VK_NULL_HANDLE) {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = renderer->init_objects.indices.graphicsFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commands.pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+
+    if (commands.used == commands.buffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commands.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer buffer;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+        commands.buffers.push_back(buffer);
+    }
+
+    VkCommandBuffer buffer = commands.buffers[commands.used++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderer->render_pass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = renderer->framebuffers[renderer->currentSwapchainImageIndex];
+    inheritanceInfo.pipelineStatistics = renderer->statisticsQueries != VK_NULL_HANDLE ? VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT : 0;
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    vkBeginCommandBuffer(buffer, &beginInfo);
+
+    return buffer;
+}
+
+void renderer_execute_secondaries(vulkan_renderer* renderer, const VkCommandBuffer* buffers, uint32_t count) {
+    vulkan_frame& frame = renderer->frames[renderer->currentFrame];
+
+    // Close what the render thread recorded so far so the order of the frame is kept
+    vkEndCommandBuffer(renderer->command_buffer);
+    frame.secondaries.push_back(renderer->command_buffer);
+    frame.secondaries.insert(frame.secondaries.end(), buffers, buffers + count);
+
+    renderer->command_buffer = renderer_begin_secondary(renderer, 0);
+}
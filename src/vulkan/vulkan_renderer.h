@@ -17,20 +17,158 @@
 #pragma once
 
 #include "vulkan_init.h"
+#include "vulkan_memory.h"
+#include "vulkan_upload.h"
+#include "vulkan_pipeline_cache.h"
+#include "vulkan_gpu_profiler.h"
+#include "vulkan_descriptors.h"
+#include "vulkan_frame_ring.h"
+#include "vulkan_shaders.h"
+#include <chrono>
+#include <string>
+
+#define RENDERER_DEFAULT_FRAMES_IN_FLIGHT 2
+#define RENDERER_MAX_FRAMES_IN_FLIGHT 4
+#define RENDERER_METRICS_HISTORY 120
+// Images rendered to in turn by a headless renderer, in place of the swapchain images
+#define RENDERER_OFFSCREEN_IMAGES 3
+
+struct vulkan_depth_pyramid;
+
+// Depth attachment of one swapchain image, left in DEPTH_STENCIL_READ_ONLY_OPTIMAL by the render pass
+struct vulkan_depth_target {
+    VkImage image;
+    vulkan_allocation allocation;
+    // All aspects of the format for the framebuffer, depth only for sampling
+    VkImageView attachmentView;
+    VkImageView sampledView;
+};
+
+// Secondary command buffers one thread records in one frame slot, the pool is created on first use
+struct vulkan_thread_commands {
+    VkCommandPool pool;
+    std::vector<VkCommandBuffer> buffers;
+    uint32_t used;
+};
+
+// Everything a frame needs that can't be touched again until the GPU is done with it
+struct vulkan_frame {
+    VkCommandPool commandPool;
+    // Primary, only begins the render pass and executes the secondaries
+    VkCommandBuffer commandBuffer;
+    // Indexed by job_system_thread_index(), 0 is the render thread
+    std::vector<vulkan_thread_commands> threadCommands;
+    // Executed in this order inside the render pass
+    std::vector<VkCommandBuffer> secondaries;
+    VkSemaphore imageAvailableSemaphore;
+    VkFence inFlightFence;
+    // Destroyed the next time this frame slot is reused
+    std::vector<VkBuffer> transientBuffers;
+    std::vector<vulkan_allocation> transientAllocations;
+    // The pipeline statistics query of this slot was submitted and can be read after the fence
+    bool statisticsPending;
+    // Host visible copy of the color image, created on the first readback of this slot. The copy is written
+    // to readbackPath once the fence signals, an empty path means none is pending.
+    VkBuffer readbackBuffer;
+    vulkan_allocation readbackAllocation;
+    std::string readbackPath;
+};
+
+struct vulkan_frame_metrics {
+    // Begin of the previous frame to begin of this one
+    float frameMilliseconds;
+    // CPU blocked on the fence of the frame slot and on acquiring the swapchain image
+    float fenceWaitMilliseconds;
+    float acquireMilliseconds;
+    // Recording and submitting, from the end of the waits to the end of the frame
+    float cpuMilliseconds;
+    uint32_t secondaryCommandBuffers;
+    // Fragment shader invocations of the render pass per pixel, 0 without pipeline statistics queries
+    uint64_t fragmentInvocations;
+    float overdraw;
+    float frameHistory[RENDERER_METRICS_HISTORY];
+    float fenceWaitHistory[RENDERER_METRICS_HISTORY];
+    uint32_t historyOffset;
+};
 
 struct vulkan_renderer {
     vulkan_objects init_objects;
+    vulkan_allocator* allocator;
+    // Staging ring and copies on the transfer queue, flushed before every frame submit
+    vulkan_uploader* uploader;
+    vulkan_pipeline_cache* pipelineCache;
+    // Embedded SPIR-V and, in development mode, recompiled sources
+    vulkan_shader_store* shaders;
+    // Scopes around the frame, the render pass and the depth pyramid are recorded by the renderer itself
+    vulkan_gpu_profiler* gpuProfiler;
+    uint32_t frameScope;
+    vulkan_descriptor_layout_cache* descriptorLayouts;
+    // Frame sets are reset when their slot's fence signalled
+    vulkan_descriptor_allocator* descriptorAllocator;
+    // Uniform and storage data of the frame that is recorded, bound with dynamic offsets
+    vulkan_frame_ring* frameRing;
     VkRenderPass render_pass;
+    VkFormat depthFormat;
+    std::vector<vulkan_depth_target> depthTargets;
+    // Memory of the images a headless renderer creates in init_objects.swapchainImages, empty otherwise
+    std::vector<vulkan_allocation> offscreenAllocations;
     std::vector<VkFramebuffer> framebuffers;
+    // Built after the render pass of every frame that sets buildDepthPyramid, which is cleared again by end_frame
+    vulkan_depth_pyramid* depthPyramid;
+    bool buildDepthPyramid;
+    // One pipeline statistics query per frame slot around the render pass, VK_NULL_HANDLE if unsupported
+    VkQueryPool statisticsQueries;
+    // For one time commands outside of frames
     VkCommandPool command_pool;
+    // Render thread's secondary command buffer inside the render pass of the frame that is currently recorded
     VkCommandBuffer command_buffer;
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
+    // Primary of the frame that is currently recorded, outside the render pass. Work like culling dispatches
+    // recorded here executes before the render pass.
+    VkCommandBuffer frame_command_buffer;
+    std::vector<vulkan_frame> frames;
+    uint32_t currentFrame;
+    uint64_t frameNumber;
+    // Signalled when rendering to a swapchain image is done, one per image since presentation holds on to it
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    // Fence of the frame that last rendered to a swapchain image
+    std::vector<VkFence> imagesInFlight;
     uint32_t currentSwapchainImageIndex;
+    // Set when the window size changed, the swapchain reported that it is out of date or suboptimal or its present
+    // mode or image count requests changed. The swapchain is recreated before the next image is acquired.
+    bool swapchainDirty;
+    // Window framebuffer size the swapchain was last created for. The surface may clamp the extent, so a resize is
+    // detected against this instead of swapchainExtent.
+    VkExtent2D framebufferSize;
+    // Also waits for the previous frame before recording, so input is sampled with at most one frame queued
+    bool lowLatency;
+    vulkan_frame_metrics metrics;
+    std::chrono::high_resolution_clock::time_point lastFrameBegin;
+    std::chrono::high_resolution_clock::time_point cpuBegin;
 };
 
-vulkan_renderer* init_renderer(vulkan_objects init_objects);
+// framesInFlight is clamped to [1, RENDERER_MAX_FRAMES_IN_FLIGHT]
+vulkan_renderer* init_renderer(vulkan_objects init_objects, uint32_t framesInFlight);
 void deinit_renderer(vulkan_renderer* renderer);
 
+// Destroys buffer and frees its memory once the GPU is done with the current frame
+void renderer_destroy_after_frame(vulkan_renderer* renderer, VkBuffer buffer, const vulkan_allocation& allocation);
+
 void renderer_begin_frame(vulkan_renderer* renderer);
-void renderer_end_frame(vulkan_renderer* renderer);
\ No newline at end of file
+void renderer_end_frame(vulkan_renderer* renderer);
+
+// Development mode, rebuilds the renderer's own pipelines if their shaders are among the reloaded ones.
+// Call outside of a frame.
+void renderer_reload_shaders(vulkan_renderer* renderer, const std::vector<std::string>& shaders);
+
+// Writes the color image of the frame that is currently recorded to path as a binary PPM once the GPU is done
+// with it. Only headless renderers can read back, their images aren't owned by a presentation engine.
+void renderer_request_readback(vulkan_renderer* renderer, const std::string& path);
+
+// Makes room for secondaries from threadCount threads, e.g. job_system_thread_count(). Only the render thread can
+// record until this is called, call outside of a frame.
+void renderer_reserve_recording_threads(vulkan_renderer* renderer, uint32_t threadCount);
+// Begins a secondary command buffer that continues the frame's render pass. Each thread must pass its own index,
+// below the reserved thread count, the returned buffer is only valid for the current frame.
+VkCommandBuffer renderer_begin_secondary(vulkan_renderer* renderer, uint32_t threadIndex);
+// Executes the ended secondaries in order after everything recorded into command_buffer so far
+void renderer_execute_secondaries(vulkan_renderer* renderer, const VkCommandBuffer* buffers, uint32_t count);
\ No newline at end of file
@@ -0,0 +1,430 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "vulkan_shaders.h"
+#include "../profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstring>
+
+// Set by CMake to the glslangValidator the shaders were built with
+#ifndef SHADER_COMPILER
+#define SHADER_COMPILER ""
+#endif
+
+#define SPIRV_MAGIC 0x07230203u
+
+enum spirv_op : uint32_t {
+    SPIRV_OP_ENTRY_POINT = 15,
+    SPIRV_OP_TYPE_INT = 21,
+    SPIRV_OP_TYPE_FLOAT = 22,
+    SPIRV_OP_TYPE_VECTOR = 23,
+    SPIRV_OP_TYPE_MATRIX = 24,
+    SPIRV_OP_TYPE_IMAGE = 25,
+    SPIRV_OP_TYPE_SAMPLER = 26,
+    SPIRV_OP_TYPE_SAMPLED_IMAGE = 27,
+    SPIRV_OP_TYPE_ARRAY = 28,
+    SPIRV_OP_TYPE_RUNTIME_ARRAY = 29,
+    SPIRV_OP_TYPE_STRUCT = 30,
+    SPIRV_OP_TYPE_POINTER = 32,
+    SPIRV_OP_CONSTANT = 43,
+    SPIRV_OP_VARIABLE = 59,
+    SPIRV_OP_DECORATE = 71,
+    SPIRV_OP_MEMBER_DECORATE = 72
+};
+
+enum spirv_decoration : uint32_t {
+    SPIRV_DECORATION_BLOCK = 2,
+    SPIRV_DECORATION_BUFFER_BLOCK = 3,
+    SPIRV_DECORATION_ARRAY_STRIDE = 6,
+    SPIRV_DECORATION_MATRIX_STRIDE = 7,
+    SPIRV_DECORATION_BINDING = 33,
+    SPIRV_DECORATION_DESCRIPTOR_SET = 34,
+    SPIRV_DECORATION_OFFSET = 35
+};
+
+enum spirv_storage_class : uint32_t {
+    SPIRV_STORAGE_UNIFORM_CONSTANT = 0,
+    SPIRV_STORAGE_UNIFORM = 2,
+    SPIRV_STORAGE_PUSH_CONSTANT = 9,
+    SPIRV_STORAGE_STORAGE_BUFFER = 12
+};
+
+#define SPIRV_DIM_BUFFER 5
+
+// Everything reflection needs to know about one result id
+struct spirv_id {
+    uint32_t opcode;
+    // Operands after the result id
+    std::vector<uint32_t> operands;
+    uint32_t set;
+    uint32_t binding;
+    bool hasBinding;
+    bool block;
+    bool bufferBlock;
+    uint32_t arrayStride;
+    std::vector<uint32_t> memberOffsets;
+    std::vector<uint32_t> memberMatrixStrides;
+};
+
+vulkan_shader_store* init_shader_store() {
+    vulkan_shader_store* store = new vulkan_shader_store();
+    store->watching = false;
+    store->reloads = 0;
+    store->failedReloads = 0;
+
+    for (size_t i = 0; i < vulkan_embeddedShaderCount; i++) {
+        vulkan_shader_source shader;
+        shader.name = vulkan_embeddedShaders[i].name;
+        shader.source = vulkan_embeddedShaders[i].source;
+        store->shaders.push_back(shader);
+    }
+
+    return store;
+}
+
+void deinit_shader_store(vulkan_shader_store* store) {
+    delete store;
+}
+
+bool vulkan_getShaderCode(vulkan_shader_store* store, const std::string& name, std::vector<uint32_t>* code) {
+    for (size_t i = 0; i < store->shaders.size(); i++) {
+        if (store->shaders[i].name != name) {
+            continue;
+        }
+
+        if (!store->shaders[i].reloaded.empty()) {
+            *code = store->shaders[i].reloaded;
+        } else {
+            const vulkan_embedded_shader& embedded = vulkan_embeddedShaders[i];
+            code->resize(embedded.size / sizeof(uint32_t));
+            memcpy(code->data(), embedded.code, code->size() * sizeof(uint32_t));
+        }
+        return true;
+    }
+
+    std::ifstream file(name, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    size_t fileSize = (size_t)file.tellg();
+    code->resize(fileSize / sizeof(uint32_t));
+    file.seekg(0);
+    file.read((char*)code->data(), code->size() * sizeof(uint32_t));
+    return true;
+}
+
+static uint32_t type_size(std::unordered_map<uint32_t, spirv_id>& ids, uint32_t type, uint32_t matrixStride) {
+    spirv_id& id = ids[type];
+    switch (id.opcode) {
+        case SPIRV_OP_TYPE_INT:
+        case SPIRV_OP_TYPE_FLOAT:
+            return id.operands[0] / 8;
+        case SPIRV_OP_TYPE_VECTOR:
+            return id.operands[1] * type_size(ids, id.operands[0], 0);
+        case SPIRV_OP_TYPE_MATRIX:
+            return id.operands[1] * (matrixStride != 0 ? matrixStride : type_size(ids, id.operands[0], 0));
+        case SPIRV_OP_TYPE_ARRAY: {
+            uint32_t length = ids[id.operands[1]].operands.size() > 1 ? ids[id.operands[1]].operands[1] : 0;
+            return length * (id.arrayStride != 0 ? id.arrayStride : type_size(ids, id.operands[0], matrixStride));
+        }
+        case SPIRV_OP_TYPE_STRUCT: {
+            uint32_t size = 0;
+            for (size_t i = 0; i < id.operands.size() && i < id.memberOffsets.size(); i++) {
+                uint32_t stride = i < id.memberMatrixStrides.size() ? id.memberMatrixStrides[i] : 0;
+                size = std::max(size, id.memberOffsets[i] + type_size(ids, id.operands[i], stride));
+            }
+            return size;
+        }
+        default:
+            return 0;
+    }
+}
+
+static bool descriptor_binding(std::unordered_map<uint32_t, spirv_id>& ids, uint32_t storageClass, uint32_t type, VkDescriptorSetLayoutBinding* binding) {
+    binding->descriptorCount = 1;
+
+    spirv_id* id = &ids[type];
+    if (id->opcode == SPIRV_OP_TYPE_ARRAY) {
+        const spirv_id& length = ids[id->operands[1]];
+        binding->descriptorCount = length.operands.size() > 1 ? length.operands[1] : 1;
+        id = &ids[id->operands[0]];
+    } else if (id->opcode == SPIRV_OP_TYPE_RUNTIME_ARRAY) {
+        binding->descriptorCount = 0;
+        id = &ids[id->operands[0]];
+    }
+
+    if (storageClass == SPIRV_STORAGE_STORAGE_BUFFER || (storageClass == SPIRV_STORAGE_UNIFORM && id->bufferBlock)) {
+        binding->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    } else if (storageClass == SPIRV_STORAGE_UNIFORM) {
+        binding->descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    } else if (id->opcode == SPIRV_OP_TYPE_SAMPLER) {
+        binding->descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    } else if (id->opcode == SPIRV_OP_TYPE_SAMPLED_IMAGE) {
+        binding->descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    } else if (id->opcode == SPIRV_OP_TYPE_IMAGE) {
+        // Sampled 2 means the image is used without a sampler
+        bool storage = id->operands[5] == 2;
+        if (id->operands[1] == SPIRV_DIM_BUFFER) {
+            binding->descriptorType = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+        } else {
+            binding->descriptorType = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool vulkan_reflectShader(const uint32_t* code, size_t wordCount, vulkan_shader_reflection* reflection) {
+    if (wordCount < 5 || code[0] != SPIRV_MAGIC) {
+        return false;
+    }
+
+    reflection->stages = 0;
+    reflection->pushConstantStages = 0;
+    reflection->pushConstantSize = 0;
+    reflection->sets.clear();
+
+    std::unordered_map<uint32_t, spirv_id> ids;
+    std::vector<uint32_t> variables;
+
+    size_t offset = 5;
+    while (offset < wordCount) {
+        uint32_t opcode = code[offset] & 0xFFFF;
+        uint32_t length = code[offset] >> 16;
+        if (length == 0 || offset + length > wordCount) {
+            return false;
+        }
+
+        const uint32_t* words = code + offset + 1;
+        uint32_t operandCount = length - 1;
+
+        switch (opcode) {
+            case SPIRV_OP_ENTRY_POINT:
+                switch (words[0]) {
+                    case 0: reflection->stages |= VK_SHADER_STAGE_VERTEX_BIT; break;
+                    case 1: reflection->stages |= VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT; break;
+                    case 2: reflection->stages |= VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT; break;
+                    case 3: reflection->stages |= VK_SHADER_STAGE_GEOMETRY_BIT; break;
+                    case 4: reflection->stages |= VK_SHADER_STAGE_FRAGMENT_BIT; break;
+                    case 5: reflection->stages |= VK_SHADER_STAGE_COMPUTE_BIT; break;
+                }
+                break;
+            case SPIRV_OP_DECORATE:
+                if (operandCount >= 2) {
+                    spirv_id& id = ids[words[0]];
+                    switch (words[1]) {
+                        case SPIRV_DECORATION_BLOCK: id.block = true; break;
+                        case SPIRV_DECORATION_BUFFER_BLOCK: id.bufferBlock = true; break;
+                        case SPIRV_DECORATION_ARRAY_STRIDE: id.arrayStride = operandCount > 2 ? words[2] : 0; break;
+                        case SPIRV_DECORATION_DESCRIPTOR_SET: id.set = operandCount > 2 ? words[2] : 0; break;
+                        case SPIRV_DECORATION_BINDING:
+                            id.binding = operandCount > 2 ? words[2] : 0;
+                            id.hasBinding = true;
+                            break;
+                    }
+                }
+                break;
+            case SPIRV_OP_MEMBER_DECORATE:
+                if (operandCount >= 4 && (words[2] == SPIRV_DECORATION_OFFSET || words[2] == SPIRV_DECORATION_MATRIX_STRIDE)) {
+                    spirv_id& id = ids[words[0]];
+                    std::vector<uint32_t>& values = words[2] == SPIRV_DECORATION_OFFSET ? id.memberOffsets : id.memberMatrixStrides;
+                    if (values.size() <= words[1]) {
+                        values.resize(words[1] + 1, 0);
+                    }
+                    values[words[1]] = words[3];
+                }
+                break;
+            case SPIRV_OP_TYPE_INT:
+            case SPIRV_OP_TYPE_FLOAT:
+            case SPIRV_OP_TYPE_VECTOR:
+            case SPIRV_OP_TYPE_MATRIX:
+            case SPIRV_OP_TYPE_IMAGE:
+            case SPIRV_OP_TYPE_SAMPLER:
+            case SPIRV_OP_TYPE_SAMPLED_IMAGE:
+            case SPIRV_OP_TYPE_ARRAY:
+            case SPIRV_OP_TYPE_RUNTIME_ARRAY:
+            case SPIRV_OP_TYPE_STRUCT:
+            case SPIRV_OP_TYPE_POINTER:
+                if (operandCount >= 1) {
+                    spirv_id& id = ids[words[0]];
+                    id.opcode = opcode;
+                    id.operands.assign(words + 1, words + operandCount);
+                }
+                break;
+            // Result type first, the value is kept as the second operand
+            case SPIRV_OP_CONSTANT:
+            case SPIRV_OP_VARIABLE:
+                if (operandCount >= 3) {
+                    spirv_id& id = ids[words[1]];
+                    id.opcode = opcode;
+                    id.operands.assign({ words[0], words[2] });
+                    if (opcode == SPIRV_OP_VARIABLE) {
+                        variables.push_back(words[1]);
+                    }
+                }
+                break;
+        }
+
+        offset += length;
+    }
+
+    for (uint32_t variableId : variables) {
+        const spirv_id& variable = ids[variableId];
+        uint32_t storageClass = variable.operands[1];
+        const spirv_id& pointer = ids[variable.operands[0]];
+        if (pointer.opcode != SPIRV_OP_TYPE_POINTER || pointer.operands.size() < 2) {
+            continue;
+        }
+        uint32_t type = pointer.operands[1];
+
+        if (storageClass == SPIRV_STORAGE_PUSH_CONSTANT) {
+            reflection->pushConstantStages = reflection->stages;
+            reflection->pushConstantSize = std::max(reflection->pushConstantSize, type_size(ids, type, 0));
+            continue;
+        }
+
+        if ((storageClass != SPIRV_STORAGE_UNIFORM_CONSTANT && storageClass != SPIRV_STORAGE_UNIFORM && storageClass != SPIRV_STORAGE_STORAGE_BUFFER)
+            || !variable.hasBinding) {
+            continue;
+        }
+
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = variable.binding;
+        binding.stageFlags = reflection->stages;
+        if (!descriptor_binding(ids, storageClass, type, &binding)) {
+            continue;
+        }
+
+        if (reflection->sets.size() <= variable.set) {
+            reflection->sets.resize(variable.set + 1);
+        }
+        reflection->sets[variable.set].push_back(binding);
+    }
+
+    for (std::vector<VkDescriptorSetLayoutBinding>& set : reflection->sets) {
+        std::sort(set.begin(), set.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+    }
+
+    return true;
+}
+
+void vulkan_mergeReflection(vulkan_shader_reflection* reflection, const vulkan_shader_reflection& other) {
+    reflection->stages |= other.stages;
+    reflection->pushConstantStages |= other.pushConstantStages;
+    reflection->pushConstantSize = std::max(reflection->pushConstantSize, other.pushConstantSize);
+
+    if (reflection->sets.size() < other.sets.size()) {
+        reflection->sets.resize(other.sets.size());
+    }
+
+    for (size_t set = 0; set < other.sets.size(); set++) {
+        std::vector<VkDescriptorSetLayoutBinding>& bindings = reflection->sets[set];
+        for (const VkDescriptorSetLayoutBinding& binding : other.sets[set]) {
+            auto existing = std::find_if(bindings.begin(), bindings.end(), [&](const VkDescriptorSetLayoutBinding& b) { return b.binding == binding.binding; });
+            if (existing != bindings.end()) {
+                existing->stageFlags |= binding.stageFlags;
+            } else {
+                bindings.push_back(binding);
+            }
+        }
+
+        std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+    }
+}
+
+static bool recompile(vulkan_shader_source& shader) {
+    PROFILE_ZONE("recompile shader");
+    std::filesystem::path output = std::filesystem::temp_directory_path() / shader.name;
+    std::string command = std::string("\"") + SHADER_COMPILER + "\" -V -o \"" + output.string() + "\" \"" + shader.source + "\"";
+
+    // The compiler prints its errors itself
+    if (std::system(command.c_str()) != 0) {
+        return false;
+    }
+
+    std::ifstream file(output, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    size_t fileSize = (size_t)file.tellg();
+    std::vector<uint32_t> code(fileSize / sizeof(uint32_t));
+    file.seekg(0);
+    file.read((char*)code.data(), code.size() * sizeof(uint32_t));
+
+    vulkan_shader_reflection reflection;
+    if (!vulkan_reflectShader(code.data(), code.size(), &reflection)) {
+        return false;
+    }
+
+    shader.reloaded = std::move(code);
+    return true;
+}
+
+std::vector<std::string> vulkan_pollShaderSources(vulkan_shader_store* store) {
+    std::vector<std::string> changed;
+
+    auto now = std::chrono::steady_clock::now();
+    if (store->watching && std::chrono::duration<double>(now - store->lastPoll).count() < SHADER_POLL_INTERVAL) {
+        return changed;
+    }
+    store->lastPoll = now;
+
+    if (strlen(SHADER_COMPILER) == 0) {
+        if (!store->watching) {
+            std::cout << "Shaders can't be reloaded, the build found no glslangValidator" << std::endl;
+            store->watching = true;
+        }
+        return changed;
+    }
+
+    PROFILE_ZONE("poll shader sources");
+    for (vulkan_shader_source& shader : store->shaders) {
+        std::error_code error;
+        std::filesystem::file_time_type lastWrite = std::filesystem::last_write_time(shader.source, error);
+        if (error) {
+            continue;
+        }
+
+        // The first poll only takes note of the times
+        if (!store->watching || lastWrite == shader.lastWrite) {
+            shader.lastWrite = lastWrite;
+            continue;
+        }
+        shader.lastWrite = lastWrite;
+
+        if (recompile(shader)) {
+            std::cout << "Reloaded " << shader.name << std::endl;
+            changed.push_back(shader.name);
+            store->reloads++;
+        } else {
+            std::cout << "Could not recompile " << shader.source << ", keeping the old code" << std::endl;
+            store->failedReloads++;
+        }
+    }
+
+    store->watching = true;
+    return changed;
+}
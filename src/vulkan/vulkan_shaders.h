@@ -0,0 +1,84 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "vulkan_init.h"
+#include <vector>
+#include <string>
+#include <chrono>
+#include <filesystem>
+
+// Seconds between two checks of the shader sources in development mode
+#define SHADER_POLL_INTERVAL 0.5
+
+// SPIR-V compiled by the build, the table is generated by cmake/embed_shaders.cmake. Empty when the build had no
+// glslangValidator, shaders are read from the working directory then.
+struct vulkan_embedded_shader {
+    // File name the shader used to be loaded from, like bsp_vert.spv
+    const char* name;
+    // Absolute path of the GLSL source at build time
+    const char* source;
+    const unsigned char* code;
+    size_t size;
+};
+
+extern const vulkan_embedded_shader vulkan_embeddedShaders[];
+extern const size_t vulkan_embeddedShaderCount;
+
+// Resources and push constants one or more stages use. Bindings of arrays have the array length as their count,
+// runtime arrays have a count of 0 and need to be sized by the caller.
+struct vulkan_shader_reflection {
+    VkShaderStageFlags stages;
+    // Stages that declare a push constant block and the size of the largest one
+    VkShaderStageFlags pushConstantStages;
+    uint32_t pushConstantSize;
+    // Indexed by set, sorted by binding
+    std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets;
+};
+
+struct vulkan_shader_source {
+    std::string name;
+    std::string source;
+    std::filesystem::file_time_type lastWrite;
+    // Code of the last successful recompile, replaces the embedded code
+    std::vector<uint32_t> reloaded;
+};
+
+struct vulkan_shader_store {
+    std::vector<vulkan_shader_source> shaders;
+    // Sources are only looked at once polling started, startup never touches the disk for embedded shaders
+    bool watching;
+    std::chrono::steady_clock::time_point lastPoll;
+    uint32_t reloads;
+    uint32_t failedReloads;
+};
+
+vulkan_shader_store* init_shader_store();
+void deinit_shader_store(vulkan_shader_store* store);
+
+// The last recompile of the shader, its embedded code or the file of that name in the working directory, in that order
+bool vulkan_getShaderCode(vulkan_shader_store* store, const std::string& name, std::vector<uint32_t>* code);
+
+// Parses decorations, types and variables of the module. Fails on anything that isn't SPIR-V.
+bool vulkan_reflectShader(const uint32_t* code, size_t wordCount, vulkan_shader_reflection* reflection);
+// Stages and bindings of other are added to reflection, bindings both use get both stages
+void vulkan_mergeReflection(vulkan_shader_reflection* reflection, const vulkan_shader_reflection& other);
+
+// Development mode, call once per frame. Recompiles sources that changed since the last check with the build's
+// glslangValidator and returns the names of the shaders that now have new code. Failed compiles keep the old code.
+std::vector<std::string> vulkan_pollShaderSources(vulkan_shader_store* store);
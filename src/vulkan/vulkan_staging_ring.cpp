@@ -0,0 +1,52 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vulkan_staging_ring.h"
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool vulkan_stagingRingAllocate(vulkan_staging_ring* ring, VkDeviceSize size, VkDeviceSize* offset) {
+    if (ring->head == ring->tail) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+
+    VkDeviceSize aligned = align_up(ring->head, ring->alignment);
+
+    if (ring->head >= ring->tail) {
+        if (aligned + size <= ring->size) {
+            *offset = aligned;
+        } else if (size < ring->tail) {
+            // Wrap around, the end of the ring stays unused until the tail passes it
+            *offset = 0;
+        } else {
+            return false;
+        }
+    } else if (aligned + size < ring->tail) {
+        *offset = aligned;
+    } else {
+        return false;
+    }
+
+    ring->head = *offset + size;
+    return true;
+}
+
+void vulkan_stagingRingRelease(vulkan_staging_ring* ring, VkDeviceSize end) {
+    ring->tail = end;
+}
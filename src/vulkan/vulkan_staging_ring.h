@@ -0,0 +1,33 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+// Head and tail of the staging ring, kept apart from the uploader so the rules can be tested without a device.
+// Head equal to tail means the ring is empty, allocations never fill it up completely to keep it that way
+struct vulkan_staging_ring {
+    VkDeviceSize size;
+    VkDeviceSize head;
+    VkDeviceSize tail;
+    VkDeviceSize alignment;
+};
+
+// Returns false without touching the ring when size bytes don't fit in front of the tail
+bool vulkan_stagingRingAllocate(vulkan_staging_ring* ring, VkDeviceSize size, VkDeviceSize* offset);
+// Everything up to end has been consumed, end is the head after the allocations being released
+void vulkan_stagingRingRelease(vulkan_staging_ring* ring, VkDeviceSize end);
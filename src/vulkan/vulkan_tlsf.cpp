@@ -0,0 +1,230 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vulkan_tlsf.h"
+
+#include <algorithm>
+
+static uint32_t highest_bit(uint64_t value) {
+    uint32_t bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+}
+
+static uint32_t lowest_bit(uint64_t value) {
+    uint32_t bit = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        bit++;
+    }
+    return bit;
+}
+
+void tlsf_mapping(VkDeviceSize size, uint32_t* fl, uint32_t* sl) {
+    if (size < TLSF_SL_COUNT) {
+        *fl = 0;
+        *sl = (uint32_t)size;
+        return;
+    }
+
+    uint32_t bit = highest_bit(size);
+    *fl = bit - TLSF_SL_BITS + 1;
+    *sl = (uint32_t)(size >> (bit - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+}
+
+static uint32_t tlsf_new_node(vulkan_memory_block* block) {
+    if (!block->unusedNodes.empty()) {
+        uint32_t node = block->unusedNodes.back();
+        block->unusedNodes.pop_back();
+        return node;
+    }
+
+    block->nodes.push_back({});
+    return (uint32_t)block->nodes.size() - 1;
+}
+
+static void tlsf_insert_free(vulkan_memory_block* block, uint32_t index) {
+    tlsf_node& node = block->nodes[index];
+    uint32_t fl, sl;
+    tlsf_mapping(node.size, &fl, &sl);
+
+    node.free = true;
+    node.prevFree = TLSF_NONE;
+    node.nextFree = block->freeLists[fl][sl];
+    if (node.nextFree != TLSF_NONE) {
+        block->nodes[node.nextFree].prevFree = index;
+    }
+
+    block->freeLists[fl][sl] = index;
+    block->slBitmap[fl] |= 1u << sl;
+    block->flBitmap |= 1ull << fl;
+}
+
+static void tlsf_remove_free(vulkan_memory_block* block, uint32_t index) {
+    tlsf_node& node = block->nodes[index];
+    uint32_t fl, sl;
+    tlsf_mapping(node.size, &fl, &sl);
+
+    if (node.prevFree != TLSF_NONE) {
+        block->nodes[node.prevFree].nextFree = node.nextFree;
+    } else {
+        block->freeLists[fl][sl] = node.nextFree;
+        if (node.nextFree == TLSF_NONE) {
+            block->slBitmap[fl] &= ~(1u << sl);
+            if (block->slBitmap[fl] == 0) {
+                block->flBitmap &= ~(1ull << fl);
+            }
+        }
+    }
+
+    if (node.nextFree != TLSF_NONE) {
+        block->nodes[node.nextFree].prevFree = node.prevFree;
+    }
+
+    node.free = false;
+}
+
+// Splits the node at size, the new node behind it takes the rest
+static uint32_t tlsf_split(vulkan_memory_block* block, uint32_t index, VkDeviceSize size) {
+    uint32_t rest = tlsf_new_node(block);
+    tlsf_node& node = block->nodes[index];
+    tlsf_node& restNode = block->nodes[rest];
+
+    restNode.offset = node.offset + size;
+    restNode.size = node.size - size;
+    restNode.prevPhysical = index;
+    restNode.nextPhysical = node.nextPhysical;
+    if (node.nextPhysical != TLSF_NONE) {
+        block->nodes[node.nextPhysical].prevPhysical = rest;
+    }
+
+    node.size = size;
+    node.nextPhysical = rest;
+
+    return rest;
+}
+
+// Merges the node behind index into it
+static void tlsf_merge_next(vulkan_memory_block* block, uint32_t index) {
+    tlsf_node& node = block->nodes[index];
+    uint32_t next = node.nextPhysical;
+    tlsf_node& nextNode = block->nodes[next];
+
+    node.size += nextNode.size;
+    node.nextPhysical = nextNode.nextPhysical;
+    if (node.nextPhysical != TLSF_NONE) {
+        block->nodes[node.nextPhysical].prevPhysical = index;
+    }
+
+    block->unusedNodes.push_back(next);
+}
+
+uint32_t tlsf_allocate(vulkan_memory_block* block, VkDeviceSize size, VkDeviceSize alignment) {
+    // Any range in the found class fits size plus worst case alignment padding
+    VkDeviceSize searchSize = size + alignment - 1;
+    if (searchSize >= TLSF_SL_COUNT) {
+        searchSize += ((VkDeviceSize)1 << (highest_bit(searchSize) - TLSF_SL_BITS)) - 1;
+    }
+
+    uint32_t fl, sl;
+    tlsf_mapping(searchSize, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return TLSF_NONE;
+    }
+
+    uint32_t slMap = block->slBitmap[fl] & (~0u << sl);
+    if (slMap == 0) {
+        uint64_t flMap = fl + 1 < TLSF_FL_COUNT ? block->flBitmap & (~0ull << (fl + 1)) : 0;
+        if (flMap == 0) {
+            return TLSF_NONE;
+        }
+
+        fl = lowest_bit(flMap);
+        slMap = block->slBitmap[fl];
+    }
+    sl = lowest_bit(slMap);
+
+    uint32_t index = block->freeLists[fl][sl];
+    tlsf_remove_free(block, index);
+
+    // Free ranges are always merged with their neighbours, so padding in front is given back as its own node
+    VkDeviceSize offset = block->nodes[index].offset;
+    VkDeviceSize padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+    if (padding > 0) {
+        uint32_t front = index;
+        index = tlsf_split(block, front, padding);
+        tlsf_insert_free(block, front);
+    }
+
+    if (block->nodes[index].size - size >= TLSF_MIN_SPLIT) {
+        uint32_t rest = tlsf_split(block, index, size);
+        tlsf_insert_free(block, rest);
+    }
+
+    block->nodes[index].free = false;
+    return index;
+}
+
+void tlsf_free(vulkan_memory_block* block, uint32_t index) {
+    uint32_t prev = block->nodes[index].prevPhysical;
+    if (prev != TLSF_NONE && block->nodes[prev].free) {
+        tlsf_remove_free(block, prev);
+        tlsf_merge_next(block, prev);
+        index = prev;
+    }
+
+    uint32_t next = block->nodes[index].nextPhysical;
+    if (next != TLSF_NONE && block->nodes[next].free) {
+        tlsf_remove_free(block, next);
+        tlsf_merge_next(block, index);
+    }
+
+    tlsf_insert_free(block, index);
+}
+
+VkDeviceSize tlsf_largest_free(vulkan_memory_block* block) {
+    if (block->flBitmap == 0) {
+        return 0;
+    }
+
+    uint32_t fl = highest_bit(block->flBitmap);
+    uint32_t sl = highest_bit(block->slBitmap[fl]);
+
+    VkDeviceSize largest = 0;
+    for (uint32_t node = block->freeLists[fl][sl]; node != TLSF_NONE; node = block->nodes[node].nextFree) {
+        largest = std::max(largest, block->nodes[node].size);
+    }
+
+    return largest;
+}
+
+void tlsf_init_block(vulkan_memory_block* block, VkDeviceSize size) {
+    block->size = size;
+    block->flBitmap = 0;
+    for (uint32_t fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        block->slBitmap[fl] = 0;
+        std::fill(block->freeLists[fl], block->freeLists[fl] + TLSF_SL_COUNT, TLSF_NONE);
+    }
+    block->allocationCount = 0;
+    block->usedBytes = 0;
+
+    block->nodes.clear();
+    block->unusedNodes.clear();
+    block->nodes.push_back({ 0, block->size, TLSF_NONE, TLSF_NONE, TLSF_NONE, TLSF_NONE, false });
+    tlsf_insert_free(block, 0);
+}
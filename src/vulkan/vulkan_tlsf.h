@@ -0,0 +1,65 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+// Sub-allocation inside the VkDeviceMemory blocks of the allocator, none of it calls into the device.
+// Two level segregated fit inside every block. The first level splits free ranges by power of two,
+// the second level linearly into TLSF_SL_COUNT classes, bitmaps find a fitting free list in constant time.
+#define TLSF_SL_BITS 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_COUNT (64 - TLSF_SL_BITS + 1)
+// Free ranges smaller than this stay part of the allocation in front of them
+#define TLSF_MIN_SPLIT 64
+#define TLSF_NONE UINT32_MAX
+
+struct tlsf_node {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Neighbours by address and, for free nodes, in the free list of their size class
+    uint32_t prevPhysical;
+    uint32_t nextPhysical;
+    uint32_t prevFree;
+    uint32_t nextFree;
+    bool free;
+};
+
+// memory and mapped belong to the allocator, everything else is set up by tlsf_init_block
+struct vulkan_memory_block {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void* mapped;
+    std::vector<tlsf_node> nodes;
+    std::vector<uint32_t> unusedNodes;
+    uint64_t flBitmap;
+    uint32_t slBitmap[TLSF_FL_COUNT];
+    uint32_t freeLists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    uint32_t allocationCount;
+    VkDeviceSize usedBytes;
+};
+
+// Free list class of a range of size bytes
+void tlsf_mapping(VkDeviceSize size, uint32_t* fl, uint32_t* sl);
+// One free node over the whole block
+void tlsf_init_block(vulkan_memory_block* block, VkDeviceSize size);
+// Node of at least size bytes at a multiple of alignment, a power of two. TLSF_NONE when no free range fits
+uint32_t tlsf_allocate(vulkan_memory_block* block, VkDeviceSize size, VkDeviceSize alignment);
+// The node is merged with free neighbours
+void tlsf_free(vulkan_memory_block* block, uint32_t index);
+VkDeviceSize tlsf_largest_free(vulkan_memory_block* block);
@@ -0,0 +1,415 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "vulkan_upload.h"
+#include "vulkan_utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Everything that reads uploaded buffers and images waits for the copies in these stages
+static const VkPipelineStageFlags UPLOAD_CONSUMER_STAGES = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+    | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+vulkan_uploader* init_uploader(vulkan_renderer* renderer, VkDeviceSize ringSize) {
+    const vulkan_objects& objects = renderer->init_objects;
+
+    vulkan_uploader* uploader = new vulkan_uploader();
+    uploader->renderer = renderer;
+    uploader->graphicsFamily = objects.indices.graphicsFamily.value();
+    uploader->queueFamily = objects.indices.transferFamily.value_or(uploader->graphicsFamily);
+    uploader->ownershipTransfer = uploader->queueFamily != uploader->graphicsFamily;
+    uploader->queue = objects.transferQueue;
+    uploader->current = nullptr;
+    uploader->nextTicket = 1;
+    uploader->completedTicket = 0;
+    uploader->submittedBytes = 0;
+    uploader->ringStalls = 0;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = uploader->queueFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    if (vkCreateCommandPool(objects.device, &poolInfo, nullptr, &uploader->commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload command pool!");
+    }
+
+    uploader->acquireCommandPool = VK_NULL_HANDLE;
+    if (uploader->ownershipTransfer) {
+        poolInfo.queueFamilyIndex = uploader->graphicsFamily;
+        if (vkCreateCommandPool(objects.device, &poolInfo, nullptr, &uploader->acquireCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload command pool!");
+        }
+    }
+
+    // Image copies need offsets that are a multiple of the texel block size, 16 covers every format we upload
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(objects.physicalDevice, &properties);
+    uploader->ring.alignment = std::max<VkDeviceSize>(16, properties.limits.optimalBufferCopyOffsetAlignment);
+
+    uploader->ring.size = ringSize;
+    uploader->ring.head = 0;
+    uploader->ring.tail = 0;
+    if (!vulkan_createBuffer(renderer, ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uploader->ringBuffer, uploader->ringAllocation)) {
+        throw std::runtime_error("failed to create upload staging ring!");
+    }
+
+    return uploader;
+}
+
+static void retire_batch(vulkan_uploader* uploader, vulkan_upload_batch* batch) {
+    VkDevice device = uploader->renderer->init_objects.device;
+
+    if (batch->usedRing) {
+        vulkan_stagingRingRelease(&uploader->ring, batch->ringEnd);
+    }
+    uploader->completedTicket = batch->ticket;
+
+    for (size_t i = 0; i < batch->stagingBuffers.size(); i++) {
+        vulkan_destroyBuffer(uploader->renderer, batch->stagingBuffers[i], batch->stagingAllocations[i]);
+    }
+    batch->stagingBuffers.clear();
+    batch->stagingAllocations.clear();
+
+    vkResetFences(device, 1, &batch->fence);
+
+    uploader->inFlight.pop_front();
+    uploader->unusedBatches.push_back(batch);
+}
+
+void deinit_uploader(vulkan_uploader* uploader) {
+    VkDevice device = uploader->renderer->init_objects.device;
+
+    vulkan_waitForUpload(uploader, vulkan_flushUploads(uploader));
+
+    for (vulkan_upload_batch* batch : uploader->unusedBatches) {
+        vkDestroyFence(device, batch->fence, nullptr);
+        if (batch->transferDone != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, batch->transferDone, nullptr);
+        }
+        delete batch;
+    }
+
+    vulkan_destroyBuffer(uploader->renderer, uploader->ringBuffer, uploader->ringAllocation);
+
+    vkDestroyCommandPool(device, uploader->commandPool, nullptr);
+    if (uploader->acquireCommandPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, uploader->acquireCommandPool, nullptr);
+    }
+
+    delete uploader;
+}
+
+static vulkan_upload_batch* create_batch(vulkan_uploader* uploader) {
+    VkDevice device = uploader->renderer->init_objects.device;
+    vulkan_upload_batch* batch = new vulkan_upload_batch();
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = uploader->commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, &batch->commandBuffer) != VK_SUCCESS
+        || vkCreateFence(device, &fenceInfo, nullptr, &batch->fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload batch!");
+    }
+
+    batch->acquireCommandBuffer = VK_NULL_HANDLE;
+    batch->transferDone = VK_NULL_HANDLE;
+    if (uploader->ownershipTransfer) {
+        allocInfo.commandPool = uploader->acquireCommandPool;
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &batch->acquireCommandBuffer) != VK_SUCCESS
+            || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch->transferDone) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload batch!");
+        }
+    }
+
+    return batch;
+}
+
+static vulkan_upload_batch* begin_batch(vulkan_uploader* uploader) {
+    if (uploader->current != nullptr) {
+        return uploader->current;
+    }
+
+    vulkan_upload_batch* batch;
+    if (!uploader->unusedBatches.empty()) {
+        batch = uploader->unusedBatches.back();
+        uploader->unusedBatches.pop_back();
+    } else {
+        batch = create_batch(uploader);
+    }
+
+    batch->ticket = uploader->nextTicket++;
+    batch->bytes = 0;
+    batch->usedRing = false;
+    batch->bufferBarriers.clear();
+    batch->imageBarriers.clear();
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch->commandBuffer, &beginInfo);
+
+    uploader->current = batch;
+    return batch;
+}
+
+// Returns where to write size bytes, the batch to record into is current afterwards
+static void* reserve_staging(vulkan_uploader* uploader, VkDeviceSize size, VkBuffer* buffer, VkDeviceSize* offset) {
+    if (size > uploader->ring.size / 2) {
+        vulkan_upload_batch* batch = begin_batch(uploader);
+
+        vulkan_allocation allocation;
+        if (!vulkan_createBuffer(uploader->renderer, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, *buffer, allocation)) {
+            throw std::runtime_error("failed to create upload staging buffer!");
+        }
+
+        batch->stagingBuffers.push_back(*buffer);
+        batch->stagingAllocations.push_back(allocation);
+        *offset = 0;
+        return allocation.mapped;
+    }
+
+    VkDeviceSize ringOffset;
+    while (!vulkan_stagingRingAllocate(&uploader->ring, size, &ringOffset)) {
+        // Ring is full of copies that are not done yet, the oldest batch gives back its space first
+        uploader->ringStalls++;
+        vulkan_flushUploads(uploader);
+        vulkan_waitForUpload(uploader, uploader->inFlight.front()->ticket);
+    }
+
+    begin_batch(uploader)->usedRing = true;
+
+    *buffer = uploader->ringBuffer;
+    *offset = ringOffset;
+    return (unsigned char*)uploader->ringAllocation.mapped + ringOffset;
+}
+
+static void add_buffer_barrier(vulkan_uploader* uploader, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex = uploader->ownershipTransfer ? uploader->queueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = uploader->ownershipTransfer ? uploader->graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    uploader->current->bufferBarriers.push_back(barrier);
+}
+
+void vulkan_queueBufferUpload(vulkan_uploader* uploader, VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    if (size == 0) {
+        return;
+    }
+
+    VkBuffer src;
+    VkDeviceSize srcOffset;
+    void* mapped = reserve_staging(uploader, size, &src, &srcOffset);
+    memcpy(mapped, data, (size_t)size);
+
+    VkBufferCopy region = {};
+    region.srcOffset = srcOffset;
+    region.dstOffset = dstOffset;
+    region.size = size;
+    vkCmdCopyBuffer(uploader->current->commandBuffer, src, dst, 1, &region);
+
+    add_buffer_barrier(uploader, dst, dstOffset, size);
+    uploader->current->bytes += size;
+}
+
+void vulkan_queueBufferCopy(vulkan_uploader* uploader, VkBuffer src, VkBuffer dst, VkDeviceSize size) {
+    vulkan_upload_batch* batch = begin_batch(uploader);
+
+    VkBufferCopy region = {};
+    region.size = size;
+    vkCmdCopyBuffer(batch->commandBuffer, src, dst, 1, &region);
+
+    add_buffer_barrier(uploader, dst, 0, size);
+    batch->bytes += size;
+}
+
+void vulkan_queueImageUpload(vulkan_uploader* uploader, const vulkan_image_upload& upload) {
+    VkBuffer src;
+    VkDeviceSize srcOffset;
+    void* mapped = reserve_staging(uploader, upload.size, &src, &srcOffset);
+    memcpy(mapped, upload.data, (size_t)upload.size);
+
+    vulkan_upload_batch* batch = uploader->current;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = upload.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = upload.mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = upload.layers;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    std::vector<VkBufferImageCopy> regions(upload.mipLevels);
+    for (uint32_t mip = 0; mip < upload.mipLevels; mip++) {
+        VkBufferImageCopy& region = regions[mip];
+        region.bufferOffset = srcOffset + upload.mipOffsets[mip];
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = mip;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = upload.layers;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent.width = std::max(upload.width >> mip, 1u);
+        region.imageExtent.height = std::max(upload.height >> mip, 1u);
+        region.imageExtent.depth = 1;
+    }
+    vkCmdCopyBufferToImage(batch->commandBuffer, src, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex = uploader->ownershipTransfer ? uploader->queueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = uploader->ownershipTransfer ? uploader->graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+    batch->imageBarriers.push_back(barrier);
+
+    batch->bytes += upload.size;
+}
+
+uint64_t vulkan_flushUploads(vulkan_uploader* uploader) {
+    vulkan_upload_batch* batch = uploader->current;
+    if (batch == nullptr) {
+        return uploader->nextTicket - 1;
+    }
+    uploader->current = nullptr;
+
+    VkQueue graphicsQueue = uploader->renderer->init_objects.graphicsQueue;
+
+    if (!uploader->ownershipTransfer) {
+        vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, UPLOAD_CONSUMER_STAGES, 0, 0, nullptr,
+                             batch->bufferBarriers.size(), batch->bufferBarriers.data(), batch->imageBarriers.size(), batch->imageBarriers.data());
+        vkEndCommandBuffer(batch->commandBuffer);
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch->commandBuffer;
+
+        if (vkQueueSubmit(uploader->queue, 1, &submitInfo, batch->fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit uploads!");
+        }
+    } else {
+        // Release on the transfer queue and acquire on the graphics queue with the same barriers, only the access masks
+        // of the side that doesn't touch the resource are dropped. Layout transitions happen once.
+        std::vector<VkBufferMemoryBarrier> bufferBarriers = batch->bufferBarriers;
+        std::vector<VkImageMemoryBarrier> imageBarriers = batch->imageBarriers;
+        for (VkBufferMemoryBarrier& barrier : bufferBarriers) {
+            barrier.dstAccessMask = 0;
+        }
+        for (VkImageMemoryBarrier& barrier : imageBarriers) {
+            barrier.dstAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                             bufferBarriers.size(), bufferBarriers.data(), imageBarriers.size(), imageBarriers.data());
+        vkEndCommandBuffer(batch->commandBuffer);
+
+        for (VkBufferMemoryBarrier& barrier : batch->bufferBarriers) {
+            barrier.srcAccessMask = 0;
+        }
+        for (VkImageMemoryBarrier& barrier : batch->imageBarriers) {
+            barrier.srcAccessMask = 0;
+        }
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(batch->acquireCommandBuffer, &beginInfo);
+        vkCmdPipelineBarrier(batch->acquireCommandBuffer, UPLOAD_CONSUMER_STAGES, UPLOAD_CONSUMER_STAGES, 0, 0, nullptr,
+                             batch->bufferBarriers.size(), batch->bufferBarriers.data(), batch->imageBarriers.size(), batch->imageBarriers.data());
+        vkEndCommandBuffer(batch->acquireCommandBuffer);
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch->commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &batch->transferDone;
+
+        if (vkQueueSubmit(uploader->queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit uploads!");
+        }
+
+        // Frames are submitted to the graphics queue after this, so they can't run ahead of the acquire
+        VkPipelineStageFlags waitStage = UPLOAD_CONSUMER_STAGES;
+        submitInfo.pCommandBuffers = &batch->acquireCommandBuffer;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &batch->transferDone;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.signalSemaphoreCount = 0;
+        submitInfo.pSignalSemaphores = nullptr;
+
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch->fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload acquire!");
+        }
+    }
+
+    batch->ringEnd = uploader->ring.head;
+    uploader->submittedBytes += batch->bytes;
+    uploader->inFlight.push_back(batch);
+
+    return batch->ticket;
+}
+
+uint64_t vulkan_collectUploads(vulkan_uploader* uploader) {
+    VkDevice device = uploader->renderer->init_objects.device;
+
+    while (!uploader->inFlight.empty() && vkGetFenceStatus(device, uploader->inFlight.front()->fence) == VK_SUCCESS) {
+        retire_batch(uploader, uploader->inFlight.front());
+    }
+
+    return uploader->completedTicket;
+}
+
+void vulkan_waitForUpload(vulkan_uploader* uploader, uint64_t ticket) {
+    VkDevice device = uploader->renderer->init_objects.device;
+
+    if (uploader->current != nullptr && uploader->current->ticket <= ticket) {
+        vulkan_flushUploads(uploader);
+    }
+
+    while (uploader->completedTicket < ticket && !uploader->inFlight.empty()) {
+        vulkan_upload_batch* batch = uploader->inFlight.front();
+        vkWaitForFences(device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        retire_batch(uploader, batch);
+    }
+}
@@ -0,0 +1,99 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "vulkan_memory.h"
+#include "vulkan_staging_ring.h"
+#include <deque>
+
+// Size of the persistently mapped staging ring, uploads larger than half of it get a staging buffer of their own
+#define UPLOAD_RING_SIZE (64ull * 1024 * 1024)
+
+struct vulkan_renderer;
+
+struct vulkan_image_upload {
+    VkImage image;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layers;
+    uint32_t mipLevels;
+    const VkDeviceSize* mipOffsets;
+    const void* data;
+    VkDeviceSize size;
+};
+
+// Copies recorded between two flushes, submitted together and retired by one fence
+struct vulkan_upload_batch {
+    uint64_t ticket;
+    VkCommandBuffer commandBuffer;
+    // Graphics queue side of the queue family ownership transfer, only used with a transfer family
+    VkCommandBuffer acquireCommandBuffer;
+    VkSemaphore transferDone;
+    VkFence fence;
+    // Ring head after this batch, the ring tail moves here once the batch is done. Batches that only copied
+    // or used dedicated staging buffers leave the tail alone, other batches may still own ring space behind it
+    bool usedRing;
+    VkDeviceSize ringEnd;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkBuffer> stagingBuffers;
+    std::vector<vulkan_allocation> stagingAllocations;
+    VkDeviceSize bytes;
+};
+
+struct vulkan_uploader {
+    vulkan_renderer* renderer;
+    VkQueue queue;
+    uint32_t queueFamily;
+    uint32_t graphicsFamily;
+    // Resources are released by the transfer family and acquired by the graphics family
+    bool ownershipTransfer;
+    VkCommandPool commandPool;
+    VkCommandPool acquireCommandPool;
+
+    VkBuffer ringBuffer;
+    vulkan_allocation ringAllocation;
+    vulkan_staging_ring ring;
+
+    // Batch that is recorded, nullptr until something is uploaded
+    vulkan_upload_batch* current;
+    std::deque<vulkan_upload_batch*> inFlight;
+    std::vector<vulkan_upload_batch*> unusedBatches;
+    uint64_t nextTicket;
+    uint64_t completedTicket;
+
+    uint64_t submittedBytes;
+    uint32_t ringStalls;
+};
+
+vulkan_uploader* init_uploader(vulkan_renderer* renderer, VkDeviceSize ringSize);
+// Waits for all uploads
+void deinit_uploader(vulkan_uploader* uploader);
+
+// Data is copied into the ring before these return. The destination is owned by the graphics queue afterwards,
+// buffers need TRANSFER_DST usage and images end up in SHADER_READ_ONLY_OPTIMAL.
+void vulkan_queueBufferUpload(vulkan_uploader* uploader, VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+void vulkan_queueImageUpload(vulkan_uploader* uploader, const vulkan_image_upload& upload);
+// src must not have been used by a queue yet, e.g. a freshly written staging buffer
+void vulkan_queueBufferCopy(vulkan_uploader* uploader, VkBuffer src, VkBuffer dst, VkDeviceSize size);
+
+// Submits the recorded copies and returns their ticket. Work submitted to the graphics queue afterwards sees the
+// uploaded data without any CPU wait
+uint64_t vulkan_flushUploads(vulkan_uploader* uploader);
+// Retires finished batches without blocking, returns the highest completed ticket
+uint64_t vulkan_collectUploads(vulkan_uploader* uploader);
+void vulkan_waitForUpload(vulkan_uploader* uploader, uint64_t ticket);
@@ -16,22 +16,11 @@
 
 #include "vulkan_utils.h"
 #include <fstream>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 
-static uint32_t findMemoryType(vulkan_renderer* renderer, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(renderer->init_objects.physicalDevice, &memProperties);
-
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-
-    throw std::runtime_error("failed to find suitable memory type!");
-    return 0;
-}
-
-bool vulkan_createBuffer(vulkan_renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+bool vulkan_createBuffer(vulkan_renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, vulkan_allocation& allocation)
 {
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -43,24 +32,15 @@ bool vulkan_createBuffer(vulkan_renderer* renderer, VkDeviceSize size, VkBufferU
         throw std::runtime_error("failed to create buffer!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(renderer->init_objects.device, buffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(renderer, memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(renderer->init_objects.device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        return false;
-    }
-
-    vkBindBufferMemory(renderer->init_objects.device, buffer, bufferMemory, 0);
+    return vulkan_allocateBufferMemory(renderer->allocator, buffer, properties, &allocation);
+}
 
-    return true;
+bool vulkan_createImage(vulkan_renderer* renderer, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, vulkan_allocation& allocation)
+{
+    return vulkan_createImageArray(renderer, width, height, 1, 1, format, usage, properties, image, allocation);
 }
 
-bool vulkan_createImage(vulkan_renderer* renderer, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& memory)
+bool vulkan_createImageArray(vulkan_renderer* renderer, uint32_t width, uint32_t height, uint32_t layers, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, vulkan_allocation& allocation)
 {
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -68,8 +48,8 @@ bool vulkan_createImage(vulkan_renderer* renderer, uint32_t width, uint32_t heig
     imageInfo.extent.width = (uint32_t)width;
     imageInfo.extent.height = (uint32_t)height;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = layers;
     imageInfo.format = format;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -82,21 +62,58 @@ bool vulkan_createImage(vulkan_renderer* renderer, uint32_t width, uint32_t heig
         return false;
     }
 
-    VkMemoryRequirements memReqs;
-    vkGetImageMemoryRequirements(renderer->init_objects.device, image, &memReqs);
+    return vulkan_allocateImageMemory(renderer->allocator, image, properties, &allocation);
+}
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memReqs.size;
-    allocInfo.memoryTypeIndex = findMemoryType(renderer, memReqs.memoryTypeBits, properties);
+void vulkan_destroyBuffer(vulkan_renderer* renderer, VkBuffer buffer, vulkan_allocation& allocation)
+{
+    vkDestroyBuffer(renderer->init_objects.device, buffer, nullptr);
+    vulkan_freeMemory(renderer->allocator, &allocation);
+}
 
-    if (vkAllocateMemory(renderer->init_objects.device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
-        return false;
+void vulkan_destroyImage(vulkan_renderer* renderer, VkImage image, vulkan_allocation& allocation)
+{
+    vkDestroyImage(renderer->init_objects.device, image, nullptr);
+    vulkan_freeMemory(renderer->allocator, &allocation);
+}
+
+VkImageView vulkan_createImageView(vulkan_renderer* renderer, VkImage image, VkImageViewType viewType, VkFormat format, uint32_t layers, uint32_t mipLevels)
+{
+    return vulkan_createImageSubresourceView(renderer, image, viewType, format, VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, layers);
+}
+
+VkImageView vulkan_createImageSubresourceView(vulkan_renderer* renderer, VkImage image, VkImageViewType viewType, VkFormat format, VkImageAspectFlags aspectMask, uint32_t baseMipLevel, uint32_t mipLevels, uint32_t layers)
+{
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = viewType;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = aspectMask;
+    viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = layers;
+
+    VkImageView imageView;
+    if (vkCreateImageView(renderer->init_objects.device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create image view!");
     }
 
-    vkBindImageMemory(renderer->init_objects.device, image, memory, 0);
+    return imageView;
+}
 
-    return true;
+void vulkan_uploadImage(vulkan_renderer* renderer, VkImage image, uint32_t width, uint32_t height, uint32_t layers, uint32_t mipLevels, const VkDeviceSize* mipOffsets, const void* data, VkDeviceSize size)
+{
+    vulkan_image_upload upload = { image, width, height, layers, mipLevels, mipOffsets, data, size };
+    vulkan_queueImageUpload(renderer->uploader, upload);
+}
+
+void vulkan_uploadImages(vulkan_renderer* renderer, const vulkan_image_upload* uploads, size_t uploadCount)
+{
+    for (size_t i = 0; i < uploadCount; i++) {
+        vulkan_queueImageUpload(renderer->uploader, uploads[i]);
+    }
 }
 
 VkCommandBuffer vulkan_beginSingleTimeCommandBuffer(vulkan_renderer* renderer) {
@@ -134,34 +151,23 @@ void vulkan_endSingleTimeCommandBuffer(vulkan_renderer* renderer, VkCommandBuffe
 
 void vulkan_copyBuffers(vulkan_renderer* renderer, VkBuffer src, VkBuffer dst, VkDeviceSize size)
 {
-    VkCommandBuffer commandBuffer = vulkan_beginSingleTimeCommandBuffer(renderer);
-
-    VkBufferCopy copyRegion = {};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, src, dst, 1, &copyRegion);
-
-    vulkan_endSingleTimeCommandBuffer(renderer, commandBuffer);
+    vulkan_queueBufferCopy(renderer->uploader, src, dst, size);
 }
 
-VkShaderModule vulkan_createShaderModule(vulkan_renderer* renderer, std::string shaderFile) {
-    std::ifstream file(shaderFile, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
+VkShaderModule vulkan_createShaderModule(vulkan_renderer* renderer, std::string shaderFile, vulkan_shader_reflection* reflection) {
+    std::vector<uint32_t> code;
+    if (!vulkan_getShaderCode(renderer->shaders, shaderFile, &code)) {
         throw std::runtime_error("could not open " + shaderFile);
     }
 
-    size_t filesize = (size_t)file.tellg();
-    std::vector<char> buffer(filesize);
-
-    file.seekg(0);
-    file.read(buffer.data(), filesize);
-
-    file.close();
+    if (reflection != nullptr && !vulkan_reflectShader(code.data(), code.size(), reflection)) {
+        throw std::runtime_error("failed to reflect " + shaderFile);
+    }
 
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = filesize;
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(buffer.data());
+    createInfo.codeSize = code.size() * sizeof(uint32_t);
+    createInfo.pCode = code.data();
 
     VkShaderModule shaderModule;
     if (vkCreateShaderModule(renderer->init_objects.device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
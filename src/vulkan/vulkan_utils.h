@@ -19,12 +19,27 @@
 #include "vulkan_renderer.h"
 #include <string>
 
-bool vulkan_createBuffer(vulkan_renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-bool vulkan_createImage(vulkan_renderer* renderer, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& memory);
+// Memory comes from the renderer's allocator, host visible allocations are already mapped
+bool vulkan_createBuffer(vulkan_renderer* renderer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, vulkan_allocation& allocation);
+bool vulkan_createImage(vulkan_renderer* renderer, uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, vulkan_allocation& allocation);
+bool vulkan_createImageArray(vulkan_renderer* renderer, uint32_t width, uint32_t height, uint32_t layers, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, vulkan_allocation& allocation);
+void vulkan_destroyBuffer(vulkan_renderer* renderer, VkBuffer buffer, vulkan_allocation& allocation);
+void vulkan_destroyImage(vulkan_renderer* renderer, VkImage image, vulkan_allocation& allocation);
+VkImageView vulkan_createImageView(vulkan_renderer* renderer, VkImage image, VkImageViewType viewType, VkFormat format, uint32_t layers, uint32_t mipLevels);
+// Same as vulkan_createImageView for depth aspects and single mip levels
+VkImageView vulkan_createImageSubresourceView(vulkan_renderer* renderer, VkImage image, VkImageViewType viewType, VkFormat format, VkImageAspectFlags aspectMask, uint32_t baseMipLevel, uint32_t mipLevels, uint32_t layers);
+
+// Copies mip levels into the image through the renderer's uploader, the image ends up in SHADER_READ_ONLY_OPTIMAL.
+// mipOffsets point into data, every mip holds all layers tightly packed. The data can be freed right away.
+void vulkan_uploadImage(vulkan_renderer* renderer, VkImage image, uint32_t width, uint32_t height, uint32_t layers, uint32_t mipLevels, const VkDeviceSize* mipOffsets, const void* data, VkDeviceSize size);
+void vulkan_uploadImages(vulkan_renderer* renderer, const vulkan_image_upload* uploads, size_t uploadCount);
 
 VkCommandBuffer vulkan_beginSingleTimeCommandBuffer(vulkan_renderer* renderer);
 void vulkan_endSingleTimeCommandBuffer(vulkan_renderer* renderer, VkCommandBuffer commandBuffer);
 
+// Recorded into the current upload batch instead of waiting for the copy
 void vulkan_copyBuffers(vulkan_renderer* renderer, VkBuffer src, VkBuffer dst, VkDeviceSize size);
 
-VkShaderModule vulkan_createShaderModule(vulkan_renderer* renderer, std::string shaderFile);
\ No newline at end of file
+// Code comes from the renderer's shader store, shaderFile is the name of the compiled shader like bsp_vert.spv.
+// Fills reflection if it isn't nullptr.
+VkShaderModule vulkan_createShaderModule(vulkan_renderer* renderer, std::string shaderFile, vulkan_shader_reflection* reflection = nullptr);
\ No newline at end of file
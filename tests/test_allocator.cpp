@@ -0,0 +1,161 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tests.h"
+#include "test_random.h"
+#include "vulkan/vulkan_tlsf.h"
+
+#include <iostream>
+#include <iterator>
+#include <map>
+
+// Walks the block by address and through the free lists. Nodes have to tile the block without gaps, free nodes
+// can't be neighbours and every free node has to be in the list of its size class, with the bitmaps agreeing.
+static bool tlsf_check_block(vulkan_memory_block* block, uint32_t* freeNodeCount) {
+    uint32_t freeNodes = 0;
+    VkDeviceSize offset = 0;
+    uint32_t prev = TLSF_NONE;
+    for (uint32_t index = 0; index != TLSF_NONE; index = block->nodes[index].nextPhysical) {
+        const tlsf_node& node = block->nodes[index];
+        if (node.offset != offset || node.prevPhysical != prev || node.size == 0) {
+            return false;
+        }
+        if (node.free && prev != TLSF_NONE && block->nodes[prev].free) {
+            return false;
+        }
+
+        freeNodes += node.free ? 1 : 0;
+        offset += node.size;
+        prev = index;
+    }
+    if (offset != block->size) {
+        return false;
+    }
+
+    uint32_t listedNodes = 0;
+    for (uint32_t fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        bool flSet = (block->flBitmap >> fl) & 1;
+        if (flSet != (block->slBitmap[fl] != 0)) {
+            return false;
+        }
+
+        for (uint32_t sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            bool slSet = (block->slBitmap[fl] >> sl) & 1;
+            if (slSet != (block->freeLists[fl][sl] != TLSF_NONE)) {
+                return false;
+            }
+
+            for (uint32_t index = block->freeLists[fl][sl]; index != TLSF_NONE; index = block->nodes[index].nextFree) {
+                uint32_t nodeFl, nodeSl;
+                tlsf_mapping(block->nodes[index].size, &nodeFl, &nodeSl);
+                if (!block->nodes[index].free || nodeFl != fl || nodeSl != sl) {
+                    return false;
+                }
+                listedNodes++;
+            }
+        }
+    }
+
+    *freeNodeCount = freeNodes;
+    return listedNodes == freeNodes;
+}
+
+bool test_allocator() {
+    struct live_allocation {
+        uint32_t node;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    vulkan_memory_block block = {};
+    // MEMORY_BLOCK_SIZE, vulkan_memory.h is not included since it brings in GLFW
+    tlsf_init_block(&block, 64ull * 1024 * 1024);
+
+    std::vector<live_allocation> live;
+    // Allocations by offset, so an overlap only has to be checked against the neighbours
+    std::map<VkDeviceSize, VkDeviceSize> ranges;
+    test_random random = { TEST_RANDOM_SEED };
+    uint64_t allocations = 0;
+    uint64_t failures = 0;
+
+    auto fail = [&](const char* reason) {
+        std::cout << "Allocator test: " << reason << " after " << allocations << " allocations" << std::endl;
+        return false;
+    };
+
+    for (uint32_t step = 0; step < 200000; step++) {
+        // Biased towards allocating until the block is mostly full, then it hovers there
+        bool allocate = live.empty() || test_random_next(&random) % 100 < (block.usedBytes < block.size / 4 * 3 ? 60u : 45u);
+
+        if (allocate) {
+            // Mostly buffers and small images, sometimes a few megabytes, alignments up to what images ask for
+            uint32_t sizeClass = test_random_next(&random) % 100;
+            VkDeviceSize size = 1 + test_random_next(&random) % (sizeClass < 70 ? 4096 : sizeClass < 97 ? 1024 * 1024 : 8 * 1024 * 1024);
+            VkDeviceSize alignment = (VkDeviceSize)1 << (test_random_next(&random) % 17);
+
+            uint32_t node = tlsf_allocate(&block, size, alignment);
+            if (node == TLSF_NONE) {
+                failures++;
+                continue;
+            }
+
+            VkDeviceSize offset = block.nodes[node].offset;
+            if (offset % alignment != 0 || block.nodes[node].size < size || offset + size > block.size) {
+                return fail("allocation is misaligned or outside of the block");
+            }
+
+            auto next = ranges.lower_bound(offset);
+            if (next != ranges.end() && next->first < offset + size) {
+                return fail("allocation overlaps the one behind it");
+            }
+            if (next != ranges.begin() && std::prev(next)->second > offset) {
+                return fail("allocation overlaps the one in front of it");
+            }
+
+            ranges[offset] = offset + block.nodes[node].size;
+            live.push_back({ node, offset, block.nodes[node].size });
+            block.usedBytes += block.nodes[node].size;
+            allocations++;
+        } else {
+            size_t i = test_random_next(&random) % live.size();
+            block.usedBytes -= live[i].size;
+            ranges.erase(live[i].offset);
+            tlsf_free(&block, live[i].node);
+            live[i] = live.back();
+            live.pop_back();
+        }
+
+        uint32_t freeNodes;
+        if (step % 1000 == 0 && !tlsf_check_block(&block, &freeNodes)) {
+            return fail("block structure is broken");
+        }
+    }
+
+    size_t peakLive = live.size();
+    for (const live_allocation& allocation : live) {
+        tlsf_free(&block, allocation.node);
+    }
+
+    // Everything merged back into the one node the block started with
+    uint32_t freeNodes;
+    if (!tlsf_check_block(&block, &freeNodes) || freeNodes != 1 || block.nodes[0].size != block.size || tlsf_largest_free(&block) != block.size) {
+        return fail("free ranges did not merge back into one");
+    }
+
+    std::cout << "Allocator test passed (" << allocations << " allocations, " << failures << " did not fit, " << peakLive
+              << " live at the end)" << std::endl;
+    return true;
+}
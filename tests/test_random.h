@@ -0,0 +1,37 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// Linear congruential generator, every test starts from the same seed so a failure replays the same sequence
+#define TEST_RANDOM_SEED 12345u
+
+struct test_random {
+    uint32_t state;
+};
+
+// 24 random bits, the low bits of the state repeat too quickly to be used
+inline uint32_t test_random_next(test_random* random) {
+    random->state = random->state * 1664525u + 1013904223u;
+    return random->state >> 8;
+}
+
+// Uniform in [min, max)
+inline float test_random_float(test_random* random, float min, float max) {
+    return min + (float)test_random_next(random) / 16777216.0f * (max - min);
+}
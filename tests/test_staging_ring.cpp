@@ -0,0 +1,113 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tests.h"
+#include "test_random.h"
+#include "vulkan/vulkan_staging_ring.h"
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+bool test_staging_ring() {
+    struct live_range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+    struct test_batch {
+        std::vector<live_range> ranges;
+        bool usedRing;
+        VkDeviceSize ringEnd;
+    };
+
+    vulkan_staging_ring ring = { 1 << 16, 0, 0, 16 };
+    std::deque<test_batch> inFlight;
+    test_batch current = {};
+    test_random random = { TEST_RANDOM_SEED };
+    uint64_t allocations = 0;
+    uint64_t stalls = 0;
+
+    auto flush = [&]() {
+        current.ringEnd = ring.head;
+        inFlight.push_back(current);
+        current = {};
+    };
+    auto retire = [&]() {
+        if (inFlight.front().usedRing) {
+            vulkan_stagingRingRelease(&ring, inFlight.front().ringEnd);
+        }
+        inFlight.pop_front();
+    };
+
+    for (uint32_t step = 0; step < 200000; step++) {
+        uint32_t action = test_random_next(&random) % 16;
+
+        if (action == 0) {
+            flush();
+        } else if (action == 1 && !inFlight.empty()) {
+            retire();
+        } else if (action == 2) {
+            // A batch that only records copies or uses a dedicated staging buffer, like vulkan_queueBufferCopy
+            flush();
+        } else {
+            VkDeviceSize size = 1 + test_random_next(&random) % (ring.size / 8);
+            VkDeviceSize offset;
+            while (!vulkan_stagingRingAllocate(&ring, size, &offset)) {
+                stalls++;
+                if (inFlight.empty()) {
+                    flush();
+                }
+                retire();
+            }
+
+            if (offset % ring.alignment != 0 || offset + size > ring.size) {
+                std::cout << "Staging ring test: allocation at " << offset << " of " << size << " bytes is misplaced" << std::endl;
+                return false;
+            }
+
+            auto overlaps = [offset, size](const test_batch& batch) {
+                for (const live_range& range : batch.ranges) {
+                    if (offset < range.offset + range.size && range.offset < offset + size) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            if (overlaps(current) || std::any_of(inFlight.begin(), inFlight.end(), overlaps)) {
+                std::cout << "Staging ring test: allocation at " << offset << " of " << size << " bytes overlaps data in flight after "
+                          << allocations << " allocations" << std::endl;
+                return false;
+            }
+
+            current.ranges.push_back({ offset, size });
+            current.usedRing = true;
+            allocations++;
+        }
+    }
+
+    flush();
+    while (!inFlight.empty()) {
+        retire();
+    }
+    if (ring.head != ring.tail) {
+        std::cout << "Staging ring test: ring is not empty after every batch retired" << std::endl;
+        return false;
+    }
+
+    std::cout << "Staging ring test passed (" << allocations << " allocations, " << stalls << " stalls)" << std::endl;
+    return true;
+}
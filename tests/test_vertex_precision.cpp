@@ -0,0 +1,207 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tests.h"
+#include "test_random.h"
+#include "bsp/bsp_vertex.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// The shaders unpack the UV scale with unpackHalf2x16
+static float half_to_float(uint16_t half) {
+    int exponent = (half >> 10) & 0x1f;
+    float mantissa = (float)(half & 0x3ff);
+    float value = exponent == 0 ? ldexpf(mantissa, -24) : ldexpf(mantissa + 1024.0f, exponent - 25);
+    return (half & 0x8000) ? -value : value;
+}
+
+static bool test_position_precision(test_random* random) {
+    bool passed = true;
+    const float extents[] = { 1.0f, 64.0f, 2048.0f, 16384.0f, 32768.0f };
+
+    for (float extent : extents) {
+        float step = bsp_position_step(extent);
+        float maxError = 0.0f;
+        bool identical = true;
+
+        // Pairs of faces share the vertex but start at different corners, coordinates stay within +-16384
+        for (int i = 0; i < 100000; i++) {
+            glm::vec3 position;
+            glm::vec3 minA;
+            glm::vec3 minB;
+            for (int c = 0; c < 3; c++) {
+                position[c] = test_random_float(random, -16384.0f, 16384.0f);
+                minA[c] = std::max(position[c] - test_random_float(random, 0.0f, extent), -16384.0f);
+                minB[c] = std::max(position[c] - test_random_float(random, 0.0f, extent), -16384.0f);
+            }
+
+            glm::vec3 originA = bsp_position_origin(minA, step);
+            glm::vec3 originB = bsp_position_origin(minB, step);
+            bsp_vertex vertexA = bsp_encode_vertex(position, glm::vec2(0.0f), glm::vec2(0.0f), 0, originA, glm::vec2(0.0f), glm::vec2(1.0f), step);
+            bsp_vertex vertexB = bsp_encode_vertex(position, glm::vec2(0.0f), glm::vec2(0.0f), 1, originB, glm::vec2(0.0f), glm::vec2(1.0f), step);
+
+            glm::vec3 decodedA;
+            glm::vec3 decodedB;
+            glm::vec2 uv;
+            glm::vec2 lightmapUV;
+            bsp_decode_vertex(vertexA, originA, glm::vec2(0.0f), glm::vec2(1.0f), step, &decodedA, &uv, &lightmapUV);
+            bsp_decode_vertex(vertexB, originB, glm::vec2(0.0f), glm::vec2(1.0f), step, &decodedB, &uv, &lightmapUV);
+
+            for (int c = 0; c < 3; c++) {
+                maxError = std::max(maxError, fabsf(decodedA[c] - position[c]));
+            }
+            identical = identical && decodedA == decodedB;
+        }
+
+        bool inBounds = maxError <= step * 0.5f && identical;
+        passed = passed && inBounds;
+        std::cout << (inBounds ? "passed" : "FAILED") << ": positions, face extent " << extent << ", step " << step << ", largest error "
+                  << maxError << " units (bound " << step * 0.5f << "), shared vertices " << (identical ? "identical" : "differ") << std::endl;
+    }
+
+    return passed;
+}
+
+static bool test_uv_precision(test_random* random) {
+    bool passed = true;
+
+    // The scale has to survive the trip through the draw record exactly, the shaders unpack it with unpackHalf2x16
+    bool scalesExact = true;
+    for (float scale = 1.0f / 1024.0f; scale <= 32768.0f; scale *= 2.0f) {
+        uint32_t packed = bsp_pack_uv_scale(glm::vec2(scale, scale * 0.5f));
+        scalesExact = scalesExact && half_to_float(packed & 0xffff) == scale && half_to_float(packed >> 16) == scale * 0.5f;
+    }
+    passed = passed && scalesExact;
+    std::cout << (scalesExact ? "passed" : "FAILED") << ": UV scales are exact as half floats" << std::endl;
+
+    // Spans from a fraction of a repeat to far beyond what any face has, the largest texture Source uses
+    const float textureSize = 4096.0f;
+    float largestSpan = 0.0f;
+    for (float span = 1.0f / 256.0f; span <= 16384.0f; span *= 4.0f) {
+        glm::vec2 uvScale = bsp_uv_scale(glm::vec2(span));
+        // Half of a unorm step, the rounding of adding the offset in float is allowed for per UV below
+        float bound = uvScale.x / 131070.0f;
+        float maxError = 0.0f;
+        float maxBound = 0.0f;
+
+        for (int i = 0; i < 10000; i++) {
+            glm::vec2 uvOffset = glm::floor(glm::vec2(test_random_float(random, -512.0f, 512.0f), test_random_float(random, -512.0f, 512.0f)));
+            glm::vec2 uv = uvOffset + glm::vec2(test_random_float(random, 0.0f, span), test_random_float(random, 0.0f, span));
+            if (i == 0) {
+                uv = uvOffset + glm::vec2(span);
+            }
+
+            bsp_vertex vertex = bsp_encode_vertex(glm::vec3(0.0f), uv, glm::vec2(0.0f), 0, glm::vec3(0.0f), uvOffset, uvScale, 1.0f);
+            glm::vec3 position;
+            glm::vec2 decoded;
+            glm::vec2 lightmapUV;
+            bsp_decode_vertex(vertex, glm::vec3(0.0f), uvOffset, uvScale, 1.0f, &position, &decoded, &lightmapUV);
+
+            for (int c = 0; c < 2; c++) {
+                float rounding = (fabsf(uv[c]) + uvScale[c]) * FLT_EPSILON;
+                maxError = std::max(maxError, fabsf(decoded[c] - uv[c]));
+                maxBound = std::max(maxBound, bound + rounding);
+            }
+        }
+
+        bool inBounds = maxError <= maxBound;
+        passed = passed && inBounds;
+        std::cout << (inBounds ? "passed" : "FAILED") << ": UVs, span " << span << " repeats, largest error " << maxError * textureSize
+                  << " texels of " << textureSize << " (bound " << maxBound * textureSize << ")" << std::endl;
+
+        if (bound * textureSize <= BSP_MAX_UV_ERROR) {
+            largestSpan = uvScale.x;
+        }
+    }
+
+    // Prepare falls back to float UVs past this, the bound has to allow at least a few repeats of the largest texture
+    bool spanUsable = largestSpan >= 4.0f;
+    passed = passed && spanUsable;
+    std::cout << (spanUsable ? "passed" : "FAILED") << ": largest span within " << BSP_MAX_UV_ERROR << " texels of " << textureSize
+              << " is " << largestSpan << " repeats" << std::endl;
+
+    float maxLightmapError = 0.0f;
+    for (int i = 0; i <= 65536; i++) {
+        glm::vec2 lightmapUV(i / 65536.0f, 1.0f - i / 65536.0f);
+        bsp_vertex vertex = bsp_encode_vertex(glm::vec3(0.0f), glm::vec2(0.0f), lightmapUV, 0, glm::vec3(0.0f), glm::vec2(0.0f), glm::vec2(1.0f), 1.0f);
+        glm::vec3 position;
+        glm::vec2 uv;
+        glm::vec2 decoded;
+        bsp_decode_vertex(vertex, glm::vec3(0.0f), glm::vec2(0.0f), glm::vec2(1.0f), 1.0f, &position, &uv, &decoded);
+        maxLightmapError = std::max(maxLightmapError, std::max(fabsf(decoded.x - lightmapUV.x), fabsf(decoded.y - lightmapUV.y)));
+    }
+
+    float lightmapBound = 0.5f / 65535.0f + FLT_EPSILON;
+    bool lightmapInBounds = maxLightmapError <= lightmapBound;
+    passed = passed && lightmapInBounds;
+    std::cout << (lightmapInBounds ? "passed" : "FAILED") << ": lightmap UVs, largest error " << maxLightmapError << " (bound " << lightmapBound << ")" << std::endl;
+
+    return passed;
+}
+
+static bool test_octahedral_precision() {
+    // snorm16 steps are 1 / 32767 on the octahedron, a few thousandths of a degree on the sphere
+    const float boundDegrees = 0.01f;
+    float maxDegrees = 0.0f;
+    float maxLengthError = 0.0f;
+
+    std::vector<glm::vec3> directions;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            for (int z = -1; z <= 1; z++) {
+                if (x != 0 || y != 0 || z != 0) {
+                    directions.push_back(glm::normalize(glm::vec3((float)x, (float)y, (float)z)));
+                }
+            }
+        }
+    }
+    // Poles to poles, the folded lower half included
+    for (int i = 0; i <= 512; i++) {
+        float theta = glm::radians(180.0f * i / 512.0f);
+        for (int j = 0; j < 1024; j++) {
+            float phi = glm::radians(360.0f * j / 1024.0f);
+            directions.push_back(glm::vec3(sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)));
+        }
+    }
+
+    for (const glm::vec3& direction : directions) {
+        glm::vec3 decoded = bsp_octahedral_decode(bsp_octahedral_encode(direction));
+        // From the chord, acos of a float dot product can't resolve angles this small
+        float chord = std::min(glm::length(decoded - direction), 2.0f);
+        maxDegrees = std::max(maxDegrees, glm::degrees(2.0f * asinf(chord * 0.5f)));
+        maxLengthError = std::max(maxLengthError, fabsf(glm::length(decoded) - 1.0f));
+    }
+
+    bool inBounds = maxDegrees <= boundDegrees && maxLengthError <= 1e-5f;
+    std::cout << (inBounds ? "passed" : "FAILED") << ": octahedral vectors, " << directions.size() << " directions, largest error "
+              << maxDegrees << " degrees (bound " << boundDegrees << ")" << std::endl;
+    return inBounds;
+}
+
+bool test_vertex_precision() {
+    test_random random = { TEST_RANDOM_SEED };
+
+    bool passed = test_position_precision(&random);
+    passed = test_uv_precision(&random) && passed;
+    passed = test_octahedral_precision() && passed;
+
+    std::cout << "Vertex precision test " << (passed ? "passed" : "failed") << std::endl;
+    return passed;
+}
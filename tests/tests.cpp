@@ -0,0 +1,53 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tests.h"
+
+#include <cstring>
+#include <iostream>
+
+struct test_case {
+    const char* name;
+    bool (*run)();
+};
+
+static const test_case TESTS[] = {
+    { "staging_ring", test_staging_ring },
+    { "allocator", test_allocator },
+    { "vertex_precision", test_vertex_precision },
+};
+
+// Runs the test named by the first argument, all of them without one
+int main(int argc, char** argv) {
+    bool found = false;
+    bool passed = true;
+
+    for (const test_case& test : TESTS) {
+        if (argc > 1 && strcmp(argv[1], test.name) != 0) {
+            continue;
+        }
+
+        found = true;
+        passed = test.run() && passed;
+    }
+
+    if (!found) {
+        std::cout << "Unknown test " << argv[1] << std::endl;
+        return 2;
+    }
+
+    return passed ? 0 : 1;
+}
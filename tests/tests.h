@@ -0,0 +1,28 @@
+// Copyright (C) 2020 Kai-Uwe Zimdars
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// Every test prints what it checked and returns false if anything was out of bounds
+
+// Replays allocations and in-order releases of the upload staging ring, no live ranges may overlap
+bool test_staging_ring();
+// Allocates and frees in a block without device memory. Allocations may not overlap, the block structure has to
+// stay intact and the free ranges have to merge back into one once everything is freed
+bool test_allocator();
+// Encodes and decodes vertices against fixed bounds: positions within half a step and identical for vertices shared
+// by faces with different origins, UVs up to the largest span and octahedral vectors over a sweep of the unit sphere
+bool test_vertex_precision();